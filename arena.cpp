@@ -0,0 +1,214 @@
+#include "arena.h"
+#include "locker.h"
+#include <stdlib.h>
+#include <atomic>
+
+static std::atomic<unsigned long> s_slab_allocs(0);
+
+#ifdef HEAP_STATS
+//调试统计：替换全局 operator new，数出进程中所有 C++ 堆分配(不含 OpenSSL 等直接调用 malloc 的库)，
+//与处理的请求数相比就是每个请求的堆分配次数
+static std::atomic<unsigned long long> s_heap_allocs(0);
+
+void* operator new(size_t size) {
+    s_heap_allocs.fetch_add(1, std::memory_order_relaxed);
+    void* p = malloc(size ? size : 1);
+    if (!p) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void* operator new[](size_t size) {
+    return operator new(size);
+}
+
+void operator delete(void* p) noexcept {
+    free(p);
+}
+
+void operator delete[](void* p) noexcept {
+    free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    free(p);
+}
+
+void operator delete[](void* p, size_t) noexcept {
+    free(p);
+}
+#endif
+
+//每个线程的空闲 slab，线程退出时释放
+namespace {
+struct cached_slab {
+    cached_slab* next;
+};
+
+struct slab_cache {
+    cached_slab* head;
+    int count;
+
+    slab_cache() : head(NULL), count(0) {}
+    ~slab_cache() {
+        while (head) {
+            cached_slab* next = head->next;
+            free(head);
+            head = next;
+        }
+    }
+};
+}
+
+static thread_local slab_cache t_cache;
+
+//线程之间共享的空闲 slab
+static locker s_depot_lock;
+static cached_slab* s_depot = NULL;
+static int s_depot_count = 0;
+
+//线程缓存空了：从共享仓库取一批
+static void refill_cache() {
+    s_depot_lock.lock();
+    for (int i = 0; i < arena::DEPOT_BATCH && s_depot; i++) {
+        cached_slab* c = s_depot;
+        s_depot = c->next;
+        s_depot_count--;
+        c->next = t_cache.head;
+        t_cache.head = c;
+        t_cache.count++;
+    }
+    s_depot_lock.unlock();
+}
+
+//线程缓存满了：放一批到共享仓库，仓库也满时释放
+static void flush_cache() {
+    cached_slab* batch = NULL;
+    for (int i = 0; i < arena::DEPOT_BATCH && t_cache.head; i++) {
+        cached_slab* c = t_cache.head;
+        t_cache.head = c->next;
+        t_cache.count--;
+        c->next = batch;
+        batch = c;
+    }
+    s_depot_lock.lock();
+    while (batch && s_depot_count < arena::MAX_DEPOT_SLABS) {
+        cached_slab* c = batch;
+        batch = c->next;
+        c->next = s_depot;
+        s_depot = c;
+        s_depot_count++;
+    }
+    s_depot_lock.unlock();
+    while (batch) {
+        cached_slab* c = batch;
+        batch = c->next;
+        free(c);
+    }
+}
+
+arena::arena() : m_slabs(NULL), m_cur(NULL), m_end(NULL) {
+}
+
+arena::~arena() {
+    release();
+}
+
+unsigned long arena::slab_allocs() {
+    return s_slab_allocs.load(std::memory_order_relaxed);
+}
+
+long long arena::heap_allocs() {
+#ifdef HEAP_STATS
+    return s_heap_allocs.load(std::memory_order_relaxed);
+#else
+    return -1;
+#endif
+}
+
+//当前 slab 不够：超大的分配单独申请一块(插在当前 slab 之后，当前 slab 剩余的空间继续使用)，
+//否则从线程缓存(空时先从共享仓库取一批)取一个新的 slab
+void* arena::alloc_slow(size_t size) {
+    bool big = size > SLAB_SIZE / 2;
+    size_t cap = big ? size : SLAB_SIZE;
+    slab* s = NULL;
+    if (!big && !t_cache.head) {
+        refill_cache();
+    }
+    if (!big && t_cache.head) {
+        s = (slab*)t_cache.head;
+        t_cache.head = t_cache.head->next;
+        t_cache.count--;
+    }
+    else {
+        s = (slab*)malloc(sizeof(slab) + cap);
+        if (!s) {
+            throw std::bad_alloc();
+        }
+        s_slab_allocs.fetch_add(1, std::memory_order_relaxed);
+#ifdef HEAP_STATS
+        s_heap_allocs.fetch_add(1, std::memory_order_relaxed);
+#endif
+    }
+    s->size = cap;
+    char* data = (char*)(s + 1);
+    if (big && m_slabs) {
+        s->next = m_slabs->next;
+        m_slabs->next = s;
+        return data;
+    }
+    s->next = m_slabs;
+    m_slabs = s;
+    m_cur = data + size;
+    m_end = data + cap;
+    return data;
+}
+
+//标准大小的 slab 放回线程缓存，超大的释放
+static void put_slab(void* p, size_t size) {
+    if (size != arena::SLAB_SIZE) {
+        free(p);
+        return;
+    }
+    if (t_cache.count >= arena::MAX_CACHED_SLABS) {
+        flush_cache();
+    }
+    cached_slab* c = (cached_slab*)p;
+    c->next = t_cache.head;
+    t_cache.head = c;
+    t_cache.count++;
+}
+
+void arena::reset() {
+    slab* keep = NULL;
+    slab* s = m_slabs;
+    while (s) {
+        slab* next = s->next;
+        if (!keep && s->size == SLAB_SIZE) {
+            keep = s;
+        }
+        else {
+            put_slab(s, s->size);
+        }
+        s = next;
+    }
+    m_slabs = keep;
+    if (keep) {
+        keep->next = NULL;
+        m_cur = (char*)(keep + 1);
+        m_end = m_cur + SLAB_SIZE;
+    }
+    else {
+        m_cur = m_end = NULL;
+    }
+}
+
+void arena::release() {
+    while (m_slabs) {
+        slab* next = m_slabs->next;
+        put_slab(m_slabs, m_slabs->size);
+        m_slabs = next;
+    }
+    m_cur = m_end = NULL;
+}
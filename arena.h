@@ -0,0 +1,68 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+#include <new>
+#include <utility>
+
+/*
+    请求级的内存区(bump allocator)：每个 http_conn 一个，请求处理期间的临时对象(请求体 sink、
+    交给处理函数的请求体等)从这里顺序分配，不单独释放，一个请求周期结束时在 init() 中整体清空。
+    内存按固定大小的 slab 向堆申请，用完的 slab 放回当前线程的缓存，下一个请求直接复用，
+    所以稳定运行时请求路径上不经过 malloc 的锁。连接常在工作线程中分配、在事件循环线程中关闭，
+    slab 会在线程之间流动，线程缓存满了或空了时成批地与一个共享仓库交换，每 DEPOT_BATCH 个 slab 才加一次锁。
+    同一时刻只有处理该连接的一个线程使用它(EPOLLONESHOT)，本身不加锁。
+*/
+class arena {
+public:
+    static const size_t SLAB_SIZE = 16 * 1024;     //slab 的大小，超过一半的分配单独向堆申请
+    static const int MAX_CACHED_SLABS = 64;         //每个线程缓存的空闲 slab 数，多出的成批放到共享仓库
+    static const int DEPOT_BATCH = 32;              //线程缓存与共享仓库一次交换的 slab 数
+    static const int MAX_DEPOT_SLABS = 1024;        //共享仓库的上限，多出的释放
+    static const size_t ALIGN = 16;
+
+    arena();
+    ~arena();
+
+    void* alloc(size_t size);       //按 ALIGN 对齐，失败抛出 std::bad_alloc
+    void reset();                   //请求周期结束：丢弃全部分配，保留一个 slab 给下一个请求
+    void release();                 //连接关闭：全部 slab 放回当前线程的缓存
+
+    //在内存区中构造对象；内存随 reset 回收，析构函数要由使用者调用 destroy
+    template<typename T, typename... Args>
+    T* create(Args&&... args) { return new (alloc(sizeof(T))) T(std::forward<Args>(args)...); }
+    template<typename T>
+    static void destroy(T* p) { p->~T(); }
+
+    static unsigned long slab_allocs();     //向堆申请的 slab 数(线程缓存和共享仓库都为空或超大分配时)
+    //全局 operator new 与 slab 的堆分配次数，只在用 -DHEAP_STATS 编译时统计，否则返回 -1
+    static long long heap_allocs();
+
+private:
+    struct slab {
+        slab* next;
+        size_t size;        //可用的字节数(不含 slab 头)
+    };
+
+    arena(const arena&);
+    arena& operator=(const arena&);
+
+    void* alloc_slow(size_t size);
+
+    slab* m_slabs;          //正在使用的 slab，第一个是当前分配的
+    char* m_cur;
+    char* m_end;
+};
+
+//快速路径：当前 slab 剩余的空间够用时只移动指针
+inline void* arena::alloc(size_t size) {
+    size = size ? (size + ALIGN - 1) & ~(ALIGN - 1) : ALIGN;
+    if ((size_t)(m_end - m_cur) >= size) {
+        void* p = m_cur;
+        m_cur += size;
+        return p;
+    }
+    return alloc_slow(size);
+}
+
+#endif
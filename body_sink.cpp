@@ -0,0 +1,117 @@
+#include "body_sink.h"
+#include "log.h"
+#include "arena.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+memory_sink::memory_sink(arena* a, size_t reserve) : m_arena(a), m_data(NULL), m_len(0), m_cap(reserve) {
+    if (m_cap > 0) {
+        m_data = (char*)m_arena->alloc(m_cap);
+    }
+}
+
+//放不下时在内存区中另分配一块两倍大的，旧的一块随请求周期回收
+bool memory_sink::write(const char* data, int len) {
+    if (len <= 0) {
+        return true;
+    }
+    if (m_len + len > m_cap) {
+        size_t cap = m_cap ? m_cap * 2 : 1024;
+        while (cap < m_len + len) {
+            cap *= 2;
+        }
+        char* buf = (char*)m_arena->alloc(cap);
+        if (m_len > 0) {
+            memcpy(buf, m_data, m_len);
+        }
+        m_data = buf;
+        m_cap = cap;
+    }
+    memcpy(m_data + m_len, data, len);
+    m_len += len;
+    return true;
+}
+
+file_sink::file_sink(arena* a) : m_arena(a), m_fd(-1), m_existed(false), m_path(NULL), m_tmp_path(NULL) {
+}
+
+file_sink::~file_sink() {
+    abort();
+}
+
+int file_sink::open(const char* dir, const char* key) {
+    size_t dir_len = strlen(dir);
+    size_t len = dir_len + strlen(key);
+    m_path = (char*)m_arena->alloc(len + 1);
+    memcpy(m_path, dir, dir_len);
+    strcpy(m_path + dir_len, key);
+    struct stat st;
+    if (stat(m_path, &st) == 0) {
+        if (!S_ISREG(st.st_mode)) {
+            return EISDIR;
+        }
+        m_existed = true;
+    }
+
+    //临时文件与目标在同一目录，rename 才是原子的
+    static const char tmp_name[] = ".upload-XXXXXX";
+    size_t dir_end = strrchr(m_path, '/') - m_path + 1;
+    m_tmp_path = (char*)m_arena->alloc(dir_end + sizeof(tmp_name));
+    memcpy(m_tmp_path, m_path, dir_end);
+    memcpy(m_tmp_path + dir_end, tmp_name, sizeof(tmp_name));
+    m_fd = mkostemp(m_tmp_path, O_CLOEXEC);
+    if (m_fd < 0) {
+        int err = errno;
+        m_tmp_path = NULL;
+        return err;
+    }
+    fchmod(m_fd, 0644);     //mkstemp 创建的文件只有属主可读，静态文件服务需要其他用户可读
+    return 0;
+}
+
+bool file_sink::write(const char* data, int len) {
+    while (len > 0) {
+        int n = ::write(m_fd, data, len);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            EMlog(LOGLEVEL_ERROR, "upload write %s failed, errno is : %d\n", m_tmp_path, errno);
+            return false;
+        }
+        data += n;
+        len -= n;
+    }
+    return true;
+}
+
+bool file_sink::finish() {
+    if (m_fd < 0) {
+        return false;
+    }
+    close(m_fd);
+    m_fd = -1;
+    if (rename(m_tmp_path, m_path) < 0) {
+        EMlog(LOGLEVEL_ERROR, "upload rename %s failed, errno is : %d\n", m_path, errno);
+        unlink(m_tmp_path);
+        m_tmp_path = NULL;
+        return false;
+    }
+    m_tmp_path = NULL;
+    return true;
+}
+
+void file_sink::abort() {
+    if (m_fd >= 0) {
+        close(m_fd);
+        m_fd = -1;
+    }
+    if (m_tmp_path) {
+        unlink(m_tmp_path);
+        m_tmp_path = NULL;
+    }
+}
@@ -0,0 +1,71 @@
+#ifndef BODY_SINK_H
+#define BODY_SINK_H
+
+#include <stddef.h>
+
+/*
+    请求体的去处。http_conn 不缓存整个请求体：读缓冲区中请求头之后的部分作为窗口，
+    每读到一段(Content-Length 或解码后的 chunked 数据)就交给sink，然后腾出窗口继续读，
+    所以无论请求体多大，每个连接占用的内存都只有读缓冲区那么大。
+    sink 处理得慢时工作线程不会重新注册 EPOLLIN，数据留在内核接收缓冲区，由TCP流量控制让客户端放慢。
+    write/finish/abort 都在处理该连接的线程中调用，同一时刻只有一个线程。
+*/
+class body_sink {
+public:
+    virtual ~body_sink() {}
+    virtual bool write(const char* data, int len) = 0;  //交付一段请求体，返回false表示出错，连接将被关闭
+    virtual bool finish() = 0;                          //请求体完整接收
+    virtual void abort() = 0;                           //连接中断或请求出错，丢弃已收到的部分
+};
+
+class arena;
+
+//交给请求处理函数(router)的请求体：整个连续地缓存在连接的内存区(arena)中，随请求周期一起回收，
+//长度上限由 begin_body/deliver_body 检查
+class memory_sink : public body_sink {
+public:
+    //reserve 为预计的长度(Content-Length)，chunked 时为0，按需倍增
+    memory_sink(arena* a, size_t reserve);
+    bool write(const char* data, int len);
+    bool finish() { return true; }
+    void abort() { m_len = 0; }
+
+    const char* data() const { return m_data ? m_data : ""; }
+    size_t size() const { return m_len; }
+
+private:
+    arena* m_arena;
+    char* m_data;
+    size_t m_len;
+    size_t m_cap;
+};
+
+/*
+    PUT/POST 上传：写入上传目录下同一路径的临时文件(以 . 开头，根目录索引不收录)，
+    接收完整后 rename 到目标文件，读者不会看到写了一半的文件。目标所在的目录必须已经存在。
+    路径也分配在连接的内存区中。
+*/
+class file_sink : public body_sink {
+public:
+    explicit file_sink(arena* a);
+    ~file_sink();
+
+    //dir 为上传目录的真实路径，key 为规范化后的请求路径(以 / 开头)。
+    //返回0成功，否则返回 errno(ENOENT 目录不存在，EISDIR 目标是目录等)
+    int open(const char* dir, const char* key);
+
+    bool write(const char* data, int len);
+    bool finish();
+    void abort();
+
+    bool existed() const { return m_existed; }     //目标文件原来就存在(覆盖)
+
+private:
+    arena* m_arena;
+    int m_fd;
+    bool m_existed;
+    char* m_path;               //目标文件
+    char* m_tmp_path;           //临时文件，没有(已 rename 或删除)时为NULL
+};
+
+#endif
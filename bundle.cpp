@@ -0,0 +1,236 @@
+#include "bundle.h"
+#include "log.h"
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+
+//-------------------- bundle --------------------
+
+bundle* bundle::open(const char* path, bool populate) {
+    int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return NULL;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(bundle_header)) {
+        close(fd);
+        return NULL;
+    }
+    //MAP_POPULATE 启动时一次性读入全部页，之后的请求不再缺页
+    int flags = MAP_PRIVATE | (populate ? MAP_POPULATE : 0);
+    void* base = mmap(NULL, st.st_size, PROT_READ, flags, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        return NULL;
+    }
+
+    bundle* b = new bundle;
+    b->m_base = (char*)base;
+    b->m_size = st.st_size;
+    if (!b->validate()) {
+        delete b;
+        return NULL;
+    }
+    return b;
+}
+
+bundle::~bundle() {
+    if (m_base) {
+        munmap(m_base, m_size);
+    }
+}
+
+//载入时检查所有偏移都在文件范围内，查找时就不必再检查
+bool bundle::validate() {
+    m_header = (const bundle_header*)m_base;
+    if (memcmp(m_header->magic, BUNDLE_MAGIC, 8) != 0 || m_header->version != BUNDLE_VERSION ||
+        m_header->file_size != m_size) {
+        return false;
+    }
+    uint64_t index_end = m_header->index_off + (uint64_t)m_header->count * sizeof(bundle_entry);
+    if (m_header->index_off % 8 != 0 || index_end > m_size ||
+        m_header->strings_off > m_size || m_header->strings_size > m_size - m_header->strings_off) {
+        return false;
+    }
+    m_entries = (const bundle_entry*)(m_base + m_header->index_off);
+    m_strings = m_base + m_header->strings_off;
+
+    uint64_t ssize = m_header->strings_size;
+    for (uint32_t i = 0; i < m_header->count; i++) {
+        const bundle_entry& e = m_entries[i];
+        if ((uint64_t)e.key_off + e.key_len > ssize || e.mime_off >= ssize ||
+            (uint64_t)e.hdr_off + e.hdr_len > ssize || (uint64_t)e.gz_hdr_off + e.gz_hdr_len > ssize ||
+            memchr(m_strings + e.mime_off, '\0', ssize - e.mime_off) == NULL ||
+            e.data_off > m_size || e.data_size > m_size - e.data_off ||
+            e.gz_off > m_size || e.gz_size > m_size - e.gz_off ||
+            memchr(e.etag, '\0', sizeof(e.etag)) == NULL || memchr(e.gz_etag, '\0', sizeof(e.gz_etag)) == NULL) {
+            return false;
+        }
+        if (i > 0) {
+            //必须严格有序，二分查找依赖这一点
+            const bundle_entry& p = m_entries[i - 1];
+            uint32_t n = p.key_len < e.key_len ? p.key_len : e.key_len;
+            int cmp = memcmp(m_strings + p.key_off, m_strings + e.key_off, n);
+            if (cmp > 0 || (cmp == 0 && p.key_len >= e.key_len)) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+bool bundle::lookup(const char* key, bool gzip, file* out) const {
+    size_t key_len = strlen(key);
+    int lo = 0, hi = (int)m_header->count - 1;
+    while (lo <= hi) {
+        int mid = (lo + hi) / 2;
+        const bundle_entry& e = m_entries[mid];
+        size_t n = e.key_len < key_len ? e.key_len : key_len;
+        int cmp = memcmp(m_strings + e.key_off, key, n);
+        if (cmp == 0) {
+            cmp = e.key_len < key_len ? -1 : (e.key_len > key_len ? 1 : 0);
+        }
+        if (cmp < 0) {
+            lo = mid + 1;
+        }
+        else if (cmp > 0) {
+            hi = mid - 1;
+        }
+        else {
+            out->mtime = e.mtime;
+            out->mime = m_strings + e.mime_off;
+            if (gzip && e.gz_size > 0) {
+                out->data = m_base + e.gz_off;
+                out->size = e.gz_size;
+                out->etag = e.gz_etag;
+                out->headers = m_strings + e.gz_hdr_off;
+                out->headers_len = e.gz_hdr_len;
+            }
+            else {
+                out->data = m_base + e.data_off;
+                out->size = e.data_size;
+                out->etag = e.etag;
+                out->headers = m_strings + e.hdr_off;
+                out->headers_len = e.hdr_len;
+            }
+            return true;
+        }
+    }
+    return false;
+}
+
+void bundle::acquire() {
+    __sync_add_and_fetch(&m_ref, 1);
+}
+
+void bundle::release() {
+    if (__sync_sub_and_fetch(&m_ref, 1) == 0) {
+        delete this;
+    }
+}
+
+//-------------------- bundle_store --------------------
+
+bundle_store::bundle_store() : m_populate(false), m_current(NULL), m_inotify_fd(-1) {
+}
+
+bundle_store::~bundle_store() {
+    if (m_inotify_fd >= 0) {
+        close(m_inotify_fd);
+    }
+    if (m_current) {
+        m_current->release();
+    }
+}
+
+bool bundle_store::init(const char* path, bool populate) {
+    m_path = path;
+    m_populate = populate;
+    size_t slash = m_path.rfind('/');
+    m_dir = slash == std::string::npos ? "." : m_path.substr(0, slash + 1);
+    m_name = slash == std::string::npos ? m_path : m_path.substr(slash + 1);
+
+    m_current = bundle::open(path, populate);
+    if (!m_current) {
+        return false;
+    }
+    EMlog(LOGLEVEL_INFO, "bundle %s loaded, %d files\n", path, m_current->count());
+
+    //监视所在目录而不是文件本身：rename 替换后文件的inode变了，对旧inode的监视会失效
+    m_inotify_fd = inotify_init1(IN_CLOEXEC);
+    if (m_inotify_fd < 0 || inotify_add_watch(m_inotify_fd, m_dir.c_str(), IN_MOVED_TO | IN_CLOSE_WRITE) < 0) {
+        EMlog(LOGLEVEL_WARN, "cannot watch %s, errno is : %d, bundle will not be reloaded\n", m_dir.c_str(), errno);
+        return true;
+    }
+    if (pthread_create(&m_thread, NULL, worker, this) != 0) {
+        return false;
+    }
+    if (pthread_detach(m_thread)) {
+        return false;
+    }
+    return true;
+}
+
+bundle* bundle_store::acquire() {
+    m_locker.lock();
+    bundle* b = m_current;
+    if (b) {
+        b->acquire();
+    }
+    m_locker.unlock();
+    return b;
+}
+
+bool bundle_store::reload() {
+    bundle* b = bundle::open(m_path.c_str(), m_populate);
+    if (!b) {
+        EMlog(LOGLEVEL_WARN, "bundle %s is invalid, keep serving the old one\n", m_path.c_str());
+        return false;
+    }
+    m_locker.lock();
+    bundle* old = m_current;
+    m_current = b;
+    m_locker.unlock();
+    if (old) {
+        old->release();     //仍在发送旧数据的连接结束后才真正解除映射
+    }
+    EMlog(LOGLEVEL_INFO, "bundle %s reloaded, %d files\n", m_path.c_str(), b->count());
+    return true;
+}
+
+void* bundle_store::worker(void* arg) {
+    bundle_store* store = (bundle_store*)arg;
+    store->run();
+    return store;
+}
+
+void bundle_store::run() {
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    while (true) {
+        int len = read(m_inotify_fd, buf, sizeof(buf));
+        if (len < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        if (len == 0) {
+            break;
+        }
+        bool changed = false;
+        for (char* p = buf; p < buf + len; ) {
+            const struct inotify_event* ev = (const struct inotify_event*)p;
+            p += sizeof(struct inotify_event) + ev->len;
+            if (ev->len > 0 && m_name == ev->name) {
+                changed = true;
+            }
+        }
+        if (changed) {
+            reload();
+        }
+    }
+}
@@ -0,0 +1,116 @@
+#ifndef BUNDLE_H
+#define BUNDLE_H
+
+#include <stdint.h>
+#include <pthread.h>
+#include <string>
+#include "locker.h"
+
+/*
+    静态站点打包文件：把整个网站根目录打成一个文件，服务器启动时整体mmap一次，
+    请求直接从映射区发送，省去每个文件的 open/stat/mmap。由 tools/mkbundle 生成。
+
+    布局(本机字节序)：
+        bundle_header
+        bundle_entry[count]     按key(规范化路径，与 doc_index 的key一致)排序，二分查找
+        字符串表                key、MIME类型、预先生成的响应头
+        文件数据                每个文件(及其gzip版本)按 BUNDLE_ALIGN 字节对齐
+*/
+
+#define BUNDLE_MAGIC "WSBUNDLE"
+#define BUNDLE_VERSION 1
+#define BUNDLE_ALIGN 64
+
+struct bundle_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t count;             //文件个数
+    uint64_t index_off;         //bundle_entry 数组的偏移
+    uint64_t strings_off;       //字符串表的偏移
+    uint64_t strings_size;
+    uint64_t file_size;         //整个打包文件的大小，用于检查截断
+};
+
+struct bundle_entry {
+    uint32_t key_off;           //以下 *_off 均相对字符串表
+    uint32_t key_len;
+    uint32_t mime_off;          //以\0结尾
+    uint32_t hdr_off;           //原始内容的 ETag/Last-Modified 等响应头
+    uint32_t hdr_len;
+    uint32_t gz_hdr_off;        //gzip版本的响应头，额外带 Content-Encoding
+    uint32_t gz_hdr_len;
+    uint32_t reserved;
+    int64_t mtime;
+    uint64_t data_off;          //相对文件开头
+    uint64_t data_size;
+    uint64_t gz_off;            //没有gzip版本时 gz_size 为0
+    uint64_t gz_size;
+    char etag[24];              //带引号的强ETag，由文件内容的哈希生成
+    char gz_etag[24];
+};
+
+//一个已映射的打包文件，引用计数为0时解除映射
+class bundle {
+public:
+    //选中的一个文件版本，指针都指向映射区，持有引用期间有效
+    struct file {
+        const char* data;
+        uint64_t size;
+        int64_t mtime;
+        const char* mime;
+        const char* etag;
+        const char* headers;    //预先生成的响应头(ETag、Last-Modified等)，每行以\r\n结尾
+        int headers_len;
+    };
+
+    static bundle* open(const char* path, bool populate);   //映射并校验，失败返回NULL
+    bool lookup(const char* key, bool gzip, file* out) const;    //gzip为true且有gzip版本时返回gzip版本
+    int count() const { return m_header->count; }
+
+    void acquire();
+    void release();
+
+private:
+    bundle() : m_base(NULL), m_size(0), m_ref(1) {}
+    ~bundle();
+    bool validate();
+
+private:
+    char* m_base;
+    size_t m_size;
+    const bundle_header* m_header;
+    const bundle_entry* m_entries;
+    const char* m_strings;
+    int m_ref;                  //原子操作增减
+};
+
+/*
+    当前使用的打包文件。后台线程用 inotify 监视打包文件所在目录，
+    新文件 rename 到原路径(或写入完成)后重新映射并原子替换；
+    正在发送旧文件数据的连接持有旧 bundle 的引用，发送完才解除映射。
+*/
+class bundle_store {
+public:
+    bundle_store();
+    ~bundle_store();
+
+    bool init(const char* path, bool populate);
+    bundle* acquire();          //返回当前bundle并增加引用，调用方用完后 release()
+    bool reload();              //重新打开打包文件并替换，失败时继续使用旧的
+
+private:
+    static void* worker(void* arg);
+    void run();
+
+private:
+    std::string m_path;
+    std::string m_dir;
+    std::string m_name;
+    bool m_populate;
+    bundle* m_current;
+    locker m_locker;
+    int m_inotify_fd;
+    pthread_t m_thread;
+};
+
+#endif
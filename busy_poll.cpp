@@ -0,0 +1,50 @@
+#include "busy_poll.h"
+
+int busy_poll::s_max_us = 0;
+busy_poll::stats busy_poll::s_stats[busy_poll::KIND_COUNT];
+
+void busy_poll::handoff(bool spun, unsigned long long ns) {
+    stats& s = s_stats[POOL];
+    if (spun) {
+        s.handoff_spin_ns.fetch_add(ns, std::memory_order_relaxed);
+        s.handoff_spin_count.fetch_add(1, std::memory_order_relaxed);
+    }
+    else {
+        s.handoff_block_ns.fetch_add(ns, std::memory_order_relaxed);
+        s.handoff_block_count.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+void busy_poll::budget::blocked(unsigned long long ns) {
+    unsigned long long max_ns = (unsigned long long)s_max_us * 1000;
+    if (ns <= max_ns) {
+        //再多转一会就能等到
+        m_ns = m_ns == 0 ? GROW_START_NS : m_ns * 2;
+        if (m_ns > max_ns) {
+            m_ns = max_ns;
+        }
+    }
+    else {
+        //空闲：缩小预算，太小时直接不转
+        m_ns /= 2;
+        if (m_ns < GROW_START_NS) {
+            m_ns = 0;
+        }
+    }
+    s_stats[m_kind].budget_ns.store(m_ns, std::memory_order_relaxed);
+}
+
+int busy_poll::epoll_wait(budget& b, int epfd, epoll_event* events, int max, int timeout) {
+    if (!enabled() || timeout == 0) {
+        return ::epoll_wait(epfd, events, max, timeout);
+    }
+    int n = 0;
+    if (b.spin([&]() { n = ::epoll_wait(epfd, events, max, 0); return n != 0; })) {
+        return n;
+    }
+    unsigned long long start = now_ns();
+    n = ::epoll_wait(epfd, events, max, timeout);
+    //超时返回说明这段时间都是空闲的
+    b.blocked(n == 0 ? ~0ULL : now_ns() - start);
+    return n;
+}
@@ -0,0 +1,111 @@
+#ifndef BUSY_POLL_H
+#define BUSY_POLL_H
+
+#include <time.h>
+#include <sys/epoll.h>
+#include <atomic>
+
+/*
+    低延迟模式(busy_poll = 最长自旋微秒数，0 关闭)：事件循环在 epoll_wait 阻塞之前、线程池的工作线程在 sem_wait 之前，
+    先自旋一段时间(事件循环反复 epoll_wait(0)，工作线程反复 sem_trywait，之间用 pause 让出流水线)，
+    这段时间内来了事件/任务就省掉一次睡眠和唤醒。
+    自旋预算按最近的等待时间自适应(与内核 cpuidle haltpoll 的做法相同)：自旋没等到、但随后阻塞的时间不超过上限，
+    说明再多转一会就能等到，预算翻倍；阻塞的时间超过上限(空闲)，预算减半，空闲的进程很快就不再空转。
+    监听socket同时设置 SO_BUSY_POLL/SO_PREFER_BUSY_POLL(sock_profile 的 busy_poll)，新连接继承。
+    运行状态的 busy_poll 中查看自旋的总时间、自旋等到/没等到的次数，以及线程池交接延迟(入队到开始处理)按
+    自旋等到和阻塞唤醒分开的平均值，两者之差乘以自旋等到的次数就是省下的延迟。
+*/
+class busy_poll {
+public:
+    enum KIND { LOOP = 0, POOL, KIND_COUNT };   //事件循环、线程池的工作线程
+
+    static int s_max_us;            //自旋预算的上限，0 关闭，启动时由配置设置
+
+    static bool enabled() { return s_max_us > 0; }
+    static unsigned long long now_ns() {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+    }
+    //线程池：一个任务从入队到被工作线程取出的时间，spun 表示工作线程是自旋等到的
+    static void handoff(bool spun, unsigned long long ns);
+
+    struct stats {
+        std::atomic<unsigned long long> spin_ns;    //自旋的总时间
+        std::atomic<unsigned long long> hits;       //自旋期间等到了
+        std::atomic<unsigned long long> misses;     //自旋没等到，随后阻塞
+        std::atomic<unsigned long long> budget_ns;  //最近一次调整后的预算(多个工作线程时为最后调整的那个)
+        std::atomic<unsigned long long> handoff_spin_ns;
+        std::atomic<unsigned long long> handoff_spin_count;
+        std::atomic<unsigned long long> handoff_block_ns;
+        std::atomic<unsigned long long> handoff_block_count;
+    };
+    static const stats& get(int kind) { return s_stats[kind]; }
+
+    //每个等待者(事件循环、每个工作线程)一个，只由自己的线程使用
+    class budget {
+    public:
+        explicit budget(KIND kind) : m_kind(kind), m_ns(0) {}
+
+        //自旋直到 ready() 返回 true 或预算用完，返回是否等到
+        template<typename F>
+        bool spin(F ready);
+        //自旋没等到，阻塞了 ns 纳秒：按阻塞时间调整预算
+        void blocked(unsigned long long ns);
+
+        unsigned long long current_ns() const { return m_ns; }
+
+    private:
+        KIND m_kind;
+        unsigned long long m_ns;    //当前的预算
+    };
+
+    //事件循环的 epoll_wait：开启时先自旋再阻塞
+    static int epoll_wait(budget& b, int epfd, epoll_event* events, int max, int timeout);
+
+private:
+    static const unsigned long long GROW_START_NS = 10000;  //预算为0时第一次增长到 10us
+    static const int CHECK_INTERVAL = 16;                   //每自旋这么多次读一次时钟
+
+    static stats s_stats[KIND_COUNT];
+};
+
+inline void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield" ::: "memory");
+#endif
+}
+
+template<typename F>
+bool busy_poll::budget::spin(F ready) {
+    if (m_ns == 0) {
+        return false;
+    }
+    unsigned long long start = now_ns();
+    unsigned long long now = start;
+    bool hit = false;
+    for (int i = 1; ; i++) {
+        if (ready()) {
+            hit = true;
+            break;
+        }
+        cpu_relax();
+        if (i % CHECK_INTERVAL == 0) {
+            now = now_ns();
+            if (now - start >= m_ns) {
+                break;
+            }
+        }
+    }
+    if (hit) {
+        now = now_ns();
+    }
+    stats& s = s_stats[m_kind];
+    s.spin_ns.fetch_add(now - start, std::memory_order_relaxed);
+    (hit ? s.hits : s.misses).fetch_add(1, std::memory_order_relaxed);
+    return hit;
+}
+
+#endif
@@ -0,0 +1,110 @@
+#include "capture.h"
+#include "log.h"
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <arpa/inet.h>
+
+static const int STDIO_BUFFER = 1 << 20;
+static const uint64_t FLUSH_INTERVAL_US = 1000000;
+
+static uint64_t clock_us(clockid_t id) {
+    struct timespec ts;
+    clock_gettime(id, &ts);
+    return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+traffic_capture::traffic_capture() : m_fp(NULL), m_start_us(0), m_last_flush_us(0), m_bytes(0), m_max_bytes(0),
+                                     m_next_conn(1) {
+}
+
+traffic_capture::~traffic_capture() {
+    close();
+}
+
+bool traffic_capture::open(const char* path, long long max_bytes) {
+    m_fp = fopen(path, "wb");
+    if (!m_fp) {
+        EMlog(LOGLEVEL_ERROR, "open capture file %s failed, errno is : %d\n", path, errno);
+        return false;
+    }
+    setvbuf(m_fp, NULL, _IOFBF, STDIO_BUFFER);
+    capture_header head;
+    memcpy(head.magic, "WSCAP001", sizeof(head.magic));
+    head.start_us = clock_us(CLOCK_REALTIME);
+    fwrite(&head, sizeof(head), 1, m_fp);
+    m_start_us = clock_us(CLOCK_MONOTONIC);
+    m_last_flush_us = m_start_us;
+    m_bytes = sizeof(head);
+    m_max_bytes = max_bytes;
+    EMlog(LOGLEVEL_WARN, "capturing requests to %s\n", path);
+    return true;
+}
+
+void traffic_capture::close() {
+    m_lock.lock();
+    if (m_fp) {
+        fclose(m_fp);
+        m_fp = NULL;
+    }
+    m_lock.unlock();
+}
+
+uint32_t traffic_capture::conn_open(const sockaddr_in& peer) {
+    uint32_t conn = m_next_conn.fetch_add(1, std::memory_order_relaxed);
+    uint64_t addr = ((uint64_t)ntohl(peer.sin_addr.s_addr) << 16) | ntohs(peer.sin_port);
+    write(conn, CAP_OPEN, 0, addr, NULL, 0);
+    return conn;
+}
+
+void traffic_capture::data(uint32_t conn, const char* buf, int len) {
+    write(conn, CAP_DATA, 0, 0, buf, len);
+}
+
+void traffic_capture::response(uint32_t conn, int status, long long size) {
+    write(conn, CAP_RESP, status, size, NULL, 0);
+}
+
+void traffic_capture::conn_close(uint32_t conn) {
+    write(conn, CAP_CLOSE, 0, 0, NULL, 0);
+}
+
+void traffic_capture::h2(uint32_t conn) {
+    write(conn, CAP_H2, 0, 0, NULL, 0);
+}
+
+void traffic_capture::write(uint32_t conn, int type, int status, uint64_t size, const char* buf, int len) {
+    uint64_t now = clock_us(CLOCK_MONOTONIC);
+    capture_record rec;
+    rec.ts_us = now - m_start_us;
+    rec.conn = conn;
+    rec.type = type;
+    rec.status = status;
+    rec.size = size;
+    rec.len = len;
+    rec.reserved = 0;
+
+    m_lock.lock();
+    if (!m_fp) {
+        m_lock.unlock();
+        return;
+    }
+    if (m_max_bytes > 0 && (long long)(m_bytes + sizeof(rec) + len) > m_max_bytes) {
+        //达到上限：停止抓取，已有的记录都是完整的
+        fclose(m_fp);
+        m_fp = NULL;
+        m_lock.unlock();
+        EMlog(LOGLEVEL_WARN, "capture file reached %lld bytes, capture stopped\n", m_max_bytes);
+        return;
+    }
+    fwrite(&rec, sizeof(rec), 1, m_fp);
+    if (len > 0) {
+        fwrite(buf, 1, len, m_fp);
+    }
+    m_bytes += sizeof(rec) + len;
+    if (now - m_last_flush_us >= FLUSH_INTERVAL_US) {
+        fflush(m_fp);
+        m_last_flush_us = now;
+    }
+    m_lock.unlock();
+}
@@ -0,0 +1,70 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <netinet/in.h>
+#include <atomic>
+#include "locker.h"
+
+/*
+    流量抓取(capture_file)：把收到的请求原样记到文件里，供 test_presure/replay 按原来的时间间隔重放。
+    文件开头是 capture_header，之后是一条条 capture_record，DATA 记录后面紧跟 len 字节的数据。
+    记录的是 read() 从socket(HTTPS 为解密后)读进读缓冲区的原始字节、连接的开始和结束、
+    每个响应的状态码和字节数，时间为相对抓取开始的微秒数。
+    切换到 HTTP/2 的连接记一条 CAP_H2，之后的帧不再记录，重放时跳过这样的连接。
+    记录可能来自不同的线程(工作线程中出错关闭连接)，写入时加锁；数据先进 stdio 缓冲，
+    每秒至少落盘一次，文件达到 max_bytes 后停止抓取。
+*/
+enum CAPTURE_TYPE {
+    CAP_OPEN = 1,       //新连接，size 为对端地址(IPv4 地址 << 16 | 端口，主机字节序)
+    CAP_DATA = 2,       //收到的数据，后跟 len 字节
+    CAP_RESP = 3,       //一个响应发送完毕，status 为状态码，size 为发送的字节数
+    CAP_CLOSE = 4,      //连接关闭
+    CAP_H2 = 5          //连接切换到 HTTP/2，不再记录
+};
+
+struct capture_header {
+    char magic[8];          //"WSCAP001"
+    uint64_t start_us;      //抓取开始的时间(Unix 时间，微秒)
+};
+
+struct capture_record {
+    uint64_t ts_us;         //相对抓取开始的微秒数
+    uint32_t conn;          //连接序号，从1开始
+    uint16_t type;          //CAPTURE_TYPE
+    uint16_t status;
+    uint64_t size;
+    uint32_t len;
+    uint32_t reserved;
+};
+
+class traffic_capture {
+public:
+    traffic_capture();
+    ~traffic_capture();
+
+    bool open(const char* path, long long max_bytes);  //启动时调用，失败时写日志
+    void close();
+
+    uint32_t conn_open(const sockaddr_in& peer);        //返回连接序号
+    void data(uint32_t conn, const char* buf, int len);
+    void response(uint32_t conn, int status, long long size);
+    void conn_close(uint32_t conn);
+    void h2(uint32_t conn);
+
+    unsigned long long bytes() const { return m_bytes; }
+
+private:
+    void write(uint32_t conn, int type, int status, uint64_t size, const char* buf, int len);
+
+    FILE* m_fp;
+    locker m_lock;
+    uint64_t m_start_us;        //抓取开始的单调时钟
+    uint64_t m_last_flush_us;
+    unsigned long long m_bytes;
+    long long m_max_bytes;
+    std::atomic<uint32_t> m_next_conn;
+};
+
+#endif
@@ -0,0 +1,443 @@
+#include "co_loop.h"
+
+#ifdef CO_LOOP_ENABLED
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include "hot_restart.h"
+#include "prefork.h"
+#include "config.h"
+#include "busy_poll.h"
+
+thread_local co_loop* co_loop::t_current = NULL;
+
+//-------------------- frame_pool --------------------
+
+frame_pool::frame_pool() : m_cur(NULL), m_left(0) {
+    memset(m_free, 0, sizeof(m_free));
+}
+
+frame_pool::~frame_pool() {
+    for (size_t i = 0; i < m_chunks.size(); i++) {
+        free(m_chunks[i]);
+    }
+}
+
+//不经过内存池，直接malloc，块头的owner为NULL
+void* frame_pool::alloc_unpooled(size_t size) {
+    block_head* head = (block_head*)malloc(size + sizeof(block_head));
+    if (!head) throw std::bad_alloc();
+    head->owner = NULL;
+    head->cls = 0;
+    return head + 1;
+}
+
+void* frame_pool::alloc(size_t size) {
+    size_t total = size + sizeof(block_head);
+    size_t cls = (total + GRAIN - 1) / GRAIN;
+    if (cls >= CLASSES) {
+        return alloc_unpooled(size);
+    }
+
+    block_head* head;
+    if (m_free[cls]) {
+        head = (block_head*)m_free[cls];
+        m_free[cls] = m_free[cls]->next;
+    }
+    else {
+        size_t bytes = cls * GRAIN;
+        if (m_left < bytes) {
+            m_cur = (char*)malloc(CHUNK_SIZE);
+            if (!m_cur) throw std::bad_alloc();
+            m_chunks.push_back(m_cur);
+            m_left = CHUNK_SIZE;
+        }
+        head = (block_head*)m_cur;
+        m_cur += bytes;
+        m_left -= bytes;
+    }
+    head->owner = this;
+    head->cls = cls;
+    return head + 1;
+}
+
+void frame_pool::release(void* p) {
+    block_head* head = (block_head*)p - 1;
+    frame_pool* pool = head->owner;
+    if (!pool) {
+        free(head);
+        return;
+    }
+    free_node* node = (free_node*)head;
+    node->next = pool->m_free[head->cls];
+    pool->m_free[head->cls] = node;
+}
+
+void* co_task::promise_type::operator new(size_t size) {
+    co_loop* loop = co_loop::current();
+    if (loop) {
+        return loop->frames().alloc(size);
+    }
+    return frame_pool::alloc_unpooled(size);
+}
+
+void co_task::promise_type::operator delete(void* p) {
+    frame_pool::release(p);
+}
+
+//-------------------- co_loop --------------------
+
+co_loop::co_loop(int listenfd, int sigfd, http_conn* users, int max_fd)
+    : m_listenfd(listenfd), m_sigfd(sigfd), m_users(users), m_max_fd(max_fd),
+      m_epollfd(-1), m_ready_fd(-1), m_stop(false), m_seq(0), m_fds(max_fd) {
+    for (int i = 0; i < max_fd; i++) {
+        m_fds[i].want = 0;
+        m_fds[i].ready = 0;
+        m_fds[i].seq = 0;
+        m_fds[i].timed_out = false;
+        m_fds[i].gen = 0;
+    }
+}
+
+co_loop::~co_loop() {
+    if (m_epollfd >= 0) {
+        close(m_epollfd);
+    }
+    if (t_current == this) {
+        t_current = NULL;
+    }
+}
+
+bool co_loop::init() {
+    m_epollfd = epoll_create(5);
+    if (m_epollfd < 0) {
+        return false;
+    }
+    epoll_event event;
+    event.events = EPOLLIN | EPOLLEXCLUSIVE;    //多个 worker 共用监听socket时只唤醒一个
+    event.data.u64 = (unsigned int)m_listenfd;
+    epoll_ctl(m_epollfd, EPOLL_CTL_ADD, m_listenfd, &event);
+    event.events = EPOLLIN;
+    event.data.u64 = (unsigned int)m_sigfd;
+    epoll_ctl(m_epollfd, EPOLL_CTL_ADD, m_sigfd, &event);
+    fcntl(m_listenfd, F_SETFL, fcntl(m_listenfd, F_GETFL) | O_NONBLOCK);
+
+    //http_conn 不再自己注册epoll，超时也由协程的定时等待负责
+    http_conn::m_epollfd = -1;
+    t_current = this;
+    return true;
+}
+
+long long co_loop::now_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+void co_loop::run() {
+    std::vector<epoll_event> events(config::current().max_events);
+    busy_poll::budget budget(busy_poll::LOOP);     //低延迟模式下先自旋再阻塞
+    while (!m_stop) {
+        int num = busy_poll::epoll_wait(budget, m_epollfd, &events[0], events.size(), next_timeout());
+        if ((num < 0) && (errno != EINTR)) {
+            EMlog(LOGLEVEL_ERROR, "epoll failure\n");
+            break;
+        }
+        for (int i = 0; i < num; i++) {
+            int fd = (int)(events[i].data.u64 & 0xffffffff);
+            unsigned int gen = (unsigned int)(events[i].data.u64 >> 32);
+            if (fd == m_listenfd) {
+                handle_accept();
+            }
+            else if (fd == m_sigfd) {
+                handle_signal();
+            }
+            else if (fd == m_ready_fd) {
+                handle_ready();
+            }
+            else if (m_fds[fd].gen == gen) {
+                wake(fd, events[i].events);
+            }
+        }
+        expire_deadlines();
+        prefork::publish();
+        //热重启：所有连接都已结束，旧进程退出
+        if (http_conn::m_draining && http_conn::m_user_count == 0) {
+            m_stop = true;
+        }
+    }
+}
+
+void co_loop::handle_accept() {
+    while (true) {
+        struct sockaddr_in client_address;
+        socklen_t client_addrlen = sizeof(client_address);
+        int connfd = accept(m_listenfd, (struct sockaddr*)&client_address, &client_addrlen);
+        if (connfd < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                EMlog(LOGLEVEL_WARN, "accept errno is : %d\n", errno);
+            }
+            return;
+        }
+        if (connfd >= m_max_fd || http_conn::m_user_count >= config::current().max_conn) {
+            close(connfd);
+            continue;
+        }
+        serve(connfd);      //协程运行到第一次等待可读时返回
+    }
+}
+
+void co_loop::handle_signal() {
+    char signals[1024];
+    int ret = recv(m_sigfd, signals, sizeof(signals), 0);
+    for (int i = 0; i < ret; i++) {
+        if (signals[i] == SIGTERM) {
+            m_stop = true;
+        }
+        else if (signals[i] == SIGHUP) {
+            config::current().reload();     //协程模型不使用线程池，线程数的改动无效
+        }
+        else if (signals[i] == SIGUSR2 && prefork::worker() >= 0) {
+            drain();    //多进程模式由主进程负责热重启，worker 收到时排空
+        }
+        else if (signals[i] == SIGUSR2 && m_ready_fd < 0 && !http_conn::m_draining) {
+            m_ready_fd = hot_restart::spawn(m_listenfd);
+            if (m_ready_fd >= 0) {
+                epoll_event event;
+                event.events = EPOLLIN;
+                event.data.u64 = (unsigned int)m_ready_fd;
+                epoll_ctl(m_epollfd, EPOLL_CTL_ADD, m_ready_fd, &event);
+            }
+        }
+    }
+}
+
+//新进程已就绪：停止accept，监听socket只留给新进程
+void co_loop::handle_ready() {
+    int ret = hot_restart::check_ready(m_ready_fd);     //有结果时关闭管道，epoll自动移除
+    if (ret < 0) {
+        return;
+    }
+    m_ready_fd = -1;
+    if (ret == 1) {
+        drain();
+    }
+}
+
+//停止accept，连接都结束后退出
+void co_loop::drain() {
+    if (http_conn::m_draining) {
+        return;
+    }
+    //新进程仍持有同一个监听socket，必须显式从epoll中删除
+    epoll_ctl(m_epollfd, EPOLL_CTL_DEL, m_listenfd, NULL);
+    close(m_listenfd);
+    m_listenfd = -1;
+    http_conn::m_draining = true;
+}
+
+//记录就绪事件，等待者关心的事件到了就恢复它
+void co_loop::wake(int fd, int events) {
+    fd_state& st = m_fds[fd];
+    if (events & (EPOLLERR | EPOLLHUP | EPOLLRDHUP)) {
+        events |= EPOLLIN | EPOLLOUT;   //出错时让读写都返回，由 read()/writev 报告错误
+    }
+    st.ready |= events & (EPOLLIN | EPOLLOUT);
+    if (st.waiter && (st.ready & st.want)) {
+        std::coroutine_handle<> h = st.waiter;
+        st.waiter = nullptr;
+        st.seq = 0;
+        h.resume();
+    }
+}
+
+int co_loop::next_timeout() {
+    while (!m_deadlines.empty()) {
+        const deadline& d = m_deadlines.top();
+        if (m_fds[d.fd].waiter && m_fds[d.fd].seq == d.seq) {
+            long long left = d.at_ms - now_ms();
+            return left > 0 ? (int)left : 0;
+        }
+        m_deadlines.pop();      //等待已经结束，丢弃
+    }
+    return -1;
+}
+
+void co_loop::expire_deadlines() {
+    long long now = now_ms();
+    while (!m_deadlines.empty() && m_deadlines.top().at_ms <= now) {
+        deadline d = m_deadlines.top();
+        m_deadlines.pop();
+        fd_state& st = m_fds[d.fd];
+        if (st.waiter && st.seq == d.seq) {
+            std::coroutine_handle<> h = st.waiter;
+            st.waiter = nullptr;
+            st.seq = 0;
+            st.timed_out = true;
+            h.resume();
+        }
+    }
+}
+
+bool co_loop::io_awaiter::await_ready() {
+    fd_state& st = loop->m_fds[fd];
+    st.timed_out = false;
+    if (st.ready & ev) {
+        st.ready &= ~ev;    //消费就绪位，调用方会一直读/写到EAGAIN
+        return true;
+    }
+    return false;
+}
+
+void co_loop::io_awaiter::await_suspend(std::coroutine_handle<> h) {
+    fd_state& st = loop->m_fds[fd];
+    st.waiter = h;
+    st.want = ev;
+    st.seq = ++loop->m_seq;
+    if (timeout_ms >= 0) {
+        deadline d;
+        d.at_ms = now_ms() + timeout_ms;
+        d.fd = fd;
+        d.seq = st.seq;
+        loop->m_deadlines.push(d);
+    }
+}
+
+bool co_loop::io_awaiter::await_resume() {
+    fd_state& st = loop->m_fds[fd];
+    st.ready &= ~ev;
+    return !st.timed_out;
+}
+
+//注册上游socket。每次等待前都调用：转发中途可能换了连接重试，新连接可能恰好复用了同一个fd号
+bool co_loop::watch(int fd) {
+    if (fd < 0 || fd >= m_max_fd) {
+        return false;
+    }
+    epoll_event event;
+    event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    event.data.u64 = ((unsigned long long)m_fds[fd].gen << 32) | (unsigned int)fd;
+    if (epoll_ctl(m_epollfd, EPOLL_CTL_ADD, fd, &event) < 0) {
+        return errno == EEXIST && epoll_ctl(m_epollfd, EPOLL_CTL_MOD, fd, &event) == 0;
+    }
+    return true;
+}
+
+//转发结束后立即调用(中间不能有等待)：连接已经关闭时fd号还没有被别人复用，删除失败也无妨
+void co_loop::unwatch(int fd) {
+    epoll_ctl(m_epollfd, EPOLL_CTL_DEL, fd, NULL);
+    m_fds[fd].ready = 0;
+}
+
+//一个连接的完整生命周期：读请求 -> 解析 -> 写响应 -> (长连接)继续读
+co_task co_loop::serve(int fd) {
+    http_conn& conn = m_users[fd];
+    struct sockaddr_in addr;
+    socklen_t addrlen = sizeof(addr);
+    getpeername(fd, (struct sockaddr*)&addr, &addrlen);
+    conn.init(fd, addr, sock_profile::of(m_listenfd));
+    //超时由带期限的等待负责，不使用定时器链表
+    http_conn::m_timer_lst.del_timer(conn.timer);
+    conn.timer = NULL;
+
+    fd_state& st = m_fds[fd];
+    st.gen++;
+    st.ready = 0;
+    st.waiter = nullptr;
+    epoll_event event;
+    event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    event.data.u64 = ((unsigned long long)st.gen << 32) | (unsigned int)fd;
+    epoll_ctl(m_epollfd, EPOLL_CTL_ADD, fd, &event);
+
+    while (true) {
+        //上次读满了读缓冲区(流式请求体)时socket中还有数据，边缘触发不会再通知，直接接着读
+        //等待的期限由连接按所处阶段(请求头、请求体、长连接空闲)计算，与定时器链表一致
+        if (!conn.has_unread() && !co_await readable(fd, conn.timeout_ms())) {
+            conn.count_timeout();
+            break;
+        }
+        if (!conn.read() || !conn.admit()) {
+            break;      //对方关闭或出错，或超过限流速率
+        }
+        http_conn::HTTP_CODE ret = conn.process_inline();
+        if (ret == http_conn::NO_REQUEST) {
+            continue;   //请求不完整，继续读
+        }
+        if (ret == http_conn::CLOSED_CONNECTION) {
+            break;
+        }
+
+        //转发时在上游和客户端之间交替：等上游 -> 发一批给客户端 -> 再推进，直到响应结束
+        bool ok = true;
+        int watched = -1;
+        int next = ret == http_conn::PROXY_REQUEST ? conn.proxy_step() : http_conn::PROXY_WRITE;
+        while (ok) {
+            if (watched >= 0 && !conn.proxying()) {
+                unwatch(watched);
+                watched = -1;
+            }
+            if (next == http_conn::PROXY_UPSTREAM_IN || next == http_conn::PROXY_UPSTREAM_OUT) {
+                int up = conn.proxy_fd();
+                if (!watch(up)) {
+                    ok = false;
+                    break;
+                }
+                watched = up;
+                int timeout_ms = config::current().proxy_timeout * 1000;
+                bool ready = next == http_conn::PROXY_UPSTREAM_IN ? co_await readable(up, timeout_ms)
+                                                                   : co_await writable(up, timeout_ms);
+                if (ready) {
+                    next = conn.proxy_step();
+                }
+                else {
+                    ok = conn.proxy_timeout();     //已经开始发送响应时只能关闭连接
+                    next = http_conn::PROXY_WRITE;
+                }
+                continue;
+            }
+            if (next != http_conn::PROXY_WRITE) {
+                break;
+            }
+            while (conn.get_bytes_to_send() > 0) {
+                int n = writev(fd, conn.get_iov(), conn.get_iv_count());
+                if (n < 0) {
+                    if (errno == EAGAIN) {
+                        if (co_await writable(fd, conn.timeout_ms())) {
+                            continue;
+                        }
+                        conn.count_timeout();
+                    }
+                    ok = false;
+                    break;
+                }
+                conn.advance_iov(n);
+                conn.refresh_timer();   //没有定时器，只记录收发时间
+            }
+            if (!ok) {
+                break;
+            }
+            next = conn.proxying() ? conn.proxy_step() : http_conn::PROXY_DONE;
+        }
+        if (watched >= 0 && !conn.proxying()) {
+            unwatch(watched);
+        }
+        if (!ok || next == http_conn::PROXY_CLOSE) {
+            break;
+        }
+        if (next == http_conn::PROXY_READ) {
+            continue;   //请求体还没读完
+        }
+        if (!conn.write_done()) {
+            break;
+        }
+    }
+
+    st.gen++;       //让本批次中该fd剩余的事件失效
+    conn.close_conn();      //close后epoll自动移除该fd
+}
+
+#endif
@@ -0,0 +1,139 @@
+#ifndef CO_LOOP_H
+#define CO_LOOP_H
+
+// 协程模型需要以 -std=c++20 编译，否则整个文件为空，main 中的 -c 选项不可用
+#if __cplusplus >= 202002L
+#define CO_LOOP_ENABLED 1
+
+#include <coroutine>
+#include <exception>
+#include <queue>
+#include <vector>
+#include <sys/epoll.h>
+#include "http_conn.h"
+
+class co_loop;
+
+/*
+    协程帧内存池：按64字节分级的空闲链表，只由所属事件循环线程使用，不加锁。
+    每块前面有一个块头记录所属内存池，不在事件循环中创建的协程回退到 malloc。
+*/
+class frame_pool {
+public:
+    frame_pool();
+    ~frame_pool();
+    void* alloc(size_t size);
+    static void* alloc_unpooled(size_t size);
+    static void release(void* p);
+
+private:
+    struct block_head {
+        frame_pool* owner;      //NULL 表示由 malloc 分配
+        size_t cls;             //大小级别
+    };
+    struct free_node {
+        free_node* next;
+    };
+    static const size_t GRAIN = 64;
+    static const size_t CLASSES = 64;          //最大 64 * 64 = 4KB，更大的帧走 malloc
+    static const size_t CHUNK_SIZE = 64 * 1024;
+
+    free_node* m_free[CLASSES];
+    std::vector<char*> m_chunks;
+    char* m_cur;                //当前chunk中尚未切分的部分
+    size_t m_left;
+};
+
+//连接协程：创建后立即运行，结束时自行销毁，不需要外部持有句柄
+struct co_task {
+    struct promise_type {
+        co_task get_return_object() { return co_task(); }
+        std::suspend_never initial_suspend() noexcept { return std::suspend_never(); }
+        std::suspend_never final_suspend() noexcept { return std::suspend_never(); }
+        void return_void() {}
+        void unhandled_exception() { std::terminate(); }
+
+        static void* operator new(size_t size);
+        static void operator delete(void* p);
+    };
+};
+
+/*
+    协程事件循环：每个连接是一个 co_task，在本线程内 co_await 可读/可写(带超时)事件，
+    直接调用 http_conn 的解析和响应拼装，不经过线程池，省去 modfd 和跨线程交接。
+    fd 以边缘触发一次性注册读写事件，事件到达时记录就绪位，等待者据此恢复。
+*/
+class co_loop {
+public:
+    co_loop(int listenfd, int sigfd, http_conn* users, int max_fd);
+    ~co_loop();
+
+    bool init();
+    void run();     //收到SIGTERM后返回
+
+    static co_loop* current() { return t_current; }
+    frame_pool& frames() { return m_frames; }
+
+    //等待fd上的事件，超时(毫秒)后也会恢复，co_await 结果为 false 表示超时
+    struct io_awaiter {
+        co_loop* loop;
+        int fd;
+        int ev;
+        int timeout_ms;
+        bool await_ready();
+        void await_suspend(std::coroutine_handle<> h);
+        bool await_resume();
+    };
+    io_awaiter readable(int fd, int timeout_ms) { return io_awaiter{this, fd, EPOLLIN, timeout_ms}; }
+    io_awaiter writable(int fd, int timeout_ms) { return io_awaiter{this, fd, EPOLLOUT, timeout_ms}; }
+
+    //反向代理：上游socket由连接协程注册到本循环后才能等待，放回连接池前取消注册
+    bool watch(int fd);
+    void unwatch(int fd);
+
+private:
+    //每个fd上的等待状态
+    struct fd_state {
+        std::coroutine_handle<> waiter;
+        int want;               //等待的事件
+        int ready;              //已就绪但还没被消费的事件
+        unsigned long seq;      //本次等待的序号，用于识别过期的超时项
+        bool timed_out;
+        unsigned int gen;       //连接代数，防止fd复用后旧事件唤醒新连接
+    };
+    //超时项，惰性删除：弹出时序号不一致说明等待已经结束
+    struct deadline {
+        long long at_ms;
+        int fd;
+        unsigned long seq;
+        bool operator>(const deadline& o) const { return at_ms > o.at_ms; }
+    };
+
+    co_task serve(int fd);      //连接协程
+    void handle_accept();
+    void handle_signal();
+    void handle_ready();
+    void drain();
+    void wake(int fd, int events);
+    void expire_deadlines();
+    int next_timeout();
+    static long long now_ms();
+
+private:
+    static thread_local co_loop* t_current;
+
+    int m_listenfd;
+    int m_sigfd;
+    http_conn* m_users;
+    int m_max_fd;
+    int m_epollfd;
+    int m_ready_fd;             //热重启时新进程的就绪通知管道
+    bool m_stop;
+    unsigned long m_seq;
+    std::vector<fd_state> m_fds;
+    std::priority_queue<deadline, std::vector<deadline>, std::greater<deadline> > m_deadlines;
+    frame_pool m_frames;
+};
+
+#endif
+#endif
@@ -0,0 +1,274 @@
+#include "config.h"
+#include "http_conn.h"
+#include "log.h"
+#include "prefork.h"
+#include "priority.h"
+#include "sock_profile.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+config::config()
+    : port(0), max_fd(65536), max_events(10000), listen_backlog(5),
+      read_buffer_size(2048), write_buffer_size(1024), docroot("resources"),
+      proxy_keepalive(32), tls_port(0), http2(1), capture_max_mb(1024), workers(0), reuseport(0),
+      worker_affinity(0), io_model("proactor"), busy_poll(0), timeslot(5), max_conn(65536), log_level(LOGLEVEL_INFO), threads(8), max_requests(10000),
+      direct_write(1), queue_deadline_ms(0), max_age(-1),
+      max_body_size(64 * 1024 * 1024), rate_limit(0), rate_burst(20), rate_prefix(32), proxy_timeout(30),
+      header_timeout(10), keepalive_timeout(15), min_body_rate(1024), min_send_rate(1024) {
+}
+
+config& config::current() {
+    static config s_current;
+    return s_current;
+}
+
+//整数项：名字、成员指针、最小值
+struct int_option {
+    const char* name;
+    int config::*field;
+    int min;
+};
+
+static const int_option int_options[] = {
+    { "port",              &config::port,              1 },
+    { "max_fd",            &config::max_fd,            64 },
+    { "max_events",        &config::max_events,        1 },
+    { "listen_backlog",    &config::listen_backlog,    1 },
+    { "read_buffer_size",  &config::read_buffer_size,  256 },
+    { "write_buffer_size", &config::write_buffer_size, 256 },
+    { "timeslot",          &config::timeslot,          1 },
+    { "max_conn",          &config::max_conn,          1 },
+    { "log_level",         &config::log_level,         LOGLEVEL_DEBUG },
+    { "threads",           &config::threads,           1 },
+    { "max_requests",      &config::max_requests,      1 },
+    { "queue_deadline_ms", &config::queue_deadline_ms, 0 },
+    { "direct_write",      &config::direct_write,      0 },
+    { "max_age",           &config::max_age,           -1 },
+    { "max_body_size",     &config::max_body_size,     0 },
+    { "proxy_keepalive",   &config::proxy_keepalive,   0 },
+    { "tls_port",          &config::tls_port,          0 },
+    { "http2",             &config::http2,             0 },
+    { "capture_max_mb",    &config::capture_max_mb,    0 },
+    { "workers",           &config::workers,           0 },
+    { "reuseport",         &config::reuseport,         0 },
+    { "worker_affinity",   &config::worker_affinity,   0 },
+    { "busy_poll",         &config::busy_poll,         0 },
+    { "proxy_timeout",     &config::proxy_timeout,     1 },
+    { "rate_limit",        &config::rate_limit,        0 },
+    { "rate_burst",        &config::rate_burst,        1 },
+    { "rate_prefix",       &config::rate_prefix,       8 },
+    { "header_timeout",    &config::header_timeout,    1 },
+    { "keepalive_timeout", &config::keepalive_timeout, 1 },
+    { "min_body_rate",     &config::min_body_rate,     0 },
+    { "min_send_rate",     &config::min_send_rate,     0 },
+};
+
+bool config::set(const char* key, const char* value) {
+    if (strcmp(key, "docroot") == 0) {
+        if (!*value) {
+            return false;
+        }
+        docroot = value;
+        return true;
+    }
+    if (strcmp(key, "upload_dir") == 0) {
+        upload_dir = value;     //可以为空，表示关闭上传
+        return true;
+    }
+    if (strcmp(key, "status_path") == 0) {
+        if (*value && *value != '/') {
+            return false;
+        }
+        status_path = value;
+        return true;
+    }
+    if (strcmp(key, "io_model") == 0) {
+        if (strcmp(value, "proactor") != 0 && strcmp(value, "reactor") != 0 && strcmp(value, "uring") != 0) {
+            return false;
+        }
+        io_model = value;
+        return true;
+    }
+    if (strcmp(key, "capture_file") == 0) {
+        capture_file = value;
+        return true;
+    }
+    if (strcmp(key, "tls_cert") == 0) {
+        tls_cert = value;
+        return true;
+    }
+    if (strcmp(key, "tls_key") == 0) {
+        tls_key = value;
+        return true;
+    }
+    if (strcmp(key, "tls_profile") == 0) {
+        sock_profile profile;
+        if (*value && !profile.parse(value)) {
+            return false;
+        }
+        tls_profile = value;
+        return true;
+    }
+    if (strcmp(key, "proxy") == 0) {
+        //前缀和上游之间用空白分隔，前缀必须以 / 开头
+        int len = strcspn(value, " \t");
+        const char* target = value + len + strspn(value + len, " \t");
+        if (value[0] != '/' || !*target || strpbrk(target, " \t")) {
+            return false;
+        }
+        proxy.push_back(value);
+        return true;
+    }
+    if (strcmp(key, "priority") == 0) {
+        priority_rules rules;
+        if (!rules.add(value)) {
+            return false;
+        }
+        priority.push_back(value);
+        return true;
+    }
+    for (size_t i = 0; i < sizeof(int_options) / sizeof(int_options[0]); i++) {
+        if (strcmp(key, int_options[i].name) == 0) {
+            char* end;
+            long v = strtol(value, &end, 10);
+            if (end == value || *end || v < int_options[i].min || v > 0x7fffffff) {
+                return false;
+            }
+            this->*int_options[i].field = (int)v;
+            return true;
+        }
+    }
+    return false;
+}
+
+//去掉首尾空白
+static char* trim(char* s) {
+    while (*s == ' ' || *s == '\t') {
+        s++;
+    }
+    char* end = s + strlen(s);
+    while (end > s && (end[-1] == ' ' || end[-1] == '\t' || end[-1] == '\r' || end[-1] == '\n')) {
+        *--end = '\0';
+    }
+    return s;
+}
+
+bool config::set(const char* item) {
+    char buf[512];
+    snprintf(buf, sizeof(buf), "%s", item);
+    char* eq = strchr(buf, '=');
+    if (!eq) {
+        return false;
+    }
+    *eq = '\0';
+    return set(trim(buf), trim(eq + 1));
+}
+
+bool config::load_file(const char* path) {
+    FILE* fp = fopen(path, "r");
+    if (!fp) {
+        EMlog(LOGLEVEL_ERROR, "cannot open config file %s\n", path);
+        return false;
+    }
+    char line[512];
+    int lineno = 0;
+    bool ok = true;
+    while (fgets(line, sizeof(line), fp)) {
+        lineno++;
+        char* comment = strchr(line, '#');  //行尾注释
+        if (comment) {
+            *comment = '\0';
+        }
+        char* p = trim(line);
+        if (!*p) {
+            continue;
+        }
+        if (!set(p)) {
+            EMlog(LOGLEVEL_ERROR, "%s:%d: invalid setting: %s\n", path, lineno, p);
+            ok = false;
+        }
+    }
+    fclose(fp);
+    return ok;
+}
+
+bool config::check() {
+    if (max_conn > max_fd) {
+        max_conn = max_fd;
+    }
+    if (log_level > LOGLEVEL_ERROR || rate_prefix > 32 || rate_burst > rate_limiter::MAX_BURST ||
+        workers > prefork::MAX_WORKERS) {
+        return false;
+    }
+    if (tls_port && (tls_port == port || tls_cert.empty() || tls_key.empty())) {
+        return false;       //HTTPS 需要证书和私钥，端口不能与 HTTP 相同
+    }
+    return true;
+}
+
+void config::apply_live() const {
+    EM_log_level = log_level;
+    http_conn::m_max_age = max_age;
+    http_conn::m_direct_write = direct_write != 0;
+    if (http_conn::m_limiter) {
+        http_conn::m_limiter->configure(rate_limit, rate_burst, rate_prefix);
+    }
+}
+
+bool config::reload() {
+    config next;
+    next.m_file = m_file;
+    next.m_overrides = m_overrides;
+    if (!m_file.empty() && !next.load_file(m_file.c_str())) {
+        EMlog(LOGLEVEL_ERROR, "reload failed, keep the current configuration\n");
+        return false;
+    }
+    for (size_t i = 0; i < m_overrides.size(); i++) {
+        next.set(m_overrides[i].c_str());
+    }
+    next.max_conn = next.max_conn > max_fd ? max_fd : next.max_conn;    //max_fd 不能热加载，按当前值限制
+    if (!next.check()) {
+        EMlog(LOGLEVEL_ERROR, "reload failed, keep the current configuration\n");
+        return false;
+    }
+
+    //启动时确定的项只提示，不生效
+    if (next.port != port || next.max_fd != max_fd || next.max_events != max_events ||
+        next.listen_backlog != listen_backlog || next.read_buffer_size != read_buffer_size ||
+        next.write_buffer_size != write_buffer_size || next.docroot != docroot ||
+        next.upload_dir != upload_dir || next.status_path != status_path || next.proxy != proxy ||
+        next.priority != priority || next.proxy_keepalive != proxy_keepalive || next.tls_port != tls_port ||
+        next.tls_cert != tls_cert || next.tls_key != tls_key || next.tls_profile != tls_profile ||
+        next.http2 != http2 || next.capture_file != capture_file || next.capture_max_mb != capture_max_mb ||
+        next.workers != workers || next.reuseport != reuseport || next.worker_affinity != worker_affinity ||
+        next.io_model != io_model || next.busy_poll != busy_poll) {
+        EMlog(LOGLEVEL_WARN, "port/max_fd/max_events/listen_backlog/buffer sizes/docroot/upload_dir/status_path/proxy/priority/tls/http2/capture/workers/io_model/busy_poll changed, "
+                             "restart (SIGUSR2) to apply\n");
+    }
+
+    timeslot = next.timeslot;
+    max_conn = next.max_conn;
+    log_level = next.log_level;
+    threads = next.threads;
+    max_requests = next.max_requests;
+    queue_deadline_ms = next.queue_deadline_ms;
+    direct_write = next.direct_write;
+    max_age = next.max_age;
+    max_body_size = next.max_body_size;
+    proxy_timeout = next.proxy_timeout;
+    rate_limit = next.rate_limit;
+    rate_burst = next.rate_burst;
+    rate_prefix = next.rate_prefix;
+    header_timeout = next.header_timeout;
+    keepalive_timeout = next.keepalive_timeout;
+    min_body_rate = next.min_body_rate;
+    min_send_rate = next.min_send_rate;
+    apply_live();
+    EMlog(LOGLEVEL_WARN, "config reloaded: timeslot=%d max_conn=%d log_level=%d threads=%d max_requests=%d queue_deadline_ms=%d direct_write=%d "
+                         "max_age=%d max_body_size=%d proxy_timeout=%d rate_limit=%d/%d per /%d header_timeout=%d keepalive_timeout=%d "
+                         "min_body_rate=%d min_send_rate=%d\n",
+          timeslot, max_conn, log_level, threads, max_requests, queue_deadline_ms, direct_write, max_age, max_body_size, proxy_timeout,
+          rate_limit, rate_burst, rate_prefix, header_timeout, keepalive_timeout, min_body_rate, min_send_rate);
+    return true;
+}
@@ -0,0 +1,82 @@
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#include <string>
+#include <vector>
+
+/*
+    运行时配置：默认值 < 配置文件(-f) < 命令行(-D key=value 及 -m 等选项)。
+    配置文件每行一个 key = value，# 开头为注释。
+    收到 SIGHUP 时重新读取配置文件并重新应用命令行覆盖项，只有标为"热加载"的项立即生效，
+    其余项的改动写入日志，需要重启(可以用 SIGUSR2 热重启)才生效。
+*/
+class config {
+public:
+    config();
+
+    static config& current();   //当前生效的配置
+
+    bool load_file(const char* path);               //读取配置文件，出错时返回false并写日志
+    bool set(const char* key, const char* value);   //设置一项，未知项或取值非法返回false
+    bool set(const char* item);                     //"key=value" 形式
+    bool check();                                   //检查取值之间的约束，并把 max_conn 限制在 max_fd 以内
+
+    //记录配置文件路径和命令行覆盖项，热加载时按同样的顺序重新应用
+    void set_file(const char* path) { m_file = path; }
+    void add_override(const char* item) { m_overrides.push_back(item); }
+
+    bool reload();                  //SIGHUP：重新读取并应用热加载项，失败时保持原配置
+    void apply_live() const;        //把日志等级等热加载项写到各模块
+
+public:
+    //启动时确定
+    int port;
+    int max_fd;                 //最大文件描述符个数，即 http_conn 数组大小
+    int max_events;             //一次 epoll_wait 最多返回的事件数
+    int listen_backlog;
+    int read_buffer_size;
+    int write_buffer_size;
+    std::string docroot;
+    std::string upload_dir;     //PUT/POST 上传文件的保存目录，为空时不接受上传
+    std::string status_path;    //运行状态(JSON)的路径，如 /_status，为空时不提供
+    std::vector<std::string> proxy;     //反向代理规则 "前缀 上游"，如 "/api/ unix:/run/app.sock"，可以出现多次
+    int proxy_keepalive;        //每个上游保留的空闲长连接数，0 表示每个请求新建连接
+    int tls_port;               //HTTPS 端口，0 表示不开启
+    std::string tls_cert;       //证书链文件(PEM)
+    std::string tls_key;        //私钥文件(PEM)
+    std::string tls_profile;    //HTTPS 监听socket的TCP参数，格式同 -o，为空时与HTTP监听socket相同
+    int http2;                  //接受 HTTP/2(连接序言、ALPN h2、h2c Upgrade)，0 关闭；只支持 epoll 后端
+    std::string capture_file;   //把收到的请求记到该文件(供 test_presure/replay 重放)，为空时不抓取；热重启的新进程加 .<pid> 后缀
+    int capture_max_mb;         //抓取文件的大小上限(MB)，达到后停止抓取，0 表示不限制
+    int workers;                //多进程模式的 worker 进程数，0 为单进程；max_conn/threads 等按每个 worker 计
+    int reuseport;              //多进程模式下每个 worker 以 SO_REUSEPORT 各自监听，0 时共用主进程的监听socket
+    int worker_affinity;        //worker i 绑定到第 i 个可用的CPU
+    std::vector<std::string> priority;  //调度优先级规则 "前缀 类别(high/normal/low)"，可以出现多次；未匹配时 POST/PUT 为 low
+    std::string io_model;       //并发模型：proactor(事件循环读写、工作线程解析，默认)、reactor(工作线程读写和解析)、uring(同 -u)
+    int busy_poll;              //低延迟模式：事件循环和线程池阻塞前最多自旋的微秒数，监听socket设置 SO_BUSY_POLL，0 关闭
+
+    //热加载
+    int timeslot;               //定时器周期(秒)，也是各项超时的检查精度；收发数据中途停顿 3 * timeslot 后关闭
+    int max_conn;               //连接数达到该值后新连接直接关闭(过载保护)，不超过 max_fd
+    int log_level;              //0 DEBUG 1 INFO 2 WARN 3 ERROR
+    int threads;                //线程池线程数
+    int max_requests;           //线程池队列长度上限
+    int direct_write;           //工作线程生成响应后直接发送，发不完再交给事件循环(epoll 后端)，0 时一律注册EPOLLOUT
+    int queue_deadline_ms;      //请求在线程池队列中最多等待的毫秒数，过期且还没有开始解析的请求回复503，0 表示不限制
+    int max_age;                //Cache-Control: max-age，小于0时不发送
+    int max_body_size;          //请求体的最大字节数，超过返回413，0 表示不限制
+    int rate_limit;             //每个客户端(按 rate_prefix 归并)每秒的请求数，超过返回429，0 表示不限流
+    int rate_burst;             //令牌桶容量：允许的突发请求数
+    int rate_prefix;            //按多长的地址前缀归并客户端，32 为单个地址，24 为 /24 网段
+    int proxy_timeout;          //等待上游的超时(秒)，超时且还没有响应时返回504
+    int header_timeout;         //从请求的第一个字节起收完请求头的期限(秒)，期间收到数据不推迟；新连接等待第一个请求也按它
+    int keepalive_timeout;      //长连接发完响应后等待下一个请求的时间(秒)
+    int min_body_rate;          //接收请求体的最低速率(字节/秒)，0 表示只按空闲超时
+    int min_send_rate;          //发送响应的最低速率(字节/秒)，0 表示只按空闲超时
+
+private:
+    std::string m_file;
+    std::vector<std::string> m_overrides;
+};
+
+#endif
@@ -0,0 +1,410 @@
+#include "doc_index.h"
+#include "log.h"
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/inotify.h>
+
+#define INOTIFY_MASK (IN_CLOSE_WRITE | IN_ATTRIB | IN_CREATE | IN_MOVED_TO | IN_DELETE | IN_MOVED_FROM | IN_ONLYDIR)
+
+//扩展名 -> MIME类型，未列出的扩展名为 application/octet-stream
+static const char* mime_table[][2] = {
+    { "html", "text/html" },
+    { "htm",  "text/html" },
+    { "css",  "text/css" },
+    { "js",   "application/javascript" },
+    { "json", "application/json" },
+    { "txt",  "text/plain" },
+    { "xml",  "text/xml" },
+    { "jpg",  "image/jpeg" },
+    { "jpeg", "image/jpeg" },
+    { "png",  "image/png" },
+    { "gif",  "image/gif" },
+    { "svg",  "image/svg+xml" },
+    { "ico",  "image/x-icon" },
+    { "webp", "image/webp" },
+    { "mp3",  "audio/mpeg" },
+    { "mp4",  "video/mp4" },
+    { "pdf",  "application/pdf" },
+    { "zip",  "application/zip" },
+    { "woff", "font/woff" },
+    { "woff2", "font/woff2" },
+};
+
+doc_index::doc_index() : m_slots(64), m_count(0), m_used(0), m_inotify_fd(-1) {
+    for (size_t i = 0; i < m_slots.size(); i++) {
+        m_slots[i].used = false;
+        m_slots[i].deleted = false;
+    }
+}
+
+doc_index::~doc_index() {
+    if (m_inotify_fd >= 0) {
+        close(m_inotify_fd);    //刷新线程的read随之出错返回
+    }
+}
+
+bool doc_index::init(const char* root) {
+    m_root = root;
+    while (m_root.size() > 1 && m_root[m_root.size() - 1] == '/') {
+        m_root.erase(m_root.size() - 1);
+    }
+    struct stat st;
+    if (stat(m_root.c_str(), &st) < 0 || !S_ISDIR(st.st_mode)) {
+        return false;
+    }
+
+    m_inotify_fd = inotify_init1(IN_CLOEXEC);
+    if (m_inotify_fd < 0) {
+        EMlog(LOGLEVEL_WARN, "inotify_init1 failed, errno is : %d, docroot index will not refresh\n", errno);
+    }
+
+    m_lock.wrlock();
+    scan_dir("");
+    m_lock.unlock();
+    EMlog(LOGLEVEL_INFO, "docroot %s indexed, %d files\n", m_root.c_str(), size());
+
+    if (m_inotify_fd >= 0) {
+        if (pthread_create(&m_thread, NULL, worker, this) != 0) {
+            return false;
+        }
+        if (pthread_detach(m_thread)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool doc_index::lookup(const char* key, doc_entry* out) {
+    unsigned int hash = hash_key(key);
+    m_lock.rdlock();
+    int i = find_slot(key, hash);
+    bool found = m_slots[i].used && !m_slots[i].deleted;
+    if (found) {
+        *out = m_slots[i].entry;
+    }
+    m_lock.unlock();
+    return found;
+}
+
+int doc_index::size() {
+    m_lock.rdlock();
+    int n = m_count;
+    m_lock.unlock();
+    return n;
+}
+
+static int hex_value(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+bool doc_index::normalize(const char* url, char* out, int out_len) {
+    if (url[0] != '/' || out_len < 2) {
+        return false;
+    }
+    int len = 0;
+    out[len++] = '/';
+    const char* p = url;
+    while (*p && *p != '?' && *p != '#') {
+        //取出下一个路径段并解码，段内解码出的 '/' 不作为分隔符
+        while (*p == '/') {
+            p++;
+        }
+        int seg = len;
+        while (*p && *p != '/' && *p != '?' && *p != '#') {
+            char c = *p++;
+            if (c == '%') {
+                int hi = hex_value(p[0]);
+                int lo = hi < 0 ? -1 : hex_value(p[1]);
+                if (lo < 0) {
+                    return false;
+                }
+                c = (char)(hi * 16 + lo);
+                p += 2;
+                if (c == '\0' || c == '/') {
+                    return false;
+                }
+            }
+            if (len >= out_len - 1) {
+                return false;
+            }
+            out[len++] = c;
+        }
+        int seg_len = len - seg;
+        if (seg_len == 1 && out[seg] == '.') {
+            len = seg;          //当前目录
+        }
+        else if (seg_len == 2 && out[seg] == '.' && out[seg + 1] == '.') {
+            if (seg == 1) {
+                return false;   //越过根目录
+            }
+            len = seg - 1;      //回到上一级：去掉前一个段
+            while (out[len - 1] != '/') {
+                len--;
+            }
+        }
+        else if (seg_len > 0 && *p == '/') {
+            if (len >= out_len - 1) {
+                return false;
+            }
+            out[len++] = '/';
+        }
+    }
+    //以 / 结尾表示目录，返回其中的 index.html
+    if (out[len - 1] == '/') {
+        const char* index = "index.html";
+        int n = strlen(index);
+        if (len + n >= out_len) {
+            return false;
+        }
+        memcpy(out + len, index, n);
+        len += n;
+    }
+    out[len] = '\0';
+    return true;
+}
+
+const char* doc_index::mime_type(const char* path) {
+    const char* slash = strrchr(path, '/');
+    const char* dot = strrchr(path, '.');
+    if (dot && (!slash || dot > slash)) {
+        for (size_t i = 0; i < sizeof(mime_table) / sizeof(mime_table[0]); i++) {
+            if (strcasecmp(dot + 1, mime_table[i][0]) == 0) {
+                return mime_table[i][1];
+            }
+        }
+    }
+    return "application/octet-stream";
+}
+
+//FNV-1a
+unsigned int doc_index::hash_key(const char* key) {
+    unsigned int h = 2166136261u;
+    while (*key) {
+        h ^= (unsigned char)*key++;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+//线性探测，返回key所在的槽；不存在时返回第一个可插入的槽(优先复用墓碑)
+int doc_index::find_slot(const char* key, unsigned int hash) {
+    int mask = m_slots.size() - 1;
+    int i = hash & mask;
+    int tomb = -1;
+    while (m_slots[i].used) {
+        if (m_slots[i].deleted) {
+            if (tomb < 0) {
+                tomb = i;
+            }
+        }
+        else if (m_slots[i].hash == hash && m_slots[i].key == key) {
+            return i;
+        }
+        i = (i + 1) & mask;
+    }
+    return tomb >= 0 ? tomb : i;
+}
+
+//装载率(含墓碑)超过一半时扩容，同时清除墓碑
+void doc_index::grow() {
+    std::vector<slot> old;
+    old.swap(m_slots);
+    size_t cap = old.size();
+    if ((size_t)m_count * 2 >= cap / 2) {
+        cap *= 2;
+    }
+    m_slots.resize(cap);
+    for (size_t i = 0; i < cap; i++) {
+        m_slots[i].used = false;
+        m_slots[i].deleted = false;
+    }
+    m_used = m_count;
+    for (size_t i = 0; i < old.size(); i++) {
+        if (old[i].used && !old[i].deleted) {
+            int j = find_slot(old[i].key.c_str(), old[i].hash);
+            m_slots[j] = old[i];
+        }
+    }
+}
+
+void doc_index::insert(const std::string& key, const doc_entry& entry) {
+    if ((size_t)(m_used + 1) * 2 > m_slots.size()) {
+        grow();
+    }
+    unsigned int hash = hash_key(key.c_str());
+    int i = find_slot(key.c_str(), hash);
+    slot& s = m_slots[i];
+    if (!s.used || s.deleted) {
+        if (!s.used) {
+            m_used++;
+        }
+        m_count++;
+        s.key = key;
+        s.hash = hash;
+        s.used = true;
+        s.deleted = false;
+    }
+    s.entry = entry;
+}
+
+void doc_index::erase(const std::string& key) {
+    int i = find_slot(key.c_str(), hash_key(key.c_str()));
+    if (m_slots[i].used && !m_slots[i].deleted) {
+        m_slots[i].deleted = true;
+        m_slots[i].key.clear();
+        m_count--;
+    }
+}
+
+//删除一个目录下的所有文件，并移除该目录及其子目录的监视
+void doc_index::erase_prefix(const std::string& prefix) {
+    for (size_t i = 0; i < m_slots.size(); i++) {
+        if (m_slots[i].used && !m_slots[i].deleted && m_slots[i].key.compare(0, prefix.size(), prefix) == 0) {
+            m_slots[i].deleted = true;
+            m_slots[i].key.clear();
+            m_count--;
+        }
+    }
+    std::string dir = prefix.substr(0, prefix.size() - 1);
+    std::map<int, std::string>::iterator it = m_watch_dirs.begin();
+    while (it != m_watch_dirs.end()) {
+        if (it->second == dir || it->second.compare(0, prefix.size(), prefix) == 0) {
+            inotify_rm_watch(m_inotify_fd, it->first);
+            m_watch_dirs.erase(it++);
+        }
+        else {
+            ++it;
+        }
+    }
+}
+
+//按key重新读取文件元数据：普通文件则收录，否则(已删除、变成符号链接等)移出索引
+void doc_index::update_file(const std::string& key) {
+    std::string path = m_root + key;
+    struct stat st;
+    if (path.size() >= (size_t)PATH_LEN || lstat(path.c_str(), &st) < 0 || !S_ISREG(st.st_mode)) {
+        erase(key);
+        return;
+    }
+    doc_entry entry;
+    memcpy(entry.path, path.c_str(), path.size() + 1);
+    entry.st = st;
+    entry.mime = mime_type(key.c_str());
+    insert(key, entry);
+}
+
+//rel 为相对根目录的路径，根目录为 ""，子目录如 "/images"
+void doc_index::scan_dir(const std::string& rel) {
+    std::string dir = m_root + rel;
+    if (m_inotify_fd >= 0) {
+        int wd = inotify_add_watch(m_inotify_fd, dir.c_str(), INOTIFY_MASK);
+        if (wd >= 0) {
+            m_watch_dirs[wd] = rel;
+        }
+    }
+    DIR* dp = opendir(dir.c_str());
+    if (!dp) {
+        return;
+    }
+    struct dirent* de;
+    while ((de = readdir(dp)) != NULL) {
+        if (de->d_name[0] == '.') {
+            continue;       //., .. 和隐藏文件都不收录
+        }
+        std::string key = rel + "/" + de->d_name;
+        struct stat st;
+        if (lstat((m_root + key).c_str(), &st) < 0) {
+            continue;
+        }
+        if (S_ISDIR(st.st_mode)) {
+            scan_dir(key);
+        }
+        else if (S_ISREG(st.st_mode)) {
+            update_file(key);
+        }
+    }
+    closedir(dp);
+}
+
+void doc_index::rebuild() {
+    std::map<int, std::string>::iterator it;
+    for (it = m_watch_dirs.begin(); it != m_watch_dirs.end(); ++it) {
+        inotify_rm_watch(m_inotify_fd, it->first);
+    }
+    m_watch_dirs.clear();
+    for (size_t i = 0; i < m_slots.size(); i++) {
+        m_slots[i].used = false;
+        m_slots[i].deleted = false;
+        m_slots[i].key.clear();
+    }
+    m_count = 0;
+    m_used = 0;
+    scan_dir("");
+}
+
+void* doc_index::worker(void* arg) {
+    doc_index* index = (doc_index*)arg;
+    index->run();
+    return index;
+}
+
+void doc_index::run() {
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    while (true) {
+        int len = read(m_inotify_fd, buf, sizeof(buf));
+        if (len < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        if (len == 0) {
+            break;
+        }
+        m_lock.wrlock();
+        handle_events(buf, len);
+        m_lock.unlock();
+    }
+}
+
+void doc_index::handle_events(const char* buf, int len) {
+    for (const char* p = buf; p < buf + len; ) {
+        const struct inotify_event* ev = (const struct inotify_event*)p;
+        p += sizeof(struct inotify_event) + ev->len;
+
+        if (ev->mask & IN_Q_OVERFLOW) {
+            EMlog(LOGLEVEL_WARN, "inotify queue overflow, rebuilding docroot index\n");
+            rebuild();
+            return;
+        }
+        if (ev->mask & IN_IGNORED) {
+            m_watch_dirs.erase(ev->wd);     //目录已删除或监视已移除
+            continue;
+        }
+        std::map<int, std::string>::iterator it = m_watch_dirs.find(ev->wd);
+        if (it == m_watch_dirs.end() || ev->len == 0 || ev->name[0] == '.') {
+            continue;
+        }
+        std::string key = it->second + "/" + ev->name;
+        if (ev->mask & IN_ISDIR) {
+            if (ev->mask & (IN_CREATE | IN_MOVED_TO)) {
+                scan_dir(key);
+            }
+            else if (ev->mask & (IN_DELETE | IN_MOVED_FROM)) {
+                erase_prefix(key + "/");
+            }
+        }
+        else if (ev->mask & (IN_DELETE | IN_MOVED_FROM)) {
+            erase(key);
+        }
+        else {
+            update_file(key);
+        }
+    }
+}
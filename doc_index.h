@@ -0,0 +1,77 @@
+#ifndef DOC_INDEX_H
+#define DOC_INDEX_H
+
+#include <sys/stat.h>
+#include <pthread.h>
+#include <string>
+#include <vector>
+#include <map>
+#include "locker.h"
+
+/*
+    网站根目录索引：启动时遍历根目录，建立 规范化URL路径 -> 文件元数据 的哈希表，
+    之后由后台线程通过 inotify 增量刷新。
+    do_request 只在索引中查找：命中时直接得到真实路径、stat 和 MIME 类型，无需任何系统调用；
+    未命中直接 404，不访问文件系统。只有根目录下真实存在的普通文件才会进入索引，
+    符号链接和以 '.' 开头的文件不收录，所以 .. 之类的路径穿越在结构上不可能发生。
+*/
+class doc_index {
+public:
+    static const int PATH_LEN = 200;    //真实路径最大长度，与 http_conn::FILENAME_LEN 一致
+
+    struct doc_entry {
+        char path[PATH_LEN];    //真实路径
+        struct stat st;         //文件元数据
+        const char* mime;       //MIME类型，指向静态表
+    };
+
+    doc_index();
+    ~doc_index();
+
+    bool init(const char* root);    //建立索引并启动 inotify 刷新线程
+    bool lookup(const char* key, doc_entry* out);   //key 为规范化后的路径，如 /images/Minion.jpg
+    int size();
+
+    //把请求的URL规范化为索引的key：去掉查询串、百分号解码、合并多余的/、处理.和..，目录补 index.html
+    //解码出 \0、.. 越过根目录或结果过长时返回false
+    static bool normalize(const char* url, char* out, int out_len);
+    static const char* mime_type(const char* path);
+
+private:
+    struct slot {
+        std::string key;
+        unsigned int hash;
+        bool used;          //占用(含墓碑)
+        bool deleted;       //墓碑
+        doc_entry entry;
+    };
+
+    static void* worker(void* arg);     //inotify 线程
+    void run();
+    void handle_events(const char* buf, int len);
+    void rebuild();                     //全部重建(inotify 队列溢出时)
+
+    //以下函数调用方需持有写锁
+    void scan_dir(const std::string& rel);  //遍历目录，收录文件并添加监视
+    void update_file(const std::string& key);
+    void erase(const std::string& key);
+    void erase_prefix(const std::string& prefix);
+    void insert(const std::string& key, const doc_entry& entry);
+    int find_slot(const char* key, unsigned int hash);
+    void grow();
+
+    static unsigned int hash_key(const char* key);
+
+private:
+    std::string m_root;
+    std::vector<slot> m_slots;      //开放寻址哈希表，容量为2的幂
+    int m_count;                    //有效元素个数
+    int m_used;                     //有效元素 + 墓碑
+    rwlocker m_lock;
+
+    int m_inotify_fd;
+    std::map<int, std::string> m_watch_dirs;    //监视描述符 -> 相对目录("" 为根目录)
+    pthread_t m_thread;
+};
+
+#endif
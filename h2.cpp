@@ -0,0 +1,1148 @@
+#include "h2.h"
+#include "http_conn.h"
+#include "log.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+std::atomic<unsigned long> h2_session::s_connections(0);
+std::atomic<unsigned long> h2_session::s_streams(0);
+
+static const char client_preface[] = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+static const char switching_101[] = "HTTP/1.1 101 Switching Protocols\r\nConnection: Upgrade\r\nUpgrade: h2c\r\n\r\n";
+
+//帧类型
+enum { FRAME_DATA = 0, FRAME_HEADERS, FRAME_PRIORITY, FRAME_RST_STREAM, FRAME_SETTINGS, FRAME_PUSH_PROMISE,
+       FRAME_PING, FRAME_GOAWAY, FRAME_WINDOW_UPDATE, FRAME_CONTINUATION };
+
+//帧标志
+static const uint8_t FLAG_END_STREAM = 0x1;
+static const uint8_t FLAG_ACK = 0x1;
+static const uint8_t FLAG_END_HEADERS = 0x4;
+static const uint8_t FLAG_PADDED = 0x8;
+static const uint8_t FLAG_PRIORITY = 0x20;
+
+//SETTINGS 参数
+enum { SETTINGS_HEADER_TABLE_SIZE = 1, SETTINGS_ENABLE_PUSH, SETTINGS_MAX_CONCURRENT_STREAMS, SETTINGS_INITIAL_WINDOW_SIZE,
+       SETTINGS_MAX_FRAME_SIZE, SETTINGS_MAX_HEADER_LIST_SIZE };
+
+//错误码
+enum { H2_NO_ERROR = 0, H2_PROTOCOL_ERROR = 1, H2_INTERNAL_ERROR = 2, H2_FLOW_CONTROL_ERROR = 3, H2_FRAME_SIZE_ERROR = 6,
+       H2_REFUSED_STREAM = 7, H2_COMPRESSION_ERROR = 9, H2_ENHANCE_YOUR_CALM = 11, H2_HTTP_1_1_REQUIRED = 13 };
+
+static const uint32_t HEADER_TABLE_SIZE = 4096;     //动态表的上限，使用协议的默认值
+static const size_t MAX_HEADER_BLOCK = 65536;       //头部块(含 CONTINUATION)和解码结果的上限
+static const int64_t MAX_WINDOW = 0x7fffffff;
+
+//-------------------- HPACK --------------------
+
+struct static_entry {
+    const char* name;
+    const char* value;
+};
+
+//RFC 7541 附录 A，下标加 1 为索引
+static const static_entry static_table[] = {
+    { ":authority", "" }, { ":method", "GET" }, { ":method", "POST" }, { ":path", "/" }, { ":path", "/index.html" },
+    { ":scheme", "http" }, { ":scheme", "https" }, { ":status", "200" }, { ":status", "204" }, { ":status", "206" },
+    { ":status", "304" }, { ":status", "400" }, { ":status", "404" }, { ":status", "500" }, { "accept-charset", "" },
+    { "accept-encoding", "gzip, deflate" }, { "accept-language", "" }, { "accept-ranges", "" }, { "accept", "" },
+    { "access-control-allow-origin", "" }, { "age", "" }, { "allow", "" }, { "authorization", "" },
+    { "cache-control", "" }, { "content-disposition", "" }, { "content-encoding", "" }, { "content-language", "" },
+    { "content-length", "" }, { "content-location", "" }, { "content-range", "" }, { "content-type", "" },
+    { "cookie", "" }, { "date", "" }, { "etag", "" }, { "expect", "" }, { "expires", "" }, { "from", "" },
+    { "host", "" }, { "if-match", "" }, { "if-modified-since", "" }, { "if-none-match", "" }, { "if-range", "" },
+    { "if-unmodified-since", "" }, { "last-modified", "" }, { "link", "" }, { "location", "" }, { "max-forwards", "" },
+    { "proxy-authenticate", "" }, { "proxy-authorization", "" }, { "range", "" }, { "referer", "" }, { "refresh", "" },
+    { "retry-after", "" }, { "server", "" }, { "set-cookie", "" }, { "strict-transport-security", "" },
+    { "transfer-encoding", "" }, { "user-agent", "" }, { "vary", "" }, { "via", "" }, { "www-authenticate", "" },
+};
+static const uint32_t STATIC_COUNT = sizeof(static_table) / sizeof(static_table[0]);
+
+struct huffman_code {
+    uint32_t code;
+    uint8_t len;
+};
+
+//RFC 7541 附录 B，最后一项为 EOS
+static const huffman_code huffman_codes[257] = {
+    { 0x00001ff8, 13 }, { 0x007fffd8, 23 }, { 0x0fffffe2, 28 }, { 0x0fffffe3, 28 },
+    { 0x0fffffe4, 28 }, { 0x0fffffe5, 28 }, { 0x0fffffe6, 28 }, { 0x0fffffe7, 28 },
+    { 0x0fffffe8, 28 }, { 0x00ffffea, 24 }, { 0x3ffffffc, 30 }, { 0x0fffffe9, 28 },
+    { 0x0fffffea, 28 }, { 0x3ffffffd, 30 }, { 0x0fffffeb, 28 }, { 0x0fffffec, 28 },
+    { 0x0fffffed, 28 }, { 0x0fffffee, 28 }, { 0x0fffffef, 28 }, { 0x0ffffff0, 28 },
+    { 0x0ffffff1, 28 }, { 0x0ffffff2, 28 }, { 0x3ffffffe, 30 }, { 0x0ffffff3, 28 },
+    { 0x0ffffff4, 28 }, { 0x0ffffff5, 28 }, { 0x0ffffff6, 28 }, { 0x0ffffff7, 28 },
+    { 0x0ffffff8, 28 }, { 0x0ffffff9, 28 }, { 0x0ffffffa, 28 }, { 0x0ffffffb, 28 },
+    { 0x00000014,  6 }, { 0x000003f8, 10 }, { 0x000003f9, 10 }, { 0x00000ffa, 12 },
+    { 0x00001ff9, 13 }, { 0x00000015,  6 }, { 0x000000f8,  8 }, { 0x000007fa, 11 },
+    { 0x000003fa, 10 }, { 0x000003fb, 10 }, { 0x000000f9,  8 }, { 0x000007fb, 11 },
+    { 0x000000fa,  8 }, { 0x00000016,  6 }, { 0x00000017,  6 }, { 0x00000018,  6 },
+    { 0x00000000,  5 }, { 0x00000001,  5 }, { 0x00000002,  5 }, { 0x00000019,  6 },
+    { 0x0000001a,  6 }, { 0x0000001b,  6 }, { 0x0000001c,  6 }, { 0x0000001d,  6 },
+    { 0x0000001e,  6 }, { 0x0000001f,  6 }, { 0x0000005c,  7 }, { 0x000000fb,  8 },
+    { 0x00007ffc, 15 }, { 0x00000020,  6 }, { 0x00000ffb, 12 }, { 0x000003fc, 10 },
+    { 0x00001ffa, 13 }, { 0x00000021,  6 }, { 0x0000005d,  7 }, { 0x0000005e,  7 },
+    { 0x0000005f,  7 }, { 0x00000060,  7 }, { 0x00000061,  7 }, { 0x00000062,  7 },
+    { 0x00000063,  7 }, { 0x00000064,  7 }, { 0x00000065,  7 }, { 0x00000066,  7 },
+    { 0x00000067,  7 }, { 0x00000068,  7 }, { 0x00000069,  7 }, { 0x0000006a,  7 },
+    { 0x0000006b,  7 }, { 0x0000006c,  7 }, { 0x0000006d,  7 }, { 0x0000006e,  7 },
+    { 0x0000006f,  7 }, { 0x00000070,  7 }, { 0x00000071,  7 }, { 0x00000072,  7 },
+    { 0x000000fc,  8 }, { 0x00000073,  7 }, { 0x000000fd,  8 }, { 0x00001ffb, 13 },
+    { 0x0007fff0, 19 }, { 0x00001ffc, 13 }, { 0x00003ffc, 14 }, { 0x00000022,  6 },
+    { 0x00007ffd, 15 }, { 0x00000003,  5 }, { 0x00000023,  6 }, { 0x00000004,  5 },
+    { 0x00000024,  6 }, { 0x00000005,  5 }, { 0x00000025,  6 }, { 0x00000026,  6 },
+    { 0x00000027,  6 }, { 0x00000006,  5 }, { 0x00000074,  7 }, { 0x00000075,  7 },
+    { 0x00000028,  6 }, { 0x00000029,  6 }, { 0x0000002a,  6 }, { 0x00000007,  5 },
+    { 0x0000002b,  6 }, { 0x00000076,  7 }, { 0x0000002c,  6 }, { 0x00000008,  5 },
+    { 0x00000009,  5 }, { 0x0000002d,  6 }, { 0x00000077,  7 }, { 0x00000078,  7 },
+    { 0x00000079,  7 }, { 0x0000007a,  7 }, { 0x0000007b,  7 }, { 0x00007ffe, 15 },
+    { 0x000007fc, 11 }, { 0x00003ffd, 14 }, { 0x00001ffd, 13 }, { 0x0ffffffc, 28 },
+    { 0x000fffe6, 20 }, { 0x003fffd2, 22 }, { 0x000fffe7, 20 }, { 0x000fffe8, 20 },
+    { 0x003fffd3, 22 }, { 0x003fffd4, 22 }, { 0x003fffd5, 22 }, { 0x007fffd9, 23 },
+    { 0x003fffd6, 22 }, { 0x007fffda, 23 }, { 0x007fffdb, 23 }, { 0x007fffdc, 23 },
+    { 0x007fffdd, 23 }, { 0x007fffde, 23 }, { 0x00ffffeb, 24 }, { 0x007fffdf, 23 },
+    { 0x00ffffec, 24 }, { 0x00ffffed, 24 }, { 0x003fffd7, 22 }, { 0x007fffe0, 23 },
+    { 0x00ffffee, 24 }, { 0x007fffe1, 23 }, { 0x007fffe2, 23 }, { 0x007fffe3, 23 },
+    { 0x007fffe4, 23 }, { 0x001fffdc, 21 }, { 0x003fffd8, 22 }, { 0x007fffe5, 23 },
+    { 0x003fffd9, 22 }, { 0x007fffe6, 23 }, { 0x007fffe7, 23 }, { 0x00ffffef, 24 },
+    { 0x003fffda, 22 }, { 0x001fffdd, 21 }, { 0x000fffe9, 20 }, { 0x003fffdb, 22 },
+    { 0x003fffdc, 22 }, { 0x007fffe8, 23 }, { 0x007fffe9, 23 }, { 0x001fffde, 21 },
+    { 0x007fffea, 23 }, { 0x003fffdd, 22 }, { 0x003fffde, 22 }, { 0x00fffff0, 24 },
+    { 0x001fffdf, 21 }, { 0x003fffdf, 22 }, { 0x007fffeb, 23 }, { 0x007fffec, 23 },
+    { 0x001fffe0, 21 }, { 0x001fffe1, 21 }, { 0x003fffe0, 22 }, { 0x001fffe2, 21 },
+    { 0x007fffed, 23 }, { 0x003fffe1, 22 }, { 0x007fffee, 23 }, { 0x007fffef, 23 },
+    { 0x000fffea, 20 }, { 0x003fffe2, 22 }, { 0x003fffe3, 22 }, { 0x003fffe4, 22 },
+    { 0x007ffff0, 23 }, { 0x003fffe5, 22 }, { 0x003fffe6, 22 }, { 0x007ffff1, 23 },
+    { 0x03ffffe0, 26 }, { 0x03ffffe1, 26 }, { 0x000fffeb, 20 }, { 0x0007fff1, 19 },
+    { 0x003fffe7, 22 }, { 0x007ffff2, 23 }, { 0x003fffe8, 22 }, { 0x01ffffec, 25 },
+    { 0x03ffffe2, 26 }, { 0x03ffffe3, 26 }, { 0x03ffffe4, 26 }, { 0x07ffffde, 27 },
+    { 0x07ffffdf, 27 }, { 0x03ffffe5, 26 }, { 0x00fffff1, 24 }, { 0x01ffffed, 25 },
+    { 0x0007fff2, 19 }, { 0x001fffe3, 21 }, { 0x03ffffe6, 26 }, { 0x07ffffe0, 27 },
+    { 0x07ffffe1, 27 }, { 0x03ffffe7, 26 }, { 0x07ffffe2, 27 }, { 0x00fffff2, 24 },
+    { 0x001fffe4, 21 }, { 0x001fffe5, 21 }, { 0x03ffffe8, 26 }, { 0x03ffffe9, 26 },
+    { 0x0ffffffd, 28 }, { 0x07ffffe3, 27 }, { 0x07ffffe4, 27 }, { 0x07ffffe5, 27 },
+    { 0x000fffec, 20 }, { 0x00fffff3, 24 }, { 0x000fffed, 20 }, { 0x001fffe6, 21 },
+    { 0x003fffe9, 22 }, { 0x001fffe7, 21 }, { 0x001fffe8, 21 }, { 0x007ffff3, 23 },
+    { 0x003fffea, 22 }, { 0x003fffeb, 22 }, { 0x01ffffee, 25 }, { 0x01ffffef, 25 },
+    { 0x00fffff4, 24 }, { 0x00fffff5, 24 }, { 0x03ffffea, 26 }, { 0x007ffff4, 23 },
+    { 0x03ffffeb, 26 }, { 0x07ffffe6, 27 }, { 0x03ffffec, 26 }, { 0x03ffffed, 26 },
+    { 0x07ffffe7, 27 }, { 0x07ffffe8, 27 }, { 0x07ffffe9, 27 }, { 0x07ffffea, 27 },
+    { 0x07ffffeb, 27 }, { 0x0ffffffe, 28 }, { 0x07ffffec, 27 }, { 0x07ffffed, 27 },
+    { 0x07ffffee, 27 }, { 0x07ffffef, 27 }, { 0x07fffff0, 27 }, { 0x03ffffee, 26 },
+    { 0x3fffffff, 30 },
+};
+
+//Huffman 解码树：child 大于0为内部节点，小于0为叶子 -(符号 + 1)，0 表示没有(根节点不会是子节点)
+struct huffman_tree {
+    short child[512][2];
+    huffman_tree() {
+        memset(child, 0, sizeof(child));
+        int count = 0;
+        for (int sym = 0; sym < 257; sym++) {
+            uint32_t code = huffman_codes[sym].code;
+            int node = 0;
+            for (int bit = huffman_codes[sym].len - 1; bit > 0; bit--) {
+                int b = (code >> bit) & 1;
+                if (!child[node][b]) {
+                    child[node][b] = ++count;
+                }
+                node = child[node][b];
+            }
+            child[node][code & 1] = -(sym + 1);
+        }
+    }
+};
+
+//逐位走解码树。结尾的填充必须是不足8位的全1(EOS 的前缀)，解出 EOS 是错误
+static bool huffman_decode(const uint8_t* p, size_t len, std::string* out) {
+    static const huffman_tree tree;
+    int node = 0;
+    int depth = 0;
+    bool ones = true;
+    for (size_t i = 0; i < len; i++) {
+        for (int bit = 7; bit >= 0; bit--) {
+            int b = (p[i] >> bit) & 1;
+            int next = tree.child[node][b];
+            if (next < 0) {
+                if (next == -257) {
+                    return false;
+                }
+                out->push_back((char)(-next - 1));
+                node = 0;
+                depth = 0;
+                ones = true;
+            }
+            else {
+                node = next;
+                depth++;
+                ones = ones && b;
+            }
+        }
+    }
+    return depth < 8 && ones;
+}
+
+hpack_decoder::hpack_decoder() : m_size(0), m_max_size(HEADER_TABLE_SIZE) {
+}
+
+void hpack_decoder::reset() {
+    m_table.clear();
+    m_size = 0;
+    m_max_size = HEADER_TABLE_SIZE;
+}
+
+//带 prefix 位前缀的整数(RFC 7541 5.1)
+bool hpack_decoder::read_int(const uint8_t*& p, const uint8_t* end, int prefix, uint32_t* value) {
+    uint32_t mask = (1u << prefix) - 1;
+    uint32_t v = *p++ & mask;
+    if (v < mask) {
+        *value = v;
+        return true;
+    }
+    for (int shift = 0; p < end && shift <= 21; shift += 7) {
+        uint8_t b = *p++;
+        v += (uint32_t)(b & 0x7f) << shift;
+        if (!(b & 0x80)) {
+            *value = v;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool hpack_decoder::read_string(const uint8_t*& p, const uint8_t* end, std::string* out) {
+    if (p >= end) {
+        return false;
+    }
+    bool huffman = *p & 0x80;
+    uint32_t len;
+    if (!read_int(p, end, 7, &len) || len > (uint32_t)(end - p)) {
+        return false;
+    }
+    out->clear();
+    if (huffman) {
+        if (!huffman_decode(p, len, out)) {
+            return false;
+        }
+    }
+    else {
+        out->assign((const char*)p, len);
+    }
+    p += len;
+    return true;
+}
+
+bool hpack_decoder::lookup(uint32_t index, std::string* name, std::string* value) const {
+    if (index == 0) {
+        return false;
+    }
+    if (index <= STATIC_COUNT) {
+        name->assign(static_table[index - 1].name);
+        if (value) {
+            value->assign(static_table[index - 1].value);
+        }
+        return true;
+    }
+    index -= STATIC_COUNT + 1;
+    if (index >= m_table.size()) {
+        return false;
+    }
+    name->assign(m_table[index].first);
+    if (value) {
+        value->assign(m_table[index].second);
+    }
+    return true;
+}
+
+void hpack_decoder::evict(uint32_t limit) {
+    while (m_size > limit && !m_table.empty()) {
+        m_size -= m_table.back().first.size() + m_table.back().second.size() + 32;
+        m_table.pop_back();
+    }
+}
+
+//比上限还大的条目清空整个表，本身也不加入(RFC 7541 4.4)
+void hpack_decoder::insert(const std::string& name, const std::string& value) {
+    uint32_t size = name.size() + value.size() + 32;
+    if (size > m_max_size) {
+        evict(0);
+        return;
+    }
+    evict(m_max_size - size);
+    m_table.push_front(std::make_pair(name, value));
+    m_size += size;
+}
+
+bool hpack_decoder::decode(const uint8_t* p, int len, fields* out) {
+    const uint8_t* end = p + len;
+    size_t total = 0;
+    std::string name, value;
+    while (p < end) {
+        uint8_t b = *p;
+        uint32_t index;
+        if (b & 0x80) {
+            //索引
+            if (!read_int(p, end, 7, &index) || !lookup(index, &name, &value)) {
+                return false;
+            }
+        }
+        else if ((b & 0xe0) == 0x20) {
+            //动态表大小更新
+            if (!read_int(p, end, 5, &index) || index > HEADER_TABLE_SIZE) {
+                return false;
+            }
+            m_max_size = index;
+            evict(m_max_size);
+            continue;
+        }
+        else {
+            //字面量：01 加入动态表，0000 不加入，0001 永不索引
+            bool indexing = b & 0x40;
+            if (!read_int(p, end, indexing ? 6 : 4, &index)) {
+                return false;
+            }
+            if (index ? !lookup(index, &name, NULL) : !read_string(p, end, &name)) {
+                return false;
+            }
+            if (!read_string(p, end, &value)) {
+                return false;
+            }
+            if (indexing) {
+                insert(name, value);
+            }
+        }
+        total += name.size() + value.size() + 32;
+        if (total > MAX_HEADER_BLOCK) {
+            return false;       //少量字节引用大条目，解码结果可能远大于头部块
+        }
+        out->push_back(std::make_pair(name, value));
+    }
+    return true;
+}
+
+static void hpack_int(std::string& out, uint8_t first, int prefix, uint32_t value) {
+    uint32_t max = (1u << prefix) - 1;
+    if (value < max) {
+        out.push_back((char)(first | value));
+        return;
+    }
+    out.push_back((char)(first | max));
+    value -= max;
+    while (value >= 128) {
+        out.push_back((char)((value & 0x7f) | 0x80));
+        value >>= 7;
+    }
+    out.push_back((char)value);
+}
+
+static void hpack_string(std::string& out, const char* s, size_t len) {
+    hpack_int(out, 0, 7, len);
+    out.append(s, len);
+}
+
+//响应头的编码只用静态表：:status 常见的值整项索引，其余字段按"不加入动态表的字面量"，
+//名字在静态表中时用它的索引，值不做 Huffman 编码。不维护编码端的动态表，也就不需要跟踪客户端的表大小
+static void hpack_status(std::string& out, int status) {
+    char value[8];
+    snprintf(value, sizeof(value), "%03d", status);
+    for (uint32_t i = 7; i < 14; i++) {
+        if (strcmp(static_table[i].value, value) == 0) {
+            hpack_int(out, 0x80, 7, i + 1);
+            return;
+        }
+    }
+    hpack_int(out, 0x00, 4, 8);
+    hpack_string(out, value, 3);
+}
+
+static void hpack_field(std::string& out, const std::string& name, const char* value, size_t value_len) {
+    for (uint32_t i = 14; i < STATIC_COUNT; i++) {
+        if (name == static_table[i].name) {
+            hpack_int(out, 0x00, 4, i + 1);
+            hpack_string(out, value, value_len);
+            return;
+        }
+    }
+    out.push_back(0);
+    hpack_string(out, name.data(), name.size());
+    hpack_string(out, value, value_len);
+}
+
+//HTTP/2 中不允许的逐跳头部(RFC 7540 8.1.2.2)，请求中出现时忽略，响应中去掉
+static bool connection_specific(const std::string& name) {
+    static const char* names[] = { "connection", "keep-alive", "proxy-connection", "transfer-encoding", "upgrade",
+                                   "http2-settings" };
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+        if (name == names[i]) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static uint32_t read32(const uint8_t* p) {
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+static void append32(std::string& out, uint32_t v) {
+    out.push_back((char)(v >> 24));
+    out.push_back((char)(v >> 16));
+    out.push_back((char)(v >> 8));
+    out.push_back((char)v);
+}
+
+//HTTP2-Settings 的值是 base64url 编码的 SETTINGS 负载，也容忍标准 base64 的字符和填充
+static bool base64url_decode(const char* in, std::string* out) {
+    uint32_t acc = 0;
+    int bits = 0;
+    for (; *in && *in != '='; in++) {
+        char c = *in;
+        int v;
+        if (c >= 'A' && c <= 'Z') {
+            v = c - 'A';
+        }
+        else if (c >= 'a' && c <= 'z') {
+            v = c - 'a' + 26;
+        }
+        else if (c >= '0' && c <= '9') {
+            v = c - '0' + 52;
+        }
+        else if (c == '-' || c == '+') {
+            v = 62;
+        }
+        else if (c == '_' || c == '/') {
+            v = 63;
+        }
+        else {
+            return false;
+        }
+        acc = (acc << 6) | v;
+        bits += 6;
+        if (bits >= 8) {
+            bits -= 8;
+            out->push_back((char)(acc >> bits));
+            acc &= (1u << bits) - 1;
+        }
+    }
+    return true;
+}
+
+//-------------------- h2_session --------------------
+
+h2_session::h2_session() : m_started(false), m_next(0) {
+}
+
+h2_session::~h2_session() {
+    reset();
+    for (size_t i = 0; i < m_free.size(); i++) {
+        delete m_free[i]->conn;
+        delete m_free[i];
+    }
+}
+
+int h2_session::preface(const char* data, int len) {
+    int n = len < PREFACE_LEN ? len : PREFACE_LEN;
+    if (memcmp(data, client_preface, n) != 0) {
+        return -1;
+    }
+    return n == PREFACE_LEN ? 1 : 0;
+}
+
+void h2_session::start(const sockaddr_in& peer) {
+    reset();
+    m_peer = peer;
+    m_started = true;
+    m_preface_left = PREFACE_LEN;
+    m_head_len = 0;
+    m_got = 0;
+    m_block.clear();
+    m_block_sid = 0;
+    m_block_end_stream = false;
+    m_decoder.reset();
+    m_last_sid = 0;
+    m_peer_max_frame = 16384;
+    m_peer_initial_window = 65535;
+    m_send_window = 65535;
+    m_recv_consumed = 0;
+    m_shutdown = false;
+    m_goaway_sent = false;
+    m_goaway_received = false;
+    m_fatal = false;
+    m_next = 0;
+    send_settings();
+    s_connections.fetch_add(1, std::memory_order_relaxed);
+}
+
+bool h2_session::upgrade(const sockaddr_in& peer, const char* settings, const std::string& request) {
+    start(peer);
+    m_ctrl.insert(0, switching_101);    //101 在服务端的 SETTINGS 之前
+    std::string payload;
+    if (!base64url_decode(settings, &payload) ||
+        apply_settings((const uint8_t*)payload.data(), payload.size()) != H2_NO_ERROR) {
+        reset();
+        return false;
+    }
+    //升级请求是流1，已经半关闭(不能带请求体)，101 就是对 HTTP2-Settings 的确认
+    m_last_sid = 1;
+    open_stream(1, request);
+    return true;
+}
+
+//GOAWAY 不在流还没发完时发送：有的客户端收到 GOAWAY 后就不再接收任何流的响应
+void h2_session::shutdown() {
+    if (m_started) {
+        m_shutdown = true;
+    }
+}
+
+void h2_session::reset() {
+    release_done();
+    for (size_t i = 0; i < m_streams.size(); i++) {
+        release(m_streams[i]);
+    }
+    m_streams.clear();
+    m_ctrl.clear();
+    m_out.clear();
+    m_pieces.clear();
+    m_iov.clear();
+    m_payload.clear();
+    m_block.clear();
+    m_started = false;
+}
+
+bool h2_session::closing() const {
+    return m_fatal || ((m_goaway_sent || m_goaway_received) && m_streams.empty());
+}
+
+void h2_session::frame(std::string& out, uint32_t len, uint8_t type, uint8_t flags, uint32_t sid) {
+    out.push_back((char)(len >> 16));
+    out.push_back((char)(len >> 8));
+    out.push_back((char)len);
+    out.push_back((char)type);
+    out.push_back((char)flags);
+    append32(out, sid);
+}
+
+//服务端的连接序言：并发流数和请求头的上限(还原后要放进流的读缓冲区)
+void h2_session::send_settings() {
+    frame(m_ctrl, 12, FRAME_SETTINGS, 0, 0);
+    m_ctrl.push_back(0);
+    m_ctrl.push_back(SETTINGS_MAX_CONCURRENT_STREAMS);
+    append32(m_ctrl, MAX_STREAMS);
+    m_ctrl.push_back(0);
+    m_ctrl.push_back(SETTINGS_MAX_HEADER_LIST_SIZE);
+    append32(m_ctrl, http_conn::m_read_buffer_size);
+}
+
+void h2_session::rst_stream(uint32_t sid, uint32_t error) {
+    frame(m_ctrl, 4, FRAME_RST_STREAM, 0, sid);
+    append32(m_ctrl, error);
+}
+
+void h2_session::goaway(uint32_t error) {
+    if (!m_goaway_sent) {
+        frame(m_ctrl, 8, FRAME_GOAWAY, 0, 0);
+        append32(m_ctrl, m_last_sid);
+        append32(m_ctrl, error);
+        m_goaway_sent = true;
+    }
+    if (error != H2_NO_ERROR) {
+        EMlog(LOGLEVEL_INFO, "http2 connection error %u, frame type %d stream %u\n", error, m_type, m_sid);
+        m_fatal = true;
+    }
+}
+
+uint32_t h2_session::apply_settings(const uint8_t* p, int len) {
+    if (len % 6 != 0) {
+        return H2_FRAME_SIZE_ERROR;
+    }
+    for (; len > 0; p += 6, len -= 6) {
+        int id = p[0] << 8 | p[1];
+        uint32_t value = read32(p + 2);
+        switch (id) {
+            case SETTINGS_ENABLE_PUSH:
+                if (value > 1) {
+                    return H2_PROTOCOL_ERROR;
+                }
+                break;
+            case SETTINGS_INITIAL_WINDOW_SIZE: {
+                if (value > MAX_WINDOW) {
+                    return H2_FLOW_CONTROL_ERROR;
+                }
+                //已有的流按差值调整，窗口可以变成负数
+                int64_t delta = (int64_t)value - m_peer_initial_window;
+                for (size_t i = 0; i < m_streams.size(); i++) {
+                    m_streams[i]->window += delta;
+                }
+                m_peer_initial_window = value;
+                break;
+            }
+            case SETTINGS_MAX_FRAME_SIZE:
+                if (value < 16384 || value > 16777215) {
+                    return H2_PROTOCOL_ERROR;
+                }
+                m_peer_max_frame = value;
+                break;
+            default:
+                break;      //编码端不用动态表，HEADER_TABLE_SIZE 不影响；其余参数和未知参数忽略
+        }
+    }
+    return H2_NO_ERROR;
+}
+
+//按帧头、负载的顺序增量接收，帧可以跨越多次读取；DATA 的负载不保存
+void h2_session::on_input(const char* data, int len) {
+    if (!m_started) {
+        return;
+    }
+    const uint8_t* p = (const uint8_t*)data;
+    const uint8_t* end = p + len;
+    while (p < end && !m_fatal) {
+        if (m_preface_left > 0) {
+            int n = end - p < m_preface_left ? end - p : m_preface_left;
+            if (memcmp(p, client_preface + PREFACE_LEN - m_preface_left, n) != 0) {
+                goaway(H2_PROTOCOL_ERROR);
+                break;
+            }
+            p += n;
+            m_preface_left -= n;
+            continue;
+        }
+        if (m_head_len < 9) {
+            int n = end - p < 9 - m_head_len ? end - p : 9 - m_head_len;
+            memcpy(m_head + m_head_len, p, n);
+            m_head_len += n;
+            p += n;
+            if (m_head_len < 9) {
+                break;
+            }
+            m_len = m_head[0] << 16 | m_head[1] << 8 | m_head[2];
+            m_type = m_head[3];
+            m_flags = m_head[4];
+            m_sid = read32(m_head + 5) & 0x7fffffff;
+            m_got = 0;
+            m_payload.clear();
+            if (m_len > MAX_FRAME_SIZE) {
+                goaway(H2_FRAME_SIZE_ERROR);
+                break;
+            }
+        }
+        uint32_t n = (uint32_t)(end - p) < m_len - m_got ? (uint32_t)(end - p) : m_len - m_got;
+        if (m_type != FRAME_DATA) {
+            m_payload.append((const char*)p, n);
+        }
+        p += n;
+        m_got += n;
+        if (m_got == m_len) {
+            m_head_len = 0;
+            on_frame();
+        }
+    }
+    //请求体不接收，丢弃的 DATA 仍然占用连接级的接收窗口，要还给客户端
+    if (m_recv_consumed > 0 && !m_fatal) {
+        frame(m_ctrl, 4, FRAME_WINDOW_UPDATE, 0, 0);
+        append32(m_ctrl, m_recv_consumed);
+        m_recv_consumed = 0;
+    }
+}
+
+void h2_session::on_frame() {
+    if (m_block_sid && (m_type != FRAME_CONTINUATION || m_sid != m_block_sid)) {
+        goaway(H2_PROTOCOL_ERROR);      //头部块必须连续
+        return;
+    }
+    const uint8_t* p = (const uint8_t*)m_payload.data();
+    uint32_t len = m_payload.size();
+    switch (m_type) {
+        case FRAME_DATA:
+            if (m_sid == 0) {
+                goaway(H2_PROTOCOL_ERROR);
+                return;
+            }
+            m_recv_consumed += m_len;   //带请求体的流已经被重置
+            break;
+        case FRAME_HEADERS:
+            on_headers_frame();
+            break;
+        case FRAME_CONTINUATION:
+            if (!m_block_sid) {
+                goaway(H2_PROTOCOL_ERROR);
+                return;
+            }
+            m_block.append(m_payload);
+            if (m_block.size() > MAX_HEADER_BLOCK) {
+                goaway(H2_ENHANCE_YOUR_CALM);
+                return;
+            }
+            if (m_flags & FLAG_END_HEADERS) {
+                end_headers();
+            }
+            break;
+        case FRAME_PRIORITY:
+            break;      //不按优先级调度，各流轮流发送
+        case FRAME_RST_STREAM:
+            if (m_sid == 0 || len != 4) {
+                goaway(m_sid == 0 ? H2_PROTOCOL_ERROR : H2_FRAME_SIZE_ERROR);
+                return;
+            }
+            if (stream* s = find(m_sid)) {
+                close_stream(s);
+            }
+            break;
+        case FRAME_SETTINGS: {
+            if (m_sid != 0) {
+                goaway(H2_PROTOCOL_ERROR);
+                return;
+            }
+            if (m_flags & FLAG_ACK) {
+                if (len != 0) {
+                    goaway(H2_FRAME_SIZE_ERROR);
+                }
+                return;
+            }
+            uint32_t error = apply_settings(p, len);
+            if (error != H2_NO_ERROR) {
+                goaway(error);
+                return;
+            }
+            frame(m_ctrl, 0, FRAME_SETTINGS, FLAG_ACK, 0);
+            break;
+        }
+        case FRAME_PUSH_PROMISE:
+            goaway(H2_PROTOCOL_ERROR);  //客户端不能推送
+            return;
+        case FRAME_PING:
+            if (m_sid != 0 || len != 8) {
+                goaway(m_sid != 0 ? H2_PROTOCOL_ERROR : H2_FRAME_SIZE_ERROR);
+                return;
+            }
+            if (!(m_flags & FLAG_ACK)) {
+                frame(m_ctrl, 8, FRAME_PING, FLAG_ACK, 0);
+                m_ctrl.append(m_payload);
+            }
+            break;
+        case FRAME_GOAWAY:
+            m_goaway_received = true;   //已经开启的流照常发完
+            break;
+        case FRAME_WINDOW_UPDATE: {
+            if (len != 4) {
+                goaway(H2_FRAME_SIZE_ERROR);
+                return;
+            }
+            uint32_t inc = read32(p) & 0x7fffffff;
+            if (m_sid == 0) {
+                m_send_window += inc;
+                if (inc == 0 || m_send_window > MAX_WINDOW) {
+                    goaway(inc == 0 ? H2_PROTOCOL_ERROR : H2_FLOW_CONTROL_ERROR);
+                }
+            }
+            else if (stream* s = find(m_sid)) {
+                s->window += inc;
+                if (inc == 0 || s->window > MAX_WINDOW) {
+                    rst_stream(m_sid, inc == 0 ? H2_PROTOCOL_ERROR : H2_FLOW_CONTROL_ERROR);
+                    close_stream(s);
+                }
+            }
+            break;
+        }
+        default:
+            break;      //未知类型的帧忽略
+    }
+}
+
+void h2_session::on_headers_frame() {
+    if (m_sid == 0 || m_sid % 2 == 0) {
+        goaway(H2_PROTOCOL_ERROR);
+        return;
+    }
+    const char* p = m_payload.data();
+    size_t len = m_payload.size();
+    size_t pad = 0;
+    if (m_flags & FLAG_PADDED) {
+        if (len < 1) {
+            goaway(H2_FRAME_SIZE_ERROR);
+            return;
+        }
+        pad = (uint8_t)p[0];
+        p++;
+        len--;
+    }
+    if (m_flags & FLAG_PRIORITY) {
+        if (len < 5) {
+            goaway(H2_FRAME_SIZE_ERROR);
+            return;
+        }
+        p += 5;
+        len -= 5;
+    }
+    if (pad > len) {
+        goaway(H2_PROTOCOL_ERROR);
+        return;
+    }
+    m_block.assign(p, len - pad);
+    m_block_sid = m_sid;
+    m_block_end_stream = m_flags & FLAG_END_STREAM;
+    if (m_flags & FLAG_END_HEADERS) {
+        end_headers();
+    }
+}
+
+//头部块完整：解码，还原成 HTTP/1.1 的请求文本，开启新的流
+void h2_session::end_headers() {
+    uint32_t sid = m_block_sid;
+    m_block_sid = 0;
+    m_fields.clear();
+    if (!m_decoder.decode((const uint8_t*)m_block.data(), m_block.size(), &m_fields)) {
+        goaway(H2_COMPRESSION_ERROR);
+        return;
+    }
+    if (sid <= m_last_sid) {
+        return;         //已经结束或重置的流上的 trailer，解码只是为了保持动态表同步
+    }
+    if (m_shutdown || m_goaway_sent || m_goaway_received) {
+        return;         //不处理的流不计入 GOAWAY 的最后流号，客户端会在新连接上重试
+    }
+    m_last_sid = sid;
+    if (m_streams.size() >= (size_t)MAX_STREAMS) {
+        rst_stream(sid, H2_REFUSED_STREAM);
+        return;
+    }
+    if (!m_block_end_stream) {
+        rst_stream(sid, H2_HTTP_1_1_REQUIRED);  //带请求体
+        return;
+    }
+
+    const std::string* method = NULL;
+    const std::string* path = NULL;
+    const std::string* authority = NULL;
+    std::string cookie;
+    for (size_t i = 0; i < m_fields.size(); i++) {
+        const std::string& name = m_fields[i].first;
+        const std::string& value = m_fields[i].second;
+        //还原成文本后不能出现换行，否则可以注入请求头
+        if (name.empty() || name.find_first_of("\r\n", 0, 3) != std::string::npos ||
+            value.find_first_of("\r\n", 0, 3) != std::string::npos) {
+            rst_stream(sid, H2_PROTOCOL_ERROR);
+            return;
+        }
+        if (name == ":method") {
+            method = &value;
+        }
+        else if (name == ":path") {
+            path = &value;
+        }
+        else if (name == ":authority") {
+            authority = &value;
+        }
+    }
+    if (!method || !path || path->empty() || method->find(' ') != std::string::npos ||
+        path->find(' ') != std::string::npos) {
+        rst_stream(sid, H2_PROTOCOL_ERROR);
+        return;
+    }
+
+    std::string& req = m_request;
+    req.clear();
+    req.append(*method);
+    req.append(" ");
+    req.append(*path);
+    req.append(" HTTP/1.1\r\n");
+    if (authority) {
+        req.append("Host: ");
+        req.append(*authority);
+        req.append("\r\n");
+    }
+    for (size_t i = 0; i < m_fields.size(); i++) {
+        const std::string& name = m_fields[i].first;
+        if (name[0] == ':' || connection_specific(name) || (authority && name == "host")) {
+            continue;
+        }
+        //cookie 在 HTTP/2 中可以拆成多个字段，HTTP/1.1 中合并成一个(RFC 7540 8.1.2.5)
+        if (name == "cookie") {
+            if (!cookie.empty()) {
+                cookie.append("; ");
+            }
+            cookie.append(m_fields[i].second);
+            continue;
+        }
+        req.append(name);
+        req.append(": ");
+        req.append(m_fields[i].second);
+        req.append("\r\n");
+    }
+    if (!cookie.empty()) {
+        req.append("cookie: ");
+        req.append(cookie);
+        req.append("\r\n");
+    }
+    req.append("\r\n");
+    open_stream(sid, req);
+}
+
+//由流自己的 http_conn 生成响应。转发和带请求体的请求(HTTP1_REQUIRED)重置流，
+//生成响应失败(CLOSED_CONNECTION)按内部错误重置
+void h2_session::open_stream(uint32_t sid, const std::string& request) {
+    stream* s;
+    if (m_free.empty()) {
+        s = new stream;
+        s->conn = new http_conn;
+    }
+    else {
+        s = m_free.back();
+        m_free.pop_back();
+    }
+    s->id = sid;
+    s->window = m_peer_initial_window;
+    s->head.clear();
+    s->head_sent = false;
+    s->body.clear();
+    s->seg = 0;
+    s->left = 0;
+    s_streams.fetch_add(1, std::memory_order_relaxed);
+
+    http_conn::HTTP_CODE ret = s->conn->run_stream(request, m_peer);
+    if (ret == http_conn::HTTP1_REQUIRED || ret == http_conn::CLOSED_CONNECTION) {
+        release(s);
+        rst_stream(sid, ret == http_conn::HTTP1_REQUIRED ? H2_HTTP_1_1_REQUIRED : H2_INTERNAL_ERROR);
+        return;
+    }
+    translate_response(s);
+    m_streams.push_back(s);
+}
+
+//HTTP/1.1 的响应头(第一个内存块中 \r\n\r\n 之前)编码成 HPACK，之后的内存块原样作为响应体
+void h2_session::translate_response(stream* s) {
+    struct iovec* iov = s->conn->get_iov();
+    int count = s->conn->get_iv_count();
+    const char* text = (const char*)iov[0].iov_base;
+    size_t text_len = iov[0].iov_len;
+    const char* head_end = (const char*)memmem(text, text_len, "\r\n\r\n", 4);
+    size_t head_len = head_end ? head_end + 4 - text : text_len;
+
+    //状态行 "HTTP/1.1 200 OK"
+    hpack_status(s->head, text_len > 12 ? atoi(text + 9) : 500);
+    const char* line = (const char*)memchr(text, '\n', head_len);
+    line = line ? line + 1 : text + head_len;
+    std::string name;
+    while (line < text + head_len) {
+        const char* eol = (const char*)memchr(line, '\r', text + head_len - line);
+        if (!eol || eol == line) {
+            break;
+        }
+        const char* colon = (const char*)memchr(line, ':', eol - line);
+        if (colon) {
+            name.assign(line, colon - line);
+            for (size_t i = 0; i < name.size(); i++) {
+                name[i] = tolower((unsigned char)name[i]);
+            }
+            const char* value = colon + 1;
+            while (value < eol && (*value == ' ' || *value == '\t')) {
+                value++;
+            }
+            if (!connection_specific(name)) {
+                hpack_field(s->head, name, value, eol - value);
+            }
+        }
+        line = eol + 2;
+    }
+
+    if (text_len > head_len) {
+        struct iovec v = { (void*)(text + head_len), text_len - head_len };
+        s->body.push_back(v);
+        s->left += v.iov_len;
+    }
+    for (int i = 1; i < count; i++) {
+        if (iov[i].iov_len > 0) {
+            s->body.push_back(iov[i]);
+            s->left += iov[i].iov_len;
+        }
+    }
+}
+
+h2_session::stream* h2_session::find(uint32_t sid) {
+    for (size_t i = 0; i < m_streams.size(); i++) {
+        if (m_streams[i]->id == sid) {
+            return m_streams[i];
+        }
+    }
+    return NULL;
+}
+
+void h2_session::close_stream(stream* s) {
+    for (size_t i = 0; i < m_streams.size(); i++) {
+        if (m_streams[i] == s) {
+            m_streams.erase(m_streams.begin() + i);
+            break;
+        }
+    }
+    m_done.push_back(s);
+}
+
+void h2_session::release_done() {
+    for (size_t i = 0; i < m_done.size(); i++) {
+        release(m_done[i]);
+    }
+    m_done.clear();
+}
+
+void h2_session::release(stream* s) {
+    s->conn->end_stream();
+    if (m_free.size() >= (size_t)MAX_FREE_STREAMS) {
+        delete s->conn;
+        delete s;
+        return;
+    }
+    m_free.push_back(s);
+}
+
+void h2_session::add_owned(size_t offset, size_t len) {
+    //连续的自有数据合并成一个内存块
+    if (!m_pieces.empty() && !m_pieces.back().data && m_pieces.back().offset + m_pieces.back().len == offset) {
+        m_pieces.back().len += len;
+        return;
+    }
+    piece p = { NULL, offset, len };
+    m_pieces.push_back(p);
+}
+
+//响应头超过客户端的帧大小上限时拆成 HEADERS + CONTINUATION
+void h2_session::add_headers_frames(stream* s) {
+    size_t len = s->head.size();
+    size_t pos = 0;
+    do {
+        size_t n = len - pos < m_peer_max_frame ? len - pos : m_peer_max_frame;
+        uint8_t flags = pos + n == len ? FLAG_END_HEADERS : 0;
+        if (pos == 0 && s->left == 0) {
+            flags |= FLAG_END_STREAM;
+        }
+        size_t offset = m_out.size();
+        frame(m_out, n, pos == 0 ? FRAME_HEADERS : FRAME_CONTINUATION, flags, s->id);
+        m_out.append(s->head, pos, n);
+        add_owned(offset, 9 + n);
+        pos += n;
+    } while (pos < len);
+    s->head_sent = true;
+}
+
+//一个 DATA 帧：帧头在 m_out 中，负载直接指向流的响应体，内存块数不够时缩短
+void h2_session::add_data_frame(stream* s, size_t len) {
+    size_t budget = MAX_BATCH_IOV - m_pieces.size() - 1;
+    size_t take = 0;
+    for (size_t i = s->seg; i < s->body.size() && take < len && budget > 0; i++, budget--) {
+        take += s->body[i].iov_len < len - take ? s->body[i].iov_len : len - take;
+    }
+    len = take;
+    size_t offset = m_out.size();
+    frame(m_out, len, FRAME_DATA, len == s->left ? FLAG_END_STREAM : 0, s->id);
+    add_owned(offset, 9);
+    s->left -= len;
+    s->window -= len;
+    m_send_window -= len;
+    while (len > 0) {
+        struct iovec& v = s->body[s->seg];
+        size_t n = v.iov_len < len ? v.iov_len : len;
+        piece p = { (const char*)v.iov_base, 0, n };
+        m_pieces.push_back(p);
+        v.iov_base = (char*)v.iov_base + n;
+        v.iov_len -= n;
+        len -= n;
+        if (v.iov_len == 0) {
+            s->seg++;
+        }
+    }
+}
+
+//组织一批帧：控制帧、新流的 HEADERS，然后各流轮流每次一个 DATA 帧，直到窗口、字节数或内存块数用完。
+//调用时上一批已经发完，上一批中结束的流此时才能释放
+int h2_session::fill() {
+    release_done();
+    m_out.clear();
+    m_pieces.clear();
+    m_iov.clear();
+    if (!m_started) {
+        return 0;
+    }
+    if (!m_ctrl.empty()) {
+        m_out.swap(m_ctrl);
+        add_owned(0, m_out.size());
+    }
+    if (!m_fatal) {
+        for (size_t i = 0; i < m_streams.size(); i++) {
+            if (!m_streams[i]->head_sent) {
+                add_headers_frames(m_streams[i]);
+            }
+        }
+
+        //h2c Upgrade：收到客户端的连接序言之前只发 101、SETTINGS 和响应头，
+        //有的客户端只能缓存 101 之后很少的数据
+        size_t bytes = m_out.size();
+        size_t n = m_streams.size();
+        bool progress = m_preface_left == 0;
+        while (progress) {
+            progress = false;
+            for (size_t k = 0; k < n; k++) {
+                stream* s = m_streams[(m_next + k) % n];
+                if (m_send_window <= 0 || bytes >= (size_t)MAX_BATCH || m_pieces.size() + 2 > (size_t)MAX_BATCH_IOV) {
+                    progress = false;
+                    break;
+                }
+                if (s->left == 0 || s->window <= 0) {
+                    continue;
+                }
+                size_t len = s->left;
+                if ((int64_t)len > s->window) {
+                    len = s->window;
+                }
+                if ((int64_t)len > m_send_window) {
+                    len = m_send_window;
+                }
+                if (len > m_peer_max_frame) {
+                    len = m_peer_max_frame;
+                }
+                if (len > MAX_BATCH - bytes) {
+                    len = MAX_BATCH - bytes;
+                }
+                size_t before = s->left;
+                add_data_frame(s, len);
+                bytes += 9 + before - s->left;
+                progress = true;
+            }
+        }
+        if (n > 0) {
+            m_next = (m_next + 1) % n;
+        }
+
+        //响应发完的流
+        size_t kept = 0;
+        for (size_t i = 0; i < m_streams.size(); i++) {
+            stream* s = m_streams[i];
+            if (s->head_sent && s->left == 0) {
+                m_done.push_back(s);
+            }
+            else {
+                m_streams[kept++] = s;
+            }
+        }
+        m_streams.resize(kept);
+
+        if (m_shutdown && !m_goaway_sent && m_streams.empty()) {
+            goaway(H2_NO_ERROR);
+            size_t offset = m_out.size();
+            m_out.append(m_ctrl);
+            add_owned(offset, m_ctrl.size());
+            m_ctrl.clear();
+        }
+    }
+
+    size_t total = 0;
+    m_iov.resize(m_pieces.size());
+    for (size_t i = 0; i < m_pieces.size(); i++) {
+        const piece& p = m_pieces[i];
+        m_iov[i].iov_base = (void*)(p.data ? p.data : m_out.data() + p.offset);
+        m_iov[i].iov_len = p.len;
+        total += p.len;
+    }
+    return total;
+}
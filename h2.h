@@ -0,0 +1,155 @@
+#ifndef H2_H
+#define H2_H
+
+#include <stdint.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include <atomic>
+
+class http_conn;
+
+//HPACK 解码(RFC 7541)：静态表、动态表、Huffman 编码的字符串都支持。
+//每个连接一个，头部块必须按收到的顺序解码(被拒绝的流也要解码)，否则动态表与客户端不一致
+class hpack_decoder {
+public:
+    typedef std::vector<std::pair<std::string, std::string> > fields;
+
+    hpack_decoder();
+    void reset();
+    bool decode(const uint8_t* p, int len, fields* out);   //解码一个完整的头部块，格式错误返回false
+
+private:
+    bool read_int(const uint8_t*& p, const uint8_t* end, int prefix, uint32_t* value);
+    bool read_string(const uint8_t*& p, const uint8_t* end, std::string* out);
+    bool lookup(uint32_t index, std::string* name, std::string* value) const;
+    void insert(const std::string& name, const std::string& value);
+    void evict(uint32_t limit);
+
+    std::deque<std::pair<std::string, std::string> > m_table;  //动态表，最新的条目在前
+    uint32_t m_size;        //动态表的大小(每个条目按 名字 + 值 + 32 计)
+    uint32_t m_max_size;    //客户端通过大小更新设置的上限，不超过 SETTINGS_HEADER_TABLE_SIZE
+};
+
+/*
+    一个 HTTP/2 连接的状态(RFC 7540)，由 http_conn 在收到连接序言或 h2c Upgrade 后创建，随连接对象复用。
+    收到的帧在工作线程中处理：请求头解码后还原成 HTTP/1.1 的请求文本，交给每个流自己的 http_conn
+    对象按原来的流程查找静态文件、调用处理函数并生成响应，响应头再编码成 HEADERS 帧，
+    响应体不拷贝，DATA 帧直接指向流的写缓冲区和文件映射。
+    发送由事件循环线程调用 fill()：按连接和各流的发送窗口，把控制帧、HEADERS 和多个流轮流的
+    DATA 帧组织成一个 iovec 数组，一次 writev 发出。
+    带请求体的请求和反向代理路由需要 HTTP/1.1 的流式转发，这类流以 HTTP_1_1_REQUIRED 重置，客户端会改用 HTTP/1.1。
+*/
+class h2_session {
+public:
+    static const int PREFACE_LEN = 24;          //客户端连接序言 "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n"
+    static const int MAX_STREAMS = 100;         //SETTINGS_MAX_CONCURRENT_STREAMS，超过时以 REFUSED_STREAM 重置(客户端可以安全重试)
+    static const int MAX_FRAME_SIZE = 16384;    //接收的帧大小上限(协议的默认值，不另行通告)
+    static const int MAX_BATCH = 256 * 1024;    //一次 writev 的字节数上限
+    static const int MAX_BATCH_IOV = 512;       //一次 writev 的内存块数上限(IOV_MAX 为 1024)
+    static const int MAX_FREE_STREAMS = 16;     //随连接保留的空闲流对象数，多出的释放
+
+    h2_session();
+    ~h2_session();
+
+    //data 是否以连接序言开头：1 是，0 目前收到的部分与序言一致但还不完整，-1 不是
+    static int preface(const char* data, int len);
+
+    void start(const sockaddr_in& peer);        //连接序言(prior knowledge 或 ALPN h2)：发送服务端的 SETTINGS
+    //h2c Upgrade：settings 为 HTTP2-Settings 头的值，request 为升级请求还原的文本，它的响应作为流1发送。
+    //先回复 101，然后等待客户端的连接序言；HTTP2-Settings 格式错误时返回false
+    bool upgrade(const sockaddr_in& peer, const char* settings, const std::string& request);
+    void shutdown();                            //热重启排空：不再接受新的流，已有的流发完后发送 GOAWAY 并关闭
+    void reset();                               //连接关闭：释放所有流
+
+    void on_input(const char* data, int len);   //处理收到的数据(工作线程)，协议错误时准备 GOAWAY
+    int fill();                                 //组织下一批要发送的帧，返回字节数，0 表示没有可发送的(事件循环线程)
+    struct iovec* iov() { return m_iov.empty() ? NULL : &m_iov[0]; }
+    int iov_count() const { return m_iov.size(); }
+    bool closing() const;                       //发出或收到 GOAWAY 且所有流都已结束，可以关闭连接
+
+    static unsigned long connections() { return s_connections.load(std::memory_order_relaxed); }
+    static unsigned long streams() { return s_streams.load(std::memory_order_relaxed); }
+
+private:
+    struct stream {
+        uint32_t id;
+        int64_t window;                 //发送窗口
+        http_conn* conn;                //生成响应的对象，流结束后随 stream 放回 m_free
+        std::string head;               //HPACK 编码好的响应头
+        bool head_sent;
+        std::vector<struct iovec> body; //响应体，指向 conn 的写缓冲区、文件映射或处理函数的缓冲区
+        size_t seg;                     //body 中第一个没有发完的内存块
+        size_t left;                    //还没有发送的响应体字节数
+    };
+
+    //一次 writev 中的一段：data 为NULL时是 m_out 中的偏移，m_out 组织完之后才换成指针
+    struct piece {
+        const char* data;
+        size_t offset;
+        size_t len;
+    };
+
+    void frame(std::string& out, uint32_t len, uint8_t type, uint8_t flags, uint32_t sid);
+    void send_settings();
+    void rst_stream(uint32_t sid, uint32_t error);
+    void goaway(uint32_t error);                //连接错误：发送 GOAWAY 后关闭连接
+    uint32_t apply_settings(const uint8_t* p, int len);    //返回错误码，0 表示成功
+    void on_frame();
+    void on_headers_frame();
+    void end_headers();
+    void open_stream(uint32_t sid, const std::string& request);
+    void translate_response(stream* s);
+    stream* find(uint32_t sid);
+    void close_stream(stream* s);
+    void release_done();
+    void release(stream* s);                    //流结束：释放响应，放回 m_free
+    void add_headers_frames(stream* s);
+    void add_data_frame(stream* s, size_t len);
+    void add_owned(size_t offset, size_t len);
+
+    sockaddr_in m_peer;
+    bool m_started;
+    int m_preface_left;                 //还没有收到的连接序言字节数
+    uint8_t m_head[9];                  //正在接收的帧头
+    int m_head_len;
+    uint32_t m_len;                     //当前帧的负载长度、类型、标志和流
+    uint8_t m_type;
+    uint8_t m_flags;
+    uint32_t m_sid;
+    uint32_t m_got;                     //当前帧已收到的负载字节数
+    std::string m_payload;              //当前帧的负载(DATA 帧不保存)
+    std::string m_block;                //HEADERS + CONTINUATION 拼起来的头部块
+    uint32_t m_block_sid;               //不为0时正在等待该流的 CONTINUATION
+    bool m_block_end_stream;
+    hpack_decoder m_decoder;
+    hpack_decoder::fields m_fields;
+    std::string m_request;              //还原的 HTTP/1.1 请求文本
+
+    uint32_t m_last_sid;                //客户端开启的最大流号
+    uint32_t m_peer_max_frame;          //客户端的 SETTINGS_MAX_FRAME_SIZE
+    int64_t m_peer_initial_window;      //客户端的 SETTINGS_INITIAL_WINDOW_SIZE
+    int64_t m_send_window;              //连接级的发送窗口
+    uint32_t m_recv_consumed;           //收到的(被丢弃的)DATA 负载，处理完这批输入后一起 WINDOW_UPDATE
+    bool m_shutdown;                    //正在排空，GOAWAY 在最后一个流发完时发送
+    bool m_goaway_sent;
+    bool m_goaway_received;
+    bool m_fatal;                       //连接错误，GOAWAY 发出后关闭
+
+    std::string m_ctrl;                 //等待发送的控制帧(SETTINGS/PING/WINDOW_UPDATE/RST_STREAM/GOAWAY)
+    std::vector<stream*> m_streams;     //正在发送响应的流，按开启顺序轮流发送 DATA
+    std::vector<stream*> m_done;        //已发完或被重置的流，它们的数据可能还在上一批中，下一次 fill 时释放
+    std::vector<stream*> m_free;        //空闲的流对象(连同其 http_conn 和缓冲区)
+    size_t m_next;                      //下一批从哪个流开始发送 DATA
+
+    std::string m_out;                  //这一批的帧头、响应头等自有数据
+    std::vector<piece> m_pieces;
+    std::vector<struct iovec> m_iov;
+
+    static std::atomic<unsigned long> s_connections;
+    static std::atomic<unsigned long> s_streams;
+};
+
+#endif
@@ -0,0 +1,187 @@
+#include "hot_restart.h"
+#include "log.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <vector>
+#include <string>
+
+#define LISTEN_FD_ENV "WEBSERVES_LISTEN_FD"
+#define READY_FD_ENV "WEBSERVES_READY_FD"
+#define TLS_FD_ENV "WEBSERVES_TLS_FD"
+#define INHERITED_LISTEN_FD 3
+#define INHERITED_READY_FD 4
+#define INHERITED_TLS_FD 5
+
+extern char** environ;
+
+char** hot_restart::s_argv = NULL;
+pid_t hot_restart::s_child = -1;
+
+void hot_restart::init(char* argv[]) {
+    s_argv = argv;
+}
+
+//取出环境变量给出的监听socket
+static int inherited_fd(const char* name) {
+    const char* env = getenv(name);
+    if (!env) {
+        return -1;
+    }
+    int fd = atoi(env);
+    unsetenv(name);
+    //确认确实是一个处于监听状态的socket
+    int listening = 0;
+    socklen_t len = sizeof(listening);
+    if (getsockopt(fd, SOL_SOCKET, SO_ACCEPTCONN, &listening, &len) < 0 || !listening) {
+        EMlog(LOGLEVEL_WARN, "inherited fd %d is not a listening socket\n", fd);
+        return -1;
+    }
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+    return fd;
+}
+
+int hot_restart::inherited_listenfd() {
+    return inherited_fd(LISTEN_FD_ENV);
+}
+
+int hot_restart::inherited_tls_listenfd() {
+    return inherited_fd(TLS_FD_ENV);
+}
+
+int hot_restart::take_ready_fd() {
+    const char* env = getenv(READY_FD_ENV);
+    if (!env) {
+        return -1;
+    }
+    int fd = atoi(env);
+    unsetenv(READY_FD_ENV);
+    return fd;
+}
+
+void hot_restart::notify_ready() {
+    notify_ready(take_ready_fd());
+}
+
+void hot_restart::notify_ready(int fd) {
+    if (fd < 0) {
+        return;
+    }
+    char ok = 1;
+    if (::write(fd, &ok, 1) != 1) {
+        EMlog(LOGLEVEL_WARN, "notify old process failed, errno is : %d\n", errno);
+    }
+    close(fd);
+}
+
+//关闭除标准输入输出和继承的几个fd以外的所有fd，连接socket、epoll、信号管道都不能泄漏给新进程
+static void close_from(int lowfd) {
+#ifdef SYS_close_range
+    if (syscall(SYS_close_range, lowfd, ~0U, 0) == 0) {
+        return;
+    }
+#endif
+    long max_fd = sysconf(_SC_OPEN_MAX);
+    for (long fd = lowfd; fd < max_fd; fd++) {
+        close(fd);
+    }
+}
+
+int hot_restart::spawn(int listenfd, int tls_listenfd) {
+    if (!s_argv) {
+        return -1;
+    }
+    int ready[2];
+    if (pipe2(ready, O_CLOEXEC) < 0) {
+        return -1;
+    }
+
+    //环境变量在fork之前准备好，子进程在exec之前只做异步信号安全的操作
+    char listen_env[64], ready_env[64], tls_env[64];
+    snprintf(listen_env, sizeof(listen_env), "%s=%d", LISTEN_FD_ENV, INHERITED_LISTEN_FD);
+    snprintf(ready_env, sizeof(ready_env), "%s=%d", READY_FD_ENV, INHERITED_READY_FD);
+    snprintf(tls_env, sizeof(tls_env), "%s=%d", TLS_FD_ENV, INHERITED_TLS_FD);
+    std::vector<char*> envp;
+    for (char** e = environ; *e; e++) {
+        if (strncmp(*e, LISTEN_FD_ENV "=", sizeof(LISTEN_FD_ENV)) != 0 &&
+            strncmp(*e, READY_FD_ENV "=", sizeof(READY_FD_ENV)) != 0 &&
+            strncmp(*e, TLS_FD_ENV "=", sizeof(TLS_FD_ENV)) != 0) {
+            envp.push_back(*e);
+        }
+    }
+    if (listenfd >= 0) {
+        envp.push_back(listen_env);
+    }
+    envp.push_back(ready_env);
+    if (tls_listenfd >= 0) {
+        envp.push_back(tls_env);
+    }
+    envp.push_back(NULL);
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        close(ready[0]);
+        close(ready[1]);
+        return -1;
+    }
+    if (pid == 0) {
+        //先复制到高位，避免 dup2 时两个fd互相覆盖
+        int lfd = listenfd >= 0 ? fcntl(listenfd, F_DUPFD, 16) : -1;
+        int rfd = fcntl(ready[1], F_DUPFD, 16);
+        int tfd = tls_listenfd >= 0 ? fcntl(tls_listenfd, F_DUPFD, 16) : -1;
+        if (rfd < 0 || dup2(rfd, INHERITED_READY_FD) < 0) {
+            _exit(127);
+        }
+        if (listenfd >= 0 && (lfd < 0 || dup2(lfd, INHERITED_LISTEN_FD) < 0)) {
+            _exit(127);
+        }
+        if (listenfd < 0) {
+            close(INHERITED_LISTEN_FD);
+        }
+        if (tls_listenfd >= 0 && (tfd < 0 || dup2(tfd, INHERITED_TLS_FD) < 0)) {
+            _exit(127);
+        }
+        close_from(tls_listenfd >= 0 ? INHERITED_TLS_FD + 1 : INHERITED_READY_FD + 1);
+        sigset_t none;
+        sigemptyset(&none);
+        sigprocmask(SIG_SETMASK, &none, NULL);
+        if (strchr(s_argv[0], '/')) {
+            execve(s_argv[0], s_argv, &envp[0]);
+        }
+        else {
+            execvpe(s_argv[0], s_argv, &envp[0]);
+        }
+        _exit(127);
+    }
+
+    close(ready[1]);
+    fcntl(ready[0], F_SETFL, fcntl(ready[0], F_GETFL) | O_NONBLOCK);
+    s_child = pid;
+    EMlog(LOGLEVEL_INFO, "hot restart: started new process %d\n", pid);
+    return ready[0];
+}
+
+int hot_restart::check_ready(int ready_fd) {
+    char buf[16];
+    int ret = ::read(ready_fd, buf, sizeof(buf));
+    if (ret < 0 && (errno == EAGAIN || errno == EINTR)) {
+        return -1;
+    }
+    close(ready_fd);
+    if (ret > 0) {
+        EMlog(LOGLEVEL_INFO, "hot restart: process %d is ready, draining\n", s_child);
+        s_child = -1;
+        return 1;
+    }
+    //新进程在就绪前退出(exec失败、端口配置错误等)，回收它，旧进程继续服务
+    int status = 0;
+    waitpid(s_child, &status, 0);
+    EMlog(LOGLEVEL_ERROR, "hot restart: process %d exited before ready, status %d\n", s_child, status);
+    s_child = -1;
+    return 0;
+}
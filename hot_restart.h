@@ -0,0 +1,34 @@
+#ifndef HOT_RESTART_H
+#define HOT_RESTART_H
+
+#include <sys/types.h>
+
+/*
+    热重启：收到 SIGUSR2 后 fork + exec 新的可执行文件(同样的命令行参数)，
+    监听socket作为fd 3直接继承给新进程，就绪通知管道的写端作为fd 4，HTTPS 监听socket(如果有)作为fd 5。
+    新进程建好根目录索引/打包文件等缓存后调用 notify_ready()，
+    旧进程收到通知后停止accept、关闭自己的监听socket，让已有连接自然结束(不再保持长连接，
+    空闲连接由定时器关闭)，连接数归零后退出。新进程在就绪前失败时旧进程继续服务。
+*/
+class hot_restart {
+public:
+    static void init(char* argv[]);         //保存命令行参数，exec新进程时原样使用
+    static int inherited_listenfd();        //旧进程传下来的监听socket，不是热重启启动时返回-1
+    static int inherited_tls_listenfd();    //旧进程传下来的 HTTPS 监听socket，没有时返回-1
+    static void notify_ready();             //新进程：通知旧进程可以停止accept了
+    //多进程模式的主进程先取出就绪通知管道的写端(不让 worker 继承到)，所有 worker 就绪后用 notify_ready(fd) 通知
+    static int take_ready_fd();             //不是热重启启动时返回-1
+    static void notify_ready(int fd);
+
+    //旧进程：启动新进程，返回就绪通知管道的读端(非阻塞)，失败返回-1。
+    //listenfd 为-1 时不传监听socket(多进程 reuseport 模式，新进程的 worker 各自监听)
+    static int spawn(int listenfd, int tls_listenfd = -1);
+    //旧进程：就绪通知管道可读时调用。返回1表示新进程已就绪，0表示新进程在就绪前退出，-1表示还没有结果
+    static int check_ready(int ready_fd);
+
+private:
+    static char** s_argv;
+    static pid_t s_child;
+};
+
+#endif
@@ -1,10 +1,33 @@
 #include"http_conn.h"
+#include"config.h"
+#include<openssl/err.h>
 
 
 int http_conn::m_epollfd = -1;  //所有的socket上的事件都被注册到同一个epoll内核事件中，所以设置成静态
 int http_conn::m_user_count = 0;    //统计用户的数量
 int http_conn::m_request_cnt = 0; 
 sort_timer_lst http_conn::m_timer_lst;
+void (*http_conn::m_process_done)(http_conn*, int) = NULL;
+int http_conn::m_max_age = -1;
+doc_index* http_conn::m_doc_index = NULL;
+bundle_store* http_conn::m_bundles = NULL;
+bool http_conn::m_draining = false;
+const char* http_conn::m_upload_dir = NULL;
+router* http_conn::m_router = NULL;
+rate_limiter* http_conn::m_limiter = NULL;
+priority_rules* http_conn::m_priority = NULL;
+unsigned long http_conn::m_timeouts[PHASE_COUNT] = {0};
+bool http_conn::m_http2 = false;
+traffic_capture* http_conn::m_capture = NULL;
+std::atomic<unsigned long> http_conn::m_requests(0);
+bool http_conn::m_direct_write = true;
+std::atomic<unsigned long> http_conn::m_direct_done(0);
+std::atomic<unsigned long> http_conn::m_direct_eagain(0);
+
+//Reactor 模型下工作线程正在读写：refresh_timer 不修改定时器链表
+static thread_local bool t_off_loop = false;
+int http_conn::m_read_buffer_size = 2048;
+int http_conn::m_write_buffer_size = 1024;
 
 //定义HTTP响应的一些状态信息
 const char* ok_200_title = "OK";
@@ -16,9 +39,30 @@ const char* error_404_title = "Not Found";
 const char* error_404_form = "The request file was not found";
 const char* error_500_title = "Internal Error";
 const char* error_500_form = "There was an unusual problem serving the request file";
+const char* ok_206_title = "Partial Content";
+const char* error_416_title = "Range Not Satisfiable";
+const char* error_416_form = "The requested range is not satisfiable";
+const char* not_modified_304_title = "Not Modified";
+const char* ok_201_title = "Created";
+const char* ok_204_title = "No Content";
+const char* error_405_title = "Method Not Allowed";
+const char* error_405_form = "The request method is not allowed for this resource";
+const char* error_413_title = "Payload Too Large";
+const char* error_413_form = "The request body is larger than the server allows";
+const char* error_502_title = "Bad Gateway";
+const char* error_502_form = "The upstream server could not be reached or sent an invalid response";
+const char* error_504_title = "Gateway Timeout";
+const char* error_504_form = "The upstream server did not respond in time";
+const char* error_503_title = "Service Unavailable";
+const char* error_503_form = "The server is overloaded, please retry later";
+const char* continue_100 = "HTTP/1.1 100 Continue\r\n\r\n";
+
+//multipart/byteranges 的分隔符
+const char* byteranges_boundary = "WEBSERVES_BYTERANGES_7f3a9c";
+
+//与 METHOD 的顺序一致
+static const char* method_names[] = { "GET", "POST", "HEAD", "PUT", "DELETE", "TRACE", "OPTIONS", "CONNECT" };
 
-//网站的根目录
-const char* doc_root = "/home/x/WebServes/resources";
 //设置文件描述符非阻塞
 int setnonblocking(int fd) {
     int old_option = fcntl(fd, F_GETFL);  //F_GETFL:获取文件描述符标志
@@ -30,21 +74,29 @@ int setnonblocking(int fd) {
 //添加需要监听的文件描述符到epoll中
 void addfd(int epollfd, int fd, bool one_shot) {
     epoll_event event;
-    event.data.fd = fd;
+    event.data.u64 = (unsigned int)fd;     //高位为0，与上游socket的事件(UPSTREAM_EVENT)区分
     event.events = EPOLLIN | EPOLLRDHUP;
 
     if (one_shot) {
         //防止同一个通信被不同的线程处理
         event.events |= EPOLLONESHOT;
     }
-    epoll_ctl(epollfd, EPOLL_CTL_ADD, fd, &event);
+    if (epollfd >= 0) {     //io_uring 后端没有epoll实例
+        epoll_ctl(epollfd, EPOLL_CTL_ADD, fd, &event);
+    }
     //设置文件描述符非阻塞
     setnonblocking(fd);
 }
 
 //从epoll中删除监听的文件描述符
 void removefd(int epollfd, int fd) {
-    epoll_ctl(epollfd, EPOLL_CTL_DEL, fd, 0);
+    if (epollfd >= 0) {
+        epoll_ctl(epollfd, EPOLL_CTL_DEL, fd, 0);
+    }
+    else {
+        //io_uring 后端：挂起的 multishot recv 持有socket引用，先shutdown让它以0结束，否则close不会真正断开
+        shutdown(fd, SHUT_RDWR);
+    }
     close(fd);
 }
 
@@ -52,19 +104,52 @@ void removefd(int epollfd, int fd) {
 //EOPLLONESHOT:只监听一次事件，当监听完这次事件之后，如果还需要继续监听这个socket的话，需要再次把这个socket加入到EPOLL队列里
 void modfd(int epollfd, int fd, int ev) {
     epoll_event event;
-    event.data.fd = fd;
+    event.data.u64 = (unsigned int)fd;
     event.events = ev | EPOLLONESHOT | EPOLLRDHUP | EPOLLET; //EPOLLET:边缘触发
-    epoll_ctl(epollfd, EPOLL_CTL_MOD, fd, &event);
+    if (epollfd >= 0) {
+        epoll_ctl(epollfd, EPOLL_CTL_MOD, fd, &event);
+    }
+}
+
+void* http_conn::operator new(size_t size) {
+    void* p = NULL;
+    if (posix_memalign(&p, alignof(http_conn), size) != 0) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+//数组的长度记录(cookie)占 alignof(http_conn) 字节，首个元素仍按缓存行对齐
+void* http_conn::operator new[](size_t size) {
+    return operator new(size);
+}
+
+void http_conn::operator delete(void* p) noexcept {
+    free(p);
+}
+
+void http_conn::operator delete[](void* p) noexcept {
+    free(p);
 }
 
 //初始化新接收的连接，外部调用初始化套接字地址
-void http_conn::init(int sockfd, const sockaddr_in& addr) {
+void http_conn::init(int sockfd, const sockaddr_in& addr, sock_profile* profile, tls_context* tls) {
     m_sockfd = sockfd;
     m_address = addr;
+    m_profile = profile;
+
+    //HTTPS：先握手，创建失败时 handshake() 返回false关闭连接
+    m_tls = tls;
+    m_ssl = tls ? tls->accept(sockfd) : NULL;
+    m_handshaking = tls != NULL;
+    m_ktls_send = false;
+    m_h2_active = false;
+    m_stream = false;
 
-    //端口复用
-    int reuse = 1;
-    setsockopt(m_sockfd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    //按监听socket的配置设置 TCP_NODELAY、keepalive 等选项
+    if (m_profile) {
+        m_profile->apply(sockfd);
+    }
 
     //将新连接添加到epoll中进行监听
     addfd(m_epollfd, sockfd, true);
@@ -74,39 +159,80 @@ void http_conn::init(int sockfd, const sockaddr_in& addr) {
     const char* str = inet_ntop(AF_INET, &addr.sin_addr.s_addr, ip, sizeof(ip));   //将地址网络字节序二进制数 转换成 文本串形式
     EMlog(LOGLEVEL_INFO, "The No.%d user. sock_fd = %d, ip = %s.\n", m_user_count, sockfd, str);
 
+    m_served = 0;
+    m_capture_id = m_capture ? m_capture->conn_open(addr) : 0;
     init();     //其余信息初始化
 
     //创建定时器，设置其回调函数与超时时间，然后绑定定时器与用户数据，最后将定时器添加到链表timer_lst中
-    util_timer* new_timer = new util_timer;
+    util_timer* new_timer = m_timer_lst.alloc_timer();
     new_timer->user_data = this;
-    time_t cur_time = time(NULL);
-    new_timer->expire = cur_time + 3 * TIMESLOT;
+    new_timer->expire = deadline();     //还没有收到数据，按请求头超时
     this->timer = new_timer;
     m_timer_lst.add_timer(new_timer);
 }
 
 //初始化连接其余的信息
 void http_conn::init() {
+    //缓冲区和冷数据在连接第一次使用时分配，之后随 http_conn 对象复用
+    if (!m_read_buf) {
+        m_read_buf = new char[m_read_buffer_size];
+        m_write_buf = new char[m_write_buffer_size];
+        m_cold = new cold_state;
+    }
 
     bytes_to_send = 0;      //要发送的字节数
     bytes_have_send = 0;    //已发送的字节数
 
+    m_idle_start = time(NULL);
+    m_request_start = m_idle_start;
+    m_body_start_time = m_idle_start;
+    m_send_start = m_idle_start;
+    m_last_io = m_idle_start;
+
     m_check_state = CHECK_STATE_REQUESTLINE;        //初始化状态为解析请求首行
     m_linger = false;                               //是否保持HTTP长连接，keep-alive功能，默认不保持
     m_method = GET;             //默认请求方式为GET
     m_url = 0;
     m_version = 0;
     m_content_length = 0;
+    m_chunked = false;
+    m_expect_continue = false;
+    m_body_start = 0;
+    m_body_left = 0;
+    m_body_received = 0;
+    m_chunk_state = CHUNK_SIZE;
+    m_upload_existed = false;
+    m_header_count = 0;
+    m_route = NULL;
+    m_allow = "GET";
+    m_headers_truncated = false;
+    m_proxy_waiting = false;
+    m_h2_upgrade = false;
+    m_h2_settings = NULL;
+    m_iov = m_cold->iv;
     m_host = 0;
+    m_range = 0;
+    m_range_count = 0;
+    m_if_none_match = 0;
+    m_if_modified_since = 0;
+    m_if_range = 0;
+    m_accept_encoding = 0;
+    m_validators = NULL;
+    m_validators_len = 0;
+    m_cold->etag[0] = '\0';
+    m_mime = "text/html";
     m_check_index = 0;
     m_start_line = 0;
     m_read_idx = 0;
+    m_read_more = false;
     m_write_idx = 0;
+    m_resp_status = 0;
+    m_resp_bytes = 0;
+    m_arena.reset();        //上一个请求的 sink 等都已销毁
 
-
-    bzero(m_read_buf, READ_BUFFER_SIZE);
-    bzero(m_write_buf, READ_BUFFER_SIZE);
-    bzero(m_real_file, FILENAME_LEN);   
+    bzero(m_read_buf, m_read_buffer_size);
+    bzero(m_write_buf, m_write_buffer_size);
+    bzero(m_cold->real_file, FILENAME_LEN);   
 
 }   
 
@@ -114,8 +240,27 @@ void http_conn::init() {
 void http_conn::close_conn() {
     if (m_sockfd != -1) {
         //一个有效的套接字描述符，会被设置为一个正整数。然而，在某些情况下，比如套接字已经被关闭或者尚未成功打开时，m_sockfd可能会被设置为一个特殊的值来表示其状态。
+        unmap();        //发送中途关闭时释放映射(或打包文件的引用)
+        abort_body();   //上传中途断开，删除临时文件
+        m_arena.release();
+        if (m_capture_id) {
+            m_capture->conn_close(m_capture_id);
+            m_capture_id = 0;
+        }
+        if (m_h2_active) {
+            m_h2->reset();  //释放各个流的响应
+            m_h2_active = false;
+        }
         m_user_count--; //关闭一个连接，总连接数减1
         EMlog(LOGLEVEL_INFO, "closing fd: %d, rest user num :%d\n", m_sockfd, m_user_count);
+        if (m_ssl) {
+            if (!m_handshaking) {
+                SSL_shutdown(m_ssl);    //尽力发送 close_notify，不等待对方回应
+            }
+            SSL_free(m_ssl);
+            m_ssl = NULL;
+            ERR_clear_error();
+        }
         removefd(m_epollfd, m_sockfd);  //移除epoll检测，关闭套接字
         m_sockfd = -1;
     }
@@ -123,23 +268,23 @@ void http_conn::close_conn() {
 
 //非阻塞读，循环读取客户数据，直到无数据可读或者对方关闭连接
 bool http_conn::read() {
-    //更新超时时间
-    if (timer) {
-        time_t cur_time = time(NULL);
-        timer->expire = cur_time + 3 * TIMESLOT;
-        m_timer_lst.adjust_timer(timer);
-    }
-
     //printf("一次性读完\n");
-    if (m_read_idx >= READ_BUFFER_SIZE) {
+    if (m_read_idx >= m_read_buffer_size) {
         return false;
     }
+    bool fresh = m_read_idx == 0 && m_check_state == CHECK_STATE_REQUESTLINE;
 
     //读取到的字节
     int bytes_read = 0;
+    m_read_more = false;
     while (true) {
-        // 从m_read_buf + m_read_idx索引处开始保存数据，大小是READ_BUFFER_SIZE - m_read_idx
-        bytes_read = recv(m_sockfd, m_read_buf + m_read_idx, READ_BUFFER_SIZE - m_read_idx, 0);
+        if (m_read_idx >= m_read_buffer_size) {
+            //读缓冲区满：请求体窗口交给sink后再继续读，其余数据留在内核接收缓冲区，由TCP流量控制
+            m_read_more = true;
+            break;
+        }
+        // 从m_read_buf + m_read_idx索引处开始保存数据，大小是m_read_buffer_size - m_read_idx
+        bytes_read = recv_some(m_read_buf + m_read_idx, m_read_buffer_size - m_read_idx);
         if (bytes_read == -1) {
             if (errno == EAGAIN || errno == EWOULDBLOCK) {
                 //没有数据
@@ -151,14 +296,263 @@ bool http_conn::read() {
             //对方关闭连接
             return false;
         }
+        if (m_capture_id && !m_h2_active) {
+            m_capture->data(m_capture_id, m_read_buf + m_read_idx, bytes_read);
+        }
         m_read_idx += bytes_read;   //索引移动
     }
+    if (fresh && m_read_idx > 0) {
+        m_request_start = time(NULL);   //请求头的期限从第一个字节算起，之后收到数据也不推迟
+    }
+    refresh_timer();    //更新超时时间
     //printf("读取到了数据: %s\n", m_read_buf);
     m_request_cnt++;
     EMlog(LOGLEVEL_INFO, "sock_fd = %d read done. request cnt = %d\n", m_sockfd, m_request_cnt);    // 全部读取完毕
     return true;
 }
 
+//只在一个请求的第一批数据到达时取令牌(请求体的后续数据、请求行没有读完时不算)。
+//超过速率的请求不解析，直接发送预先生成的429并关闭连接，不进入线程池的队列
+bool http_conn::admit() {
+    if (!m_limiter || !m_limiter->enabled() || m_h2_active || m_check_state != CHECK_STATE_REQUESTLINE || m_check_index != 0) {
+        return true;
+    }
+    if (m_limiter->allow(m_address)) {
+        return true;
+    }
+    int len;
+    const char* resp = rate_limiter::response(&len);
+    send_some(resp, len, MSG_NOSIGNAL | MSG_DONTWAIT);     //发送缓冲区此时是空的，发不出去也不重试
+    if (m_capture_id) {
+        m_capture->response(m_capture_id, 429, len);
+    }
+    EMlog(LOGLEVEL_INFO, "sock_fd = %d rate limited\n", m_sockfd);
+    return false;
+}
+
+int http_conn::priority() {
+    if (!m_priority || m_h2_active) {
+        return priority_rules::NORMAL;
+    }
+    if (m_check_state == CHECK_STATE_REQUESTLINE && m_check_index == 0) {
+        int len = m_read_idx;
+        if (m_reactor_op == EPOLLIN) {
+            //Reactor 模型：数据还在socket中等工作线程读，先窥视到读缓冲区的空闲部分(不移动 m_read_idx，read() 会读到同样的数据)
+            int n = recv(m_sockfd, m_read_buf + m_read_idx, m_read_buffer_size - m_read_idx, MSG_PEEK | MSG_DONTWAIT);
+            len += n > 0 ? n : 0;
+        }
+        m_prio = m_priority->classify(m_read_buf, len);
+    }
+    return m_prio;
+}
+
+//只有还没有开始解析的请求直接回复503并关闭连接；HTTP/2、读了一半的请求体、转发中的请求已经占用了资源，照常处理
+bool http_conn::expire(http_conn* conn) {
+    if (conn->m_h2_active || conn->m_proxying || conn->m_check_state != CHECK_STATE_REQUESTLINE || conn->m_check_index != 0) {
+        return false;
+    }
+    EMlog(LOGLEVEL_INFO, "sock_fd = %d queued past deadline\n", conn->m_sockfd);
+    conn->m_linger = false;
+    if (!conn->process_write(SERVICE_UNAVAILABLE)) {
+        return false;
+    }
+    if (conn->m_profile) {
+        conn->m_profile->begin_response(conn->m_sockfd, &conn->m_segs_start);
+    }
+    conn->rearm(EPOLLOUT);
+    return true;
+}
+
+//事件循环(io_uring)已经把数据收到了自己的缓冲区，这里只做拷贝，语义与read()相同
+//放不下的部分由事件循环暂存，等请求体窗口腾出空间后再交进来
+int http_conn::feed(const char* data, int len) {
+    int room = m_read_buffer_size - m_read_idx;
+    if (room == 0 && m_check_state != CHECK_STATE_CONTENT) {
+        return -1;      //请求头把读缓冲区占满了，与read()读满时一样按出错处理
+    }
+    if (len > room) {
+        len = room;
+    }
+    if (m_read_idx == 0 && m_check_state == CHECK_STATE_REQUESTLINE && len > 0) {
+        m_request_start = time(NULL);
+    }
+    memcpy(m_read_buf + m_read_idx, data, len);
+    if (m_capture_id && !m_h2_active && len > 0) {
+        m_capture->data(m_capture_id, data, len);
+    }
+    m_read_idx += len;
+    refresh_timer();
+    m_request_cnt++;
+    EMlog(LOGLEVEL_INFO, "sock_fd = %d feed %d bytes. request cnt = %d\n", m_sockfd, len, m_request_cnt);
+    return len;
+}
+
+//推进TLS握手(事件循环线程)，需要对方的数据时等可读，发送缓冲区满时等可写。
+//完成后检查 OpenSSL 是否把发送方向交给了内核(kTLS)，之后的响应直接 writev
+bool http_conn::handshake() {
+    if (!m_ssl) {
+        return false;
+    }
+    ERR_clear_error();
+    int ret = SSL_do_handshake(m_ssl);
+    if (ret == 1) {
+        m_handshaking = false;
+#ifndef OPENSSL_NO_KTLS
+        m_ktls_send = BIO_get_ktls_send(SSL_get_wbio(m_ssl));
+#endif
+        m_tls->handshake_done(m_ssl, m_ktls_send);
+        modfd(m_epollfd, m_sockfd, input_event());
+        return true;
+    }
+    switch (SSL_get_error(m_ssl, ret)) {
+        case SSL_ERROR_WANT_READ:
+            modfd(m_epollfd, m_sockfd, EPOLLIN);
+            return true;
+        case SSL_ERROR_WANT_WRITE:
+            modfd(m_epollfd, m_sockfd, EPOLLOUT);
+            return true;
+        default:
+            EMlog(LOGLEVEL_INFO, "sock_fd = %d TLS handshake failed\n", m_sockfd);
+            ERR_clear_error();
+            return false;
+    }
+}
+
+bool http_conn::tls_pending() const {
+    return m_ssl && !m_handshaking && bytes_to_send == 0 && !m_proxying && SSL_has_pending(m_ssl);
+}
+
+//SSL 缓冲中还有解密好(或已收到)的数据时 socket 不会再报告可读，
+//借可写事件(几乎总是就绪)让事件循环接着读，事件循环对这种连接按可读处理
+int http_conn::input_event() const {
+    return tls_pending() ? EPOLLOUT : EPOLLIN;
+}
+
+int http_conn::recv_some(char* buf, int len) {
+    if (!m_ssl) {
+        return recv(m_sockfd, buf, len, 0);
+    }
+    ERR_clear_error();
+    return ssl_result(SSL_read(m_ssl, buf, len));
+}
+
+int http_conn::send_some(const char* buf, int len, int flags) {
+    if (!m_ssl || m_ktls_send) {
+        return send(m_sockfd, buf, len, flags);
+    }
+    ERR_clear_error();
+    return ssl_result(SSL_write(m_ssl, buf, len));
+}
+
+//没有 kTLS 的 HTTPS 连接每次把第一个未发完的内存块交给 SSL_write(允许部分写入)，
+//调用方按返回值 advance_iov 后继续；WANT_WRITE 重试时传入的是同一块数据
+int http_conn::send_iov() {
+    if (!m_ssl || m_ktls_send) {
+        return writev(m_sockfd, m_iov, m_iv_count);
+    }
+    for (int i = 0; i < m_iv_count; i++) {
+        if (m_iov[i].iov_len > 0) {
+            int len = m_iov[i].iov_len > (1 << 30) ? (1 << 30) : (int)m_iov[i].iov_len;
+            return send_some((const char*)m_iov[i].iov_base, len, 0);
+        }
+    }
+    return 0;
+}
+
+int http_conn::ssl_result(int ret) {
+    if (ret > 0) {
+        return ret;
+    }
+    switch (SSL_get_error(m_ssl, ret)) {
+        case SSL_ERROR_WANT_READ:
+        case SSL_ERROR_WANT_WRITE:
+            errno = EAGAIN;
+            return -1;
+        case SSL_ERROR_ZERO_RETURN:
+            return 0;       //对方发送了 close_notify
+        default:
+            ERR_clear_error();
+            errno = ECONNRESET;
+            return -1;
+    }
+}
+
+//收发了数据，按当前阶段的期限更新定时器
+void http_conn::refresh_timer() {
+    m_last_io = time(NULL);
+    if (t_off_loop) {
+        return;     //工作线程不修改定时器链表，定时器到期时 on_timeout 按新的期限推迟
+    }
+    arm_timer(m_last_io);
+}
+
+//定时器设为当前阶段的期限，但最晚 3 * timeslot 后检查一次：
+//线程池中开始的转发等阶段变化不经过事件循环，由到期时的 on_timeout 重新计算
+void http_conn::arm_timer(time_t now) {
+    if (timer) {
+        time_t expire = deadline();
+        time_t check = now + 3 * config::current().timeslot;
+        timer->expire = expire < check ? expire : check;
+        m_timer_lst.adjust_timer(timer);
+    }
+}
+
+//连接当前所处的阶段(见 PHASE)
+int http_conn::phase() const {
+    if (m_proxying) {
+        return PHASE_PROXY;
+    }
+    if (m_h2_active) {
+        return bytes_to_send > 0 ? PHASE_SEND : PHASE_KEEPALIVE;   //HTTP/2 的请求头都在帧里，一次收完
+    }
+    if (bytes_to_send > 0) {
+        return PHASE_SEND;
+    }
+    if (m_check_state == CHECK_STATE_CONTENT) {
+        return PHASE_BODY;
+    }
+    if (m_check_state != CHECK_STATE_REQUESTLINE || m_read_idx > 0 || m_served == 0) {
+        return PHASE_HEADER;
+    }
+    return PHASE_KEEPALIVE;
+}
+
+//当前阶段的期限。请求头和长连接空闲是固定的期限；请求体和响应按速率下限，
+//每收发 min_*_rate 字节多给一秒，另外留出 3 * timeslot 的余量；速率下限为0时退回到空闲超时
+time_t http_conn::deadline() const {
+    const config& cfg = config::current();
+    int idle = 3 * cfg.timeslot;
+    switch (phase()) {
+        case PHASE_PROXY:
+            if (m_proxy_waiting) {
+                return m_proxy->last_active() + cfg.proxy_timeout;
+            }
+            return m_last_io + (cfg.proxy_timeout > idle ? cfg.proxy_timeout : idle);
+        case PHASE_SEND:
+            if (cfg.min_send_rate > 0) {
+                return m_send_start + idle + bytes_have_send / cfg.min_send_rate;
+            }
+            return m_last_io + idle;
+        case PHASE_BODY:
+            if (cfg.min_body_rate > 0) {
+                return m_body_start_time + idle + m_body_received / cfg.min_body_rate;
+            }
+            return m_last_io + idle;
+        case PHASE_HEADER:
+            if (m_read_idx > 0 || m_check_state != CHECK_STATE_REQUESTLINE) {
+                return m_request_start + cfg.header_timeout;
+            }
+            return m_idle_start + cfg.header_timeout;
+        default:
+            return m_idle_start + cfg.keepalive_timeout;
+    }
+}
+
+int http_conn::timeout_ms() const {
+    long long left = (long long)(deadline() - time(NULL)) * 1000;
+    return left > 0 ? (int)left : 0;
+}
+
 //主状态机，解析HTTP请求
 http_conn::HTTP_CODE http_conn::process_read() {
     LINE_STATUS line_status = LINE_OK;
@@ -170,6 +564,15 @@ http_conn::HTTP_CODE http_conn::process_read() {
             || ((line_status = parse_line()) == LINE_OK)) {  //一行一行的解析
             //解析到了一行完整的数据， 或者解析到了请求体，也是完成的数据
 
+            //请求体不按行解析，窗口中有多少就交给sink多少
+            if (m_check_state == CHECK_STATE_CONTENT) {
+                ret = parse_content();
+                if (ret == GET_REQUEST) {
+                    return complete_request();
+                }
+                return ret;
+            }
+
             //获取一行数据
             text = get_line();
 
@@ -191,21 +594,12 @@ http_conn::HTTP_CODE http_conn::process_read() {
                 case CHECK_STATE_HEADER:
                 {
                     ret = parse_headers(text);
-                    if (ret == BAD_REQUEST) {
-                        return BAD_REQUEST;
-                    }
-                    else if (ret == GET_REQUEST) {
-                        return do_request();    //解析具体的请求信息
-                    }
-                    break;
-                }
-                case CHECK_STATE_CONTENT:
-                {
-                    ret = parse_content(text);
                     if (ret == GET_REQUEST) {
-                        return do_request();
+                        return complete_request();    //解析具体的请求信息
+                    }
+                    else if (ret != NO_REQUEST) {
+                        return ret;
                     }
-                    line_status = LINE_OPEN;
                     break;
                 }
                 default:
@@ -227,8 +621,13 @@ http_conn::HTTP_CODE http_conn::parse_request_line(char* text) {
     // GET\0/index.html HTTP/1.1
     *m_url++ = '\0';        // 置位空字符，字符串结束符
     char* method = text;
-    //判断是否是get请求方法，strcasecmp忽略大小写比较(strcmp)
+    //判断请求方法，strcasecmp忽略大小写比较(strcmp)
     if (strcasecmp(method, "GET") == 0) m_method = GET;
+    else if (strcasecmp(method, "POST") == 0) m_method = POST;
+    else if (strcasecmp(method, "HEAD") == 0) m_method = HEAD;
+    else if (strcasecmp(method, "PUT") == 0) m_method = PUT;
+    else if (strcasecmp(method, "DELETE") == 0) m_method = DELETE;
+    else if (strcasecmp(method, "OPTIONS") == 0) m_method = OPTIONS;
     else return BAD_REQUEST;
 
     // /index.html HTTP/1.1
@@ -258,20 +657,32 @@ http_conn::HTTP_CODE http_conn::parse_request_line(char* text) {
 
 
 }
+//记录请求头(指向读缓冲区)，供请求处理函数查询和转发给上游，超过 MAX_HEADERS 的忽略
+void http_conn::record_header(const char* text) {
+    const char* colon = strchr(text, ':');
+    if (!colon) {
+        return;
+    }
+    if (m_header_count == MAX_HEADERS) {
+        m_headers_truncated = true;
+        return;
+    }
+    http_header& h = m_cold->headers[m_header_count++];
+    h.name = text;
+    h.name_len = colon - text;
+    h.value = colon + 1 + strspn(colon + 1, " \t");
+}
+
 //解析HTTP请求头      
 http_conn::HTTP_CODE http_conn::parse_headers(char* text) {
     //遇到空行，表示头部字段解析完毕
     if (text[0] == '\0') {
-        //如果HTTP请求有消息体，则还需要读取m_content_length字节的消息体
-        //状态机转移到CHECK_STATE_CONTENT状态
-        if (m_content_length != 0) {
-            m_check_state = CHECK_STATE_CONTENT;
-            return NO_REQUEST;
-        }
+        //如果HTTP请求有消息体，状态机转移到CHECK_STATE_CONTENT状态流式接收，
         //否则说明我们已经得到了一个完整的HTTP请求
-        return GET_REQUEST;
+        return begin_body();
     }
-    else if (strncasecmp(text, "Connection:", 11) == 0) {
+    record_header(text);
+    if (strncasecmp(text, "Connection:", 11) == 0) {
         //处理Connection头部字段， Connection: keep-alive
         text += 11;
         text += strspn(text, " \t");
@@ -283,7 +694,65 @@ http_conn::HTTP_CODE http_conn::parse_headers(char* text) {
         //处理Content-Length头部字段
         text += 15;
         text += strspn(text, " \t");
-        m_content_length = atol(text);
+        char* end;
+        m_content_length = strtoll(text, &end, 10);
+        if (end == text || *end || m_content_length < 0) {
+            return BAD_REQUEST;
+        }
+    }
+    else if (strncasecmp(text, "Transfer-Encoding:", 18) == 0) {
+        //只支持 chunked，其它编码无法确定请求体的边界
+        text += 18;
+        text += strspn(text, " \t");
+        if (strcasecmp(text, "chunked") != 0) {
+            return BAD_REQUEST;
+        }
+        m_chunked = true;
+    }
+    else if (strncasecmp(text, "Expect:", 7) == 0) {
+        text += 7;
+        text += strspn(text, " \t");
+        if (strcasecmp(text, "100-continue") == 0) {
+            m_expect_continue = true;
+        }
+    }
+    else if (strncasecmp(text, "Range:", 6) == 0) {
+        //处理Range头部字段， Range: bytes=0-499
+        text += 6;
+        text += strspn(text, " \t");
+        m_range = text;
+    }
+    else if (strncasecmp(text, "If-None-Match:", 14) == 0) {
+        text += 14;
+        text += strspn(text, " \t");
+        m_if_none_match = text;
+    }
+    else if (strncasecmp(text, "If-Modified-Since:", 18) == 0) {
+        text += 18;
+        text += strspn(text, " \t");
+        m_if_modified_since = text;
+    }
+    else if (strncasecmp(text, "If-Range:", 9) == 0) {
+        text += 9;
+        text += strspn(text, " \t");
+        m_if_range = text;
+    }
+    else if (strncasecmp(text, "Accept-Encoding:", 16) == 0) {
+        text += 16;
+        text += strspn(text, " \t");
+        m_accept_encoding = text;
+    }
+    else if (strncasecmp(text, "Upgrade:", 8) == 0) {
+        text += 8;
+        text += strspn(text, " \t");
+        if (strcasecmp(text, "h2c") == 0) {
+            m_h2_upgrade = true;
+        }
+    }
+    else if (strncasecmp(text, "HTTP2-Settings:", 15) == 0) {
+        text += 15;
+        text += strspn(text, " \t");
+        m_h2_settings = text;
     }
     else if (strncasecmp(text, "Host:", 5) == 0) {
         //处理Host头部字段
@@ -298,100 +767,847 @@ http_conn::HTTP_CODE http_conn::parse_headers(char* text) {
     }
     return NO_REQUEST;
 } 
-//解析HTTP请求体，没有真正的解析，只是判断是否被完整读入           
-http_conn::HTTP_CODE http_conn::parse_content(char* text) {
-    if (m_read_idx >= (m_content_length + m_check_index)) {
-        text[m_content_length] = '\0';
+//请求头解析完毕：POST/PUT 先打开sink，请求体还没有到达时按 Expect: 100-continue 通知客户端开始发送。
+//在读请求体之前就拒绝的请求(405/413等)，请求体留在socket里，响应后必须关闭连接
+http_conn::HTTP_CODE http_conn::begin_body() {
+    bool has_body = m_chunked || m_content_length > 0;
+    if (m_router) {
+        m_route = m_router->match(m_url, strcspn(m_url, "?#"));
+    }
+    //代理路由：GET 的目标在根目录中存在时仍然作为静态文件，其余请求转发给上游
+    upstream* up = NULL;
+    if (m_route && m_route->fn[m_method] == proxy_handler) {
+        up = (upstream*)m_route->arg[m_method];
+        m_route = NULL;
+        if (m_method == GET && static_exists()) {
+            up = NULL;
+        }
+    }
+    //HTTP/2 的流只处理不带请求体、不转发的请求，其余的让客户端改用 HTTP/1.1
+    if (m_stream && (up || has_body)) {
+        return HTTP1_REQUIRED;
+    }
+    //h2c Upgrade：只在明文连接上切换，带请求体或转发的请求忽略 Upgrade，按 HTTP/1.1 回复
+    if (m_h2_upgrade && m_h2_settings && m_http2 && !m_ssl && !m_stream && !m_draining && !up && !has_body &&
+        !m_headers_truncated) {
+        return H2_UPGRADE;
+    }
+    int max_body = m_route ? m_router->max_body : config::current().max_body_size;
+    if (!m_chunked && max_body > 0 && m_content_length > max_body) {
+        m_linger = false;
+        return BODY_TOO_LARGE;
+    }
+    if (up) {
+        HTTP_CODE ret = begin_proxy(up);
+        if (ret != NO_REQUEST) {
+            m_linger = false;
+            return ret;
+        }
+    }
+    else if (m_route) {
+        //处理函数需要完整的请求体，缓存在内存中
+        if (!m_route->fn[m_method]) {
+            m_allow = m_route->allow;
+            m_linger = false;
+            return METHOD_NOT_ALLOWED;
+        }
+        if (has_body) {
+            m_sink = m_arena.create<memory_sink>(&m_arena, m_chunked || max_body <= 0 ? 0 : (size_t)m_content_length);
+        }
+    }
+    else if (m_method == POST || m_method == PUT) {
+        char key[FILENAME_LEN];
+        if (!doc_index::normalize(m_url, key, FILENAME_LEN)) {
+            m_linger = false;
+            return BAD_REQUEST;
+        }
+        HTTP_CODE ret = open_sink(key);
+        if (ret != NO_REQUEST) {
+            m_linger = false;
+            return ret;
+        }
+    }
+    else if (m_method != GET) {
+        m_allow = m_upload_dir ? "GET, POST, PUT" : "GET";
+        m_linger = false;
+        return METHOD_NOT_ALLOWED;
+    }
+    if (!has_body) {
         return GET_REQUEST;
     }
+
+    //客户端可能不等100就直接发送，已经收到请求体时不再发送
+    if (m_expect_continue && m_check_index == m_read_idx) {
+        int len = strlen(continue_100);
+        if (send_some(continue_100, len, MSG_NOSIGNAL) != len) {
+            //发送缓冲区此时是空的，几乎不会失败；即使失败客户端等待超时后也会发送请求体
+            EMlog(LOGLEVEL_WARN, "sock_fd = %d send 100 Continue failed\n", m_sockfd);
+        }
+    }
+    m_body_start = m_check_index;
+    m_start_line = m_check_index;
+    m_body_left = m_chunked ? 0 : m_content_length;
+    m_chunk_state = CHUNK_SIZE;
+    m_check_state = CHECK_STATE_CONTENT;
+    m_body_start_time = time(NULL);
     return NO_REQUEST;
-}           
+}
 
-//解析具体某行，判断依据\r\n
-http_conn::LINE_STATUS http_conn::parse_line() {
-    char temp;
-    for (; m_check_index < m_read_idx; m_check_index++) {   //检查的索引小于读到的索引
-        temp = m_read_buf[m_check_index];           //遍历缓冲区字符
-        if (temp == '\r') {
-            if (m_check_index + 1 == m_read_idx) {  //回车符是已经读到的最后一个字符，表示行数据尚不完整
-                return LINE_OPEN;
+//在上传目录中打开目标文件的临时文件
+http_conn::HTTP_CODE http_conn::open_sink(const char* key) {
+    if (!m_upload_dir) {
+        return METHOD_NOT_ALLOWED;
+    }
+    file_sink* sink = m_arena.create<file_sink>(&m_arena);
+    int err = sink->open(m_upload_dir, key);
+    if (err != 0) {
+        arena::destroy(sink);
+        if (err == ENOENT) {
+            return NO_RESOURCE;         //目标所在的目录不存在
+        }
+        return err == EISDIR || err == EACCES ? FORBIDDEN_REQUEST : INTERNAL_ERROR;
+    }
+    m_upload_existed = sink->existed();
+    m_sink = sink;
+    return NO_REQUEST;
+}
+
+//流式接收请求体：把读缓冲区中请求头之后的数据交给sink，然后把窗口腾空继续读，
+//读缓冲区的大小就是每个上传占用的全部内存
+http_conn::HTTP_CODE http_conn::parse_content() {
+    HTTP_CODE ret;
+    if (m_chunked) {
+        ret = parse_chunked();
+    }
+    else {
+        long long avail = m_read_idx - m_check_index;
+        int len = avail < m_body_left ? avail : m_body_left;
+        ret = deliver_body(m_read_buf + m_check_index, len);
+        m_check_index += len;
+        m_start_line = m_check_index;
+        m_body_left -= len;
+        if (ret == NO_REQUEST && m_body_left == 0) {
+            ret = GET_REQUEST;
+        }
+    }
+
+    if (ret == NO_REQUEST) {
+        compact_body();
+        if (m_read_idx >= m_read_buffer_size) {
+            ret = BAD_REQUEST;      //一个块大小行或trailer行把整个窗口占满了
+        }
+    }
+    if (ret != NO_REQUEST && ret != GET_REQUEST) {
+        abort_body();
+        m_linger = false;           //请求体没有读完，不能继续在这个连接上解析下一个请求
+    }
+    return ret;
+}
+
+//chunked 解码：
+//  块大小(十六进制)[;扩展]\r\n  块数据\r\n  ...  0\r\n  [trailer\r\n]  \r\n
+//块大小行和trailer借用parse_line按行解析，块数据直接交给sink
+http_conn::HTTP_CODE http_conn::parse_chunked() {
+    while (true) {
+        if (m_chunk_state == CHUNK_DATA) {
+            long long avail = m_read_idx - m_check_index;
+            if (avail == 0) {
+                return NO_REQUEST;
             }
-            else if (m_read_buf[m_check_index + 1] == '\n') {   //当前检查到\r\n
-                m_read_buf[m_check_index++] = '\0';             //\r 变 \0 index++
-                m_read_buf[m_check_index++] = '\0';             //\n 变 \0 index++，到下一行的起始位置
-                return LINE_OK;
+            int len = avail < m_body_left ? avail : m_body_left;
+            HTTP_CODE ret = deliver_body(m_read_buf + m_check_index, len);
+            if (ret != NO_REQUEST) {
+                return ret;
             }
-            return LINE_BAD;
+            m_check_index += len;
+            m_start_line = m_check_index;
+            m_body_left -= len;
+            if (m_body_left == 0) {
+                m_chunk_state = CHUNK_DATA_END;
+            }
+            continue;
         }
-        else if (temp == '\n') {
-            if ((m_check_index > 1) && (m_read_buf[m_check_index - 1] == '\r')) {   //上一次读取的数据行不完整，刚好\r\n在不容数据的结尾和开头的情况
-                m_read_buf[m_check_index - 1] = '\0';       //\r 变 \0 index++
-                m_read_buf[m_check_index++] = '\0';         //\n 变 \0 index++，到下一行的起始位置
-                return LINE_OK;
+
+        LINE_STATUS line_status = parse_line();
+        if (line_status == LINE_OPEN) {
+            return NO_REQUEST;
+        }
+        if (line_status == LINE_BAD) {
+            return BAD_REQUEST;
+        }
+        char* text = get_line();
+        m_start_line = m_check_index;
+
+        switch (m_chunk_state) {
+            case CHUNK_SIZE:
+            {
+                char* end;
+                errno = 0;
+                long long size = strtoll(text, &end, 16);
+                if (end == text || size < 0 || errno == ERANGE || (*end && *end != ';' && *end != ' ' && *end != '\t')) {
+                    return BAD_REQUEST;
+                }
+                m_body_left = size;
+                m_chunk_state = size == 0 ? CHUNK_TRAILER : CHUNK_DATA;
+                break;
             }
-            return LINE_BAD;
+            case CHUNK_DATA_END:
+            {
+                if (text[0] != '\0') {
+                    return BAD_REQUEST;     //块数据比声明的长
+                }
+                m_chunk_state = CHUNK_SIZE;
+                break;
+            }
+            case CHUNK_TRAILER:
+            {
+                if (text[0] == '\0') {
+                    return GET_REQUEST;     //最后的空行，请求体结束
+                }
+                break;                      //trailer 字段忽略
+            }
+            default:
+                return INTERNAL_ERROR;
         }
-        
     }
-    return LINE_OPEN;       //没有到结束符，数据尚不完整
-}                        
+}
 
-// 当得到一个完整、正确的HTTP请求时，我们就分析目标文件的属性，
-// 如果目标文件存在、对所有用户可读，且不是目录，则使用mmap将其
-// 映射到内存地址m_file_address处，并告诉调用者获取文件成功
-/*
-char doc_root[256] = "";
-char * path = getenv("PWD");
-strcpy(doc_root, path);
-strcat(doc_root, "/resources");
-chdir(doc_root);  //切换工作目录
-*/ 
-http_conn::HTTP_CODE http_conn::do_request() {
-    // "/home/x/WebServer/resources"
-    char temp[256] = "";
-    char * path = getenv("PWD");
-    strcpy(temp, path);
-    strcat(temp, "/resources");
-    const char* doc_root = temp;
-
-    strcpy(m_real_file, doc_root);
-    int len = strlen(doc_root);
-    strncpy(m_real_file + len, m_url, FILENAME_LEN - len - 1);  //拼接目录
-    //获取m_real_file文件的相关的状态信息，-1失败，0成功
-    if (stat(m_real_file, &m_file_stat) < 0) {
+//交付一段请求体。没有sink时(如带请求体的GET)读完即丢弃
+http_conn::HTTP_CODE http_conn::deliver_body(const char* data, int len) {
+    if (len == 0) {
         return NO_REQUEST;
     }
+    m_body_received += len;
+    int max_body = m_route ? m_router->max_body : config::current().max_body_size;
+    if (max_body > 0 && m_body_received > max_body) {
+        return BODY_TOO_LARGE;      //chunked 请求体事先不知道长度，超过上限时才能发现
+    }
+    if (m_proxying) {
+        m_proxy->body(data, len);   //发送缓冲发完之前不会再读客户端，这里最多多出一个读缓冲区
+    }
+    else if (m_sink && !m_sink->write(data, len)) {
+        return INTERNAL_ERROR;
+    }
+    return NO_REQUEST;
+}
 
-    //判断访问权限
-    if (!(m_file_stat.st_mode & S_IROTH)) {
-        return FORBIDDEN_REQUEST;
+//窗口中已交付的数据不再需要：把还没处理完的部分(不完整的块大小行等)移到窗口开头
+void http_conn::compact_body() {
+    int shift = m_start_line - m_body_start;
+    if (shift > 0) {
+        memmove(m_read_buf + m_body_start, m_read_buf + m_start_line, m_read_idx - m_start_line);
+        m_read_idx -= shift;
+        m_check_index -= shift;
+        m_start_line = m_body_start;
     }
+}
 
-    //判断是否是目录  判断是否为普通文件S_ISREG
-    if (S_ISDIR(m_file_stat.st_mode)) {
-        return BAD_REQUEST;
+void http_conn::abort_body() {
+    end_proxy(false);
+    if (m_sink) {
+        m_sink->abort();
+        arena::destroy(m_sink);
+        m_sink = NULL;
     }
-    /*
-    在这可加中文UTF-8转成16进制，16进制转成10进制，即可识别中文
-    */
-    //以只读方式打开文件
-    int fd = open(m_real_file, O_RDONLY);
-    //创建内存映射
-    m_file_address = (char*)mmap(0, m_file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
-    close(fd);          //关闭打开的网站资源文件
-    return FILE_REQUEST;
 }
 
-//对内存映射区执行munmap操作
-void http_conn::unmap() {
-    if (m_file_address) {
-        munmap(m_file_address, m_file_stat.st_size);
-        m_file_address = 0;
+//请求完整接收后的去处：上游、处理函数、上传或静态文件
+http_conn::HTTP_CODE http_conn::complete_request() {
+    if (m_proxying) {
+        m_proxy->end_body();
+        return PROXY_REQUEST;
+    }
+    if (m_route) {
+        return do_handler();
     }
+    return m_sink ? do_upload() : do_request();
 }
 
-// 根据服务器处理HTTP请求的结果，决定返回给客户端的内容
-bool http_conn::process_write(HTTP_CODE ret) {
+//调用注册的处理函数，响应写入 m_cold->response
+http_conn::HTTP_CODE http_conn::do_handler() {
+    request_view req;
+    req.method = m_method;
+    req.method_name = method_names[m_method];
+    req.path = m_url;
+    req.path_len = strcspn(m_url, "?#");
+    req.subpath = m_url + m_route->prefix_len;
+    req.subpath_len = req.path_len - m_route->prefix_len;
+    req.query = m_url[req.path_len] == '?' ? m_url + req.path_len + 1 : "";
+    memory_sink* body = static_cast<memory_sink*>(m_sink);
+    req.body = body ? body->data() : "";
+    req.body_len = body ? body->size() : 0;
+    req.peer = &m_address;
+    req.headers = m_cold->headers;
+    req.header_count = m_header_count;
+
+    m_route->fn[m_method](req, m_cold->response, m_route->arg[m_method]);
+
+    if (m_sink) {
+        arena::destroy(m_sink);
+        m_sink = NULL;
+    }
+    return HANDLER_REQUEST;
+}
+
+//请求体已完整写入临时文件，rename 到目标文件
+http_conn::HTTP_CODE http_conn::do_upload() {
+    bool ok = m_sink->finish();
+    arena::destroy(m_sink);
+    m_sink = NULL;
+    if (!ok) {
+        return INTERNAL_ERROR;
+    }
+    EMlog(LOGLEVEL_INFO, "sock_fd = %d upload %s done, %lld bytes\n", m_sockfd, m_url, m_body_received);
+    return UPLOAD_DONE;
+}
+
+//请求的目标是否是根目录(或打包文件)中的静态文件
+bool http_conn::static_exists() {
+    char key[FILENAME_LEN];
+    if (!doc_index::normalize(m_url, key, FILENAME_LEN)) {
+        return false;
+    }
+    if (m_bundles) {
+        bundle* b = m_bundles->acquire();
+        if (!b) {
+            return false;
+        }
+        bundle::file f;
+        bool found = b->lookup(key, false, &f);
+        b->release();
+        return found;
+    }
+    doc_index::doc_entry entry;
+    return m_doc_index && m_doc_index->lookup(key, &entry);
+}
+
+//不转发给上游的请求头：逐跳头部由本服务器与上游之间重新决定，请求体的长度和编码按转发的方式重新生成
+static bool skip_forward_header(const char* name, int len) {
+    static const char* names[] = { "Connection", "Keep-Alive", "Proxy-Connection", "TE", "Trailer",
+                                   "Transfer-Encoding", "Upgrade", "Content-Length", "Expect", "X-Forwarded-For" };
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+        if ((int)strlen(names[i]) == len && strncasecmp(name, names[i], len) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+//改写请求头并取一个上游连接，请求体随后由 deliver_body 交给 m_proxy
+http_conn::HTTP_CODE http_conn::begin_proxy(upstream* up) {
+    if (m_headers_truncated) {
+        return BAD_REQUEST;     //丢掉一部分请求头再转发会改变请求的含义
+    }
+    if (!m_proxy) {
+        m_proxy = new proxy_session;
+    }
+    std::string& out = m_proxy->request();
+    out.clear();
+    out.append(method_names[m_method]);
+    out.append(" ");
+    out.append(m_url);
+    out.append(" HTTP/1.1\r\n");
+
+    const char* forwarded = NULL;
+    bool has_host = false;
+    for (int i = 0; i < m_header_count; i++) {
+        const http_header& h = m_cold->headers[i];
+        if (h.name_len == 15 && strncasecmp(h.name, "X-Forwarded-For", 15) == 0) {
+            forwarded = h.value;
+        }
+        if (skip_forward_header(h.name, h.name_len)) {
+            continue;
+        }
+        if (h.name_len == 4 && strncasecmp(h.name, "Host", 4) == 0) {
+            has_host = true;
+        }
+        out.append(h.name, h.name_len);
+        out.append(": ");
+        out.append(h.value);
+        out.append("\r\n");
+    }
+    if (!has_host) {
+        out.append("Host: localhost\r\n");     //HTTP/1.0 客户端可能不带 Host，HTTP/1.1 的上游要求有
+    }
+    //客户端地址追加在已有的 X-Forwarded-For 之后
+    char ip[16] = "";
+    inet_ntop(AF_INET, &m_address.sin_addr, ip, sizeof(ip));
+    out.append("X-Forwarded-For: ");
+    if (forwarded && *forwarded) {
+        out.append(forwarded);
+        out.append(", ");
+    }
+    out.append(ip);
+    out.append("\r\n");
+
+    proxy_session::BODY body = proxy_session::BODY_NONE;
+    if (m_chunked) {
+        out.append("Transfer-Encoding: chunked\r\n");
+        body = proxy_session::BODY_CHUNKED;
+    }
+    else if (m_content_length > 0 || m_method == POST || m_method == PUT) {
+        char line[48];
+        snprintf(line, sizeof(line), "Content-Length: %lld\r\n", m_content_length);
+        out.append(line);
+        body = m_content_length > 0 ? proxy_session::BODY_LENGTH : proxy_session::BODY_NONE;
+    }
+    out.append("\r\n");
+
+    if (!m_proxy->start(up, body, m_method == HEAD, m_linger && !m_draining)) {
+        out.clear();
+        return BAD_GATEWAY;
+    }
+    m_proxying = true;
+    EMlog(LOGLEVEL_INFO, "sock_fd = %d proxy %s %s to %s, upstream fd = %d\n",
+          m_sockfd, method_names[m_method], m_url, up->name(), m_proxy->fd());
+    return NO_REQUEST;
+}
+
+//结束转发。上游socket先从epoll中删除，放回连接池后可能被别的连接取走
+void http_conn::end_proxy(bool reuse) {
+    if (!m_proxying) {
+        return;
+    }
+    if (m_epollfd >= 0 && m_proxy->fd() >= 0) {
+        epoll_ctl(m_epollfd, EPOLL_CTL_DEL, m_proxy->fd(), 0);
+    }
+    m_proxy->finish(reuse);
+    m_proxying = false;
+    m_proxy_waiting = false;
+}
+
+//上游socket与客户端socket注册在同一个epoll中，事件的 data 带上 UPSTREAM_EVENT 标记和客户端fd。
+//客户端socket此时没有注册任何事件(EPOLLONESHOT)，所以同一时刻只有一个线程处理这个连接
+void http_conn::arm_upstream(int ev) {
+    epoll_event event;
+    event.data.u64 = UPSTREAM_EVENT | (unsigned int)m_sockfd;
+    event.events = ev | EPOLLONESHOT | EPOLLRDHUP | EPOLLET;
+    m_proxy_waiting = true;
+    int fd = m_proxy->fd();
+    if (epoll_ctl(m_epollfd, EPOLL_CTL_MOD, fd, &event) < 0 && errno == ENOENT) {
+        epoll_ctl(m_epollfd, EPOLL_CTL_ADD, fd, &event);   //新连接(或换了连接重试)第一次等待
+    }
+}
+
+//推进转发，把 proxy_session 的结果翻译成事件循环的下一步
+int http_conn::proxy_step() {
+    switch (m_proxy->step()) {
+        case proxy_session::NEED_BODY:
+            return PROXY_READ;
+        case proxy_session::WAIT_READ:
+            return PROXY_UPSTREAM_IN;
+        case proxy_session::WAIT_WRITE:
+            return PROXY_UPSTREAM_OUT;
+        case proxy_session::SEND:
+            if (m_proxy->head_pending() && m_profile) {
+                m_profile->begin_response(m_sockfd, &m_segs_start);
+            }
+            m_resp_status = m_proxy->status();
+            m_iov = m_cold->iv;
+            m_iv_count = m_proxy->fill_iov(m_cold->iv);
+            bytes_to_send = m_proxy->bytes();
+            return PROXY_WRITE;
+        case proxy_session::DONE:
+            m_linger = m_linger && m_proxy->keep_client();
+            end_proxy(true);
+            return PROXY_DONE;
+        default:
+            break;
+    }
+    //响应已经开始发送时无法再改成502，只能关闭连接让客户端知道响应不完整
+    bool started = m_proxy->started();
+    end_proxy(false);
+    if (started) {
+        return PROXY_CLOSE;
+    }
+    m_linger = false;       //请求体可能没有读完
+    if (!process_write(BAD_GATEWAY)) {
+        return PROXY_CLOSE;
+    }
+    if (m_profile) {
+        m_profile->begin_response(m_sockfd, &m_segs_start);
+    }
+    return PROXY_WRITE;
+}
+
+//epoll 后端：推进转发，按结果注册客户端或上游socket的事件
+bool http_conn::proxy_continue() {
+    m_proxy_waiting = false;
+    switch (proxy_step()) {
+        case PROXY_READ:
+            modfd(m_epollfd, m_sockfd, input_event());
+            return true;
+        case PROXY_WRITE:
+            modfd(m_epollfd, m_sockfd, EPOLLOUT);
+            return true;
+        case PROXY_UPSTREAM_IN:
+            arm_upstream(EPOLLIN);
+            return true;
+        case PROXY_UPSTREAM_OUT:
+            arm_upstream(EPOLLOUT);
+            return true;
+        case PROXY_DONE:
+            if (!write_done()) {
+                return false;
+            }
+            modfd(m_epollfd, m_sockfd, input_event());
+            return true;
+        default:
+            return false;
+    }
+}
+
+//等待上游超时：还没有向客户端发出响应时改为504
+bool http_conn::proxy_timeout() {
+    m_timeouts[PHASE_PROXY]++;
+    if (m_proxy->started()) {
+        return false;
+    }
+    EMlog(LOGLEVEL_WARN, "sock_fd = %d upstream fd = %d timed out\n", m_sockfd, m_proxy->fd());
+    end_proxy(false);
+    m_linger = false;
+    if (!process_write(GATEWAY_TIMEOUT)) {
+        return false;
+    }
+    if (m_profile) {
+        m_profile->begin_response(m_sockfd, &m_segs_start);
+    }
+    return true;
+}
+
+//定时器到期(事件循环线程)。阶段变了或期限随收发的数据推后了(例如上游还在陆续发数据)就推迟定时器；
+//等待上游超时回复504；其余情况按所处阶段计数，由调用方关闭连接
+bool http_conn::on_timeout() {
+    if (!timer) {
+        return false;
+    }
+    time_t now = time(NULL);
+    if (deadline() > now) {
+        arm_timer(now);
+        return true;
+    }
+    if (!m_proxying || !m_proxy_waiting) {
+        count_timeout();
+        return false;
+    }
+    if (!proxy_timeout()) {
+        return false;
+    }
+    refresh_timer();
+    modfd(m_epollfd, m_sockfd, EPOLLOUT);
+    return true;
+}
+
+//解析具体某行，判断依据\r\n
+http_conn::LINE_STATUS http_conn::parse_line() {
+    char temp;
+    for (; m_check_index < m_read_idx; m_check_index++) {   //检查的索引小于读到的索引
+        temp = m_read_buf[m_check_index];           //遍历缓冲区字符
+        if (temp == '\r') {
+            if (m_check_index + 1 == m_read_idx) {  //回车符是已经读到的最后一个字符，表示行数据尚不完整
+                return LINE_OPEN;
+            }
+            else if (m_read_buf[m_check_index + 1] == '\n') {   //当前检查到\r\n
+                m_read_buf[m_check_index++] = '\0';             //\r 变 \0 index++
+                m_read_buf[m_check_index++] = '\0';             //\n 变 \0 index++，到下一行的起始位置
+                return LINE_OK;
+            }
+            return LINE_BAD;
+        }
+        else if (temp == '\n') {
+            if ((m_check_index > 1) && (m_read_buf[m_check_index - 1] == '\r')) {   //上一次读取的数据行不完整，刚好\r\n在不容数据的结尾和开头的情况
+                m_read_buf[m_check_index - 1] = '\0';       //\r 变 \0 index++
+                m_read_buf[m_check_index++] = '\0';         //\n 变 \0 index++，到下一行的起始位置
+                return LINE_OK;
+            }
+            return LINE_BAD;
+        }
+        
+    }
+    return LINE_OPEN;       //没有到结束符，数据尚不完整
+}                        
+
+// 当得到一个完整、正确的HTTP请求时，我们就在根目录索引中查找目标文件，
+// 如果目标文件存在、对所有用户可读，则使用mmap将其
+// 映射到内存地址m_file_address处，并告诉调用者获取文件成功
+http_conn::HTTP_CODE http_conn::do_request() {
+    //URL规范化：百分号解码(可识别中文文件名)、去掉查询串、处理 . 和 ..
+    char key[FILENAME_LEN];
+    if (!doc_index::normalize(m_url, key, FILENAME_LEN)) {
+        return BAD_REQUEST;
+    }
+    if (m_bundles) {
+        return do_bundle_request(key);
+    }
+    //索引中只有根目录下的普通文件，未命中直接404，不访问文件系统
+    doc_index::doc_entry entry;
+    if (!m_doc_index || !m_doc_index->lookup(key, &entry)) {
+        return NO_RESOURCE;
+    }
+    memcpy(m_cold->real_file, entry.path, FILENAME_LEN);
+    m_cold->file_stat = entry.st;
+
+    //判断访问权限
+    if (!(m_cold->file_stat.st_mode & S_IROTH)) {
+        return FORBIDDEN_REQUEST;
+    }
+
+    //条件请求：客户端缓存仍然有效时直接返回304，不打开、不映射文件
+    make_etag();
+    if (not_modified()) {
+        return NOT_MODIFIED;
+    }
+
+    //Range请求：范围不可满足时直接返回416，不打开文件
+    HTTP_CODE range_ret = FILE_REQUEST;
+    if (m_range && m_if_range && !if_range_match()) {
+        m_range = 0;        //If-Range 不一致，说明文件已变化，返回整个文件
+    }
+    if (m_range) {
+        range_ret = parse_range(m_cold->file_stat.st_size);
+        if (range_ret == RANGE_NOT_SATISFIABLE) {
+            return RANGE_NOT_SATISFIABLE;
+        }
+    }
+    m_mime = entry.mime;
+    if (m_cold->file_stat.st_size == 0) {
+        m_file_address = 0;
+        return range_ret;       //空文件不能mmap，只发送响应头
+    }
+    //以只读方式打开文件，索引刷新前文件可能已被删除
+    int fd = open(m_cold->real_file, O_RDONLY);
+    if (fd < 0) {
+        return NO_RESOURCE;
+    }
+    //创建内存映射
+    //mmap只建立映射，Range请求只会缺页读入所需范围的页，不会读取前面不需要的部分
+    m_file_address = (char*)mmap(0, m_cold->file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);          //关闭打开的网站资源文件
+    if (m_file_address == MAP_FAILED) {
+        m_file_address = 0;
+        return INTERNAL_ERROR;
+    }
+    return range_ret;
+}
+
+//Accept-Encoding 中是否接受gzip(q=0 表示不接受)
+static bool accepts_gzip(const char* value) {
+    const char* p = value;
+    while (p && *p) {
+        p += strspn(p, " \t,");
+        int len = strcspn(p, " \t,;");
+        if ((len == 4 && strncasecmp(p, "gzip", 4) == 0) || (len == 1 && *p == '*')) {
+            const char* q = p + len;
+            q += strspn(q, " \t");
+            if (*q == ';') {
+                q += 1 + strspn(q + 1, " \t");
+                if (strncasecmp(q, "q=", 2) == 0 && strtod(q + 2, NULL) == 0) {
+                    return false;
+                }
+            }
+            return true;
+        }
+        p = strchr(p, ',');
+    }
+    return false;
+}
+
+//从打包文件中取目标文件：元数据、ETag和部分响应头都已预先生成，数据直接指向打包文件的映射区
+http_conn::HTTP_CODE http_conn::do_bundle_request(const char* key) {
+    bundle* b = m_bundles->acquire();
+    if (!b) {
+        return NO_RESOURCE;
+    }
+    //Range请求总是针对原始内容，不使用gzip版本
+    bool gzip = !m_range && m_accept_encoding && accepts_gzip(m_accept_encoding);
+    bundle::file f;
+    if (!b->lookup(key, gzip, &f)) {
+        b->release();
+        return NO_RESOURCE;
+    }
+    m_bundle = b;       //响应发送完后在unmap中释放
+    memset(&m_cold->file_stat, 0, sizeof(m_cold->file_stat));
+    m_cold->file_stat.st_mode = S_IFREG | 0444;
+    m_cold->file_stat.st_size = f.size;
+    m_cold->file_stat.st_mtime = f.mtime;
+    snprintf(m_cold->etag, sizeof(m_cold->etag), "%s", f.etag);
+    m_validators = f.headers;
+    m_validators_len = f.headers_len;
+
+    if (not_modified()) {
+        return NOT_MODIFIED;
+    }
+    HTTP_CODE range_ret = FILE_REQUEST;
+    if (m_range && m_if_range && !if_range_match()) {
+        m_range = 0;
+    }
+    if (m_range) {
+        range_ret = parse_range(m_cold->file_stat.st_size);
+        if (range_ret == RANGE_NOT_SATISFIABLE) {
+            return RANGE_NOT_SATISFIABLE;
+        }
+    }
+    m_mime = f.mime;
+    m_file_address = (char*)f.data;
+    return range_ret;
+}
+
+//ETag 由 inode、大小、修改时间组成。修改时间就在当前这一秒内时文件可能仍在被写入，
+//同一秒内的两次修改无法区分，此时只给出弱ETag
+void http_conn::make_etag() {
+    bool weak = m_cold->file_stat.st_mtime >= time(NULL) - 1;
+    snprintf(m_cold->etag, sizeof(m_cold->etag), "%s\"%lx-%llx-%llx\"", weak ? "W/" : "",
+             (unsigned long)m_cold->file_stat.st_ino, (unsigned long long)m_cold->file_stat.st_size,
+             (unsigned long long)m_cold->file_stat.st_mtime);
+}
+
+//解析HTTP日期，如 Sun, 06 Nov 1994 08:49:37 GMT，失败返回-1
+static time_t parse_http_date(const char* text) {
+    struct tm tm;
+    memset(&tm, 0, sizeof(tm));
+    if (!strptime(text, "%a, %d %b %Y %H:%M:%S GMT", &tm)) {
+        return -1;
+    }
+    return timegm(&tm);
+}
+
+//比较两个ETag，weak为true时忽略W/前缀(弱比较)
+static bool etag_equal(const char* a, int a_len, const char* b, bool weak) {
+    int b_len = strlen(b);
+    bool a_weak = a_len > 2 && strncmp(a, "W/", 2) == 0;
+    bool b_weak = b_len > 2 && strncmp(b, "W/", 2) == 0;
+    if (!weak && (a_weak || b_weak)) {
+        return false;
+    }
+    if (a_weak) { a += 2; a_len -= 2; }
+    if (b_weak) { b += 2; b_len -= 2; }
+    return a_len == b_len && strncmp(a, b, a_len) == 0;
+}
+
+//If-None-Match 优先：列表中任一ETag弱匹配即为未修改；否则看 If-Modified-Since
+bool http_conn::not_modified() {
+    if (m_if_none_match) {
+        const char* p = m_if_none_match;
+        while (*p) {
+            p += strspn(p, " \t,");
+            if (!*p) {
+                break;
+            }
+            int len = strcspn(p, " \t,");
+            if ((len == 1 && *p == '*') || etag_equal(p, len, m_cold->etag, true)) {
+                return true;
+            }
+            p += len;
+        }
+        return false;
+    }
+    if (m_if_modified_since) {
+        time_t since = parse_http_date(m_if_modified_since);
+        return since != -1 && m_cold->file_stat.st_mtime <= since;
+    }
+    return false;
+}
+
+//If-Range 为ETag时要求强匹配，为日期时要求与修改时间完全一致
+bool http_conn::if_range_match() {
+    if (m_if_range[0] == '"' || strncmp(m_if_range, "W/", 2) == 0) {
+        return etag_equal(m_if_range, strlen(m_if_range), m_cold->etag, false);
+    }
+    return parse_http_date(m_if_range) == m_cold->file_stat.st_mtime;
+}
+
+//解析 Range: bytes=a-b, a-, -n
+//语法错误或范围过多时忽略Range返回整个文件(FILE_REQUEST)，全部范围超出文件大小时返回416
+http_conn::HTTP_CODE http_conn::parse_range(off_t file_size) {
+    if (strncasecmp(m_range, "bytes=", 6) != 0) {
+        return FILE_REQUEST;
+    }
+    char* p = m_range + 6;
+    int specs = 0;
+    m_range_count = 0;
+    while (*p) {
+        p += strspn(p, " \t,");
+        if (!*p) {
+            break;
+        }
+        specs++;
+        off_t start, end;
+        char* endp;
+        if (*p == '-') {
+            //后缀范围：最后n个字节
+            long long n = strtoll(p + 1, &endp, 10);
+            if (endp == p + 1 || n < 0) {
+                return FILE_REQUEST;
+            }
+            if (n == 0 || file_size == 0) {
+                p = endp;
+                continue;       //不可满足
+            }
+            start = n >= file_size ? 0 : file_size - n;
+            end = file_size - 1;
+        }
+        else {
+            long long a = strtoll(p, &endp, 10);
+            if (endp == p || *endp != '-' || a < 0) {
+                return FILE_REQUEST;
+            }
+            p = endp + 1;
+            long long b = file_size - 1;
+            if (*p >= '0' && *p <= '9') {
+                b = strtoll(p, &endp, 10);
+                if (b < a) {
+                    return FILE_REQUEST;    //语法无效，整个Range头忽略
+                }
+            }
+            else {
+                endp = p;
+            }
+            if (a >= file_size) {
+                p = endp;
+                continue;       //不可满足
+            }
+            start = a;
+            end = b >= file_size ? file_size - 1 : b;
+        }
+        p = endp;
+        p += strspn(p, " \t");
+        if (*p && *p != ',') {
+            return FILE_REQUEST;
+        }
+
+        if (m_range_count == MAX_RANGES) {
+            m_range_count = 0;
+            return FILE_REQUEST;    //范围太多，直接返回整个文件
+        }
+        m_cold->ranges[m_range_count].start = start;
+        m_cold->ranges[m_range_count].end = end;
+        m_range_count++;
+    }
+
+    if (m_range_count > 0) {
+        return PARTIAL_REQUEST;
+    }
+    return specs > 0 ? RANGE_NOT_SATISFIABLE : FILE_REQUEST;
+}
+
+//对内存映射区执行munmap操作
+void http_conn::unmap() {
+    if (m_bundle) {
+        m_bundle->release();    //数据属于打包文件的映射区，不能munmap
+        m_bundle = NULL;
+        m_file_address = 0;
+    }
+    else if (m_file_address) {
+        munmap(m_file_address, m_cold->file_stat.st_size);
+        m_file_address = 0;
+    }
+    m_cold->response.reset();
+}
+
+// 根据服务器处理HTTP请求的结果，决定返回给客户端的内容
+bool http_conn::process_write(HTTP_CODE ret) {
+    m_send_start = time(NULL);
+    m_requests.fetch_add(1, std::memory_order_relaxed);
     switch (ret)
     {
         case INTERNAL_ERROR:
@@ -422,51 +1638,193 @@ bool http_conn::process_write(HTTP_CODE ret) {
                 return false;
             }
             break;
+        case RANGE_NOT_SATISFIABLE:
+            add_status_line( 416, error_416_title );
+            add_response( "Content-Range: bytes */%lld\r\n", (long long)m_cold->file_stat.st_size );
+            add_headers( strlen( error_416_form ) );
+            if ( ! add_content( error_416_form ) ) {
+                return false;
+            }
+            break;
+        case METHOD_NOT_ALLOWED:
+            add_status_line( 405, error_405_title );
+            add_response( "Allow: %s\r\n", m_allow );
+            add_headers( strlen( error_405_form ) );
+            if ( ! add_content( error_405_form ) ) {
+                return false;
+            }
+            break;
+        case BODY_TOO_LARGE:
+            add_status_line( 413, error_413_title );
+            add_headers( strlen( error_413_form ) );
+            if ( ! add_content( error_413_form ) ) {
+                return false;
+            }
+            break;
+        case BAD_GATEWAY:
+            add_status_line( 502, error_502_title );
+            add_headers( strlen( error_502_form ) );
+            if ( ! add_content( error_502_form ) ) {
+                return false;
+            }
+            break;
+        case GATEWAY_TIMEOUT:
+            add_status_line( 504, error_504_title );
+            add_headers( strlen( error_504_form ) );
+            if ( ! add_content( error_504_form ) ) {
+                return false;
+            }
+            break;
+        case SERVICE_UNAVAILABLE:
+            add_status_line( 503, error_503_title );
+            add_response( "Retry-After: 1\r\n" );
+            add_headers( strlen( error_503_form ) );
+            if ( ! add_content( error_503_form ) ) {
+                return false;
+            }
+            break;
+        case UPLOAD_DONE:       //新建返回201，覆盖已有文件返回204，都没有响应体
+            if (m_upload_existed) {
+                add_status_line( 204, ok_204_title );
+                add_linger();
+                add_blank_line();
+            }
+            else {
+                add_status_line( 201, ok_201_title );
+                add_content_length( 0 );
+                add_linger();
+                add_blank_line();
+            }
+            break;
+        case NOT_MODIFIED:      //客户端缓存有效，只发送头部
+            add_status_line( 304, not_modified_304_title );
+            add_validators();
+            add_linger();
+            add_blank_line();
+            break;
         case FILE_REQUEST:      //请求服务器文件
             add_status_line(200, ok_200_title );
-            add_headers(m_file_stat.st_size);
+            add_response( "Accept-Ranges: bytes\r\n" );
+            add_validators();
+            add_headers(m_cold->file_stat.st_size);
             //对两块内存进行封装
-            m_iv[ 0 ].iov_base = m_write_buf;   //起始地址
-            m_iv[ 0 ].iov_len = m_write_idx;    //长度
-            m_iv[ 1 ].iov_base = m_file_address;
-            m_iv[ 1 ].iov_len = m_file_stat.st_size;
+            m_cold->iv[ 0 ].iov_base = m_write_buf;   //起始地址
+            m_cold->iv[ 0 ].iov_len = m_write_idx;    //长度
+            m_cold->iv[ 1 ].iov_base = m_file_address;
+            m_cold->iv[ 1 ].iov_len = m_cold->file_stat.st_size;
             m_iv_count = 2;                     //内存块数
 
-            bytes_to_send = m_write_idx + m_file_stat.st_size;  //响应头的大小 + 文件的大小
+            bytes_to_send = m_write_idx + m_cold->file_stat.st_size;  //响应头的大小 + 文件的大小
 
             return true;
+        case HANDLER_REQUEST:   //处理函数拼好的响应，各段直接交给writev
+            m_cold->response.seal(m_linger);
+            m_resp_status = m_cold->response.status_code();
+            m_iov = m_cold->response.iov();
+            m_iv_count = m_cold->response.iov_count();
+            bytes_to_send = m_cold->response.bytes();
+            return true;
+        case PARTIAL_REQUEST:   //请求文件的部分内容
+            add_status_line( 206, ok_206_title );
+            add_response( "Accept-Ranges: bytes\r\n" );
+            add_validators();
+            return add_ranges();
         default:
             return false;
     }
 
-    m_iv[ 0 ].iov_base = m_write_buf;
-    m_iv[ 0 ].iov_len = m_write_idx;
+    m_cold->iv[ 0 ].iov_base = m_write_buf;
+    m_cold->iv[ 0 ].iov_len = m_write_idx;
     m_iv_count = 1;
     bytes_to_send = m_write_idx;
     return true;
 }
+//206响应：单个范围用Content-Range，多个范围用multipart/byteranges
+//文件数据直接指向mmap区域的对应偏移，不经过用户态拷贝
+bool http_conn::add_ranges() {
+    long long file_size = m_cold->file_stat.st_size;
+    if (m_range_count == 1) {
+        const byte_range& r = m_cold->ranges[0];
+        long long len = r.end - r.start + 1;
+        add_response( "Content-Range: bytes %lld-%lld/%lld\r\n", (long long)r.start, (long long)r.end, file_size );
+        add_headers( len );
+        m_cold->iv[ 0 ].iov_base = m_write_buf;
+        m_cold->iv[ 0 ].iov_len = m_write_idx;
+        m_cold->iv[ 1 ].iov_base = m_file_address + r.start;
+        m_cold->iv[ 1 ].iov_len = len;
+        m_iv_count = 2;
+        bytes_to_send = m_write_idx + len;
+        return true;
+    }
+
+    //各分段头写入m_part_buf，与文件数据交替排列
+    int part_idx = 0;
+    long long body_len = 0;
+    m_iv_count = 1;
+    for (int i = 0; i < m_range_count; i++) {
+        const byte_range& r = m_cold->ranges[i];
+        int len = snprintf( m_cold->part_buf + part_idx, PART_BUFFER_SIZE - part_idx,
+                            "%s--%s\r\nContent-Type: %s\r\nContent-Range: bytes %lld-%lld/%lld\r\n\r\n",
+                            i == 0 ? "" : "\r\n", byteranges_boundary, m_mime,
+                            (long long)r.start, (long long)r.end, file_size );
+        if ( len >= PART_BUFFER_SIZE - part_idx ) {
+            return false;
+        }
+        m_cold->iv[ m_iv_count ].iov_base = m_cold->part_buf + part_idx;
+        m_cold->iv[ m_iv_count ].iov_len = len;
+        m_cold->iv[ m_iv_count + 1 ].iov_base = m_file_address + r.start;
+        m_cold->iv[ m_iv_count + 1 ].iov_len = r.end - r.start + 1;
+        m_iv_count += 2;
+        part_idx += len;
+        body_len += len + (r.end - r.start + 1);
+    }
+    int len = snprintf( m_cold->part_buf + part_idx, PART_BUFFER_SIZE - part_idx, "\r\n--%s--\r\n", byteranges_boundary );
+    if ( len >= PART_BUFFER_SIZE - part_idx ) {
+        return false;
+    }
+    m_cold->iv[ m_iv_count ].iov_base = m_cold->part_buf + part_idx;
+    m_cold->iv[ m_iv_count ].iov_len = len;
+    m_iv_count++;
+    body_len += len;
+
+    add_content_length( body_len );
+    add_response( "Content-Type: multipart/byteranges; boundary=%s\r\n", byteranges_boundary );
+    add_linger();
+    add_blank_line();
+    m_cold->iv[ 0 ].iov_base = m_write_buf;
+    m_cold->iv[ 0 ].iov_len = m_write_idx;
+    bytes_to_send = m_write_idx + body_len;
+    return true;
+}
+
 //写回HTTP响应，非阻塞写
 bool http_conn::write() {
     int temp = 0;
 
-    //更新超时时间
-    if (timer) {
-        time_t cur_time = time(NULL);
-        timer->expire = cur_time + 3 * TIMESLOT;
-        m_timer_lst.adjust_timer(timer);
-    }
+    refresh_timer();    //更新超时时间
 
-    EMlog(LOGLEVEL_INFO, "sock_fd = %d writing %d bytes. request cnt = %d\n", m_sockfd, bytes_to_send, m_request_cnt);
+    EMlog(LOGLEVEL_INFO, "sock_fd = %d writing %lld bytes. request cnt = %d\n", m_sockfd, bytes_to_send, m_request_cnt);
 
+    if (bytes_to_send == 0 && m_proxying) {
+        return proxy_continue();
+    }
+    if (bytes_to_send == 0 && m_h2_active) {
+        if (!h2_continue()) {
+            return false;
+        }
+        if (bytes_to_send == 0) {
+            return true;
+        }
+    }
     if (bytes_to_send == 0) {
         //如果即将要发送的字符为0，这一次响应结束
-        modfd(m_epollfd, m_sockfd, EPOLLIN);    //修改监听连接为读
-        init();         //
+        init();
+        modfd(m_epollfd, m_sockfd, input_event());    //修改监听连接为读，之后其它线程可能接手(Reactor)，放在最后
         return true;
     }
     while (1) {
         //分散写
-        temp = writev(m_sockfd, m_iv, m_iv_count);
+        temp = send_iov();
         if (temp <= -1) {
             //如果TCP写缓冲没有空间，则等待下一轮EPOLLOUT事件，虽然在此期间服务器无法立即接收
             //同一客户的下一个请求，但可以保证里拦截的完整性。
@@ -478,45 +1836,81 @@ bool http_conn::write() {
             return false;
         }
 
-        bytes_have_send += temp;
-        bytes_to_send -= temp;
-
-        if (bytes_have_send >= m_iv[0].iov_len) {   //发完头部了
-            m_iv[0].iov_len = 0;                    //更新两个发送内存块的信息
-            m_iv[1].iov_base = m_file_address + (bytes_have_send - m_write_idx);    //已经发了部分的响应体数据
-            m_iv[1].iov_len = bytes_to_send;
-        }
-        else {      //还未发完头部
-            m_iv[0].iov_base = m_write_buf + bytes_have_send;
-            m_iv[0].iov_len = m_iv[0].iov_len - temp;
+        advance_iov(temp);
+        if (bytes_to_send <= 0 && m_proxying) {
+            return proxy_continue();    //这一批响应发完，读上游的下一批
         }
-    if (bytes_to_send <= 0) {
-            // 没有数据要发送了
-            unmap();
-            modfd(m_epollfd, m_sockfd, EPOLLIN);
-
-            if (m_linger)
-            {
-                init();
-                return true;
+        if (bytes_to_send <= 0 && m_h2_active) {
+            //这一批帧发完：h2_continue 准备了下一批时接着发
+            if (!h2_continue()) {
+                return false;
             }
-            else
-            {
+            if (bytes_to_send > 0) {
+                continue;
+            }
+            return true;
+        }
+        if (bytes_to_send <= 0) {
+            // 没有数据要发送了，长连接收尾后再注册读事件
+            if (!write_done()) {
                 return false;
             }
+            modfd(m_epollfd, m_sockfd, input_event());
+            return true;
+        }
+    }
+}
+
+//已经发送了bytes字节，跳过已发完的内存块，调整第一个未发完的内存块
+void http_conn::advance_iov(int bytes) {
+    bytes_have_send += bytes;
+    bytes_to_send -= bytes;
+    m_resp_bytes += bytes;
+
+    for (int i = 0; i < m_iv_count && bytes > 0; i++) {
+        if ((size_t)bytes >= m_iov[i].iov_len) {
+            bytes -= m_iov[i].iov_len;
+            m_iov[i].iov_len = 0;
+        }
+        else {
+            m_iov[i].iov_base = (char*)m_iov[i].iov_base + bytes;
+            m_iov[i].iov_len -= bytes;
+            bytes = 0;
         }
     }
 }
 
+//响应发送完毕，释放内存映射；长连接则重置状态继续服务，否则返回false由调用方关闭连接
+void http_conn::finish_response() {
+    if (m_profile) {
+        m_profile->end_response(m_sockfd, m_segs_start);
+    }
+    if (m_capture_id) {
+        m_capture->response(m_capture_id, m_resp_status, m_resp_bytes);
+    }
+    unmap();
+}
+
+bool http_conn::write_done() {
+    finish_response();
+    if (m_linger) {
+        m_served++;
+        init();
+        refresh_timer();    //进入长连接空闲，期限可能比发送时短
+        return true;
+    }
+    return false;
+}
+
 //往写缓冲区中写入待发送的数据
 bool http_conn::add_response(const char* format, ...) {
-    if (m_write_idx >= WRITE_BUFFER_SIZE) {     //写缓冲区满了
+    if (m_write_idx >= m_write_buffer_size) {     //写缓冲区满了
         return false;
     }
     va_list arg_list;                   //可变参数，格式化文本
     va_start(arg_list, format);         //添加文本到写缓冲区m_write_buf中
-    int len = vsnprintf(m_write_buf + m_write_idx, WRITE_BUFFER_SIZE - 1 - m_write_idx, format, arg_list);
-    if (len >= (WRITE_BUFFER_SIZE - 1 - m_write_idx)) {
+    int len = vsnprintf(m_write_buf + m_write_idx, m_write_buffer_size - 1 - m_write_idx, format, arg_list);
+    if (len >= (m_write_buffer_size - 1 - m_write_idx)) {
         return false;                   //没写完，已经满了
     }
     m_write_idx += len;                 //更新下次写数据的起始位置
@@ -525,10 +1919,11 @@ bool http_conn::add_response(const char* format, ...) {
 }
 
 bool http_conn::add_status_line(int status, const char* title) {
+    m_resp_status = status;
     return add_response("%s %d %s\r\n", "HTTP/1.1", status, title);
 }
 
-bool http_conn::add_headers(int content_len) {
+bool http_conn::add_headers(off_t content_len) {
     add_content_length(content_len);
     add_content_type();
     add_linger();
@@ -536,8 +1931,30 @@ bool http_conn::add_headers(int content_len) {
     return true;
 }
 
-bool http_conn::add_content_length(int content_len) {
-    return add_response( "Content-Length: %d\r\n", content_len );
+bool http_conn::add_content_length(off_t content_len) {
+    return add_response( "Content-Length: %lld\r\n", (long long)content_len );
+}
+
+bool http_conn::add_validators() {
+    if (m_validators) {
+        //打包文件中已生成好的 ETag/Last-Modified(以及 Content-Encoding/Vary)
+        if (!add_response("%.*s", m_validators_len, m_validators)) {
+            return false;
+        }
+    }
+    else {
+        char date[64];
+        struct tm tm;
+        gmtime_r(&m_cold->file_stat.st_mtime, &tm);
+        strftime(date, sizeof(date), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+        if (!add_response("ETag: %s\r\nLast-Modified: %s\r\n", m_cold->etag, date)) {
+            return false;
+        }
+    }
+    if (m_max_age >= 0) {
+        return add_response("Cache-Control: max-age=%d\r\n", m_max_age);
+    }
+    return true;
 }
 
 bool http_conn::add_linger()
@@ -556,27 +1973,270 @@ bool http_conn::add_content( const char* content )
 }
 
 bool http_conn::add_content_type() {
-    return add_response("Content-Type:%s\r\n", "text/html");
+    return add_response("Content-Type:%s\r\n", m_mime);
 }
 
 //处理客户端请求，解析报文并封装客户端需要的数据
 //由线程池中的工作线程调用，这是处理HTTP请求的入口函数
 void http_conn::process() {
+    if (m_reactor_op && !reactor_io()) {
+        return;
+    }
 
-    //解析HTTP请求
-    HTTP_CODE read_ret = process_read();
-    if (read_ret == NO_REQUEST) {
-        modfd(m_epollfd, m_sockfd, EPOLLIN);    //继续监听事件
+    //解析HTTP请求并生成响应
+    HTTP_CODE ret = process_inline();
+    if (ret == NO_REQUEST) {
+        rearm(input_event());    //继续监听事件
+        return;
+    }
+    if (ret == PROXY_REQUEST) {
+        if (!proxy_continue()) {
+            close_conn();
+            if (timer) {
+                m_timer_lst.del_timer(timer);
+            }
+        }
         return;
     }
 
-    //生成响应
-    bool write_ret = process_write(read_ret);
-    if (!write_ret) {
+    if (ret == CLOSED_CONNECTION) {
+        if (m_process_done) {
+            m_process_done(this, 0);    //由事件循环线程关闭连接
+            return;
+        }
         close_conn();
         if (timer) {
             m_timer_lst.del_timer(timer);   //移除其对应的定时器
         }
     }
-    modfd(m_epollfd, m_sockfd, EPOLLOUT);   //重置EPOLLONESHOT
-} 
+    else if (write_direct()) {
+        return;
+    }
+    rearm(EPOLLOUT);   //重置EPOLLONESHOT
+}
+
+//可读时读完数据，返回true接着解析(限流和分类已由事件循环在放入线程池之前做过)；可写时发送剩余的响应，返回false。
+//出错时 shutdown 后重新注册，事件循环收到 EPOLLHUP 后关闭连接(关闭要移除定时器，只由事件循环做)
+bool http_conn::reactor_io() {
+    int op = m_reactor_op;
+    m_reactor_op = 0;
+    t_off_loop = true;
+    bool ok = op == EPOLLOUT ? write() : read();
+    t_off_loop = false;
+    if (!ok) {
+        shutdown(m_sockfd, SHUT_RDWR);
+        rearm(EPOLLIN);
+        return false;
+    }
+    return op != EPOLLOUT;
+}
+
+//发送缓冲区通常有空间，小响应一次 writev 就能发完，省掉注册EPOLLOUT的 epoll_ctl、事件循环多一次唤醒和连接在两个线程间的迁移。
+//只处理发完后保持长连接的普通响应：要关闭连接的、TLS(kTLS 除外)、HTTP/2、反向代理、非epoll后端仍交给事件循环。
+//发送出错时也交给事件循环，由它的 write() 再次遇到错误后关闭连接。
+//定时器链表只由事件循环线程修改，这里只更新 m_last_io，定时器到期时 on_timeout 按新的期限推迟
+bool http_conn::write_direct() {
+    if (!m_direct_write || m_process_done || !m_linger || m_h2_active || m_proxying || (m_ssl && !m_ktls_send) ||
+        bytes_to_send <= 0) {
+        return false;
+    }
+    while (bytes_to_send > 0) {
+        int temp = send_iov();
+        if (temp < 0) {
+            if (errno == EAGAIN) {
+                m_direct_eagain.fetch_add(1, std::memory_order_relaxed);
+            }
+            return false;       //已发送的部分记在 m_iov 中，事件循环从断点继续
+        }
+        advance_iov(temp);
+    }
+    m_direct_done.fetch_add(1, std::memory_order_relaxed);
+    finish_response();
+    m_served++;
+    init();
+    rearm(input_event());   //重新注册后事件循环随时可能接手，之后不能再访问连接
+    return true;
+}
+
+//解析请求，完整时生成响应。返回 NO_REQUEST 表示请求不完整，CLOSED_CONNECTION 表示生成响应失败需关闭连接，
+//PROXY_REQUEST 表示请求正在转发(包括请求体还没有读完)，由调用方按 proxy_step 推进
+http_conn::HTTP_CODE http_conn::process_inline() {
+    if (m_h2_active) {
+        return process_h2();
+    }
+    //HTTP/2 连接序言只出现在连接的最开始(prior knowledge，或 TLS 的 ALPN 选择了 h2)
+    if (m_http2 && m_served == 0 && m_check_state == CHECK_STATE_REQUESTLINE && m_check_index == 0) {
+        int preface = h2_session::preface(m_read_buf, m_read_idx);
+        if (preface == 0) {
+            return NO_REQUEST;
+        }
+        if (preface > 0) {
+            return begin_h2(false);
+        }
+    }
+    HTTP_CODE read_ret = process_read();
+    if (read_ret == NO_REQUEST) {
+        return m_proxying ? PROXY_REQUEST : NO_REQUEST;
+    }
+    if (read_ret == PROXY_REQUEST) {
+        return PROXY_REQUEST;
+    }
+    if (read_ret == H2_UPGRADE) {
+        read_ret = begin_h2(true);
+        if (read_ret != BAD_REQUEST) {
+            return read_ret;
+        }
+    }
+    if (m_draining) {
+        m_linger = false;   //旧进程正在退出，响应后关闭连接，客户端重连到新进程
+    }
+    if (!process_write(read_ret)) {
+        return CLOSED_CONNECTION;
+    }
+    if (m_profile && bytes_to_send > 0) {
+        m_profile->begin_response(m_sockfd, &m_segs_start);
+    }
+    return read_ret;
+}
+
+//epoll 后端直接修改监听事件，其它后端通过回调交还给事件循环
+void http_conn::rearm(int ev) {
+    if (m_process_done) {
+        m_process_done(this, ev);
+        return;
+    }
+    modfd(m_epollfd, m_sockfd, ev);
+}
+
+//切换到 HTTP/2。h2c Upgrade 时升级请求按解析出的请求行和请求头重新拼成文本(读缓冲区已被解析改写)，
+//作为流1处理；请求之后已经收到的数据(客户端的连接序言)留给 HTTP/2
+http_conn::HTTP_CODE http_conn::begin_h2(bool upgrade) {
+    if (!m_h2) {
+        m_h2 = new h2_session;
+    }
+    if (m_capture_id) {
+        m_capture->h2(m_capture_id);    //之后是 HTTP/2 的帧，不再记录
+    }
+    if (!upgrade) {
+        m_h2->start(m_address);
+        m_h2_active = true;
+        EMlog(LOGLEVEL_INFO, "sock_fd = %d http2\n", m_sockfd);
+        return process_h2();
+    }
+    std::string request(method_names[m_method]);
+    request.append(" ");
+    request.append(m_url);
+    request.append(" HTTP/1.1\r\n");
+    for (int i = 0; i < m_header_count; i++) {
+        const http_header& h = m_cold->headers[i];
+        if ((h.name_len == 7 && strncasecmp(h.name, "Upgrade", 7) == 0) ||
+            (h.name_len == 10 && strncasecmp(h.name, "Connection", 10) == 0) ||
+            (h.name_len == 14 && strncasecmp(h.name, "HTTP2-Settings", 14) == 0)) {
+            continue;
+        }
+        request.append(h.name, h.name_len);
+        request.append(": ");
+        request.append(h.value);
+        request.append("\r\n");
+    }
+    request.append("\r\n");
+    if (!m_h2->upgrade(m_address, m_h2_settings, request)) {
+        m_linger = false;
+        return BAD_REQUEST;
+    }
+    m_h2_active = true;
+    m_read_idx -= m_check_index;
+    memmove(m_read_buf, m_read_buf + m_check_index, m_read_idx);
+    EMlog(LOGLEVEL_INFO, "sock_fd = %d upgrade to h2c\n", m_sockfd);
+    return process_h2();
+}
+
+//工作线程：读缓冲区中的数据全部交给 h2_session(不完整的帧由它保存)，准备第一批要发送的帧
+http_conn::HTTP_CODE http_conn::process_h2() {
+    m_h2->on_input(m_read_buf, m_read_idx);
+    m_read_idx = 0;
+    if (m_draining) {
+        m_h2->shutdown();   //旧进程正在退出：GOAWAY，已开启的流发完后关闭，之后的请求客户端到新进程上重开
+    }
+    m_idle_start = time(NULL);
+    if (h2_fill()) {
+        return H2_FRAMES;
+    }
+    return m_h2->closing() ? CLOSED_CONNECTION : NO_REQUEST;
+}
+
+bool http_conn::h2_fill() {
+    int bytes = m_h2->fill();
+    if (bytes == 0) {
+        return false;
+    }
+    m_iov = m_h2->iov();
+    m_iv_count = m_h2->iov_count();
+    bytes_to_send = bytes;
+    bytes_have_send = 0;
+    m_send_start = time(NULL);
+    return true;
+}
+
+bool http_conn::input_ready() const {
+    if (m_read_idx > 0 || tls_pending()) {
+        return true;
+    }
+    char c;
+    int ret = recv(m_sockfd, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+    return ret >= 0 || (errno != EAGAIN && errno != EWOULDBLOCK);   //连接关闭或出错也交给 read() 发现
+}
+
+//一批帧发完(事件循环线程)。客户端发来了帧时先交给线程池处理，其中可能有新的流、窗口更新或 RST_STREAM；
+//否则在各流的窗口内接着组织下一批；都没有时等待客户端的数据
+bool http_conn::h2_continue() {
+    m_idle_start = time(NULL);
+    if (!m_h2->closing() && input_ready()) {
+        modfd(m_epollfd, m_sockfd, input_event());
+        return true;
+    }
+    if (h2_fill()) {
+        return true;
+    }
+    if (m_h2->closing()) {
+        return false;
+    }
+    modfd(m_epollfd, m_sockfd, input_event());
+    return true;
+}
+
+http_conn::HTTP_CODE http_conn::run_stream(const std::string& request, const sockaddr_in& peer) {
+    m_sockfd = -1;
+    m_address = peer;
+    m_profile = NULL;
+    m_tls = NULL;
+    m_handshaking = false;
+    m_stream = true;
+    m_served = 0;
+    m_capture_id = 0;
+    timer = NULL;
+    init();
+    HTTP_CODE ret = BAD_REQUEST;    //还原的请求头放不进读缓冲区
+    if ((int)request.size() < m_read_buffer_size) {
+        memcpy(m_read_buf, request.data(), request.size());
+        m_read_idx = request.size();
+        ret = process_read();
+        if (ret == NO_REQUEST) {
+            ret = BAD_REQUEST;
+        }
+    }
+    if (ret == HTTP1_REQUIRED) {
+        return ret;
+    }
+    if (!process_write(ret)) {
+        unmap();
+        return CLOSED_CONNECTION;
+    }
+    return ret;
+}
+
+//流的响应发完或流被重置
+void http_conn::end_stream() {
+    abort_body();
+    unmap();
+}
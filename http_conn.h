@@ -18,29 +18,65 @@
 #include"locker.h"
 #include"lst_timer.h"
 #include"log.h"
+#include"doc_index.h"
+#include"bundle.h"
+#include"sock_profile.h"
+#include"arena.h"
+#include"body_sink.h"
+#include"router.h"
+#include"proxy.h"
+#include"rate_limit.h"
+#include"tls.h"
+#include"h2.h"
+#include"capture.h"
+#include"priority.h"
 
 class sort_timer_lst;
 class util_timer;
+class http_bench;
 
 #define COUT_OPEN 1
 const bool ET = true;
-#define TIMESLOT 5      // 定时器周期：秒
 
-//HTTP连接的用户数据类
-class http_conn {
+//HTTP连接的用户数据类。按缓存行对齐：开头的热数据正好落在前两个缓存行中(由类自己的 operator new 按缓存行分配)
+class alignas(64) http_conn {
+    friend class http_bench;    // 微基准(test_presure/microbench)直接调用解析和拼装函数
 public:
     static int m_epollfd;   //所有的socket上的事件都被注册到同一个epoll中
     static int m_user_count;    //统计用户的数量
     static int m_request_cnt;   // 接收到的请求次数
     static sort_timer_lst m_timer_lst;// 定时器链表
+    // 非epoll后端(io_uring)：工作线程处理完后不调用modfd，而是通过该回调把连接交还给事件循环
+    // ev 为接下来需要的事件：EPOLLIN 继续读，EPOLLOUT 发送响应，0 表示出错需关闭连接
+    static void (*m_process_done)(http_conn* conn, int ev);
+    static int m_max_age;           // Cache-Control: max-age 的秒数，小于0时不发送
+    static doc_index* m_doc_index;  // 网站根目录索引，由main在启动时建立
+    static bundle_store* m_bundles; // 静态站点打包文件(-b)，设置后代替根目录索引
+    static bool m_draining;         // 热重启后旧进程不再接受新连接，响应后不保持长连接
+    static const char* m_upload_dir;    // PUT/POST 上传目录的真实路径，为NULL时不接受上传
+    static router* m_router;        // 进程内请求处理函数和反向代理规则，匹配的请求不再查找静态文件
+    static rate_limiter* m_limiter; // 按客户端地址限流，事件循环在交给线程池之前检查
+    static priority_rules* m_priority;  // 调度优先级规则，事件循环在交给线程池之前分类
+    static unsigned long m_timeouts[];  // 按阶段(PHASE)统计的超时关闭次数，只由事件循环线程修改
+    static bool m_http2;            // 接受 HTTP/2(连接序言、ALPN h2、h2c Upgrade)，只在epoll后端开启
+    static traffic_capture* m_capture;  // 流量抓取(capture_file)，为NULL时不抓取
+    static std::atomic<unsigned long> m_requests;  // 生成了响应的请求数，与堆分配次数相比得出每个请求的分配次数
+    static bool m_direct_write;     // 工作线程生成响应后直接发送(epoll 后端)，发不完再注册EPOLLOUT，可热加载
+    static std::atomic<unsigned long> m_direct_done;   // 工作线程直接发完的响应数
+    static std::atomic<unsigned long> m_direct_eagain; // 直接发送遇到发送缓冲区满、交给事件循环继续发的响应数
+    static const unsigned long long UPSTREAM_EVENT = 1ULL << 32;   // epoll 事件 data 的高位标记：上游socket的事件，低32位为客户端fd
     static const int FILENAME_LEN = 200;        //文件名的最大长度
-    static const int READ_BUFFER_SIZE = 2048;   //读缓冲区的大小
-    static const int WRITE_BUFFER_SIZE = 1024;  //写缓冲区的大小
+    static int m_read_buffer_size;  //读缓冲区的大小，启动时由配置决定
+    static int m_write_buffer_size; //写缓冲区的大小
+    static const int MAX_RANGES = 8;            //一个请求最多支持的字节范围个数，超过则忽略Range返回整个文件
+    static const int PART_BUFFER_SIZE = 1024;   //multipart/byteranges 各分段头部的缓冲区大小
+    static const int MAX_IOV = 2 * MAX_RANGES + 2;  //响应头 + 每个分段(分段头 + 文件数据) + 结束分隔符
+    static const int MAX_HEADERS = 32;          //交给处理函数的请求头个数上限，超出的忽略
 
     util_timer* timer;              //定时器
 
 public:
-    //HTTP请求方法，只支持GET
+    //HTTP请求方法，静态文件支持GET，配置了上传目录时支持POST/PUT，其余方法只交给注册的处理函数或上游
     enum METHOD {GET = 0, POST, HEAD, PUT, DELETE, TRACE, OPTIONS, CONNECT};
 
     /*
@@ -51,6 +87,9 @@ public:
     */
     enum CHECK_STATE {CHECK_STATE_REQUESTLINE = 0, CHECK_STATE_HEADER, CHECK_STATE_CONTENT};
 
+    //chunked 请求体的解码状态：块大小行、块数据、块数据后的CRLF、结尾的trailer
+    enum CHUNK_STATE {CHUNK_SIZE = 0, CHUNK_DATA, CHUNK_DATA_END, CHUNK_TRAILER};
+
     //从状态机的三种可能状态，即行的读取状态， 分别表示
     //1、读取到一个完整的行 2、行出错 3、行数据尚且不完整
     enum LINE_STATUS {LINE_OK = 0, LINE_BAD, LINE_OPEN};
@@ -65,57 +104,251 @@ public:
         FILE_REQUEST        :   文件请求， 获取文件成功
         INTERNAL_ERROR      :   表示服务器内部错误
         CLOSED_CONNECTION   :   表示客户端已经关闭连接
+        PARTIAL_REQUEST     :   Range请求，返回文件的部分内容(206)
+        RANGE_NOT_SATISFIABLE : Range请求的范围都超出文件大小(416)
+        NOT_MODIFIED        :   条件请求命中，客户端缓存仍然有效(304)
+        UPLOAD_DONE         :   上传的请求体已完整写入目标文件(201/204)
+        METHOD_NOT_ALLOWED  :   请求方法不被允许，如没有配置上传目录时的POST/PUT(405)
+        BODY_TOO_LARGE      :   请求体超过 max_body_size(413)
+        HANDLER_REQUEST     :   由注册的处理函数生成了响应
+        PROXY_REQUEST       :   请求正在转发给上游，由 proxy_step 推进
+        BAD_GATEWAY         :   上游连接失败或响应格式错误(502)
+        GATEWAY_TIMEOUT     :   等待上游超时(504)
+        H2_UPGRADE          :   请求带 Upgrade: h2c，回复101后切换到 HTTP/2
+        H2_FRAMES           :   HTTP/2 连接：有待发送的帧
+        HTTP1_REQUIRED      :   HTTP/2 的流中不支持的请求(转发、请求体)，以 HTTP_1_1_REQUIRED 重置该流
+    */
+   enum HTTP_CODE { NO_REQUEST, GET_REQUEST, BAD_REQUEST, NO_RESOURCE, FORBIDDEN_REQUEST, FILE_REQUEST, INTERNAL_ERROR,CLOSED_CONNECTION,
+                    PARTIAL_REQUEST, RANGE_NOT_SATISFIABLE, NOT_MODIFIED, UPLOAD_DONE, METHOD_NOT_ALLOWED, BODY_TOO_LARGE,
+                    HANDLER_REQUEST, PROXY_REQUEST, BAD_GATEWAY, GATEWAY_TIMEOUT, H2_UPGRADE, H2_FRAMES, HTTP1_REQUIRED,
+                    SERVICE_UNAVAILABLE };
+
+    /*
+        反向代理时事件循环的下一步(proxy_step 的返回值)
+        PROXY_READ          :   继续读客户端的请求体
+        PROXY_WRITE         :   响应数据已就绪，发给客户端后再调用 proxy_step(proxying() 为 false 时按普通响应结束)
+        PROXY_UPSTREAM_IN   :   等待上游socket(proxy_fd)可读
+        PROXY_UPSTREAM_OUT  :   等待上游socket可写
+        PROXY_DONE          :   响应完整结束，调用 write_done
+        PROXY_CLOSE         :   关闭连接
+    */
+    enum PROXY_NEXT { PROXY_READ, PROXY_WRITE, PROXY_UPSTREAM_IN, PROXY_UPSTREAM_OUT, PROXY_DONE, PROXY_CLOSE };
+
+    /*
+        连接所处的阶段，每个阶段有自己的期限(deadline)，超时按阶段计数
+        PHASE_HEADER    :   等待或接收请求头：从第一个字节起 header_timeout 内必须收完，收到数据不推迟；
+                            新连接还没有发来任何数据时也按 header_timeout
+        PHASE_BODY      :   接收请求体：允许的时间随已收到的字节数增长(min_body_rate)
+        PHASE_SEND      :   发送响应：允许的时间随已发送的字节数增长(min_send_rate)
+        PHASE_KEEPALIVE :   长连接上一个响应发完后等待下一个请求(keepalive_timeout)
+        PHASE_PROXY     :   转发给上游(proxy_timeout)
     */
-   enum HTTP_CODE { NO_REQUEST, GET_REQUEST, BAD_REQUEST, NO_RESOURCE, FORBIDDEN_REQUEST, FILE_REQUEST, INTERNAL_ERROR,CLOSED_CONNECTION };
+    enum PHASE { PHASE_HEADER = 0, PHASE_BODY, PHASE_SEND, PHASE_KEEPALIVE, PHASE_PROXY, PHASE_COUNT };
 
 public:
-    http_conn() {}
-    ~http_conn() {}
+    http_conn() : m_proxying(false), m_h2_active(false), m_stream(false), m_read_buf(NULL), m_ssl(NULL), m_write_buf(NULL),
+                  m_sink(NULL), m_proxy(NULL), m_h2(NULL), m_file_address(0), m_bundle(NULL), m_capture_id(0),
+                  m_prio(priority_rules::NORMAL), m_reactor_op(0), m_cold(NULL) {}
+    //C++17 之前全局 new 不保证 alignas(64)，users 数组和 HTTP/2 流的连接都经这里用 posix_memalign 分配
+    static void* operator new(size_t size);
+    static void* operator new[](size_t size);
+    static void operator delete(void* p) noexcept;
+    static void operator delete[](void* p) noexcept;
+    ~http_conn() { delete[] m_read_buf; delete[] m_write_buf; if (m_sink) arena::destroy(m_sink); delete m_proxy; delete m_h2; if (m_ssl) SSL_free(m_ssl); delete m_cold; }
     void process(); //处理客户端请求，解析报文并封装客户端需要的数据
-    void init(int sockfd, const sockaddr_in& addr); //初始化新接收的连接
+    HTTP_CODE process_inline(); //在当前线程解析并生成响应，不修改事件注册(协程模型使用)
+    //初始化新接收的连接，profile为所属监听socket的TCP参数，tls不为NULL时是HTTPS连接，先握手
+    void init(int sockfd, const sockaddr_in& addr, sock_profile* profile = NULL, tls_context* tls = NULL);
     void close_conn();  //关闭连接
     bool read();        //非阻塞读
     bool write();       //非阻塞写
 
+    //HTTPS(epoll 后端)：握手完成前事件循环只调用 handshake()
+    bool handshaking() const { return m_handshaking; }
+    bool handshake();   //推进握手并注册下一个事件，返回false表示握手失败
+    bool tls_pending() const;   //SSL 缓冲中还有没读出的请求数据，socket 不会再报告可读
+
+    //HTTP/2(epoll 后端)：一批帧发完后由 write() 调用，决定先读客户端的帧还是接着发送，返回false表示需要关闭连接
+    bool h2_continue();
+    //HTTP/2 的一个流：h2_session 把请求还原成 HTTP/1.1 的文本交给单独的 http_conn 对象(不关联socket)，
+    //按原来的流程生成响应，get_iov() 中的响应保留到 end_stream()
+    HTTP_CODE run_stream(const std::string& request, const sockaddr_in& peer);
+    void end_stream();
+
+    //供非epoll后端使用：由事件循环收数据、发数据，http_conn 只负责状态机
+    int feed(const char* data, int len);    //把事件循环收到的数据追加到读缓冲区，返回放入的字节数，-1表示请求头过长
+    bool has_unread() const { return m_read_more; }     //上次read()因读缓冲区满而停止，socket中可能还有数据
+    //Reactor 模型(io_model = reactor)：事件循环只等待就绪，把就绪的事件(EPOLLIN/EPOLLOUT)记下后放入线程池，
+    //读、解析、发送都由工作线程完成；HTTPS、HTTP/2、反向代理的连接仍按 Proactor 由事件循环读写
+    bool reactor_capable() const { return !m_ssl && !m_h2_active && !m_proxying; }
+    void set_reactor_op(int op) { m_reactor_op = op; }
+    bool admit();       //新请求的第一批数据到达时限流，超过速率时已回复429，返回false由调用方关闭连接
+    int priority();     //交给线程池之前调用：新请求按请求行分类(Reactor 模型下窥视socket)，请求体的后续数据、HTTP/2 沿用上次的类别
+    static bool expire(http_conn* conn);    //线程池中排队超过期限(工作线程)，已回复503时返回true
+    void advance_iov(int bytes);            //已发送bytes字节，更新待发送的内存块
+    bool write_done();                      //响应发送完毕，返回false表示需要关闭连接
+    void refresh_timer();                   //有数据收发，按所处阶段更新超时时间
+    int get_sockfd() const { return m_sockfd; }
+    struct iovec* get_iov() { return m_iov; }
+    int get_iv_count() const { return m_iv_count; }
+    long long get_bytes_to_send() const { return bytes_to_send; }
+
+    //反向代理：上游的读写都是非阻塞的，事件循环按 proxy_step 的返回值等待客户端或上游socket
+    bool proxying() const { return m_proxying; }
+    int proxy_fd() const { return m_proxy->fd(); }
+    int proxy_step();                       //推进转发，返回 PROXY_NEXT
+    bool proxy_continue();                  //epoll 后端：推进转发并注册下一个事件，返回false表示需要关闭连接
+    bool proxy_timeout();                   //等待上游超时：还没有发出响应时准备504，返回false表示只能关闭连接
+    bool on_timeout();                      //定时器到期，返回true表示连接自行处理了超时(推迟了定时器)，否则记录超时原因
+
+    //按阶段的超时期限，epoll/io_uring 后端由定时器链表检查，协程模型用作等待的超时
+    int phase() const;
+    time_t deadline() const;
+    int timeout_ms() const;                 //距离期限的毫秒数
+    void count_timeout() { m_timeouts[phase()]++; }
+
 
 private:
+    /*
+        成员按访问频率排列。对象开头(timer 和下面的热数据，约两个缓存行)是事件循环每个事件都要读写的
+        I/O 与解析状态；其后是只在解析请求、生成响应时才用到的字段；大块的冷数据(文件路径、请求头表、
+        Range、stat、iovec 数组和处理函数的响应)放在单独分配的 cold_state 中，
+        这样 users 数组中的对象更小，事件循环处理一个事件只碰到对象开头的一两个缓存行。
+    */
+    //---- 热数据 ----
     int m_sockfd;           //该HTTP连接的socket
-    sockaddr_in m_address;  //通信的socket地址
-    char m_read_buf[READ_BUFFER_SIZE];  //读缓冲区
     int m_read_idx;         //标识读缓冲区中以及读入的客户端数据的最后一个字节的下一个位置
-
     int m_check_index;      //当前正在解析的字符在读缓冲区的位置
     int m_start_line;       //当前正在解析的行的起始位置
-
     CHECK_STATE m_check_state;  //主状态机当前所处的状态
+    long long bytes_to_send;        // 将要发送的数据的字节数
+    long long bytes_have_send;      // 已经发送的字节数
+    int m_iv_count;
+    int m_served;                   // 这个连接上已经完成的请求数，大于0时空闲按长连接计时
+    bool m_read_more;       //read()因读缓冲区满而停止
+    bool m_linger;                          // HTTP请求是否要求保持连接
+    bool m_handshaking;                     // TLS 握手还没有完成
+    bool m_ktls_send;                       // 发送方向已交给内核(kTLS)，响应直接 writev
+    bool m_proxying;                        // 当前请求正在转发给上游
+    bool m_proxy_waiting;                   // 正在等待上游socket的事件(epoll后端)，此时只有事件循环线程访问该连接
+    bool m_h2_active;                       // 这个连接已经切换到 HTTP/2
+    bool m_stream;                          // 本对象是 HTTP/2 的一个流(run_stream)，不是客户端连接
+    char* m_read_buf;       //读缓冲区，第一次使用时分配
+    struct iovec* m_iov;                    // 实际发送的内存块：静态文件响应指向 cold_state::iv，处理函数的响应指向 cold_state::response 中的数组
+    SSL* m_ssl;                             // HTTPS 连接的 SSL 对象，普通连接为NULL
+    time_t m_last_io;               // 最近一次收发数据的时间，没有设置速率下限的阶段按它计算空闲
+    time_t m_idle_start;            // 连接建立或上一个响应发完的时间
+    time_t m_request_start;         // 收到本次请求第一个字节的时间
+    time_t m_send_start;            // 开始发送响应的时间
+
+    //---- 请求解析和生成响应时使用 ----
+    time_t m_body_start_time;       // 开始接收请求体的时间
+    long long m_body_received;              // 已交给sink的请求体字节数
+    long long m_content_length;             // HTTP请求的消息总长度
+    long long m_body_left;                  // Content-Length 请求体或当前块还未收到的字节数
+    int m_body_start;                       // 请求体窗口在读缓冲区中的起始位置(请求头之后)
+    CHUNK_STATE m_chunk_state;
     METHOD m_method;                        // 请求方法
-    char m_real_file[ FILENAME_LEN ];       // 客户请求的目标文件的完整路径，其内容等于 doc_root + m_url, doc_root是网站根目录
+    bool m_chunked;                         // Transfer-Encoding: chunked
+    bool m_expect_continue;                 // Expect: 100-continue
+    bool m_upload_existed;                  // 上传覆盖了已有文件(204)，否则为新建(201)
+    bool m_headers_truncated;               // 请求头超过 MAX_HEADERS，不能完整转发给上游
+    bool m_h2_upgrade;                      // 请求带 Upgrade: h2c
+    char* m_write_buf;                      // 写缓冲区，第一次使用时分配
+    int m_write_idx;                        // 写缓冲区中待发送的字节数
+    int m_header_count;
+    int m_range_count;
+    int m_validators_len;
+    unsigned int m_segs_start;  //本次响应开始时已发出的段数(sock_profile 的 stats)
+    sock_profile* m_profile;    //所属监听socket的TCP参数，可以为NULL
+    const char* m_mime;                     // 目标文件的MIME类型，指向索引中的静态表
     char* m_url;                            // 请求的目标文件的文件名
     char* m_version;                        // HTTP协议版本号，仅支持HTTP1.1
     char* m_host;                           // 主机名
-    int m_content_length;                   // HTTP请求的消息总长度
-    bool m_linger;                          // HTTP请求是否要求保持连接
-
-    char m_write_buf[ WRITE_BUFFER_SIZE ];  // 写缓冲区
-    int m_write_idx;                        // 写缓冲区中待发送的字节数
+    body_sink* m_sink;                      // 请求体的去处，为NULL时读完丢弃(如带请求体的GET)，在 m_arena 中分配
+    const router::route* m_route;           // 匹配到的处理函数，为NULL时按静态文件/上传处理
+    const char* m_allow;                    // 405 响应的 Allow 头
+    proxy_session* m_proxy;                 // 转发状态，第一次代理时分配，之后随连接复用
+    tls_context* m_tls;                     // 所属 HTTPS 监听socket的TLS上下文
+    h2_session* m_h2;                       // HTTP/2 连接的状态，第一次使用时分配，之后随连接复用
+    const char* m_h2_settings;              // HTTP2-Settings 请求头的值
+    char* m_range;                          // Range请求头的值，如 bytes=0-499,1000-
+    char* m_if_none_match;                  // If-None-Match 请求头的值
+    char* m_if_modified_since;              // If-Modified-Since 请求头的值
+    char* m_if_range;                       // If-Range 请求头的值(ETag或日期)
+    char* m_accept_encoding;                // Accept-Encoding 请求头的值
     char* m_file_address;                   // 客户请求的目标文件被mmap到内存中的起始位置
-    struct stat m_file_stat;                // 目标文件的状态。通过它我们可以判断文件是否存在、是否为目录、是否可读，并获取文件大小等信息
-    struct iovec m_iv[2];                   // 我们将采用writev来执行写操作，所以定义下面两个成员，其中m_iv_count表示被写内存块的数量。
-    int m_iv_count;
+    bundle* m_bundle;                       // 文件来自打包文件时持有其引用，m_file_address指向其映射区，unmap时释放
+    const char* m_validators;               // 打包文件中预先生成的 ETag/Last-Modified 等响应头，为NULL时现场生成
+    sockaddr_in m_address;  //通信的socket地址
+    uint32_t m_capture_id;                  // 流量抓取中的连接序号，0 表示不记录(没有开启抓取或 HTTP/2 的流)
+    int m_resp_status;                      // 本次响应的状态码和已发送的字节数，抓取时记录
+    long long m_resp_bytes;
+    int m_prio;                             // 当前请求的调度优先级(priority_rules::CLASS)
+    int m_reactor_op;                       // Reactor 模型下交给工作线程的就绪事件，0 表示按 Proactor 处理
+    arena m_arena;                          // 请求级的内存区，init() 时整体清空，连接关闭时 slab 还给线程缓存
+
+    struct byte_range {
+        off_t start;                        // 起始偏移(含)
+        off_t end;                          // 结束偏移(含)
+    };
 
-    int bytes_to_send;              // 将要发送的数据的字节数
-    int bytes_have_send;            // 已经发送的字节数
+    //---- 冷数据：与读写缓冲区一起在连接第一次使用时分配，之后随 http_conn 对象复用 ----
+    struct cold_state {
+        char real_file[FILENAME_LEN];       // 客户请求的目标文件的完整路径，由根目录索引给出
+        char etag[64];                      // 由inode、大小、修改时间生成的ETag，带引号
+        http_header headers[MAX_HEADERS];   // 全部请求头，交给处理函数
+        byte_range ranges[MAX_RANGES];      // 解析出的可满足的字节范围
+        struct stat file_stat;              // 目标文件的状态。通过它我们可以判断文件是否存在、是否为目录、是否可读，并获取文件大小等信息
+        struct iovec iv[MAX_IOV];           // 我们将采用writev来执行写操作，静态文件响应的内存块，数量为 m_iv_count
+        char part_buf[PART_BUFFER_SIZE];    // multipart/byteranges 的分段头和结束分隔符
+        response_builder response;          // 处理函数的响应，发送完后在unmap中清空
+    };
+    cold_state* m_cold;
 
 private:
     void init();                    //初始化连接其余的信息
+    void rearm(int ev);             //工作线程处理完毕，重新注册需要监听的事件
+    bool write_direct();            //工作线程直接发送刚生成的响应，发完并已重新注册EPOLLIN时返回true
+    bool reactor_io();              //Reactor 模型：工作线程完成就绪事件的读写，返回true时接着解析
+    void finish_response();         //响应发送完毕：TCP统计、抓取记录、释放文件映射
     HTTP_CODE process_read();                        //解析HTTP请求
     bool process_write(HTTP_CODE ret);              //填充HTTP应答数据
 
     //process_read调用这组函数完成HTTP请求解析
     HTTP_CODE parse_request_line(char* text);      //解析HTTP请求首行
     HTTP_CODE parse_headers(char* text);           //解析HTTP请求头
-    HTTP_CODE parse_content(char* text);           //解析HTTP请求体  
+    HTTP_CODE parse_content();                     //流式接收请求体，完整时返回GET_REQUEST
+    HTTP_CODE parse_chunked();                     //chunked 解码，解出的数据交给sink
+    HTTP_CODE begin_body();                        //请求头解析完毕：决定请求体的去处，必要时发送100 Continue
+    HTTP_CODE open_sink(const char* key);          //POST/PUT：在上传目录中打开目标文件
+    HTTP_CODE do_upload();                         //请求体接收完毕，提交上传的文件
+    void record_header(const char* text);          //保存一个请求头，供处理函数查询
+    HTTP_CODE do_handler();                        //调用匹配到的处理函数
+    HTTP_CODE complete_request();                  //请求(含请求体)完整后按 处理函数/上传/静态文件 分派
+    HTTP_CODE deliver_body(const char* data, int len);  //把一段请求体交给sink，成功返回NO_REQUEST
+    void compact_body();                           //丢弃窗口中已交付的数据，腾出读缓冲区
+    void abort_body();                             //请求出错或连接关闭，丢弃未完成的上传
+    void arm_timer(time_t now);                    //按阶段的期限设置定时器
+    int input_event() const;                       //等待请求数据时注册的事件
+    int recv_some(char* buf, int len);             //收数据，返回值和errno与recv相同(HTTPS 经过 SSL_read)
+    int send_some(const char* buf, int len, int flags);    //发数据，返回值和errno与send相同
+    int send_iov();                                //发送 m_iov，返回值和errno与writev相同
+    int ssl_result(int ret);                       //SSL_read/SSL_write 的结果换成 recv/send 的约定
+    HTTP_CODE begin_h2(bool upgrade);              //切换到 HTTP/2：连接序言或 h2c Upgrade
+    HTTP_CODE process_h2();                        //处理收到的帧，组织要发送的帧
+    bool h2_fill();                                //取下一批帧放到 m_iov，没有可发送的返回false
+    bool input_ready() const;                      //socket(或 SSL 缓冲)中有客户端发来的数据
+    HTTP_CODE begin_proxy(upstream* up);           //改写请求头，取一个上游连接
+    void end_proxy(bool reuse);                    //结束转发，上游连接放回连接池或关闭
+    void arm_upstream(int ev);                     //epoll 后端：等待上游socket的事件
+    bool static_exists();                          //请求的目标是根目录(或打包文件)中的静态文件
     HTTP_CODE do_request();                         //
+    HTTP_CODE do_bundle_request(const char* key);   //从打包文件中查找目标文件
+    HTTP_CODE parse_range(off_t file_size);         //解析Range头，决定返回整个文件、部分内容还是416
+    void make_etag();                               //根据m_file_stat生成ETag
+    bool not_modified();                            //If-None-Match / If-Modified-Since 判断客户端缓存是否有效
+    bool if_range_match();                          //If-Range 与当前文件是否一致，不一致时忽略Range
     char* get_line() { return m_read_buf + m_start_line; }  //内联函数，获取一行数据
     LINE_STATUS parse_line();                        //解析具体某行
 
@@ -125,10 +358,12 @@ private:
     bool add_content(const char* content);
     bool add_content_type();
     bool add_status_line(int status, const char* title);
-    bool add_headers( int content_length );
-    bool add_content_length( int content_length );
+    bool add_headers( off_t content_length );
+    bool add_content_length( off_t content_length );
     bool add_linger();
     bool add_blank_line();
+    bool add_ranges();                              //206响应：Content-Range 或 multipart/byteranges
+    bool add_validators();                          //ETag、Last-Modified、Cache-Control
 
 };
 #endif
\ No newline at end of file
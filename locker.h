@@ -95,6 +95,10 @@ public:
     bool wait() {
         return sem_wait(&m_sem) == 0;
     }
+    //不阻塞的等待：信号量为0时立即返回false
+    bool trywait() {
+        return sem_trywait(&m_sem) == 0;
+    }
     //增加信号量
     bool post() {
         return sem_post(&m_sem) == 0;
@@ -104,6 +108,33 @@ private:
     sem_t m_sem;
 };
 
+//4、读写锁类
+class rwlocker {
+public:
+    rwlocker() {
+        if (pthread_rwlock_init(&m_rwlock, NULL) != 0) {
+            throw std::exception();
+        }
+    }
+    ~rwlocker() {
+        pthread_rwlock_destroy(&m_rwlock);
+    }
+    //加读锁，多个读者可以同时持有
+    bool rdlock() {
+        return pthread_rwlock_rdlock(&m_rwlock) == 0;
+    }
+    //加写锁，与所有读者和写者互斥
+    bool wrlock() {
+        return pthread_rwlock_wrlock(&m_rwlock) == 0;
+    }
+    bool unlock() {
+        return pthread_rwlock_unlock(&m_rwlock) == 0;
+    }
+
+private:
+    pthread_rwlock_t m_rwlock;
+};
+
 
 
 #endif
\ No newline at end of file
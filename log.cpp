@@ -1,5 +1,7 @@
 #include "log.h"
 
+int EM_log_level = LOG_LEVEL;
+
 char *EM_logLevelGet(const int level){  // 得到当前输入等级level的字符串
     if(level == LOGLEVEL_DEBUG){
         return (char*)"DEBUG";
@@ -22,7 +24,7 @@ void EM_log(const int level, const char* fun, const int line, const char *fmt, .
     char buf[1024];     // 创建缓存字符数组
     vsnprintf(buf, sizeof(buf), fmt, arg);          // 赋值 ftm 格式的 arg 到 buf
     va_end(arg);   
-    if(level >= LOG_LEVEL){                         // 判断当前日志等级，与程序日志等级状态对比
+    if(level >= EM_log_level){                         // 判断当前日志等级，与程序日志等级状态对比
         printf("[%s]\t[%s %d]: %s \n", EM_logLevelGet(level), fun, line, buf);
     }  
     #endif
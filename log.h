@@ -18,6 +18,8 @@ typedef enum{                       // 日志等级，越往下等级越高
     LOGLEVEL_ERROR,
 }E_LOGLEVEL;
 
+extern int EM_log_level;            // 运行时日志等级，初值为 LOG_LEVEL，可由配置热加载修改
+
 void EM_log(const int level, const char* fun, const int line, const char *fmt, ...);
 
 #define EMlog(level, fmt...) EM_log(level, __FUNCTION__, __LINE__, fmt) // 宏定义，隐藏形参
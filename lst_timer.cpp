@@ -1,5 +1,22 @@
 #include "lst_timer.h"
 
+util_timer* sort_timer_lst::alloc_timer() {
+    if (!free_list) {
+        return new util_timer;
+    }
+    util_timer* timer = free_list;
+    free_list = timer->next;
+    timer->prev = nullptr;
+    timer->next = nullptr;
+    return timer;
+}
+
+//从链表取下的定时器放回空闲链表
+void sort_timer_lst::free_timer(util_timer* timer) {
+    timer->prev = nullptr;
+    timer->next = free_list;
+    free_list = timer;
+}
 
 // 将目标定时器timer添加到链表中
 void sort_timer_lst::add_timer(util_timer* timer) {
@@ -23,11 +40,26 @@ void sort_timer_lst::add_timer(util_timer* timer) {
 
 }    
 
-/* 当某个定时任务发生变化时，调整对应的定时器在链表中的位置。这个函数只考虑被调整的定时器的
-超时时间延长的情况，即该定时器需要往链表的尾部移动。*/
+/* 当某个定时任务发生变化时，调整对应的定时器在链表中的位置。超时时间延长时该定时器往链表的尾部移动；
+按阶段计算的期限也可能提前(例如长连接空闲比请求头超时短)，这时取出后从头节点重新插入。*/
 void sort_timer_lst::adjust_timer(util_timer* timer) {
     if (!timer) return;
 
+    //超时时间提前到了前一个定时器之前：从链表中取出，按新的超时时间重新插入
+    if (timer->prev && timer->expire < timer->prev->expire) {
+        timer->prev->next = timer->next;
+        if (timer->next) {
+            timer->next->prev = timer->prev;
+        }
+        else {
+            tail = timer->prev;
+        }
+        timer->prev = nullptr;
+        timer->next = nullptr;
+        add_timer(timer);
+        return;
+    }
+
     util_timer* tmp = timer->next;
     // 如果被调整的目标定时器处在链表的尾部，或者该定时器新的超时时间值仍然小于其下一个定时器的超时时间则不用调整
     if (!tmp || (timer->expire < tmp->expire)) {
@@ -57,7 +89,7 @@ void sort_timer_lst::del_timer(util_timer* timer) {
     
     //如果链表只有一个定时器时
     if (timer == head && timer == tail) {
-        delete timer;
+        free_timer(timer);
         head = nullptr;
         tail = nullptr;
         return;
@@ -68,7 +100,7 @@ void sort_timer_lst::del_timer(util_timer* timer) {
     if (timer == head) {
         head = head->next;
         head->prev = nullptr;
-        delete timer;
+        free_timer(timer);
         return;
     }
 
@@ -77,14 +109,14 @@ void sort_timer_lst::del_timer(util_timer* timer) {
     if (timer == tail) {
         tail = tail->prev;
         tail->next = nullptr;
-        delete timer;
+        free_timer(timer);
         return;
     }
 
     // 如果目标定时器位于链表的中间，则把它前后的定时器串联起来，然后删除目标定时器
     timer->prev->next = timer->next;
     timer->next->prev = timer->prev;
-    delete timer;
+    free_timer(timer);
 
 } 
 /* SIGALARM 信号每次被触发就在其信号处理函数中执行一次 tick() 函数，以处理链表上到期任务。*/         
@@ -106,6 +138,12 @@ void sort_timer_lst::tick() {
             break;
         }
 
+        //正在等待上游的连接自己处理超时(推迟定时器或回复504)，定时器的位置变了，从头开始
+        if (tmp->user_data->on_timeout()) {
+            tmp = head;
+            continue;
+        }
+
         //调用定时器的回调函数，以执行定时任务，关闭连接
         tmp->user_data->close_conn();
         //删除定时器
@@ -32,9 +32,9 @@ public:
 //定时器链表类，它是一个升序、双向链表，且带有头节点和尾节点。
 class sort_timer_lst {
 public:
-    sort_timer_lst() : head(nullptr), tail(nullptr) {}
+    sort_timer_lst() : head(nullptr), tail(nullptr), free_list(nullptr) {}
 
-    //链表被销毁时，删除其中所有的定时器
+    //链表被销毁时，删除其中所有的定时器和空闲的定时器
     ~sort_timer_lst() {
         util_timer* tmp = head;
         while (tmp) {
@@ -42,16 +42,24 @@ public:
             delete tmp;
             tmp = head;
         }
+        while (free_list) {
+            tmp = free_list;
+            free_list = free_list->next;
+            delete tmp;
+        }
     }
 
+    //取一个定时器：优先复用 del_timer 回收的，新连接不必每次都向堆申请(只在事件循环线程调用)
+    util_timer* alloc_timer();
+
     // 将目标定时器timer添加到链表中
     void add_timer(util_timer* timer);    
 
-    /* 当某个定时任务发生变化时，调整对应的定时器在链表中的位置。这个函数只考虑被调整的定时器的
-    超时时间延长的情况，即该定时器需要往链表的尾部移动。*/
+    /* 当某个定时任务发生变化时，调整对应的定时器在链表中的位置。超时时间延长时往链表的尾部移动，
+    提前时取出后从头节点重新插入。*/
     void adjust_timer(util_timer* timer);
 
-    // 将目标定时器 timer 从链表中删除
+    // 将目标定时器 timer 从链表中删除，放回空闲链表
     void del_timer(util_timer* timer);
     /* SIGALARM 信号每次被触发就在其信号处理函数中执行一次 tick() 函数，以处理链表上到期任务。*/         
     void tick();                      
@@ -60,10 +68,12 @@ private:
     /* 一个重载的辅助函数，它被公有的 add_timer 函数和 adjust_timer 函数调用
     该函数表示将目标定时器 timer 添加到节点 lst_head 之后的部分链表中 */
     void add_timer(util_timer* timer, util_timer* lst_head);
+    void free_timer(util_timer* timer);
 
 private:
     util_timer* head;   //头节点
     util_timer* tail;   //尾节点
+    util_timer* free_list;  //del_timer 回收的定时器，用 next 串起来
 };
 
 #endif
\ No newline at end of file
@@ -15,11 +15,18 @@
 #include<assert.h>
 #include"lst_timer.h"
 #include"log.h"
-
-#define MAX_FD 65536    //最大文件描述符个数
-#define MAX_EVENT_NUMBER 10000    //一次监听的最大的事件数量
+#include"uring_loop.h"
+#include"co_loop.h"
+#include"hot_restart.h"
+#include"config.h"
+#include"prefork.h"
+#include"busy_poll.h"
+#include<limits.h>
+#include<stdlib.h>
+#include<vector>
 
 static int pipefd[2];           // 管道文件描述符 0为读，1为写
+static threadPool<http_conn>* s_pool = NULL;   // 线程池，运行状态中输出各优先级的排队时间
 
 //添加信号捕捉
 void addsig(int sig, void(handler)(int)) {
@@ -50,30 +57,124 @@ extern void modfd(int epollfd, int fd, int ev);
 // 文件描述符设置非阻塞操作
 extern void setnonblocking(int fd);
 
-int main(int argc, char* argv[]) {
-
-    //传入参数个数必须大于1
-    if (argc <= 1) {    
-        printf("按照如下格式运行: %s port_number\n", basename(argv[0]));
-        return 1;
+//运行状态(status_path)：进程号、当前连接数、线程数、是否在热重启排空、被限流的请求数、各阶段超时关闭的连接数，
+//开启 HTTPS 时(arg 为 tls_context)还有握手数、会话恢复数和使用 kTLS 的连接数，开启 HTTP/2 时还有其连接数和流数；
+//开启低延迟模式时还有 busy_poll 的自旋统计；queue 为线程池各优先级的排队时间和过期数；direct_write 为工作线程直接发完的和发送缓冲区满交回事件循环的响应数；alloc 为生成了响应的请求数和请求内存区向堆申请的 slab 数，用 -DHEAP_STATS 编译时还有全部堆分配次数和平均每个请求的次数
+static void status_handler(const request_view&, response_builder& resp, void* arg) {
+    const config& cfg = config::current();
+    const tls_context* tls = (const tls_context*)arg;
+    resp.content_type("application/json");
+    resp.header("Cache-Control", "no-store");
+    resp.printf("{\"pid\":%d,\"connections\":%d,\"max_conn\":%d,\"threads\":%d,\"draining\":%s,\"rate_limited\":%lu,"
+                "\"timeouts\":{\"header\":%lu,\"body\":%lu,\"send\":%lu,\"keepalive\":%lu,\"proxy\":%lu}",
+                (int)getpid(), http_conn::m_user_count, cfg.max_conn, cfg.threads,
+                http_conn::m_draining ? "true" : "false", http_conn::m_limiter->rejected(),
+                http_conn::m_timeouts[http_conn::PHASE_HEADER], http_conn::m_timeouts[http_conn::PHASE_BODY],
+                http_conn::m_timeouts[http_conn::PHASE_SEND], http_conn::m_timeouts[http_conn::PHASE_KEEPALIVE],
+                http_conn::m_timeouts[http_conn::PHASE_PROXY]);
+    if (tls) {
+        resp.printf(",\"tls\":{\"handshakes\":%lu,\"resumed\":%lu,\"ktls\":%lu}",
+                    tls->handshakes(), tls->resumed(), tls->ktls());
     }
-
-    //获取端口号(将argv[1]指向的字符串通过 atoi 函数转换成整数)
-    int port = atoi(argv[1]);
-
-    //对SIGPIE信号进行处理
-    addsig(SIGPIPE, SIG_IGN);   //遇到SIGPIPE信号忽略该信号
-
-    //创建线程池，初始化线程池
-    threadPool<http_conn> * pool = NULL;
-    try {
-        pool = new threadPool<http_conn>;
+    if (http_conn::m_http2) {
+        resp.printf(",\"http2\":{\"connections\":%lu,\"streams\":%lu}", h2_session::connections(), h2_session::streams());
     }
-    catch(...) {
-        exit(-1);
+    if (http_conn::m_capture) {
+        resp.printf(",\"capture_bytes\":%llu", http_conn::m_capture->bytes());
+    }
+    if (prefork::worker() >= 0) {
+        //多进程模式：各 worker 在共享内存中的计数，本 worker 的先更新
+        prefork::publish();
+        int conns = 0;
+        unsigned long reqs = 0;
+        resp.printf(",\"worker\":%d,\"workers\":[", prefork::worker());
+        for (int i = 0; i < prefork::workers(); i++) {
+            const prefork::slot& w = prefork::at(i);
+            int c = w.connections.load(std::memory_order_relaxed);
+            unsigned long r = w.requests.load(std::memory_order_relaxed);
+            resp.printf("%s{\"pid\":%d,\"restarts\":%d,\"connections\":%d,\"requests\":%lu,\"rate_limited\":%lu,\"timeouts\":%lu}",
+                        i ? "," : "", w.pid.load(std::memory_order_relaxed), w.restarts.load(std::memory_order_relaxed),
+                        c, r, w.rate_limited.load(std::memory_order_relaxed), w.timeouts.load(std::memory_order_relaxed));
+            conns += c;
+            reqs += r;
+        }
+        resp.printf("],\"total\":{\"connections\":%d,\"requests\":%lu}", conns, reqs);
+    }
+    if (busy_poll::enabled()) {
+        resp.printf(",\"busy_poll\":{\"max_us\":%d", busy_poll::s_max_us);
+        const char* names[] = { "loop", "pool" };
+        for (int i = 0; i < busy_poll::KIND_COUNT; i++) {
+            const busy_poll::stats& s = busy_poll::get(i);
+            resp.printf(",\"%s\":{\"spin_us\":%llu,\"hits\":%llu,\"misses\":%llu,\"budget_us\":%llu}", names[i],
+                        s.spin_ns.load(std::memory_order_relaxed) / 1000, s.hits.load(std::memory_order_relaxed),
+                        s.misses.load(std::memory_order_relaxed), s.budget_ns.load(std::memory_order_relaxed) / 1000);
+        }
+        //线程池的交接延迟：自旋等到的与阻塞唤醒的分开平均，省下的延迟按两者之差乘以自旋等到的次数估算
+        const busy_poll::stats& pool = busy_poll::get(busy_poll::POOL);
+        unsigned long long spun = pool.handoff_spin_count.load(std::memory_order_relaxed);
+        unsigned long long blocked = pool.handoff_block_count.load(std::memory_order_relaxed);
+        double spin_avg = spun ? pool.handoff_spin_ns.load(std::memory_order_relaxed) / 1000.0 / spun : 0.0;
+        double block_avg = blocked ? pool.handoff_block_ns.load(std::memory_order_relaxed) / 1000.0 / blocked : 0.0;
+        double saved = spun && blocked && block_avg > spin_avg ? (block_avg - spin_avg) * spun : 0.0;
+        resp.printf(",\"handoff\":{\"spun\":%llu,\"blocked\":%llu,\"spin_avg_us\":%.2f,\"block_avg_us\":%.2f,\"saved_us\":%.0f}}",
+                    spun, blocked, spin_avg, block_avg, saved);
     }
+    if (s_pool) {
+        //线程池各优先级：取出的任务数、过期回复503的数、排队时间的分位数(直方图格子的上界)和直方图
+        resp.printf(",\"queue\":{");
+        for (int p = 0; p < threadPool<http_conn>::PRIORITIES; p++) {
+            const threadPool<http_conn>::class_stats& s = s_pool->stats(p);
+            unsigned long hist[threadPool<http_conn>::WAIT_BUCKETS];
+            unsigned long total = 0;
+            for (int b = 0; b < threadPool<http_conn>::WAIT_BUCKETS; b++) {
+                hist[b] = s.wait[b].load(std::memory_order_relaxed);
+                total += hist[b];
+            }
+            resp.printf("%s\"%s\":{\"served\":%lu,\"expired\":%lu", p ? "," : "", priority_rules::name(p),
+                        s.served.load(std::memory_order_relaxed), s.expired.load(std::memory_order_relaxed));
+            const double quantiles[] = { 0.5, 0.99, 0.999 };
+            const char* names[] = { "p50_us", "p99_us", "p999_us" };
+            for (int q = 0; q < 3; q++) {
+                unsigned long rank = (unsigned long)(total * quantiles[q]);
+                unsigned long seen = 0;
+                int b = 0;
+                while (b < threadPool<http_conn>::WAIT_BUCKETS - 1 && seen + hist[b] <= rank) {
+                    seen += hist[b];
+                    b++;
+                }
+                resp.printf(",\"%s\":%lu", names[q], total ? 1UL << b : 0UL);
+            }
+            resp.printf(",\"wait_hist\":[");
+            for (int b = 0; b < threadPool<http_conn>::WAIT_BUCKETS; b++) {
+                resp.printf("%s%lu", b ? "," : "", hist[b]);
+            }
+            resp.printf("]}");
+        }
+        resp.printf("}");
+    }
+    resp.printf(",\"direct_write\":{\"done\":%lu,\"eagain\":%lu}", http_conn::m_direct_done.load(std::memory_order_relaxed),
+                http_conn::m_direct_eagain.load(std::memory_order_relaxed));
+    unsigned long requests = http_conn::m_requests.load(std::memory_order_relaxed);
+    resp.printf(",\"alloc\":{\"requests\":%lu,\"arena_slabs\":%lu", requests, arena::slab_allocs());
+    long long heap = arena::heap_allocs();
+    if (heap >= 0) {
+        resp.printf(",\"heap\":%lld,\"heap_per_request\":%.2f", heap, requests ? (double)heap / requests : 0.0);
+    }
+    resp.printf("}");
+    resp.printf("}\n");
+}
+
+//监听socket加入epoll：EPOLLEXCLUSIVE 使多个 worker 共用监听socket时一个新连接只唤醒其中一个
+static void add_listener(int epollfd, int fd) {
+    epoll_event event;
+    event.data.u64 = (unsigned int)fd;
+    event.events = EPOLLIN | EPOLLEXCLUSIVE;
+    epoll_ctl(epollfd, EPOLL_CTL_ADD, fd, &event);
+    setnonblocking(fd);
+}
 
-    //服务端
+//创建、绑定并监听一个端口，TCP参数按 profile 设置，失败时退出
+static int open_listener(int port, const sock_profile* profile) {
     //创建socket           IPv4    面向连接可靠  默认协议
     int listenfd = socket(PF_INET, SOCK_STREAM, 0);
     if (listenfd == -1) {
@@ -84,6 +185,16 @@ int main(int argc, char* argv[]) {
     //设置端口复用
     int reuse = 1;
     setsockopt(listenfd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    if (config::current().reuseport) {
+        //多进程模式下每个 worker 各自监听同一端口，由内核分配新连接
+        setsockopt(listenfd, SOL_SOCKET, SO_REUSEPORT, &reuse, sizeof(reuse));
+    }
+
+    //发送/接收缓冲区大小要在listen之前设置，新连接才能继承
+    if (!profile->apply_listener(listenfd)) {
+        perror("setsockopt\n");
+        exit(-1);
+    }
 
     //绑定
     struct sockaddr_in address;
@@ -97,39 +208,391 @@ int main(int argc, char* argv[]) {
     }
 
     //监听
-    ret = listen(listenfd, 5);
+    ret = listen(listenfd, config::current().listen_backlog);
     if (ret == -1) {
         perror("listen\n");
         exit(-1);
     }
+    return listenfd;
+}
 
-    //创建epoll对象， 事件数组，添加监听文件描述符
-    epoll_event events[MAX_EVENT_NUMBER];
-    int epollfd = epoll_create(5);
-    //将监听的文件描述符添加到epoll对象中
-    addfd(epollfd, listenfd, false);
+int main(int argc, char* argv[]) {
+
+    //解析选项： -u 使用io_uring后端， -c 使用协程模型， -m 静态文件的 Cache-Control max-age
+    //          -b 从打包文件提供静态文件， -p 启动时预读整个打包文件， -o 监听socket的TCP参数
+    //          -f 配置文件， -D key=value 覆盖配置文件中的一项
+    bool use_uring = false;
+    bool use_coroutine = false;
+    const char* bundle_path = NULL;
+    bool bundle_populate = false;
+    sock_profile* profile = new sock_profile;  //默认只开启 TCP_NODELAY
+    config& cfg = config::current();
+    std::vector<const char*> overrides;        //命令行覆盖项在读完配置文件后再应用
+    char item[64];
+    int opt;
+    while ((opt = getopt(argc, argv, "ucm:b:po:f:D:")) != -1) {
+        switch (opt) {
+            case 'f':
+                cfg.set_file(optarg);
+                if (!cfg.load_file(optarg)) {
+                    printf("配置文件有误：%s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'D':
+                overrides.push_back(optarg);
+                break;
+            case 'o':
+                if (!profile->parse(optarg)) {
+                    printf("无法识别的TCP参数：%s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'b':
+                bundle_path = optarg;
+                break;
+            case 'p':
+                bundle_populate = true;
+                break;
+            case 'm':
+                snprintf(item, sizeof(item), "max_age=%s", optarg);
+                overrides.push_back(strdup(item));
+                break;
+            case 'u':
+                use_uring = true;
+                break;
+            case 'c':
+                use_coroutine = true;
+                break;
+            default:
+                break;
+        }
+    }
+
+    //端口号可以在命令行给出，也可以写在配置文件里
+    if (optind < argc) {
+        snprintf(item, sizeof(item), "port=%s", argv[optind]);
+        overrides.push_back(strdup(item));
+    }
+    bool config_ok = true;
+    for (size_t i = 0; i < overrides.size(); i++) {
+        cfg.add_override(overrides[i]);
+        if (!cfg.set(overrides[i])) {
+            printf("配置项无效：%s\n", overrides[i]);
+            config_ok = false;
+        }
+    }
+
+    if (!config_ok || !cfg.check() || cfg.port == 0) {
+        printf("按照如下格式运行: %s [-u] [-c] [-m max_age] [-b bundle [-p]] [-o profile] [-f config] [-D key=value] [port_number]\n", basename(argv[0]));
+        printf("  -u  使用io_uring后端(内核不支持时回退到epoll)\n");
+        printf("  -c  使用协程模型，每个连接一个协程，不经过线程池(需以C++20编译)\n");
+        printf("  -m  静态文件响应中 Cache-Control: max-age 的秒数，默认不发送\n");
+        printf("  -b  从 tools/mkbundle 生成的打包文件提供静态文件，代替 resources 目录，文件被替换时自动切换\n");
+        printf("  -p  以 MAP_POPULATE 映射打包文件，启动时一次性读入\n");
+        printf("  -o  监听socket的TCP参数，如 nodelay,cork,sndbuf=262144,lowat=16384,user_timeout=30000,keepalive=60:10:5,busy_poll=50,stats\n");
+        printf("  -f  配置文件，每行一个 key = value，格式见 webserver.conf，收到 SIGHUP 时重新读取\n");
+        printf("  -D  覆盖一项配置，如 -D threads=16，可以多次给出\n");
+        return 1;
+    }
+    http_conn::m_limiter = new rate_limiter;   //一直创建，rate_limit 可以热加载打开
+    http_conn::m_priority = new priority_rules;    //一直创建，没有规则时按请求方法分类
+    for (size_t i = 0; i < cfg.priority.size(); i++) {
+        http_conn::m_priority->add(cfg.priority[i].c_str());
+    }
+    cfg.apply_live();
+    http_conn::m_read_buffer_size = cfg.read_buffer_size;
+    http_conn::m_write_buffer_size = cfg.write_buffer_size;
+    //低延迟模式：-o 没有给出 busy_poll 时监听socket也按配置轮询
+    busy_poll::s_max_us = cfg.busy_poll;
+    if (cfg.busy_poll > 0 && profile->busy_poll_us == 0) {
+        profile->busy_poll_us = cfg.busy_poll;
+    }
+    //HTTPS 监听socket：配置了 tls_profile 时单独一组TCP参数(set 时已校验)，统计也分开
+    sock_profile* tls_profile = profile;
+    if (!cfg.tls_profile.empty()) {
+        tls_profile = new sock_profile;
+        tls_profile->parse(cfg.tls_profile.c_str());
+        if (cfg.busy_poll > 0 && tls_profile->busy_poll_us == 0) {
+            tls_profile->busy_poll_us = cfg.busy_poll;
+        }
+    }
+
+    hot_restart::init(argv);    //热重启时以同样的参数启动新进程
+
+    int port = cfg.port;
+
+    //对SIGPIE信号进行处理
+    addsig(SIGPIPE, SIG_IGN);   //遇到SIGPIPE信号忽略该信号
+
+    //热重启启动的新进程直接使用旧进程传下来的监听socket，不再重新bind。
+    //多进程模式下监听socket要在 fork 之前建好(reuseport 时由各 worker 自己监听)
+    int listenfd = -1;
+    int tls_listenfd = -1;
+    bool inherited = false;
+    if (cfg.workers == 0 || !cfg.reuseport) {
+        listenfd = hot_restart::inherited_listenfd();
+        inherited = listenfd >= 0;
+        if (inherited) {
+            EMlog(LOGLEVEL_INFO, "hot restart: inherited listen fd %d\n", listenfd);
+            profile->apply_listener(listenfd);
+        }
+        else {
+            //服务端
+            listenfd = open_listener(port, profile);
+        }
+        sock_profile::bind(listenfd, profile);
+
+        //HTTPS 监听socket
+        if (cfg.tls_port) {
+            tls_listenfd = hot_restart::inherited_tls_listenfd();
+            if (tls_listenfd >= 0) {
+                tls_profile->apply_listener(tls_listenfd);
+            }
+            else {
+                tls_listenfd = open_listener(cfg.tls_port, tls_profile);
+            }
+            sock_profile::bind(tls_listenfd, tls_profile);
+        }
+    }
+
+    //多进程模式：主进程在这里一直管理 worker，只有 worker 返回，之后的线程池、缓存等都由各 worker 自己创建
+    if (cfg.workers > 0) {
+        prefork::run(cfg.workers, listenfd, tls_listenfd, cfg.worker_affinity != 0);
+    }
+
+    //创建线程池，初始化线程池
+    threadPool<http_conn> * pool = NULL;
+    try {
+        pool = new threadPool<http_conn>(cfg.threads, cfg.max_requests);
+    }
+    catch(...) {
+        exit(-1);
+    }
+    pool->set_expire(http_conn::expire);
+    pool->set_deadline(cfg.queue_deadline_ms);
+    s_pool = pool;
+
+    if (bundle_path) {
+        //打包文件模式：整个网站一次mmap，不再访问resources目录
+        bundle_store* bundles = new bundle_store;
+        if (!bundles->init(bundle_path, bundle_populate)) {
+            printf("无法加载打包文件：%s\n", bundle_path);
+            exit(-1);
+        }
+        http_conn::m_bundles = bundles;
+    }
+    else {
+        //建立网站根目录索引(默认为当前目录下的resources)，之后由inotify增量刷新
+        char root[PATH_MAX];
+        if (!realpath(cfg.docroot.c_str(), root)) {
+            printf("网站根目录不存在：%s\n", cfg.docroot.c_str());
+            exit(-1);
+        }
+        doc_index* docs = new doc_index;
+        if (!docs->init(root)) {
+            printf("无法建立网站根目录索引：%s\n", root);
+            exit(-1);
+        }
+        http_conn::m_doc_index = docs;
+    }
+
+    //上传目录：配置后才接受 PUT/POST
+    if (!cfg.upload_dir.empty()) {
+        static char upload_dir[PATH_MAX];
+        if (!realpath(cfg.upload_dir.c_str(), upload_dir)) {
+            printf("上传目录不存在：%s\n", cfg.upload_dir.c_str());
+            exit(-1);
+        }
+        http_conn::m_upload_dir = upload_dir;
+    }
+
+    //HTTPS：加载证书和私钥，监听socket在下面与HTTP的一起创建
+    tls_context* tls = NULL;
+    if (cfg.tls_port) {
+        tls = new tls_context;
+        if (!tls->init(cfg.tls_cert.c_str(), cfg.tls_key.c_str(), cfg.http2 != 0)) {
+            printf("无法加载证书或私钥：%s %s\n", cfg.tls_cert.c_str(), cfg.tls_key.c_str());
+            exit(-1);
+        }
+    }
+
+    //进程内请求处理函数和反向代理规则：启动时注册，之后路由表只读
+    if (!cfg.status_path.empty() || !cfg.proxy.empty()) {
+        router* routes = new router;
+        if (!cfg.status_path.empty()) {
+            routes->add(http_conn::GET, cfg.status_path.c_str(), status_handler, tls);
+        }
+        upstream::m_max_idle = cfg.proxy_keepalive;
+        for (size_t i = 0; i < cfg.proxy.size(); i++) {
+            char prefix[256], target[256];
+            if (sscanf(cfg.proxy[i].c_str(), "%255s %255s", prefix, target) != 2) {
+                printf("反向代理规则有误：%s\n", cfg.proxy[i].c_str());
+                exit(-1);
+            }
+            upstream* up = new upstream;
+            if (!up->init(target)) {
+                printf("无法解析上游地址：%s\n", target);
+                exit(-1);
+            }
+            //代理规则接受所有方法，请求方法由上游决定是否支持
+            for (int m = 0; m < router::MAX_METHODS; m++) {
+                if (!routes->add(m, prefix, proxy_handler, up)) {
+                    printf("反向代理前缀重复：%s\n", prefix);
+                    exit(-1);
+                }
+            }
+            EMlog(LOGLEVEL_INFO, "proxy %s -> %s\n", prefix, target);
+        }
+        routes->compile();
+        http_conn::m_router = routes;
+    }
+
+    //流量抓取：热重启时新旧进程同时在写，多进程模式下各 worker 同时在写，文件名加上自己的 pid
+    if (!cfg.capture_file.empty()) {
+        std::string path = cfg.capture_file;
+        if (inherited || prefork::worker() >= 0) {
+            path += "." + std::to_string(getpid());
+        }
+        traffic_capture* capture = new traffic_capture;
+        if (!capture->open(path.c_str(), (long long)cfg.capture_max_mb << 20)) {
+            printf("无法创建抓取文件：%s\n", path.c_str());
+            exit(-1);
+        }
+        http_conn::m_capture = capture;
+    }
+
+    //reuseport 的 worker：各自监听
+    int ret;
+    if (listenfd < 0) {
+        listenfd = open_listener(port, profile);
+        sock_profile::bind(listenfd, profile);
+        if (tls) {
+            tls_listenfd = open_listener(cfg.tls_port, tls_profile);
+            sock_profile::bind(tls_listenfd, tls_profile);
+        }
+    }
 
     // 创建套接字
     ret = socketpair(PF_UNIX, SOCK_STREAM, 0, pipefd);
     assert( ret != -1 );  // C/C++中的 assert 是一个宏，用于在运行时检查一个条件是否为真，如果条件不满足，则运行时将终止程序的执行并输出一条错误信息。
     setnonblocking( pipefd[1] );               // 写管道非阻塞
-    addfd(epollfd, pipefd[0], false ); // epoll检测读管道
 
     // 设置信号处理函数
     addsig(SIGALRM, sig_to_pipe);   // 定时器信号
     addsig(SIGTERM, sig_to_pipe);   // SIGTERM 关闭服务器
+    addsig(SIGUSR2, sig_to_pipe);   // SIGUSR2 热重启
+    addsig(SIGHUP, sig_to_pipe);    // SIGHUP 重新加载配置
     bool stop_server = false;       // 关闭服务器标志位
 
     //创建一个数组用于保存所有的客户端信息
-    http_conn * users = new http_conn[MAX_FD];
+    http_conn * users = new http_conn[cfg.max_fd];
+
+    //io_model = uring 与 -u 相同；reactor 只用于epoll事件循环
+    if (cfg.io_model == "uring") {
+        use_uring = true;
+    }
+    bool reactor = cfg.io_model == "reactor";
+    if (reactor && (use_uring || use_coroutine)) {
+        EMlog(LOGLEVEL_WARN, "io_model = reactor only applies to the epoll backend, ignored\n");
+        reactor = false;
+    }
+
+    //io_uring后端没有实现上游socket的等待，配置了反向代理时使用epoll
+    if (use_uring && !cfg.proxy.empty()) {
+        EMlog(LOGLEVEL_WARN, "io_uring backend does not support proxy rules, fall back to epoll\n");
+        use_uring = false;
+    }
+
+    //TLS 握手和记录层只接入了epoll事件循环
+    if ((use_uring || use_coroutine) && tls) {
+        EMlog(LOGLEVEL_WARN, "io_uring/coroutine backends do not support tls_port, fall back to epoll\n");
+        use_uring = false;
+        use_coroutine = false;
+    }
+
+    //io_uring后端：事件循环完全由uring_loop接管，不创建epoll
+    if (use_uring) {
+        uring_loop* loop = new uring_loop(listenfd, pipefd[0], users, cfg.max_fd, pool);
+        if (loop->init()) {
+            EMlog(LOGLEVEL_INFO, "using io_uring backend\n");
+            alarm(cfg.timeslot);
+            hot_restart::notify_ready();
+            prefork::notify_ready();
+            loop->run();
+            sock_profile::report_all();
+            delete loop;
+            if (!http_conn::m_draining) {
+                close(listenfd);    //热重启时已由事件循环关闭
+            }
+            close(pipefd[0]);
+            close(pipefd[1]);
+            delete[] users;
+            delete pool;
+            delete http_conn::m_capture;
+            return 0;
+        }
+        delete loop;
+        EMlog(LOGLEVEL_WARN, "io_uring unavailable, fall back to epoll\n");
+    }
+
+    //协程模型：连接在事件循环线程内由协程处理
+    if (use_coroutine) {
+#ifdef CO_LOOP_ENABLED
+        co_loop* loop = new co_loop(listenfd, pipefd[0], users, cfg.max_fd);
+        if (loop->init()) {
+            EMlog(LOGLEVEL_INFO, "using coroutine handlers\n");
+            alarm(cfg.timeslot);
+            hot_restart::notify_ready();
+            prefork::notify_ready();
+            loop->run();
+            sock_profile::report_all();
+            delete loop;
+            if (!http_conn::m_draining) {
+                close(listenfd);    //热重启时已由事件循环关闭
+            }
+            close(pipefd[0]);
+            close(pipefd[1]);
+            delete[] users;
+            delete pool;
+            delete http_conn::m_capture;
+            return 0;
+        }
+        delete loop;
+#endif
+        EMlog(LOGLEVEL_WARN, "coroutine handlers unavailable (need -std=c++20), fall back to epoll\n");
+    }
+
+    //HTTP/2 的帧由工作线程处理、事件循环线程分批发送，只接入了epoll事件循环
+    http_conn::m_http2 = cfg.http2 != 0;
+    if (reactor) {
+        EMlog(LOGLEVEL_INFO, "using reactor model: worker threads read, process and write\n");
+    }
+
+    //创建epoll对象， 事件数组，添加监听文件描述符
+    std::vector<epoll_event> events(cfg.max_events);
+    int epollfd = epoll_create(5);
+    //将监听的文件描述符添加到epoll中
+    add_listener(epollfd, listenfd);
+    if (tls_listenfd >= 0) {
+        add_listener(epollfd, tls_listenfd);
+    }
+    addfd(epollfd, pipefd[0], false ); // epoll检测读管道
+
     http_conn::m_epollfd = epollfd;     //静态成员，类共享
 
     bool timeout = false;   // 定时器周期已到
-    alarm(TIMESLOT);        // 定时产生SIGALRM信号
+    alarm(cfg.timeslot);        // 定时产生SIGALRM信号
+    int ready_fd = -1;      // 热重启时新进程的就绪通知管道
+    bool drain = false;     // 停止accept，连接都结束后退出
+    busy_poll::budget loop_budget(busy_poll::LOOP);     // 低延迟模式下事件循环的自旋预算
+
+    hot_restart::notify_ready();    //热重启启动的新进程：缓存已建好，通知旧进程停止accept
+    prefork::notify_ready();
 
     //循环检测事件发生
-    while(true) {
-        int num = epoll_wait(epollfd, events, MAX_EVENT_NUMBER, -1);    //阻塞，返回事件数量
+    while(!stop_server) {
+        int num = busy_poll::epoll_wait(loop_budget, epollfd, &events[0], cfg.max_events, -1);    //阻塞，返回事件数量(低延迟模式先自旋)
         if ((num < 0) && (errno != EINTR)) {
             printf("epoll failure\n");
             break;
@@ -137,24 +600,35 @@ int main(int argc, char* argv[]) {
 
         //循环遍历
         for (int i = 0; i < num; i++) {
-            int sockfd = events[i].data.fd;
-            if (sockfd == listenfd) {       //监听文件描述符有事件响应
+            int sockfd = (int)(events[i].data.u64 & 0xffffffff);
+            if (events[i].data.u64 & http_conn::UPSTREAM_EVENT) {
+                //上游socket的事件，低32位是转发这个请求的客户端连接；出错也交给 proxy_continue，由读写报告
+                users[sockfd].refresh_timer();
+                if (!users[sockfd].proxy_continue()) {
+                    users[sockfd].close_conn();
+                    http_conn::m_timer_lst.del_timer(users[sockfd].timer);
+                }
+            }
+            else if (sockfd == listenfd || sockfd == tls_listenfd) {       //监听文件描述符有事件响应
                 //有客户端连接进来
                 struct sockaddr_in client_address;
                 socklen_t client_addrlen = sizeof(client_address);
-                int connfd = accept(listenfd, (struct sockaddr*)&client_address, &client_addrlen);
+                int connfd = accept(sockfd, (struct sockaddr*)&client_address, &client_addrlen);
                 if (connfd < 0) {
-                    printf("errno is : %d\n", errno);
+                    if (errno != EAGAIN) {      //多个 worker 共用监听socket时可能被别的 worker 取走
+                        printf("errno is : %d\n", errno);
+                    }
+                    continue;
                 }
 
-                if (http_conn::m_user_count >= MAX_FD) {
-                    //目前连接数满了。
+                if (connfd >= cfg.max_fd || http_conn::m_user_count >= cfg.max_conn) {
+                    //目前连接数满了(或达到配置的上限)。
                     //关闭这个连接
                     close(connfd);
                     continue;
                 }
-                //将新的客户的数据初始化，放入数组中
-                users[connfd].init(connfd, client_address);
+                //将新的客户的数据初始化，放入数组中，HTTPS 连接先握手
+                users[connfd].init(connfd, client_address, sock_profile::of(sockfd), sockfd == tls_listenfd ? tls : NULL);
                 // 当listen_fd也注册了ONESHOT事件时(addfd)，
                 // 接受了新的连接后需要重置socket上EPOLLONESHOT事件，确保下次可读时，EPOLLIN 事件被触发
                 // modfd(epoll_fd, listen_fd, EPOLLIN);
@@ -180,23 +654,70 @@ int main(int argc, char* argv[]) {
                                 break;
                             case SIGTERM:  //SIGTERM是kill或killall命令发送到进程的默认信号。它会导致进程终止，但与SIGKILL信号不同，进程可以捕获并解释（或忽略）它。因此，SIGTERM类似于要求进程很好地终止，允许清理和关闭文件。出于这个原因，在关闭期间的许多Unix系统上，init向所有对关闭电源不重要的进程发出SIGTERM，等待几秒钟，然后发出SIGKILL强制终止剩余的任何此类进程。
                                 stop_server = true;
+                                break;
+                            case SIGHUP:    //重新加载配置，线程池按新的线程数增减
+                                if (cfg.reload()) {
+                                    pool->resize(cfg.threads);
+                                    pool->set_max_requests(cfg.max_requests);
+                                    pool->set_deadline(cfg.queue_deadline_ms);
+                                }
+                                break;
+                            case SIGUSR2:   //热重启：启动新进程，等它就绪；worker 由主进程负责热重启，收到时排空
+                                if (prefork::worker() >= 0) {
+                                    drain = true;
+                                }
+                                else if (ready_fd < 0 && !http_conn::m_draining) {
+                                    ready_fd = hot_restart::spawn(listenfd, tls_listenfd);
+                                    if (ready_fd >= 0) {
+                                        addfd(epollfd, ready_fd, false);
+                                    }
+                                }
+                                break;
                         }
                     }
                 }
             }
+            //新进程的就绪通知：停止accept，监听socket只留给新进程
+            else if (sockfd == ready_fd) {
+                int ready = hot_restart::check_ready(ready_fd);     //有结果时关闭管道，epoll自动移除
+                if (ready >= 0) {
+                    ready_fd = -1;
+                }
+                if (ready == 1) {
+                    drain = true;
+                }
+            }
             else if (events[i].events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
                 //对方异常断开或错误的事件
                 EMlog(LOGLEVEL_DEBUG,"-------EPOLLRDHUP | EPOLLHUP | EPOLLERR--------\n");
                 users[sockfd].close_conn();
                 http_conn::m_timer_lst.del_timer(users[sockfd].timer);  //移除其对应的定时器
             }
-            else if (events[i].events & EPOLLIN) {
-                EMlog(LOGLEVEL_DEBUG,"-------EPOLLIN-------\n\n");
-                if (users[sockfd].read()) {     //主进程一次性把读缓冲区所有数据都读完
-                    // 加入到线程池队列中，数组指针 + 偏移 &users[sock_fd]
-                    pool->append(users + sockfd);
+            else if (users[sockfd].handshaking()) {
+                //TLS 握手在事件循环线程中推进，完成前不交给线程池
+                if (!users[sockfd].handshake()) {
+                    users[sockfd].close_conn();
+                    http_conn::m_timer_lst.del_timer(users[sockfd].timer);
                 }
-                else {
+            }
+            //Reactor 模型：记下就绪的事件交给工作线程，读、解析、发送都在工作线程中完成
+            else if (reactor && users[sockfd].reactor_capable() && (events[i].events & (EPOLLIN | EPOLLOUT))) {
+                //工作线程不修改定时器链表，这里按事件到达的时间重设，到期时 on_timeout 按工作线程更新后的期限推迟或关闭
+                users[sockfd].refresh_timer();
+                int op = (events[i].events & EPOLLIN) ? EPOLLIN : EPOLLOUT;
+                users[sockfd].set_reactor_op(op);
+                //数据还没有读，限流在这里做(超过速率的客户端不进入线程池队列)，分类时 priority() 窥视请求行
+                if ((op == EPOLLIN && !users[sockfd].admit()) || !pool->append(users + sockfd, users[sockfd].priority())) {
+                    users[sockfd].close_conn();     //超过速率或队列已满
+                    http_conn::m_timer_lst.del_timer(users[sockfd].timer);
+                }
+            }
+            //SSL 缓冲中还有请求数据时借可写事件通知，按可读处理
+            else if ((events[i].events & EPOLLIN) || users[sockfd].tls_pending()) {
+                EMlog(LOGLEVEL_DEBUG,"-------EPOLLIN-------\n\n");
+                //主进程一次性把读缓冲区所有数据都读完，超过速率的客户端不进入线程池队列
+                // 加入到线程池队列中，数组指针 + 偏移 &users[sock_fd]；读失败、超过速率或队列已满都关闭连接
+                if (!users[sockfd].read() || !users[sockfd].admit() || !pool->append(users + sockfd, users[sockfd].priority())) {
                     users[sockfd].close_conn();
                     http_conn::m_timer_lst.del_timer(users[sockfd].timer);  // 移除其对应的定时器
                 }
@@ -209,22 +730,46 @@ int main(int argc, char* argv[]) {
                 }
             }
         }
+        if (drain && !http_conn::m_draining) {
+            //新进程仍持有同一个监听socket，必须显式从epoll中删除
+            removefd(epollfd, listenfd);
+            listenfd = -1;
+            if (tls_listenfd >= 0) {
+                removefd(epollfd, tls_listenfd);
+                tls_listenfd = -1;
+            }
+            http_conn::m_draining = true;
+        }
         // 最后处理定时事件，因为I/O事件有更高的优先级。当然，这样做将导致定时任务不能精准的按照预定的时间执行。
         if (timeout) {
             //处理定时任务，实际上就是调用tick()函数
             http_conn::m_timer_lst.tick();
             //因为一次alarm调用只会引起一次SIGALARM信号，所以要重新定时，以不断触发SIGALARM信号。
-            alarm(TIMESLOT);
+            alarm(cfg.timeslot);
             timeout = false;        //重置timeout
+
+            //热重启：所有连接都已结束，旧进程退出
+            if (http_conn::m_draining && http_conn::m_user_count == 0) {
+                stop_server = true;
+            }
         }
+        prefork::publish();     //多进程模式：本 worker 的计数写入共享内存
     }
 
+    sock_profile::report_all();
     close(epollfd);
-    close(listenfd);
+    if (listenfd >= 0) {
+        close(listenfd);
+    }
+    if (tls_listenfd >= 0) {
+        close(tls_listenfd);
+    }
     close(pipefd[0]);
     close(pipefd[1]);
     delete[] users;
     delete pool;
+    delete tls;
+    delete http_conn::m_capture;
 
 
     return 0;
@@ -0,0 +1,340 @@
+#include "prefork.h"
+#include "hot_restart.h"
+#include "http_conn.h"
+#include "rate_limit.h"
+#include "log.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sched.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <new>
+#include <vector>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/signalfd.h>
+#include <sys/wait.h>
+
+int prefork::s_index = -1;
+int prefork::s_count = 0;
+int prefork::s_listenfd = -1;
+int prefork::s_tls_listenfd = -1;
+bool prefork::s_affinity = false;
+prefork::slot* prefork::s_slots = NULL;
+int prefork::s_ready_pipe[2] = { -1, -1 };
+int prefork::s_sigfd = -1;
+int prefork::s_hot_ready = -1;
+int prefork::s_spawn_ready = -1;
+
+//主进程对每个 worker 的记录(只在主进程中使用)
+struct worker_state {
+    long long started_ms;       //最近一次启动的时间
+    long long restart_ms;       //退出后到这个时间再启动，0 表示不需要启动
+    bool ready;                 //已经就绪过(第一批 worker 中还没有就绪过的退出时主进程退出)
+};
+static std::vector<worker_state> s_states;
+static pid_t s_master = 0;
+static sigset_t s_oldmask;
+
+static long long now_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+//按主进程可用的CPU集合，第 i 个 worker 绑定到其中第 i % n 个
+static void pin_cpu(int i) {
+    cpu_set_t set;
+    if (sched_getaffinity(0, sizeof(set), &set) < 0) {
+        return;
+    }
+    int n = CPU_COUNT(&set);
+    if (n <= 0) {
+        return;
+    }
+    int want = i % n;
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (CPU_ISSET(cpu, &set) && want-- == 0) {
+            cpu_set_t one;
+            CPU_ZERO(&one);
+            CPU_SET(cpu, &one);
+            if (sched_setaffinity(0, sizeof(one), &one) < 0) {
+                EMlog(LOGLEVEL_WARN, "worker %d: bind to cpu %d failed, errno is : %d\n", i, cpu, errno);
+            }
+            return;
+        }
+    }
+}
+
+void prefork::run(int workers, int listenfd, int tls_listenfd, bool affinity) {
+    s_count = workers;
+    s_listenfd = listenfd;
+    s_tls_listenfd = tls_listenfd;
+    s_affinity = affinity;
+    s_master = getpid();
+
+    void* mem = mmap(NULL, sizeof(slot) * workers, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED) {
+        perror("mmap\n");
+        exit(-1);
+    }
+    s_slots = (slot*)mem;
+    for (int i = 0; i < workers; i++) {
+        new (&s_slots[i]) slot();
+    }
+    s_states.assign(workers, worker_state());
+
+    //热重启启动的主进程：worker 不能继承旧进程的就绪通知管道，所有 worker 就绪后由主进程通知
+    s_hot_ready = hot_restart::take_ready_fd();
+    if (pipe2(s_ready_pipe, O_CLOEXEC | O_NONBLOCK) < 0) {
+        perror("pipe\n");
+        exit(-1);
+    }
+
+    //主进程的信号由 signalfd 读取，fork 出的 worker 恢复原来的信号屏蔽字
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    sigaddset(&mask, SIGTERM);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGHUP);
+    sigaddset(&mask, SIGUSR2);
+    sigprocmask(SIG_BLOCK, &mask, &s_oldmask);
+    s_sigfd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (s_sigfd < 0) {
+        perror("signalfd\n");
+        exit(-1);
+    }
+
+    EMlog(LOGLEVEL_WARN, "master %d: starting %d workers%s\n", (int)s_master, workers, listenfd < 0 ? " (reuseport)" : "");
+    for (int i = 0; i < workers; i++) {
+        if (spawn(i)) {
+            return;
+        }
+    }
+    supervise();
+}
+
+bool prefork::spawn(int i) {
+    fflush(NULL);       //日志输出到文件时是全缓冲的，否则缓冲中的内容会由子进程再输出一遍
+    pid_t pid = fork();
+    if (pid < 0) {
+        EMlog(LOGLEVEL_ERROR, "master: fork worker %d failed, errno is : %d\n", i, errno);
+        s_states[i].restart_ms = now_ms() + RESTART_DELAY_MS;
+        return false;
+    }
+    if (pid == 0) {
+        //worker：主进程退出(包括被 SIGKILL)时随之退出
+        prctl(PR_SET_PDEATHSIG, SIGTERM);
+        if (getppid() != s_master) {
+            _exit(0);
+        }
+        s_index = i;
+        close(s_sigfd);
+        close(s_ready_pipe[0]);
+        if (s_hot_ready >= 0) {
+            close(s_hot_ready);
+        }
+        if (s_spawn_ready >= 0) {
+            close(s_spawn_ready);
+        }
+        sigprocmask(SIG_SETMASK, &s_oldmask, NULL);
+        if (s_affinity) {
+            pin_cpu(i);
+        }
+        s_slots[i].pid.store(getpid(), std::memory_order_relaxed);
+        return true;
+    }
+    s_slots[i].pid.store(pid, std::memory_order_relaxed);
+    s_states[i].started_ms = now_ms();
+    s_states[i].restart_ms = 0;
+    EMlog(LOGLEVEL_INFO, "master: worker %d started, pid %d\n", i, (int)pid);
+    return false;
+}
+
+//向所有运行中的 worker 发送信号
+static void signal_workers(int sig) {
+    for (int i = 0; i < prefork::workers(); i++) {
+        int pid = prefork::at(i).pid.load(std::memory_order_relaxed);
+        if (pid > 0) {
+            kill(pid, sig);
+        }
+    }
+}
+
+void prefork::supervise() {
+    bool stopping = false;      //收到 SIGTERM，等 worker 退出
+    bool draining = false;      //热重启的新主进程已就绪，等 worker 排空
+    bool started = false;       //第一批 worker 都已就绪
+    int ready_count = 0;
+    while (true) {
+        //还在运行的 worker 数，全部退出时主进程结束
+        int live = 0;
+        long long wake = -1;
+        for (int i = 0; i < s_count; i++) {
+            if (s_slots[i].pid.load(std::memory_order_relaxed) > 0) {
+                live++;
+            }
+            else if (s_states[i].restart_ms > 0 && (wake < 0 || s_states[i].restart_ms < wake)) {
+                wake = s_states[i].restart_ms;
+            }
+        }
+        if ((stopping || draining) && live == 0) {
+            EMlog(LOGLEVEL_WARN, "master %d: all workers exited\n", (int)s_master);
+            exit(0);
+        }
+
+        struct pollfd fds[3];
+        int nfds = 0;
+        fds[nfds].fd = s_sigfd;
+        fds[nfds++].events = POLLIN;
+        fds[nfds].fd = s_ready_pipe[0];
+        fds[nfds++].events = POLLIN;
+        if (s_spawn_ready >= 0) {
+            fds[nfds].fd = s_spawn_ready;
+            fds[nfds++].events = POLLIN;
+        }
+        int timeout = -1;
+        if (wake >= 0 && !stopping && !draining) {
+            long long left = wake - now_ms();
+            timeout = left > 0 ? (int)left : 0;
+        }
+        if (poll(fds, nfds, timeout) < 0 && errno != EINTR) {
+            EMlog(LOGLEVEL_ERROR, "master: poll failed, errno is : %d\n", errno);
+            exit(-1);
+        }
+
+        signalfd_siginfo si;
+        while (read(s_sigfd, &si, sizeof(si)) == sizeof(si)) {
+            switch (si.ssi_signo) {
+                case SIGCHLD:
+                    //只回收 worker，热重启启动的新主进程由 hot_restart::check_ready 回收
+                    for (int i = 0; i < s_count; i++) {
+                        int pid = s_slots[i].pid.load(std::memory_order_relaxed);
+                        int status = 0;
+                        if (pid <= 0 || waitpid(pid, &status, WNOHANG) != pid) {
+                            continue;
+                        }
+                        s_slots[i].pid.store(0, std::memory_order_relaxed);
+                        if (stopping || draining) {
+                            continue;
+                        }
+                        if (WIFSIGNALED(status)) {
+                            EMlog(LOGLEVEL_ERROR, "master: worker %d (pid %d) killed by signal %d\n", i, pid, WTERMSIG(status));
+                        }
+                        else {
+                            EMlog(LOGLEVEL_ERROR, "master: worker %d (pid %d) exited with %d\n", i, pid, WEXITSTATUS(status));
+                        }
+                        if (!s_states[i].ready && !started) {
+                            //第一批 worker 启动失败(端口、根目录等配置错误)：重启也不会成功
+                            EMlog(LOGLEVEL_ERROR, "master: worker %d failed to start, exiting\n", i);
+                            signal_workers(SIGTERM);
+                            exit(-1);
+                        }
+                        s_slots[i].restarts.fetch_add(1, std::memory_order_relaxed);
+                        long long now = now_ms();
+                        s_states[i].restart_ms = now - s_states[i].started_ms < RESTART_DELAY_MS ? now + RESTART_DELAY_MS : now;
+                    }
+                    break;
+                case SIGTERM:
+                case SIGINT:
+                    stopping = true;
+                    signal_workers(SIGTERM);
+                    break;
+                case SIGHUP:
+                    signal_workers(SIGHUP);
+                    break;
+                case SIGUSR2:
+                    if (s_spawn_ready < 0 && !draining && !stopping) {
+                        s_spawn_ready = hot_restart::spawn(s_listenfd, s_tls_listenfd);
+                    }
+                    break;
+            }
+        }
+
+        //worker 就绪：第一批全部就绪后通知热重启的旧进程
+        int ids[64];
+        int n;
+        while ((n = ::read(s_ready_pipe[0], ids, sizeof(ids))) > 0) {
+            for (int k = 0; k < n / (int)sizeof(int); k++) {
+                int i = ids[k];
+                if (i >= 0 && i < s_count && !s_states[i].ready) {
+                    s_states[i].ready = true;
+                    ready_count++;
+                }
+            }
+            if (n < (int)sizeof(ids)) {
+                break;
+            }
+        }
+        if (!started && ready_count == s_count) {
+            EMlog(LOGLEVEL_WARN, "master %d: all workers ready\n", (int)s_master);
+            hot_restart::notify_ready(s_hot_ready);
+            s_hot_ready = -1;
+            started = true;
+        }
+
+        //热重启：新的主进程就绪后，旧的 worker 排空，监听socket只留给新进程
+        if (s_spawn_ready >= 0) {
+            int ret = hot_restart::check_ready(s_spawn_ready);
+            if (ret >= 0) {
+                s_spawn_ready = -1;
+            }
+            if (ret == 1) {
+                draining = true;
+                signal_workers(SIGUSR2);
+                if (s_listenfd >= 0) {
+                    close(s_listenfd);
+                }
+                if (s_tls_listenfd >= 0) {
+                    close(s_tls_listenfd);
+                }
+            }
+        }
+
+        //到时间的 worker 重新启动
+        if (!stopping && !draining) {
+            long long now = now_ms();
+            for (int i = 0; i < s_count; i++) {
+                if (s_slots[i].pid.load(std::memory_order_relaxed) == 0 && s_states[i].restart_ms > 0 &&
+                    s_states[i].restart_ms <= now) {
+                    if (spawn(i)) {
+                        return;
+                    }
+                }
+            }
+        }
+    }
+}
+
+void prefork::notify_ready() {
+    if (s_index < 0) {
+        return;
+    }
+    publish();
+    if (::write(s_ready_pipe[1], &s_index, sizeof(s_index)) != sizeof(s_index)) {
+        EMlog(LOGLEVEL_WARN, "worker %d: notify master failed, errno is : %d\n", s_index, errno);
+    }
+    close(s_ready_pipe[1]);
+    s_ready_pipe[1] = -1;
+}
+
+void prefork::publish() {
+    if (s_index < 0) {
+        return;
+    }
+    slot& s = s_slots[s_index];
+    unsigned long timeouts = 0;
+    for (int p = 0; p < http_conn::PHASE_COUNT; p++) {
+        timeouts += http_conn::m_timeouts[p];
+    }
+    s.connections.store(http_conn::m_user_count, std::memory_order_relaxed);
+    s.requests.store(http_conn::m_requests.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    s.rate_limited.store(http_conn::m_limiter ? http_conn::m_limiter->rejected() : 0, std::memory_order_relaxed);
+    s.timeouts.store(timeouts, std::memory_order_relaxed);
+}
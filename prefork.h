@@ -0,0 +1,61 @@
+#ifndef PREFORK_H
+#define PREFORK_H
+
+#include <sys/types.h>
+#include <atomic>
+
+/*
+    多进程模式(workers > 0)：主进程只持有监听socket、管理 worker 进程，自己不处理连接。
+    每个 worker 在线程池、根目录索引等创建之前 fork 出来，之后按单进程的流程运行完整的服务端
+    (事件循环、线程池、定时器、缓存都是自己的)，worker 之间不共享状态、不加锁，一个 worker 崩溃只影响它自己的连接。
+    监听socket由主进程创建后继承给所有 worker，epoll 后端以 EPOLLEXCLUSIVE 等待，一个新连接只唤醒一个 worker；
+    reuseport = 1 时主进程不监听，每个 worker 以 SO_REUSEPORT 各自监听同一端口，由内核按四元组分配连接
+    (worker 退出时它的 accept 队列中还没有取走的连接会被重置)。
+    worker 退出时主进程重新 fork 一个，启动后1秒内又退出的等1秒再启动；第一批 worker 在就绪前退出时主进程退出。
+    worker 的连接数、请求数等计数写入共享内存中自己的槽位，运行状态汇总所有 worker。
+    主进程的信号：SIGTERM 转发给所有 worker，等它们退出后退出；SIGHUP 转发，各 worker 自己重新读取配置；
+    SIGUSR2 热重启：启动新的主进程，它的 worker 全部就绪后向旧的 worker 发送 SIGUSR2 排空(停止accept，连接结束后退出)。
+*/
+class prefork {
+public:
+    static const int MAX_WORKERS = 256;
+    static const int RESTART_DELAY_MS = 1000;   //启动后这么快就退出的 worker 延迟这么久再启动
+
+    //共享内存中每个 worker 的槽位，worker 每轮事件循环更新自己的，主进程写 pid 和 restarts
+    struct slot {
+        std::atomic<int> pid;               //0 表示没有运行
+        std::atomic<int> restarts;          //异常退出后重新启动的次数
+        std::atomic<int> connections;
+        std::atomic<unsigned long> requests;
+        std::atomic<unsigned long> rate_limited;
+        std::atomic<unsigned long> timeouts;
+    };
+
+    //主进程：fork 出 workers 个 worker 并一直管理它们，只在 worker 中返回，返回后按单进程的流程继续。
+    //listenfd/tls_listenfd 为-1 时由 worker 自己监听(reuseport)；affinity 为 true 时 worker i 绑定到第 i 个可用的CPU
+    static void run(int workers, int listenfd, int tls_listenfd, bool affinity);
+
+    static int worker() { return s_index; }             //worker 的序号，主进程和单进程模式为-1
+    static int workers() { return s_count; }
+    static const slot& at(int i) { return s_slots[i]; }
+
+    static void notify_ready();     //worker：初始化完成，开始accept(主进程据此通知热重启的旧进程)
+    static void publish();          //worker：把计数写入自己的槽位(几次 relaxed store，每轮事件循环调用一次)
+
+private:
+    static bool spawn(int i);       //fork 第 i 个 worker，在子进程中返回 true
+    static void supervise();
+
+    static int s_index;
+    static int s_count;
+    static int s_listenfd;
+    static int s_tls_listenfd;
+    static bool s_affinity;
+    static slot* s_slots;
+    static int s_ready_pipe[2];     //worker 就绪时写入自己的序号
+    static int s_sigfd;             //主进程的 signalfd
+    static int s_hot_ready;         //热重启启动的主进程：通知旧进程的管道写端
+    static int s_spawn_ready;       //主进程发起热重启时新进程的就绪通知管道读端
+};
+
+#endif
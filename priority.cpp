@@ -0,0 +1,61 @@
+#include "priority.h"
+#include <stdio.h>
+#include <string.h>
+
+static const char* class_names[] = { "high", "normal", "low" };
+
+const char* priority_rules::name(int cls) {
+    return cls >= 0 && cls < CLASS_COUNT ? class_names[cls] : "";
+}
+
+bool priority_rules::add(const char* spec) {
+    char prefix[256], cls[16];
+    if (sscanf(spec, "%255s %15s", prefix, cls) != 2 || prefix[0] != '/') {
+        return false;
+    }
+    for (int i = 0; i < CLASS_COUNT; i++) {
+        if (strcmp(cls, class_names[i]) == 0) {
+            rule r;
+            r.prefix = prefix;
+            r.cls = i;
+            m_rules.push_back(r);
+            return true;
+        }
+    }
+    return false;
+}
+
+int priority_rules::classify(const char* buf, int len) const {
+    const char* end = buf + len;
+    const char* sp = (const char*)memchr(buf, ' ', len);
+    if (!sp) {
+        return NORMAL;
+    }
+    const char* path = sp + 1;
+    const char* path_end = path;
+    while (path_end < end && *path_end != ' ' && *path_end != '?' && *path_end != '\r') {
+        path_end++;
+    }
+    if (path_end == end) {
+        return NORMAL;      //请求行还没有收完
+    }
+    //最长前缀匹配，规则只有几条，顺序查找
+    int cls = -1;
+    size_t best = 0;
+    size_t path_len = path_end - path;
+    for (size_t i = 0; i < m_rules.size(); i++) {
+        const std::string& p = m_rules[i].prefix;
+        if (p.size() <= path_len && p.size() >= best && memcmp(path, p.data(), p.size()) == 0) {
+            cls = m_rules[i].cls;
+            best = p.size();
+        }
+    }
+    if (cls >= 0) {
+        return cls;
+    }
+    size_t method_len = sp - buf;
+    if ((method_len == 4 && memcmp(buf, "POST", 4) == 0) || (method_len == 3 && memcmp(buf, "PUT", 3) == 0)) {
+        return LOW;
+    }
+    return NORMAL;
+}
@@ -0,0 +1,31 @@
+#ifndef PRIORITY_H
+#define PRIORITY_H
+
+#include <string>
+#include <vector>
+
+/*
+    请求的调度优先级：事件循环读到一个新请求的第一批数据后、交给线程池之前，按请求行分类，
+    线程池先处理高优先级的请求，过载时小而便宜的请求不必排在大上传后面。
+    规则 "前缀 类别"(配置项 priority，可以出现多次，类别为 high/normal/low)按最长前缀匹配；
+    没有匹配的规则时，带请求体的方法(POST/PUT)为 low，其余为 normal。
+    请求行还没有收完时按 normal。只在启动时登记规则，之后只读。
+*/
+class priority_rules {
+public:
+    enum CLASS { HIGH = 0, NORMAL, LOW, CLASS_COUNT };     //与线程池的优先级一致，0 最高
+
+    bool add(const char* rule);                 //解析 "前缀 类别"，格式错误返回false
+    int classify(const char* buf, int len) const;   //buf 为请求的开头
+
+    static const char* name(int cls);
+
+private:
+    struct rule {
+        std::string prefix;
+        int cls;
+    };
+    std::vector<rule> m_rules;
+};
+
+#endif
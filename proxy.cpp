@@ -0,0 +1,540 @@
+#include "proxy.h"
+#include "log.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+int upstream::m_max_idle = 32;
+
+void proxy_handler(const request_view&, response_builder& resp, void*) {
+    resp.status(502);
+    resp.write("proxy route was not forwarded\n");
+}
+
+//-------------------- upstream --------------------
+
+upstream::upstream() : m_addr_len(0) {
+    memset(&m_addr, 0, sizeof(m_addr));
+}
+
+upstream::~upstream() {
+    for (size_t i = 0; i < m_idle.size(); i++) {
+        close(m_idle[i]);
+    }
+}
+
+bool upstream::init(const char* spec) {
+    m_name = spec;
+    if (strncmp(spec, "unix:", 5) == 0) {
+        struct sockaddr_un* addr = (struct sockaddr_un*)&m_addr;
+        const char* path = spec + 5;
+        if (!*path || strlen(path) >= sizeof(addr->sun_path)) {
+            return false;
+        }
+        addr->sun_family = AF_UNIX;
+        strcpy(addr->sun_path, path);
+        m_addr_len = sizeof(*addr);
+        return true;
+    }
+
+    //host:port，IPv6 地址写成 [::1]:8080
+    const char* colon = strrchr(spec, ':');
+    if (!colon || colon == spec || !colon[1]) {
+        return false;
+    }
+    std::string host(spec, colon - spec);
+    if (host.size() > 2 && host[0] == '[' && host[host.size() - 1] == ']') {
+        host = host.substr(1, host.size() - 2);
+    }
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    struct addrinfo* res;
+    if (getaddrinfo(host.c_str(), colon + 1, &hints, &res) != 0) {
+        return false;
+    }
+    memcpy(&m_addr, res->ai_addr, res->ai_addrlen);
+    m_addr_len = res->ai_addrlen;
+    freeaddrinfo(res);
+    return true;
+}
+
+int upstream::connect_new() {
+    int fd = socket(m_addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    if (m_addr.ss_family != AF_UNIX) {
+        int on = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    }
+    //TCP 返回 EINPROGRESS，连接的结果在第一次发送时得到
+    if (connect(fd, (struct sockaddr*)&m_addr, m_addr_len) < 0 && errno != EINPROGRESS) {
+        EMlog(LOGLEVEL_WARN, "connect upstream %s failed, errno is : %d\n", m_name.c_str(), errno);
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int upstream::acquire(bool fresh, bool* reused) {
+    *reused = false;
+    while (!fresh) {
+        m_lock.lock();
+        if (m_idle.empty()) {
+            m_lock.unlock();
+            break;
+        }
+        int fd = m_idle.back();
+        m_idle.pop_back();
+        m_lock.unlock();
+
+        //空闲期间上游可能已经关闭了连接，或者发来了不属于任何请求的数据
+        char c;
+        int n = recv(fd, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            *reused = true;
+            return fd;
+        }
+        close(fd);
+    }
+    return connect_new();
+}
+
+void upstream::release(int fd) {
+    m_lock.lock();
+    if ((int)m_idle.size() < m_max_idle) {
+        m_idle.push_back(fd);
+        fd = -1;
+    }
+    m_lock.unlock();
+    if (fd >= 0) {
+        close(fd);
+    }
+}
+
+//-------------------- proxy_session --------------------
+
+proxy_session::proxy_session()
+    : m_up(NULL), m_fd(-1), m_reused(false), m_retryable(false), m_body(BODY_NONE), m_body_done(true),
+      m_head_method(false), m_keep_client(false), m_keep_upstream(false), m_started(false), m_state(COMPLETE),
+      m_out_pos(0), m_buf(NULL), m_len(0), m_head_pending(false), m_status(0), m_send_off(0), m_send_len(0),
+      m_left(0), m_chunk(CH_SIZE), m_chunk_digits(0), m_last_active(0) {
+}
+
+proxy_session::~proxy_session() {
+    finish(false);
+    delete[] m_buf;
+}
+
+bool proxy_session::start(upstream* up, BODY body, bool head_method, bool keep_client) {
+    //响应缓冲区在连接第一次转发时分配，之后随 http_conn 复用
+    if (!m_buf) {
+        m_buf = new char[BUFFER_SIZE];
+    }
+    m_up = up;
+    m_body = body;
+    m_body_done = body == BODY_NONE;
+    m_retryable = body == BODY_NONE;
+    m_head_method = head_method;
+    m_keep_client = keep_client;
+    m_keep_upstream = false;
+    m_started = false;
+    m_state = SENDING;
+    m_out_pos = 0;
+    m_len = 0;
+    m_head.clear();
+    m_head_pending = false;
+    m_status = 0;
+    m_send_len = 0;
+    m_last_active = time(NULL);
+    m_fd = up->acquire(false, &m_reused);
+    return m_fd >= 0;
+}
+
+void proxy_session::body(const char* data, int len) {
+    if (m_body == BODY_CHUNKED) {
+        char size[16];
+        snprintf(size, sizeof(size), "%x\r\n", len);
+        m_out.append(size);
+        m_out.append(data, len);
+        m_out.append("\r\n");
+    }
+    else {
+        m_out.append(data, len);
+    }
+}
+
+void proxy_session::end_body() {
+    if (m_body == BODY_CHUNKED && !m_body_done) {
+        m_out.append("0\r\n\r\n");
+    }
+    m_body_done = true;
+}
+
+void proxy_session::finish(bool reuse) {
+    if (m_fd >= 0) {
+        if (reuse && m_keep_upstream && m_state == COMPLETE) {
+            m_up->release(m_fd);
+        }
+        else {
+            close(m_fd);
+        }
+        m_fd = -1;
+    }
+    m_out.clear();
+    m_out_pos = 0;
+    m_state = COMPLETE;
+}
+
+int proxy_session::fill_iov(struct iovec* iov) const {
+    int n = 0;
+    if (m_head_pending) {
+        iov[n].iov_base = (void*)m_head.data();
+        iov[n].iov_len = m_head.size();
+        n++;
+    }
+    if (m_send_len > 0) {
+        iov[n].iov_base = m_buf + m_send_off;
+        iov[n].iov_len = m_send_len;
+        n++;
+    }
+    return n;
+}
+
+int proxy_session::bytes() const {
+    return (m_head_pending ? m_head.size() : 0) + m_send_len;
+}
+
+int proxy_session::fail(const char* what, int err) {
+    EMlog(LOGLEVEL_WARN, "upstream %s %s failed, errno is : %d\n", m_up->name(), what, err);
+    m_keep_upstream = false;
+    return FAILED;
+}
+
+//复用的空闲连接可能恰好被上游关闭：还没收到任何响应、请求可以完整重发时，换一个新连接重试一次
+bool proxy_session::retry() {
+    if (!m_reused || !m_retryable || m_started) {
+        return false;
+    }
+    close(m_fd);
+    m_fd = m_up->acquire(true, &m_reused);
+    if (m_fd < 0) {
+        return false;
+    }
+    m_out_pos = 0;
+    m_len = 0;
+    m_state = SENDING;
+    return true;
+}
+
+//发送缓冲中的请求数据，返回 SEND 表示全部发完
+int proxy_session::flush() {
+    while (m_out_pos < m_out.size()) {
+        int n = send(m_fd, m_out.data() + m_out_pos, m_out.size() - m_out_pos, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return WAIT_WRITE;
+            }
+            if (errno == EINTR) {
+                continue;
+            }
+            return retry() ? flush() : fail("send", errno);
+        }
+        m_out_pos += n;
+    }
+    //已经发出的请求体不再保留；没有请求体时保留整个请求，以便换连接重发
+    if (!m_retryable) {
+        m_out.clear();
+        m_out_pos = 0;
+    }
+    return SEND;
+}
+
+int proxy_session::step() {
+    m_last_active = time(NULL);
+    //上一批响应数据客户端已经发完
+    m_head_pending = false;
+    m_send_len = 0;
+
+    if (m_state == SENDING) {
+        int ret = flush();
+        if (ret != SEND) {
+            return ret;
+        }
+        if (!m_body_done) {
+            return NEED_BODY;
+        }
+        m_state = HEAD;
+        m_len = 0;
+    }
+
+    while (m_state != COMPLETE) {
+        if (m_state != HEAD) {
+            m_len = 0;      //响应头之后每批都从缓冲区开头读
+        }
+        int n = recv(m_fd, m_buf + m_len, BUFFER_SIZE - m_len, 0);
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return WAIT_READ;
+            }
+            if (errno == EINTR) {
+                continue;
+            }
+            if (m_state == HEAD && m_len == 0 && retry()) {
+                return step();
+            }
+            return fail("recv", errno);
+        }
+        if (n == 0) {
+            if (m_state == BODY_EOF) {
+                m_state = COMPLETE;         //响应以连接关闭结束，连接不能复用
+                break;
+            }
+            if (m_state == HEAD && m_len == 0 && retry()) {
+                return step();
+            }
+            return fail("recv", ECONNRESET);
+        }
+        m_len += n;
+
+        if (m_state == HEAD) {
+            int ret = parse_head();
+            if (ret < 0) {
+                return fail("parse response", EPROTO);
+            }
+            if (ret == 0) {
+                if (m_len == BUFFER_SIZE) {
+                    return fail("parse response", EMSGSIZE);   //响应头放不下
+                }
+                continue;
+            }
+            return SEND;
+        }
+
+        m_send_off = 0;
+        m_send_len = consume(m_buf, m_len);
+        if (m_send_len < 0) {
+            return fail("parse response", EPROTO);
+        }
+        if (m_send_len > 0) {
+            return SEND;
+        }
+    }
+    return DONE;
+}
+
+//在响应缓冲区中找完整的响应头，改写后放入 m_head。返回1完成，0需要更多数据，-1格式错误
+int proxy_session::parse_head() {
+    while (true) {
+        char* end = (char*)memmem(m_buf, m_len, "\r\n\r\n", 4);
+        if (!end) {
+            return 0;
+        }
+        int head_len = end + 4 - m_buf;
+        if (strncmp(m_buf, "HTTP/1.", 7) != 0 || !isdigit(m_buf[7]) || m_buf[8] != ' ' ||
+            !isdigit(m_buf[9]) || !isdigit(m_buf[10]) || !isdigit(m_buf[11])) {
+            return -1;
+        }
+        int status = atoi(m_buf + 9);
+        if (status < 200) {
+            if (status == 101) {
+                return -1;      //请求中已经去掉了 Upgrade，不支持协议升级
+            }
+            //100 Continue 等中间响应直接丢弃
+            memmove(m_buf, m_buf + head_len, m_len - head_len);
+            m_len -= head_len;
+            continue;
+        }
+
+        m_status = status;
+        m_keep_upstream = m_buf[7] != '0';      //HTTP/1.0 默认不保持连接
+        bool chunked = false;
+        bool has_encoding = false;
+        long long length = -1;
+        char* line = (char*)memchr(m_buf, '\n', head_len) + 1;
+        m_head.assign("HTTP/1.1");
+        m_head.append(m_buf + 8, line - m_buf - 8);
+        while (line < end + 2) {
+            char* eol = (char*)memchr(line, '\n', end + 4 - line);
+            int line_len = eol - line + 1;
+            char* colon = (char*)memchr(line, ':', line_len);
+            if (!colon) {
+                return -1;
+            }
+            int name_len = colon - line;
+            char* value = colon + 1;
+            value += strspn(value, " \t");
+            int value_len = eol - value;
+            while (value_len > 0 && (value[value_len - 1] == '\r' || value[value_len - 1] == ' ')) {
+                value_len--;
+            }
+            std::string v(value, value_len);
+
+            //逐跳头部不转发，客户端连接的 Connection 由本服务器决定
+            if (name_len == 10 && strncasecmp(line, "Connection", 10) == 0) {
+                if (strcasestr(v.c_str(), "close")) {
+                    m_keep_upstream = false;
+                }
+                else if (strcasestr(v.c_str(), "keep-alive")) {
+                    m_keep_upstream = true;
+                }
+            }
+            else if ((name_len == 10 && strncasecmp(line, "Keep-Alive", 10) == 0) ||
+                     (name_len == 16 && strncasecmp(line, "Proxy-Connection", 16) == 0) ||
+                     (name_len == 7 && strncasecmp(line, "Upgrade", 7) == 0)) {
+            }
+            else {
+                if (name_len == 14 && strncasecmp(line, "Content-Length", 14) == 0) {
+                    char* num_end;
+                    length = strtoll(v.c_str(), &num_end, 10);
+                    if (num_end == v.c_str() || *num_end || length < 0) {
+                        return -1;
+                    }
+                }
+                else if (name_len == 17 && strncasecmp(line, "Transfer-Encoding", 17) == 0) {
+                    //最后一个编码是 chunked 时按块确定边界，其它编码只能读到连接关闭
+                    has_encoding = true;
+                    int len = v.size();
+                    chunked = len >= 7 && strcasecmp(v.c_str() + len - 7, "chunked") == 0;
+                }
+                m_head.append(line, line_len - 1 - (eol[-1] == '\r'));
+                m_head.append("\r\n");
+            }
+            line = eol + 1;
+        }
+
+        if (m_head_method || status == 204 || status == 304) {
+            m_state = COMPLETE;
+        }
+        else if (chunked) {
+            m_state = BODY_CHUNK;
+            m_chunk = CH_SIZE;
+            m_chunk_digits = 0;
+            m_left = 0;
+        }
+        else if (length >= 0 && !has_encoding) {
+            m_state = length > 0 ? BODY_LEN : COMPLETE;
+            m_left = length;
+        }
+        else {
+            //没有长度的响应体读到上游关闭为止，客户端只能同样靠关闭连接判断结束
+            m_state = BODY_EOF;
+            m_keep_upstream = false;
+            m_keep_client = false;
+        }
+        m_head.append(m_keep_client ? "Connection: keep-alive\r\n\r\n" : "Connection: close\r\n\r\n");
+        m_started = true;
+        m_head_pending = true;
+
+        m_send_off = head_len;
+        m_send_len = consume(m_buf + head_len, m_len - head_len);
+        return m_send_len < 0 ? -1 : 1;
+    }
+}
+
+//一批响应体中属于本响应的字节数；后面多出来的数据说明上游不可信，连接不再复用
+int proxy_session::consume(const char* data, int len) {
+    int used = 0;
+    switch (m_state) {
+        case BODY_LEN:
+            used = len < m_left ? len : m_left;
+            m_left -= used;
+            if (m_left == 0) {
+                m_state = COMPLETE;
+            }
+            break;
+        case BODY_CHUNK:
+            used = scan_chunked(data, len);
+            if (used < 0) {
+                return -1;
+            }
+            break;
+        case BODY_EOF:
+            used = len;
+            break;
+        default:
+            break;
+    }
+    if (used < len) {
+        m_keep_upstream = false;
+    }
+    return used;
+}
+
+//跟踪 chunked 编码的边界(数据原样转发)，返回属于本响应的字节数，格式错误返回-1
+int proxy_session::scan_chunked(const char* data, int len) {
+    int i = 0;
+    while (i < len && m_state == BODY_CHUNK) {
+        char c = data[i];
+        switch (m_chunk) {
+            case CH_SIZE:
+                if (isxdigit(c)) {
+                    if (m_left >> 40) {
+                        return -1;      //块大小超过1TB，视为格式错误
+                    }
+                    m_left = m_left * 16 + (isdigit(c) ? c - '0' : (tolower(c) - 'a' + 10));
+                    m_chunk_digits++;
+                    i++;
+                    break;
+                }
+                if (m_chunk_digits == 0) {
+                    return -1;
+                }
+                m_chunk = CH_EXT;
+                break;
+            case CH_EXT:        //块扩展，到行尾为止
+                if (c == '\n') {
+                    m_chunk = m_left > 0 ? CH_DATA : CH_TRAILER;
+                }
+                i++;
+                break;
+            case CH_DATA:
+            {
+                int n = len - i < m_left ? len - i : m_left;
+                i += n;
+                m_left -= n;
+                if (m_left == 0) {
+                    m_chunk = CH_DATA_END;
+                }
+                break;
+            }
+            case CH_DATA_END:   //块数据后的 \r\n
+                if (c == '\n') {
+                    m_chunk = CH_SIZE;
+                    m_chunk_digits = 0;
+                }
+                else if (c != '\r') {
+                    return -1;
+                }
+                i++;
+                break;
+            case CH_TRAILER:    //trailer 的行首，空行表示响应结束
+                if (c == '\n') {
+                    m_state = COMPLETE;
+                }
+                else if (c != '\r') {
+                    m_chunk = CH_TRAILER_LINE;
+                }
+                i++;
+                break;
+            case CH_TRAILER_LINE:
+                if (c == '\n') {
+                    m_chunk = CH_TRAILER;
+                }
+                i++;
+                break;
+        }
+    }
+    return i;
+}
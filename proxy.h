@@ -0,0 +1,123 @@
+#ifndef PROXY_H
+#define PROXY_H
+
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <string>
+#include <vector>
+#include "locker.h"
+#include "router.h"
+
+/*
+    反向代理：匹配前缀的请求转发给本机的应用进程(Unix socket 或 TCP)，响应流式返回客户端。
+    代理规则与进程内处理函数注册在同一个路由表中(处理函数为 proxy_handler，参数为 upstream)，
+    按最长前缀一起匹配；GET 请求的目标在根目录中存在时仍然作为静态文件提供。
+*/
+
+//一个上游地址及其空闲长连接池。工作线程和事件循环线程都会取还连接，加锁
+class upstream {
+public:
+    upstream();
+    ~upstream();
+
+    bool init(const char* spec);            //"unix:/run/app.sock" 或 "127.0.0.1:8080"，启动时解析
+    int acquire(bool fresh, bool* reused);  //取一个空闲长连接，没有时新建非阻塞连接；fresh 为 true 时总是新建。失败返回-1
+    void release(int fd);                   //响应完整结束的连接放回池中，池满时关闭
+    const char* name() const { return m_name.c_str(); }
+
+    static int m_max_idle;                  //每个上游保留的空闲连接数，0 表示不复用
+
+private:
+    int connect_new();
+
+    std::string m_name;
+    struct sockaddr_storage m_addr;
+    socklen_t m_addr_len;
+    locker m_lock;
+    std::vector<int> m_idle;                //栈：最近放回的连接先被取出，更可能仍然有效
+};
+
+//代理路由的标记：http_conn 匹配到它时直接转发，不会调用
+void proxy_handler(const request_view& req, response_builder& resp, void* arg);
+
+/*
+    一个连接上正在转发的请求，所有读写都是非阻塞的，由 step 推进，返回值告诉事件循环下一步等什么：
+        请求方向  改写后的请求头和请求体(chunked 时重新分块)放进发送缓冲，发完一批再读客户端的下一批，
+                  缓冲最多比读缓冲区多一个块头，上游慢时由TCP流量控制让客户端放慢
+        响应方向  读一批到响应缓冲区，第一批中解析并改写响应头，客户端发完后再读下一批；
+                  按 Content-Length / chunked / 连接关闭 确定响应的结束位置，响应体原样转发
+    只有响应按协议完整结束的上游连接才放回连接池，出错、超时或客户端中途断开时都直接关闭。
+*/
+class proxy_session {
+public:
+    enum BODY { BODY_NONE, BODY_LENGTH, BODY_CHUNKED };
+    enum STEP {
+        NEED_BODY,      //请求体还没读完，继续读客户端
+        WAIT_READ,      //等上游可读
+        WAIT_WRITE,     //等上游可写
+        SEND,           //响应数据已就绪(fill_iov)，客户端发完后再调用 step
+        DONE,           //响应完整结束
+        FAILED          //上游出错；started() 为 false 时还可以回复502
+    };
+    static const int BUFFER_SIZE = 16384;   //响应缓冲区，也是响应头的长度上限
+
+    proxy_session();
+    ~proxy_session();
+
+    std::string& request() { return m_out; }    //start 之前写入改写好的请求头
+    bool start(upstream* up, BODY body, bool head_method, bool keep_client);
+    void body(const char* data, int len);       //一段请求体
+    void end_body();                            //请求体结束
+    int step();
+    void finish(bool reuse);                    //结束转发：响应完整时连接放回池中，否则关闭
+
+    int fd() const { return m_fd; }
+    bool started() const { return m_started; }          //响应头已经交给客户端
+    bool head_pending() const { return m_head_pending; }
+    int status() const { return m_status; }             //上游响应的状态码，响应头解析完之前为0
+    bool keep_client() const { return m_keep_client; }  //响应以上游关闭连接结束时，客户端连接也要关闭
+    time_t last_active() const { return m_last_active; }
+    int fill_iov(struct iovec* iov) const;      //本批要发给客户端的数据，最多两段(响应头、响应体)
+    int bytes() const;
+
+private:
+    enum STATE { SENDING, HEAD, BODY_LEN, BODY_CHUNK, BODY_EOF, COMPLETE };
+    enum CHUNK { CH_SIZE, CH_EXT, CH_DATA, CH_DATA_END, CH_TRAILER, CH_TRAILER_LINE };
+
+    int flush();
+    int parse_head();
+    int consume(const char* data, int len);
+    int scan_chunked(const char* data, int len);
+    bool retry();
+    int fail(const char* what, int err);
+
+    upstream* m_up;
+    int m_fd;
+    bool m_reused;          //连接来自连接池
+    bool m_retryable;       //没有请求体，整个请求还在发送缓冲中，可以换连接重发
+    BODY m_body;
+    bool m_body_done;
+    bool m_head_method;     //HEAD 请求的响应没有响应体
+    bool m_keep_client;
+    bool m_keep_upstream;
+    bool m_started;
+    int m_state;
+
+    std::string m_out;      //发往上游的请求数据
+    size_t m_out_pos;
+
+    char* m_buf;            //响应缓冲区
+    int m_len;
+    std::string m_head;     //改写后发给客户端的响应头
+    bool m_head_pending;
+    int m_status;
+    int m_send_off;         //本批响应体在 m_buf 中的位置
+    int m_send_len;
+    long long m_left;       //Content-Length 或当前块剩余的字节数
+    int m_chunk;
+    int m_chunk_digits;
+    time_t m_last_active;
+};
+
+#endif
@@ -0,0 +1,117 @@
+#include "rate_limit.h"
+#include <time.h>
+#include <arpa/inet.h>
+
+static const char too_many_requests[] =
+    "HTTP/1.1 429 Too Many Requests\r\n"
+    "Content-Length: 18\r\n"
+    "Content-Type: text/plain\r\n"
+    "Retry-After: 1\r\n"
+    "Connection: close\r\n"
+    "\r\n"
+    "Too Many Requests\n";
+
+static long long monotonic_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+rate_limiter::rate_limiter() : m_start_ms(monotonic_ms()), m_rate(0), m_burst(1), m_prefix(32), m_rejected(0) {
+    m_slots = new slot[TABLE_SIZE];
+    for (int i = 0; i < TABLE_SIZE; i++) {
+        m_slots[i].key.store(0, std::memory_order_relaxed);
+        m_slots[i].state.store(0, std::memory_order_relaxed);
+    }
+}
+
+rate_limiter::~rate_limiter() {
+    delete[] m_slots;
+}
+
+void rate_limiter::configure(int rate, int burst, int prefix) {
+    m_rate.store(rate, std::memory_order_relaxed);
+    m_burst.store(burst < 1 ? 1 : (burst > MAX_BURST ? MAX_BURST : burst), std::memory_order_relaxed);
+    m_prefix.store(prefix < 1 ? 1 : (prefix > 32 ? 32 : prefix), std::memory_order_relaxed);
+}
+
+const char* rate_limiter::response(int* len) {
+    *len = sizeof(too_many_requests) - 1;
+    return too_many_requests;
+}
+
+//相对启动时间的毫秒数，49天回绕一次，只用差值所以不受影响
+uint32_t rate_limiter::now_ms() const {
+    return (uint32_t)(monotonic_ms() - m_start_ms);
+}
+
+//桶是否已经补满：补满的桶与新建的桶没有区别，槽位可以让给别的地址
+bool rate_limiter::full(uint64_t state, uint32_t now, int rate, uint32_t cap) const {
+    uint32_t elapsed = now - (uint32_t)(state >> 32);
+    return (uint32_t)state + (uint64_t)elapsed * rate >= cap;
+}
+
+bool rate_limiter::allow(const sockaddr_in& addr) {
+    int rate = m_rate.load(std::memory_order_relaxed);
+    if (rate <= 0) {
+        return true;
+    }
+    uint32_t cap = m_burst.load(std::memory_order_relaxed) * 1000;
+    int prefix = m_prefix.load(std::memory_order_relaxed);
+    uint32_t ip = ntohl(addr.sin_addr.s_addr);
+    uint32_t masked = prefix >= 32 ? ip : ip & ~(0xffffffffu >> prefix);
+    uint64_t key = ((uint64_t)prefix << 32) | masked;
+    uint32_t now = now_ms();
+
+    //先在整个探测范围内找该地址的槽位，找不到再占用第一个空槽或已补满的槽，
+    //否则地址所在槽之前有空槽时会再占一个新槽，令牌桶被一分为二
+    slot* s = NULL;
+    uint32_t h = (masked * 2654435761u) >> 16;
+    for (int i = 0; i < MAX_PROBE && !s; i++) {
+        slot& cur = m_slots[(h + i) & (TABLE_SIZE - 1)];
+        if (cur.key.load(std::memory_order_acquire) == key) {
+            s = &cur;
+        }
+    }
+    for (int i = 0; i < MAX_PROBE && !s; i++) {
+        slot& cur = m_slots[(h + i) & (TABLE_SIZE - 1)];
+        uint64_t k = cur.key.load(std::memory_order_acquire);
+        if (k == key) {
+            s = &cur;
+        }
+        else if (k == 0 || full(cur.state.load(std::memory_order_relaxed), now, rate, cap)) {
+            if (cur.key.compare_exchange_strong(k, key, std::memory_order_acq_rel)) {
+                cur.state.store(((uint64_t)now << 32) | cap, std::memory_order_release);
+                s = &cur;
+            }
+            else if (k == key) {
+                s = &cur;       //另一个线程刚为同一地址占用了它
+            }
+        }
+    }
+    if (!s) {
+        return true;
+    }
+
+    //补充令牌并取走一个，与其它线程竞争时重试
+    uint64_t old = s->state.load(std::memory_order_acquire);
+    while (true) {
+        uint32_t last = (uint32_t)(old >> 32);
+        int32_t elapsed = (int32_t)(now - last);
+        if (elapsed < 0) {
+            elapsed = 0;        //别的线程用更晚的时间更新过
+        }
+        uint64_t tokens = (uint32_t)old + (uint64_t)elapsed * rate;     //每秒 rate 个 = 每毫秒 rate 个千分之一
+        if (tokens > cap) {
+            tokens = cap;
+        }
+        if (tokens < 1000) {
+            m_rejected.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        uint64_t next = ((uint64_t)(elapsed ? now : last) << 32) | (tokens - 1000);
+        if (s->state.compare_exchange_weak(old, next, std::memory_order_acq_rel)) {
+            return true;
+        }
+    }
+}
@@ -0,0 +1,49 @@
+#ifndef RATE_LIMIT_H
+#define RATE_LIMIT_H
+
+#include <stdint.h>
+#include <netinet/in.h>
+#include <atomic>
+
+/*
+    按客户端地址(或 /24 等网段)的令牌桶限流，在事件循环中、请求交给线程池之前检查，
+    一个客户端发得再快也占不满线程池的队列。
+    固定大小的开放寻址哈希表，每个槽位的键和桶状态各是一个原子变量，取令牌用 CAS 更新，不加锁。
+    令牌已经补满的桶与不存在等价，探测时可以直接被新地址占用，所以不需要单独的过期清理；
+    探测范围内都是活跃的桶时新地址不限流(表按 65536 个活跃客户端设计)。
+*/
+class rate_limiter {
+public:
+    static const int TABLE_SIZE = 65536;    //槽位数，2的幂
+    static const int MAX_PROBE = 8;         //线性探测的最大长度
+    static const int MAX_BURST = 1000000;   //令牌以千分之一为单位存在32位里
+
+    rate_limiter();
+    ~rate_limiter();
+
+    //每秒请求数(0 关闭)、桶容量、按多长的地址前缀归并客户端；可以在运行中调用(热加载)
+    void configure(int rate, int burst, int prefix);
+    bool enabled() const { return m_rate.load(std::memory_order_relaxed) > 0; }
+    bool allow(const sockaddr_in& addr);    //取一个令牌，返回false表示超过速率
+    unsigned long rejected() const { return m_rejected.load(std::memory_order_relaxed); }
+
+    static const char* response(int* len);  //预先生成的429响应(Connection: close)
+
+private:
+    struct slot {
+        std::atomic<uint64_t> key;          //前缀长度 << 32 | 地址前缀，0 表示空槽
+        std::atomic<uint64_t> state;        //高32位：上次补充令牌的时间(ms)，低32位：令牌数(千分之一个)
+    };
+
+    uint32_t now_ms() const;
+    bool full(uint64_t state, uint32_t now, int rate, uint32_t cap) const;
+
+    slot* m_slots;
+    long long m_start_ms;
+    std::atomic<int> m_rate;
+    std::atomic<int> m_burst;
+    std::atomic<int> m_prefix;
+    std::atomic<unsigned long> m_rejected;
+};
+
+#endif
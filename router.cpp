@@ -0,0 +1,328 @@
+#include "router.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <strings.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <algorithm>
+
+//与 http_conn::METHOD 的顺序一致
+static const char* method_names[router::MAX_METHODS] = {
+    "GET", "POST", "HEAD", "PUT", "DELETE", "TRACE", "OPTIONS", "CONNECT"
+};
+
+const char* request_view::header(const char* name) const {
+    int len = strlen(name);
+    for (int i = 0; i < header_count; i++) {
+        if (headers[i].name_len == len && strncasecmp(headers[i].name, name, len) == 0) {
+            return headers[i].value;
+        }
+    }
+    return NULL;
+}
+
+//-------------------- response_builder --------------------
+
+response_builder::response_builder() : m_status(200), m_reason(NULL), m_bytes(0) {
+}
+
+response_builder::~response_builder() {
+    reset();
+}
+
+void response_builder::status(int code, const char* reason) {
+    m_status = code;
+    m_reason = reason;
+}
+
+void response_builder::header(const char* name, const char* value) {
+    m_headers.append(name);
+    m_headers.append(": ");
+    m_headers.append(value);
+    m_headers.append("\r\n");
+}
+
+void response_builder::content_type(const char* type) {
+    m_content_type = type;
+}
+
+//连续写入的数据合成一段；上一段不是自有缓冲区时新开一段
+void response_builder::write(const char* data, int len) {
+    if (len <= 0) {
+        return;
+    }
+    if (m_segs.empty() || !m_segs.back().owned) {
+        segment seg;
+        seg.owned = true;
+        seg.data = NULL;
+        seg.offset = m_body.size();
+        seg.len = 0;
+        m_segs.push_back(seg);
+    }
+    m_body.append(data, len);
+    m_segs.back().len += len;
+}
+
+void response_builder::write(const char* str) {
+    write(str, strlen(str));
+}
+
+void response_builder::printf(const char* format, ...) {
+    char buf[512];
+    va_list args;
+    va_start(args, format);
+    int len = vsnprintf(buf, sizeof(buf), format, args);
+    va_end(args);
+    if (len < 0) {
+        return;
+    }
+    if (len < (int)sizeof(buf)) {
+        write(buf, len);
+        return;
+    }
+    //超过栈上缓冲区时直接格式化到自有缓冲区的末尾
+    std::string tmp(len + 1, '\0');
+    va_start(args, format);
+    vsnprintf(&tmp[0], len + 1, format, args);
+    va_end(args);
+    write(tmp.data(), len);
+}
+
+void response_builder::add_static(const void* data, int len) {
+    if (len <= 0) {
+        return;
+    }
+    segment seg;
+    seg.owned = false;
+    seg.data = (const char*)data;
+    seg.offset = 0;
+    seg.len = len;
+    m_segs.push_back(seg);
+}
+
+bool response_builder::add_file(const char* path, off_t offset, off_t len) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) || offset < 0 || offset > st.st_size) {
+        close(fd);
+        return false;
+    }
+    if (len < 0 || offset + len > st.st_size) {
+        len = st.st_size - offset;
+    }
+    if (len == 0) {
+        close(fd);
+        return true;
+    }
+    //mmap 的偏移必须按页对齐
+    off_t page = sysconf(_SC_PAGESIZE);
+    off_t aligned = offset & ~(page - 1);
+    size_t map_len = len + (offset - aligned);
+    void* addr = mmap(0, map_len, PROT_READ, MAP_PRIVATE, fd, aligned);
+    close(fd);
+    if (addr == MAP_FAILED) {
+        return false;
+    }
+    mapping m;
+    m.addr = addr;
+    m.len = map_len;
+    m_maps.push_back(m);
+    add_static((char*)addr + (offset - aligned), len);
+    return true;
+}
+
+static const char* reason_phrase(int code) {
+    switch (code) {
+        case 200: return "OK";
+        case 201: return "Created";
+        case 202: return "Accepted";
+        case 204: return "No Content";
+        case 301: return "Moved Permanently";
+        case 302: return "Found";
+        case 304: return "Not Modified";
+        case 400: return "Bad Request";
+        case 401: return "Unauthorized";
+        case 403: return "Forbidden";
+        case 404: return "Not Found";
+        case 405: return "Method Not Allowed";
+        case 409: return "Conflict";
+        case 413: return "Payload Too Large";
+        case 422: return "Unprocessable Entity";
+        case 429: return "Too Many Requests";
+        case 500: return "Internal Error";
+        case 502: return "Bad Gateway";
+        case 503: return "Service Unavailable";
+        case 504: return "Gateway Timeout";
+        default:  return "Unknown";
+    }
+}
+
+void response_builder::seal(bool linger) {
+    long long body_len = 0;
+    for (size_t i = 0; i < m_segs.size(); i++) {
+        body_len += m_segs[i].len;
+    }
+
+    char line[128];
+    snprintf(line, sizeof(line), "HTTP/1.1 %d %s\r\nContent-Length: %lld\r\nConnection: %s\r\nContent-Type: ",
+             m_status, m_reason ? m_reason : reason_phrase(m_status), body_len, linger ? "keep-alive" : "close");
+    m_head.assign(line);
+    m_head.append(m_content_type.empty() ? "text/plain" : m_content_type.c_str());
+    m_head.append("\r\n");
+    m_head.append(m_headers);
+    m_head.append("\r\n");
+
+    //自有缓冲区不再增长，此时才能把偏移换成指针
+    m_iov.resize(m_segs.size() + 1);
+    m_iov[0].iov_base = (void*)m_head.data();
+    m_iov[0].iov_len = m_head.size();
+    for (size_t i = 0; i < m_segs.size(); i++) {
+        const segment& seg = m_segs[i];
+        m_iov[i + 1].iov_base = (void*)(seg.owned ? m_body.data() + seg.offset : seg.data);
+        m_iov[i + 1].iov_len = seg.len;
+    }
+    m_bytes = m_head.size() + body_len;
+}
+
+void response_builder::reset() {
+    for (size_t i = 0; i < m_maps.size(); i++) {
+        munmap(m_maps[i].addr, m_maps[i].len);
+    }
+    m_maps.clear();
+    m_status = 200;
+    m_reason = NULL;
+    m_content_type.clear();
+    m_headers.clear();
+    m_head.clear();
+    m_body.clear();
+    m_segs.clear();
+    m_iov.clear();
+    m_bytes = 0;
+}
+
+//-------------------- router --------------------
+
+router::router() : max_body(1024 * 1024) {
+    build_node root;
+    root.label = 0;
+    root.route = -1;
+    m_build.push_back(root);
+}
+
+bool router::add(int method, const char* prefix, http_handler fn, void* arg) {
+    if (method < 0 || method >= MAX_METHODS || !fn || prefix[0] != '/') {
+        return false;
+    }
+    int cur = 0;
+    for (const char* p = prefix; *p; p++) {
+        int next = -1;
+        for (size_t i = 0; i < m_build[cur].children.size(); i++) {
+            if (m_build[m_build[cur].children[i]].label == *p) {
+                next = m_build[cur].children[i];
+                break;
+            }
+        }
+        if (next < 0) {
+            build_node n;
+            n.label = *p;
+            n.route = -1;
+            m_build.push_back(n);
+            next = m_build.size() - 1;
+            m_build[cur].children.push_back(next);
+        }
+        cur = next;
+    }
+
+    if (m_build[cur].route < 0) {
+        route r;
+        memset(&r, 0, sizeof(r));
+        r.prefix_len = strlen(prefix);
+        r.subtree = prefix[r.prefix_len - 1] == '/';
+        m_routes.push_back(r);
+        m_build[cur].route = m_routes.size() - 1;
+    }
+    route& r = m_routes[m_build[cur].route];
+    if (r.fn[method]) {
+        return false;       //同一方法和前缀重复注册
+    }
+    r.fn[method] = fn;
+    r.arg[method] = arg;
+    return true;
+}
+
+//按层次遍历压平：每个结点的子结点在数组中连续存放并按字符排序，查找时二分
+void router::compile() {
+    for (size_t i = 0; i < m_routes.size(); i++) {
+        route& r = m_routes[i];
+        int len = 0;
+        r.allow[0] = '\0';
+        for (int m = 0; m < MAX_METHODS; m++) {
+            if (r.fn[m]) {
+                len += snprintf(r.allow + len, sizeof(r.allow) - len, "%s%s", len ? ", " : "", method_names[m]);
+            }
+        }
+    }
+
+    m_nodes.clear();
+    m_nodes.resize(m_build.size());
+    std::vector<int> order;         //order[i] 为压平后第i个结点对应的注册阶段结点
+    order.push_back(0);
+    for (size_t i = 0; i < order.size(); i++) {
+        build_node& b = m_build[order[i]];
+        std::vector<int> kids = b.children;
+        std::sort(kids.begin(), kids.end(), [this](int x, int y) { return m_build[x].label < m_build[y].label; });
+        node& n = m_nodes[i];
+        n.label = b.label;
+        n.route = b.route;
+        n.first_child = order.size();
+        n.child_count = kids.size();
+        order.insert(order.end(), kids.begin(), kids.end());
+    }
+}
+
+const router::route* router::match(const char* path, int len) const {
+    if (m_nodes.empty()) {
+        return NULL;
+    }
+    const route* best = NULL;
+    int cur = 0;
+    for (int i = 0; ; i++) {
+        const node& n = m_nodes[cur];
+        if (n.route >= 0) {
+            const route& r = m_routes[n.route];
+            if (r.subtree || i == len || path[i] == '/') {
+                best = &r;
+            }
+        }
+        if (i == len || n.child_count == 0) {
+            break;
+        }
+        //子结点按字符有序，二分查找
+        int lo = n.first_child, hi = n.first_child + n.child_count - 1, next = -1;
+        while (lo <= hi) {
+            int mid = (lo + hi) / 2;
+            if (m_nodes[mid].label == path[i]) {
+                next = mid;
+                break;
+            }
+            if (m_nodes[mid].label < path[i]) {
+                lo = mid + 1;
+            }
+            else {
+                hi = mid - 1;
+            }
+        }
+        if (next < 0) {
+            break;
+        }
+        cur = next;
+    }
+    return best;
+}
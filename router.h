@@ -0,0 +1,141 @@
+#ifndef ROUTER_H
+#define ROUTER_H
+
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <string>
+#include <vector>
+
+/*
+    进程内请求处理函数：按 请求方法 + 路径前缀 注册，在工作线程中调用(协程模型下在事件循环线程中调用)。
+    处理函数拿到只读的请求视图，把响应写进 response_builder；http_conn 负责补齐
+    Content-Length/Connection 并用 writev 发送。处理函数内不能阻塞太久，它占用的是线程池的线程。
+*/
+
+struct http_header {
+    const char* name;       //不以\0结尾，长度为name_len
+    int name_len;
+    const char* value;      //以\0结尾
+};
+
+//请求视图：所有指针都指向连接的读缓冲区(或请求体缓冲)，只在处理函数执行期间有效
+struct request_view {
+    int method;                 //http_conn::METHOD
+    const char* method_name;
+    const char* path;           //请求路径，不含查询串，未解码
+    int path_len;
+    const char* subpath;        //path 去掉匹配到的路由前缀后的部分
+    int subpath_len;
+    const char* query;          //'?' 之后的部分，没有时为 ""
+    const char* body;           //请求体，没有时为 ""
+    int body_len;
+    const sockaddr_in* peer;
+    const http_header* headers;
+    int header_count;
+
+    const char* header(const char* name) const;     //按名字(不区分大小写)查找请求头，没有时返回NULL
+};
+
+/*
+    响应拼装：响应体由若干段组成，发送时每段对应一个 iovec，不再合并拷贝
+        write/printf    拷贝进自有缓冲区(连续写入的部分合成一段)
+        add_static      直接引用调用方的内存，不拷贝，内存必须比这次响应活得长(如字符串常量、启动时生成的表)
+        add_file        只读映射文件的一段，响应发送完后解除映射
+    缓冲区随连接复用，稳定运行后拼装响应不再分配内存。
+*/
+class response_builder {
+public:
+    response_builder();
+    ~response_builder();
+
+    void status(int code, const char* reason = NULL);  //默认200，reason为NULL时使用标准短语
+    void header(const char* name, const char* value);  //追加一个响应头(拷贝)
+    void content_type(const char* type);               //默认 text/plain
+
+    void write(const char* data, int len);
+    void write(const char* str);
+    void printf(const char* format, ...) __attribute__((format(printf, 2, 3)));
+    void add_static(const void* data, int len);
+    bool add_file(const char* path, off_t offset = 0, off_t len = -1);  //len为-1时到文件末尾，失败返回false
+
+    //由 http_conn 调用：生成状态行和响应头，组装待发送的 iovec
+    void seal(bool linger);
+    struct iovec* iov() { return &m_iov[0]; }
+    int iov_count() const { return m_iov.size(); }
+    long long bytes() const { return m_bytes; }
+    int status_code() const { return m_status; }
+    void reset();                   //响应发送完毕或连接关闭：解除文件映射，清空各缓冲区(保留容量)
+
+private:
+    struct segment {
+        bool owned;                 //true 时 data 为 m_body 中的偏移
+        const char* data;
+        size_t offset;
+        size_t len;
+    };
+    struct mapping {
+        void* addr;
+        size_t len;
+    };
+
+    int m_status;
+    const char* m_reason;
+    std::string m_content_type;
+    std::string m_headers;          //处理函数追加的响应头
+    std::string m_head;             //seal 生成的状态行 + 全部响应头
+    std::string m_body;             //write/printf 拷贝进来的数据
+    std::vector<segment> m_segs;
+    std::vector<mapping> m_maps;
+    std::vector<struct iovec> m_iov;
+    long long m_bytes;
+};
+
+typedef void (*http_handler)(const request_view& req, response_builder& resp, void* arg);
+
+/*
+    路由表：启动时 add 注册，compile 把字符trie压平成数组(每个结点的子结点连续存放、按字符排序)，
+    之后只读，多个工作线程同时查找不加锁。
+    前缀以 '/' 结尾时匹配其下所有路径，否则只匹配该路径本身及其子路径(/api 匹配 /api、/api/x，不匹配 /apix)。
+    多个前缀都匹配时取最长的。
+*/
+class router {
+public:
+    static const int MAX_METHODS = 8;       //与 http_conn::METHOD 的个数一致
+
+    struct route {
+        http_handler fn[MAX_METHODS];       //按请求方法索引，NULL 表示该方法不允许(405)
+        void* arg[MAX_METHODS];
+        int prefix_len;
+        bool subtree;
+        char allow[64];                     //405 响应的 Allow 头
+    };
+
+    router();
+
+    bool add(int method, const char* prefix, http_handler fn, void* arg = NULL);
+    void compile();
+    const route* match(const char* path, int len) const;    //没有匹配时返回NULL
+    int size() const { return m_routes.size(); }
+
+    int max_body;               //交给处理函数的请求体上限(整个缓存在内存中)，默认1MB
+
+private:
+    struct build_node {
+        char label;
+        int route;
+        std::vector<int> children;
+    };
+    struct node {
+        int first_child;        //子结点在 m_nodes 中的起始下标
+        unsigned short child_count;
+        char label;
+        int route;              //-1 表示没有路由在此结束
+    };
+
+    std::vector<build_node> m_build;    //注册阶段的trie
+    std::vector<node> m_nodes;          //compile 之后的只读trie，m_nodes[0] 为根
+    std::vector<route> m_routes;
+};
+
+#endif
@@ -0,0 +1,170 @@
+#include "sock_profile.h"
+#include "log.h"
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <linux/tcp.h>      //tcp_info 的 tcpi_segs_out 只在内核头文件中
+#include <errno.h>
+
+#ifndef SO_PREFER_BUSY_POLL
+#define SO_PREFER_BUSY_POLL 69  //Linux 5.11，较老的 glibc 头文件中没有
+#endif
+
+int sock_profile::s_count = 0;
+int sock_profile::s_fds[MAX_LISTENERS];
+sock_profile* sock_profile::s_profiles[MAX_LISTENERS];
+
+sock_profile::sock_profile()
+    : nodelay(true), cork(false), sndbuf(0), rcvbuf(0), notsent_lowat(0), user_timeout_ms(0),
+      keepalive_idle(0), keepalive_intvl(0), keepalive_cnt(0), stats(false), busy_poll_us(0),
+      m_responses(0), m_segments(0) {
+}
+
+bool sock_profile::parse(const char* spec) {
+    //给出配置串时只启用其中列出的选项
+    nodelay = false;
+    char buf[256];
+    snprintf(buf, sizeof(buf), "%s", spec);
+    char* save = NULL;
+    for (char* item = strtok_r(buf, ",", &save); item; item = strtok_r(NULL, ",", &save)) {
+        char* value = strchr(item, '=');
+        if (value) {
+            *value++ = '\0';
+        }
+        if (strcmp(item, "nodelay") == 0) {
+            nodelay = true;
+        }
+        else if (strcmp(item, "cork") == 0) {
+            cork = true;
+        }
+        else if (strcmp(item, "stats") == 0) {
+            stats = true;
+        }
+        else if (!value) {
+            return false;
+        }
+        else if (strcmp(item, "sndbuf") == 0) {
+            sndbuf = atoi(value);
+        }
+        else if (strcmp(item, "rcvbuf") == 0) {
+            rcvbuf = atoi(value);
+        }
+        else if (strcmp(item, "lowat") == 0) {
+            notsent_lowat = atoi(value);
+        }
+        else if (strcmp(item, "user_timeout") == 0) {
+            user_timeout_ms = atoi(value);
+        }
+        else if (strcmp(item, "busy_poll") == 0) {
+            busy_poll_us = atoi(value);
+        }
+        else if (strcmp(item, "keepalive") == 0) {
+            if (sscanf(value, "%d:%d:%d", &keepalive_idle, &keepalive_intvl, &keepalive_cnt) != 3) {
+                return false;
+            }
+        }
+        else {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool sock_profile::apply_listener(int listenfd) const {
+    if (sndbuf > 0 && setsockopt(listenfd, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf)) < 0) {
+        return false;
+    }
+    if (rcvbuf > 0 && setsockopt(listenfd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf)) < 0) {
+        return false;
+    }
+    if (busy_poll_us > 0) {
+        //需要 CAP_NET_ADMIN 才能设置超过 net.core.busy_poll 的值，内核不支持或没有权限时只是不轮询，不影响启动
+        int on = 1;
+        if (setsockopt(listenfd, SOL_SOCKET, SO_BUSY_POLL, &busy_poll_us, sizeof(busy_poll_us)) < 0 ||
+            setsockopt(listenfd, SOL_SOCKET, SO_PREFER_BUSY_POLL, &on, sizeof(on)) < 0) {
+            EMlog(LOGLEVEL_WARN, "set SO_BUSY_POLL on listen fd %d failed, errno is : %d\n", listenfd, errno);
+        }
+    }
+    return true;
+}
+
+void sock_profile::apply(int connfd) const {
+    int on = 1;
+    if (nodelay) {
+        setsockopt(connfd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    }
+    if (notsent_lowat > 0) {
+        setsockopt(connfd, IPPROTO_TCP, TCP_NOTSENT_LOWAT, &notsent_lowat, sizeof(notsent_lowat));
+    }
+    if (user_timeout_ms > 0) {
+        setsockopt(connfd, IPPROTO_TCP, TCP_USER_TIMEOUT, &user_timeout_ms, sizeof(user_timeout_ms));
+    }
+    if (keepalive_idle > 0) {
+        setsockopt(connfd, SOL_SOCKET, SO_KEEPALIVE, &on, sizeof(on));
+        setsockopt(connfd, IPPROTO_TCP, TCP_KEEPIDLE, &keepalive_idle, sizeof(keepalive_idle));
+        setsockopt(connfd, IPPROTO_TCP, TCP_KEEPINTVL, &keepalive_intvl, sizeof(keepalive_intvl));
+        setsockopt(connfd, IPPROTO_TCP, TCP_KEEPCNT, &keepalive_cnt, sizeof(keepalive_cnt));
+    }
+}
+
+unsigned int sock_profile::segs_out(int connfd) {
+    struct tcp_info info;
+    socklen_t len = sizeof(info);
+    memset(&info, 0, sizeof(info));
+    if (getsockopt(connfd, IPPROTO_TCP, TCP_INFO, &info, &len) < 0) {
+        return 0;
+    }
+    return info.tcpi_segs_out;
+}
+
+//cork 期间内核只发出满长度的段，最后不足一段的部分在取消cork时发出
+void sock_profile::begin_response(int connfd, unsigned int* segs_start) const {
+    if (cork) {
+        int on = 1;
+        setsockopt(connfd, IPPROTO_TCP, TCP_CORK, &on, sizeof(on));
+    }
+    if (stats) {
+        *segs_start = segs_out(connfd);
+    }
+}
+
+void sock_profile::end_response(int connfd, unsigned int segs_start) {
+    if (cork) {
+        int off = 0;
+        setsockopt(connfd, IPPROTO_TCP, TCP_CORK, &off, sizeof(off));
+    }
+    //只统计已经发出的段，仍在发送缓冲区中排队的部分不计入，大文件的结果偏小
+    if (stats) {
+        unsigned int segs = segs_out(connfd) - segs_start;
+        __sync_add_and_fetch(&m_segments, segs);
+        __sync_add_and_fetch(&m_responses, 1);
+    }
+}
+
+void sock_profile::bind(int listenfd, sock_profile* profile) {
+    if (s_count < MAX_LISTENERS) {
+        s_fds[s_count] = listenfd;
+        s_profiles[s_count] = profile;
+        s_count++;
+    }
+}
+
+sock_profile* sock_profile::of(int listenfd) {
+    for (int i = 0; i < s_count; i++) {
+        if (s_fds[i] == listenfd) {
+            return s_profiles[i];
+        }
+    }
+    return NULL;
+}
+
+void sock_profile::report_all() {
+    for (int i = 0; i < s_count; i++) {
+        const sock_profile* p = s_profiles[i];
+        if (!p->stats || p->m_responses == 0) {
+            continue;
+        }
+        EMlog(LOGLEVEL_INFO, "listen fd %d: %lu responses, %lu segments, %.2f segments/response\n",
+              s_fds[i], p->m_responses, p->m_segments, (double)p->m_segments / p->m_responses);
+    }
+}
@@ -0,0 +1,60 @@
+#ifndef SOCK_PROFILE_H
+#define SOCK_PROFILE_H
+
+/*
+    监听socket的TCP参数配置，accept时应用到新连接上。
+    配置串以逗号分隔，例如：
+        nodelay,cork,sndbuf=262144,rcvbuf=131072,lowat=16384,user_timeout=30000,keepalive=60:10:5,stats
+    nodelay         TCP_NODELAY，关闭Nagle，小响应不再等待上一个段的ACK
+    cork            响应拼好后加 TCP_CORK，发送完再取消，响应头和文件数据合并成满长度的段
+    sndbuf/rcvbuf   SO_SNDBUF/SO_RCVBUF 字节数，设置在监听socket上，新连接继承(接收窗口的扩大因子在握手时确定)
+    lowat           TCP_NOTSENT_LOWAT，内核中未发送数据低于该值才报告可写，减少排队在发送缓冲区的数据
+    user_timeout    TCP_USER_TIMEOUT 毫秒，已发送数据多久未被确认就断开
+    keepalive=i:n:c SO_KEEPALIVE，空闲i秒后开始探测，间隔n秒，c次无响应断开
+    stats           用 TCP_INFO 统计每个响应发出的段数
+    busy_poll=us    SO_BUSY_POLL 微秒并设置 SO_PREFER_BUSY_POLL，recv 在没有数据时先轮询网卡队列，新连接继承
+                    (没有给出时取配置的 busy_poll，见 busy_poll.h)
+*/
+class sock_profile {
+public:
+    sock_profile();
+
+    bool parse(const char* spec);           //解析配置串，未知项返回false
+    bool apply_listener(int listenfd) const;    //listen之前调用，设置会被新连接继承的选项
+    void apply(int connfd) const;           //accept之后调用
+
+    //每个响应开始发送/发送完毕时由 http_conn 调用
+    void begin_response(int connfd, unsigned int* segs_start) const;
+    void end_response(int connfd, unsigned int segs_start);
+
+    //按监听socket登记和查找配置，只在启动时登记
+    static void bind(int listenfd, sock_profile* profile);
+    static sock_profile* of(int listenfd);
+    static void report_all();               //把各监听socket的统计写到日志
+
+public:
+    bool nodelay;
+    bool cork;
+    int sndbuf;             //0 表示不设置，下同
+    int rcvbuf;
+    int notsent_lowat;
+    int user_timeout_ms;
+    int keepalive_idle;
+    int keepalive_intvl;
+    int keepalive_cnt;
+    bool stats;
+    int busy_poll_us;
+
+private:
+    static unsigned int segs_out(int connfd);
+
+    static const int MAX_LISTENERS = 16;
+    static int s_count;
+    static int s_fds[MAX_LISTENERS];
+    static sock_profile* s_profiles[MAX_LISTENERS];
+
+    unsigned long m_responses;      //已统计的响应数
+    unsigned long m_segments;       //这些响应共发出的段数
+};
+
+#endif
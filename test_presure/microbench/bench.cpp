@@ -0,0 +1,624 @@
+/*
+    组件级微基准：请求解析、定时器链表、线程池队列、响应报文拼装、请求处理函数、限流、事件分发时的连接状态访问
+
+    编译（在仓库根目录下执行，do_request 使用 ./resources 的根目录索引）：
+        g++ -std=c++17 -O2 -I. test_presure/microbench/bench.cpp \
+            http_conn.cpp doc_index.cpp bundle.cpp sock_profile.cpp body_sink.cpp router.cpp proxy.cpp rate_limit.cpp tls.cpp h2.cpp arena.cpp capture.cpp busy_poll.cpp priority.cpp \
+            lst_timer.cpp config.cpp log.cpp -pthread -lssl -lcrypto -o microbench
+    运行：
+        ./microbench                                          与默认基线对比
+        ./microbench -b test_presure/microbench/baseline.json 指定基线文件
+        ./microbench -s test_presure/microbench/baseline.json 保存本次结果为新基线
+        ./microbench -f timer                                 只运行名字包含 timer 的用例
+
+    每个用例输出 ns/op、allocs/op（全局 operator new 计数）、cycles/op（rdtsc）和
+    misses/op（perf_event_open 统计的本线程硬件 cache-misses，没有权限或没有PMU时为 -），
+    并给出相对基线的变化百分比。
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include <atomic>
+#include <new>
+#include <string>
+#include <vector>
+#include <map>
+#include "http_conn.h"
+#include "lst_timer.h"
+#include "threadPool.h"
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+//-------------------- 分配计数 --------------------
+static std::atomic<unsigned long> g_alloc_cnt(0);
+
+// 替换的 new/delete 都不内联：只内联其中一边时 GCC 会把调用处看到的 malloc/free 与另一边的
+// operator new/delete 配对，报 -Wmismatched-new-delete
+#define BENCH_NOINLINE __attribute__((noinline))
+
+BENCH_NOINLINE void* operator new(size_t size) {
+    g_alloc_cnt.fetch_add(1, std::memory_order_relaxed);
+    void* p = malloc(size ? size : 1);
+    if (!p) throw std::bad_alloc();
+    return p;
+}
+BENCH_NOINLINE void* operator new[](size_t size) { return operator new(size); }
+BENCH_NOINLINE void operator delete(void* p) noexcept { free(p); }
+BENCH_NOINLINE void operator delete[](void* p) noexcept { free(p); }
+BENCH_NOINLINE void operator delete(void* p, size_t) noexcept { free(p); }
+BENCH_NOINLINE void operator delete[](void* p, size_t) noexcept { free(p); }
+
+//-------------------- 计时工具 --------------------
+static inline unsigned long long cycles_now() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+static inline double ns_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// 硬件 cache-misses 计数器(最后一级缓存)，只统计调用线程，打开失败时为 -1
+static int g_miss_fd = -1;
+
+static void open_miss_counter() {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = PERF_COUNT_HW_CACHE_MISSES;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    g_miss_fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static inline long long misses_now() {
+    long long v;
+    if (g_miss_fd < 0 || read(g_miss_fd, &v, sizeof(v)) != sizeof(v)) {
+        return -1;
+    }
+    return v;
+}
+
+struct bench_result {
+    double ns_per_op;
+    double allocs_per_op;
+    double cycles_per_op;
+    double misses_per_op;       // 小于0表示没有计数器
+};
+
+// 一次测量：body(iters) 执行 iters 次操作
+struct bench_meter {
+    double t0;
+    unsigned long long c0;
+    unsigned long a0;
+    long long m0;
+    void start() {
+        a0 = g_alloc_cnt.load();
+        m0 = misses_now();
+        c0 = cycles_now();
+        t0 = ns_now();
+    }
+    bench_result stop(long iters) {
+        double t1 = ns_now();
+        unsigned long long c1 = cycles_now();
+        unsigned long a1 = g_alloc_cnt.load();
+        long long m1 = misses_now();
+        bench_result r;
+        r.ns_per_op = (t1 - t0) / iters;
+        r.cycles_per_op = (double)(c1 - c0) / iters;
+        r.allocs_per_op = (double)(a1 - a0) / iters;
+        r.misses_per_op = m0 < 0 || m1 < 0 ? -1 : (double)(m1 - m0) / iters;
+        return r;
+    }
+};
+
+//-------------------- http_conn 访问入口 --------------------
+// http_conn 的解析和拼装函数都是私有的，通过友元类暴露给基准测试
+class http_bench {
+public:
+    // 把一条原始请求放进读缓冲区，走一遍 process_read（含 do_request 的 索引查找/open/mmap）
+    static int parse_once(http_conn& c, const char* req, int len) {
+        c.init();
+        memcpy(c.m_read_buf, req, len);
+        c.m_read_idx = len;
+        http_conn::HTTP_CODE ret = c.process_read();
+        c.unmap();
+        return ret;
+    }
+
+    // init() 才分配读写缓冲区，只拼装响应的用例先调用一次
+    static void prepare(http_conn& c) {
+        c.init();
+    }
+
+    // 只拼装响应头，模拟 200 文件响应
+    static void build_file_response(http_conn& c, char* body, int body_len, bool linger) {
+        c.m_write_idx = 0;
+        c.m_linger = linger;
+        c.m_file_address = body;
+        c.m_cold->file_stat.st_size = body_len;
+        c.process_write(http_conn::FILE_REQUEST);
+        c.m_file_address = 0;
+    }
+
+    // 完整的一次请求：解析 + 路由 + 处理函数 + 拼装响应(不发送)
+    static int request_once(http_conn& c, const char* req, int len) {
+        c.init();
+        memcpy(c.m_read_buf, req, len);
+        c.m_read_idx = len;
+        c.m_write_idx = 0;
+        http_conn::HTTP_CODE ret = c.process_read();
+        c.process_write(ret);
+        c.unmap();
+        return ret;
+    }
+
+    // 事件分发：只设置事件循环会读到的字段，不分配缓冲区
+    static void prepare_event(http_conn& c, int fd) {
+        c.timer = NULL;
+        c.m_sockfd = fd;
+        c.m_ssl = NULL;
+        c.m_handshaking = false;
+        c.m_proxying = false;
+        c.m_h2_active = false;
+        c.m_check_state = http_conn::CHECK_STATE_REQUESTLINE;
+        c.m_read_idx = 0;
+        c.m_read_more = false;
+        c.m_served = 1;
+        c.bytes_to_send = 0;
+        c.bytes_have_send = 0;
+        c.m_idle_start = c.m_last_io = c.m_request_start = c.m_send_start = 0;
+    }
+
+    // 事件循环处理一个事件时对连接状态的访问：握手/转发标志、待发送字节数、按阶段的期限，并更新收发时间
+    static long dispatch_event(http_conn& c, time_t now) {
+        long v = c.get_sockfd();
+        if (c.handshaking() || c.proxying()) {
+            return v;
+        }
+        v += c.get_bytes_to_send() + c.has_unread();
+        c.m_last_io = now;
+        return v + c.deadline();
+    }
+
+    // 错误响应（带响应体文本）
+    static void build_error_response(http_conn& c) {
+        c.m_write_idx = 0;
+        c.m_linger = false;
+        c.process_write(http_conn::NO_RESOURCE);
+    }
+};
+
+//-------------------- 用例 --------------------
+typedef bench_result (*bench_fn)(long param);
+
+struct bench_case {
+    std::string name;
+    bench_fn fn;
+    long param;
+};
+
+// 真实浏览器 / 压测工具发出的请求头
+static const char* g_corpus[] = {
+    "GET /index.html HTTP/1.1\r\n"
+    "Host: 192.168.117.128:10000\r\n"
+    "Connection: keep-alive\r\n"
+    "Upgrade-Insecure-Requests: 1\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/118.0.0.0 Safari/537.36\r\n"
+    "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,image/avif,image/webp,*/*;q=0.8\r\n"
+    "Accept-Encoding: gzip, deflate\r\n"
+    "Accept-Language: zh-CN,zh;q=0.9,en;q=0.8\r\n"
+    "\r\n",
+
+    "GET /images/Minion.jpg HTTP/1.1\r\n"
+    "Host: 192.168.117.128:10000\r\n"
+    "Connection: keep-alive\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:109.0) Gecko/20100101 Firefox/119.0\r\n"
+    "Accept: image/avif,image/webp,*/*\r\n"
+    "Referer: http://192.168.117.128:10000/index.html\r\n"
+    "\r\n",
+
+    // webbench -2 发出的请求
+    "GET /index.html HTTP/1.1\r\n"
+    "User-Agent: WebBench 1.5\r\n"
+    "Host: 192.168.117.128\r\n"
+    "Connection: close\r\n"
+    "\r\n",
+
+    "GET /not_exist.html HTTP/1.1\r\n"
+    "Host: localhost\r\n"
+    "\r\n",
+};
+
+static bench_result bench_parse(long idx) {
+    http_conn* c = new http_conn;
+    const char* req = g_corpus[idx];
+    int len = strlen(req);
+    long iters = 20000;
+    for (int i = 0; i < 100; i++) http_bench::parse_once(*c, req, len);   // 预热
+
+    bench_meter m;
+    m.start();
+    for (long i = 0; i < iters; i++) {
+        http_bench::parse_once(*c, req, len);
+    }
+    bench_result r = m.stop(iters);
+    delete c;
+    return r;
+}
+
+// 定时器抖动：链表中有 n 个定时器，每次操作把一个随机定时器的超时时间推到最后（对应 read/write 中的 adjust_timer）
+static bench_result bench_timer_churn(long n) {
+    sort_timer_lst* lst = new sort_timer_lst;
+    std::vector<util_timer*> timers(n);
+    time_t base = 1000000;
+    // 以降序插入，每次都落在表头，避免 O(n^2) 的建表开销
+    for (long i = n - 1; i >= 0; i--) {
+        util_timer* t = new util_timer;
+        t->expire = base + i;
+        t->user_data = NULL;
+        timers[i] = t;
+        lst->add_timer(t);
+    }
+    time_t next = base + n;
+    long iters = 20000000 / n;
+    if (iters < 200) iters = 200;
+    unsigned int seed = 12345;
+
+    bench_meter m;
+    m.start();
+    for (long i = 0; i < iters; i++) {
+        util_timer* t = timers[rand_r(&seed) % n];
+        t->expire = next++;
+        lst->adjust_timer(t);
+    }
+    bench_result r = m.stop(iters);
+    delete lst;         // 析构时释放全部定时器
+    return r;
+}
+
+// 新连接加入 + 连接关闭删除定时器（init/close_conn 路径）
+static bench_result bench_timer_add_del(long n) {
+    sort_timer_lst* lst = new sort_timer_lst;
+    time_t base = 1000000;
+    for (long i = n - 1; i >= 0; i--) {
+        util_timer* t = new util_timer;
+        t->expire = base + i;
+        t->user_data = NULL;
+        lst->add_timer(t);
+    }
+    time_t next = base + n;
+    long iters = 20000000 / n;
+    if (iters < 200) iters = 200;
+
+    bench_meter m;
+    m.start();
+    for (long i = 0; i < iters; i++) {
+        util_timer* t = lst->alloc_timer();
+        t->expire = next++;
+        t->user_data = NULL;
+        lst->add_timer(t);
+        lst->del_timer(t);
+    }
+    bench_result r = m.stop(iters);
+    delete lst;
+    return r;
+}
+
+// 线程池任务：process() 只做计数
+struct pingpong_task {
+    static std::atomic<long> done;
+    void process() { done.fetch_add(1, std::memory_order_relaxed); }
+};
+std::atomic<long> pingpong_task::done(0);
+
+struct producer_arg {
+    threadPool<pingpong_task>* pool;
+    pingpong_task* task;
+    long count;
+};
+
+static void* producer(void* arg) {
+    producer_arg* a = (producer_arg*)arg;
+    for (long i = 0; i < a->count; i++) {
+        while (!a->pool->append(a->task)) {
+            sched_yield();      // 队列满，等待消费者
+        }
+    }
+    return NULL;
+}
+
+// param 编码：生产者数 * 100 + 消费者数
+static bench_result bench_pool(long param) {
+    int producers = param / 100;
+    int consumers = param % 100;
+    long per_producer = 200000 / producers;
+    long total = per_producer * producers;
+
+    // 线程池的工作线程是分离的且没有退出通知，这里不析构，避免销毁仍被等待的信号量
+    threadPool<pingpong_task>* pool = new threadPool<pingpong_task>(consumers, 10000);
+    pingpong_task task;
+    pingpong_task::done.store(0);
+
+    std::vector<pthread_t> tids(producers);
+    std::vector<producer_arg> args(producers);
+
+    bench_meter m;
+    m.start();
+    for (int i = 0; i < producers; i++) {
+        args[i].pool = pool;
+        args[i].task = &task;
+        args[i].count = per_producer;
+        pthread_create(&tids[i], NULL, producer, &args[i]);
+    }
+    for (int i = 0; i < producers; i++) {
+        pthread_join(tids[i], NULL);
+    }
+    while (pingpong_task::done.load() < total) {
+        sched_yield();
+    }
+    return m.stop(total);
+}
+
+static bench_result bench_response_file(long body_len) {
+    http_conn* c = new http_conn;
+    http_bench::prepare(*c);
+    std::vector<char> body(body_len, 'x');
+    long iters = 500000;
+
+    bench_meter m;
+    m.start();
+    for (long i = 0; i < iters; i++) {
+        http_bench::build_file_response(*c, &body[0], body_len, i & 1);
+    }
+    bench_result r = m.stop(iters);
+    delete c;
+    return r;
+}
+
+static bench_result bench_response_error(long) {
+    http_conn* c = new http_conn;
+    http_bench::prepare(*c);
+    long iters = 500000;
+
+    bench_meter m;
+    m.start();
+    for (long i = 0; i < iters; i++) {
+        http_bench::build_error_response(*c);
+    }
+    bench_result r = m.stop(iters);
+    delete c;
+    return r;
+}
+
+// 请求处理函数：printf 拷贝进自有缓冲区 / add_static 直接引用常量
+static void json_handler(const request_view& req, response_builder& resp, void*) {
+    resp.content_type("application/json");
+    resp.printf("{\"path\":\"%.*s\",\"query\":\"%s\",\"ok\":true}", req.subpath_len, req.subpath, req.query);
+}
+
+static const char g_static_body[] = "<html><body>static handler response</body></html>\n";
+
+static void static_handler(const request_view&, response_builder& resp, void*) {
+    resp.content_type("text/html");
+    resp.add_static(g_static_body, sizeof(g_static_body) - 1);
+}
+
+static const char* g_handler_req[] = {
+    "GET /api/users/42?fields=name HTTP/1.1\r\n"
+    "Host: localhost\r\n"
+    "Connection: keep-alive\r\n"
+    "\r\n",
+
+    "GET /static/page HTTP/1.1\r\n"
+    "Host: localhost\r\n"
+    "Connection: keep-alive\r\n"
+    "\r\n",
+};
+
+static bench_result bench_handler(long idx) {
+    http_conn* c = new http_conn;
+    const char* req = g_handler_req[idx];
+    int len = strlen(req);
+    long iters = 200000;
+    for (int i = 0; i < 100; i++) http_bench::request_once(*c, req, len);  // 预热，让缓冲区长到稳定容量
+
+    bench_meter m;
+    m.start();
+    for (long i = 0; i < iters; i++) {
+        http_bench::request_once(*c, req, len);
+    }
+    bench_result r = m.stop(iters);
+    delete c;
+    return r;
+}
+
+// 限流：clients 个地址轮流取令牌，速率足够高，每次都放行，测的是查表 + CAS 的开销
+static bench_result bench_rate_limit(long clients) {
+    rate_limiter* limiter = new rate_limiter;
+    limiter->configure(1000000000, rate_limiter::MAX_BURST, 32);
+    std::vector<sockaddr_in> addrs(clients);
+    for (long i = 0; i < clients; i++) {
+        memset(&addrs[i], 0, sizeof(addrs[i]));
+        addrs[i].sin_family = AF_INET;
+        addrs[i].sin_addr.s_addr = htonl(0x0a000000 + i * 7);
+    }
+    long iters = 2000000;
+    bench_meter m;
+    m.start();
+    for (long i = 0; i < iters; i++) {
+        limiter->allow(addrs[i % clients]);
+    }
+    bench_result r = m.stop(iters);
+    delete limiter;
+    return r;
+}
+
+// 事件分发：n 个连接中随机取一个处理一个事件。连接数多到超出缓存时，
+// 每个事件的耗时主要是访问连接对象的缓存未命中，取决于热数据占了几个缓存行
+static bench_result bench_conn_event(long n) {
+    http_conn* conns = new http_conn[n];
+    for (long i = 0; i < n; i++) {
+        http_bench::prepare_event(conns[i], i);
+    }
+    std::vector<unsigned int> order(1 << 20);
+    unsigned int seed = 12345;
+    for (size_t i = 0; i < order.size(); i++) {
+        order[i] = rand_r(&seed) % n;
+    }
+    long iters = 4000000;
+    volatile long sink = 0;
+
+    bench_meter m;
+    m.start();
+    for (long i = 0; i < iters; i++) {
+        sink += http_bench::dispatch_event(conns[order[i & (order.size() - 1)]], i);
+    }
+    bench_result r = m.stop(iters);
+    delete[] conns;
+    return r;
+}
+
+//-------------------- 基线读写 --------------------
+// 基线文件格式：每个用例一行
+//   "name": {"ns_per_op": 1.0, "allocs_per_op": 0.0, "cycles_per_op": 3.0},
+static std::map<std::string, bench_result> load_baseline(const char* path) {
+    std::map<std::string, bench_result> m;
+    FILE* fp = fopen(path, "r");
+    if (!fp) return m;
+    char line[512];
+    while (fgets(line, sizeof(line), fp)) {
+        char name[128];
+        bench_result r;
+        if (sscanf(line, " \"%127[^\"]\": {\"ns_per_op\": %lf, \"allocs_per_op\": %lf, \"cycles_per_op\": %lf}",
+                   name, &r.ns_per_op, &r.allocs_per_op, &r.cycles_per_op) == 4) {
+            m[name] = r;
+        }
+    }
+    fclose(fp);
+    return m;
+}
+
+static bool save_baseline(const char* path, const std::vector<std::pair<std::string, bench_result> >& results) {
+    FILE* fp = fopen(path, "w");
+    if (!fp) return false;
+    fprintf(fp, "{\n");
+    for (size_t i = 0; i < results.size(); i++) {
+        const bench_result& r = results[i].second;
+        fprintf(fp, "  \"%s\": {\"ns_per_op\": %.1f, \"allocs_per_op\": %.2f, \"cycles_per_op\": %.1f}%s\n",
+                results[i].first.c_str(), r.ns_per_op, r.allocs_per_op, r.cycles_per_op,
+                i + 1 == results.size() ? "" : ",");
+    }
+    fprintf(fp, "}\n");
+    fclose(fp);
+    return true;
+}
+
+int main(int argc, char* argv[]) {
+    const char* baseline_path = "test_presure/microbench/baseline.json";
+    const char* save_path = NULL;
+    const char* filter = NULL;
+    int opt;
+    while ((opt = getopt(argc, argv, "b:s:f:")) != -1) {
+        switch (opt) {
+            case 'b': baseline_path = optarg; break;
+            case 's': save_path = optarg; break;
+            case 'f': filter = optarg; break;
+            default:
+                fprintf(stderr, "usage: %s [-b baseline.json] [-s save.json] [-f filter]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    doc_index docs;
+    if (!docs.init("resources")) {
+        fprintf(stderr, "cannot index ./resources, run from the repository root\n");
+        return 1;
+    }
+    http_conn::m_doc_index = &docs;
+
+    router routes;
+    routes.add(http_conn::GET, "/api/", json_handler);
+    routes.add(http_conn::GET, "/static", static_handler);
+    routes.compile();
+    http_conn::m_router = &routes;
+
+    std::vector<bench_case> cases;
+    cases.push_back({"parse/index_chrome", bench_parse, 0});
+    cases.push_back({"parse/image_firefox", bench_parse, 1});
+    cases.push_back({"parse/webbench", bench_parse, 2});
+    cases.push_back({"parse/not_found", bench_parse, 3});
+    cases.push_back({"timer/churn_1k", bench_timer_churn, 1000});
+    cases.push_back({"timer/churn_10k", bench_timer_churn, 10000});
+    cases.push_back({"timer/churn_100k", bench_timer_churn, 100000});
+    cases.push_back({"timer/add_del_1k", bench_timer_add_del, 1000});
+    cases.push_back({"timer/add_del_10k", bench_timer_add_del, 10000});
+    cases.push_back({"timer/add_del_100k", bench_timer_add_del, 100000});
+    cases.push_back({"pool/p1_c1", bench_pool, 101});
+    cases.push_back({"pool/p1_c8", bench_pool, 108});
+    cases.push_back({"pool/p4_c4", bench_pool, 404});
+    cases.push_back({"pool/p8_c8", bench_pool, 808});
+    cases.push_back({"response/file_1k", bench_response_file, 1024});
+    cases.push_back({"response/file_1m", bench_response_file, 1 << 20});
+    cases.push_back({"response/error_404", bench_response_error, 0});
+    cases.push_back({"handler/json", bench_handler, 0});
+    cases.push_back({"handler/static", bench_handler, 1});
+    cases.push_back({"ratelimit/1_client", bench_rate_limit, 1});
+    cases.push_back({"ratelimit/10k_clients", bench_rate_limit, 10000});
+    cases.push_back({"conn/event_1k", bench_conn_event, 1000});
+    cases.push_back({"conn/event_64k", bench_conn_event, 65536});
+
+    std::map<std::string, bench_result> baseline = load_baseline(baseline_path);
+
+    // 被测代码中的 printf / EMlog 会刷屏，测量期间把标准输出重定向到 /dev/null
+    int out_fd = dup(STDOUT_FILENO);
+    FILE* out = fdopen(out_fd, "w");
+    int null_fd = open("/dev/null", O_WRONLY);
+    dup2(null_fd, STDOUT_FILENO);
+    close(null_fd);
+
+    open_miss_counter();
+    fprintf(out, "%-22s %12s %12s %12s %12s %10s\n", "benchmark", "ns/op", "allocs/op", "cycles/op", "misses/op", "vs base");
+    std::vector<std::pair<std::string, bench_result> > results;
+    for (size_t i = 0; i < cases.size(); i++) {
+        if (filter && cases[i].name.find(filter) == std::string::npos) continue;
+        bench_result r = cases[i].fn(cases[i].param);
+        fflush(stdout);
+        results.push_back(std::make_pair(cases[i].name, r));
+
+        char delta[32] = "-";
+        std::map<std::string, bench_result>::iterator it = baseline.find(cases[i].name);
+        if (it != baseline.end() && it->second.ns_per_op > 0) {
+            snprintf(delta, sizeof(delta), "%+.1f%%", (r.ns_per_op / it->second.ns_per_op - 1) * 100);
+        }
+        char misses[32] = "-";
+        if (r.misses_per_op >= 0) {
+            snprintf(misses, sizeof(misses), "%.2f", r.misses_per_op);
+        }
+        fprintf(out, "%-22s %12.1f %12.2f %12.1f %12s %10s\n", cases[i].name.c_str(),
+                r.ns_per_op, r.allocs_per_op, r.cycles_per_op, misses, delta);
+        fflush(out);
+    }
+
+    if (save_path) {
+        if (!save_baseline(save_path, results)) {
+            fprintf(out, "save baseline to %s failed\n", save_path);
+            return 1;
+        }
+        fprintf(out, "baseline saved to %s\n", save_path);
+    }
+    return 0;
+}
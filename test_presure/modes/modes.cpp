@@ -0,0 +1,301 @@
+/*
+    并发模型对比：依次以 io_model = proactor / reactor / uring 启动服务端，对不同大小的静态文件、不同的并发连接数
+    各压测一段时间，输出每个组合的请求数/秒、吞吐量和延迟分位数。
+    每个连接一个线程，长连接上连续发 GET，收完一个响应再发下一个。文件放在临时的根目录中，内容为同一个字节。
+
+    编译：
+        g++ -std=c++11 -O2 test_presure/modes/modes.cpp -pthread -o modes
+    运行：
+        ./modes [-d 秒数] [-m proactor,reactor,uring] [-s 128,4096,65536,1048576] [-c 1,16,64,256] [-t 线程数] [-p 端口] ./main
+        -d 每个组合的压测时间，默认 3 秒；-t 服务端的线程池线程数，默认为服务端配置的默认值
+    说明：
+        服务端以 listen_backlog=1024、log_level=3 启动，其余为默认配置；
+        内核不支持 io_uring 时 uring 回退到 epoll(服务端日志中有提示)，这一行的结果与 proactor 相同；
+        压测端与服务端在同一台机器上时两者争用CPU，连接数多于核数时结果主要反映调度开销。
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+struct load_arg {
+    int size;
+    uint64_t end_us;
+    long requests;
+    long errors;
+    std::vector<uint64_t> latency;      //每个响应的延迟(微秒)
+};
+
+static int g_port = 19500;
+
+static uint64_t now_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+static std::vector<std::string> split(const char* s) {
+    std::vector<std::string> out;
+    std::string item;
+    for (const char* p = s; ; p++) {
+        if (*p == ',' || *p == '\0') {
+            if (!item.empty()) {
+                out.push_back(item);
+            }
+            item.clear();
+            if (*p == '\0') {
+                break;
+            }
+        }
+        else {
+            item += *p;
+        }
+    }
+    return out;
+}
+
+static int connect_server() {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(g_port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (connect(fd, (sockaddr*)&addr, sizeof(addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+    int on = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    return fd;
+}
+
+//读一个带 Content-Length 的响应，返回状态码，出错返回0
+static int read_response(int fd, std::string& buf) {
+    char tmp[65536];
+    size_t end;
+    while ((end = buf.find("\r\n\r\n")) == std::string::npos) {
+        int n = recv(fd, tmp, sizeof(tmp), 0);
+        if (n <= 0) {
+            return 0;
+        }
+        buf.append(tmp, n);
+    }
+    if (buf.compare(0, 7, "HTTP/1.") != 0 || buf.size() < 12) {
+        return 0;
+    }
+    int status = atoi(buf.c_str() + 9);
+    const char* cl = strcasestr(buf.c_str(), "\r\nContent-Length:");
+    if (!cl || cl > buf.c_str() + end) {
+        return 0;
+    }
+    size_t total = end + 4 + atoll(cl + 17);
+    while (buf.size() < total) {
+        int n = recv(fd, tmp, sizeof(tmp), 0);
+        if (n <= 0) {
+            return 0;
+        }
+        buf.append(tmp, n);
+    }
+    buf.erase(0, total);
+    return status;
+}
+
+static void* load_thread(void* p) {
+    load_arg* a = (load_arg*)p;
+    char req[128];
+    int len = snprintf(req, sizeof(req), "GET /f%d HTTP/1.1\r\nHost: modes\r\nConnection: keep-alive\r\n\r\n", a->size);
+    std::string buf;
+    int fd = -1;
+    while (now_us() < a->end_us) {
+        if (fd < 0) {
+            fd = connect_server();
+            buf.clear();
+            if (fd < 0) {
+                a->errors++;
+                usleep(1000);
+                continue;
+            }
+        }
+        uint64_t start = now_us();
+        if (send(fd, req, len, MSG_NOSIGNAL) != len || read_response(fd, buf) != 200) {
+            a->errors++;
+            close(fd);
+            fd = -1;
+            continue;
+        }
+        a->latency.push_back(now_us() - start);
+        a->requests++;
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+    return NULL;
+}
+
+static pid_t start_server(const char* bin, const char* mode, const char* docroot, int threads) {
+    pid_t pid = fork();
+    if (pid == 0) {
+        int null = open("/dev/null", O_WRONLY);
+        dup2(null, 1);
+        dup2(null, 2);
+        std::vector<std::string> args;
+        args.push_back(bin);
+        args.push_back("-D"); args.push_back(std::string("docroot=") + docroot);
+        args.push_back("-D"); args.push_back(std::string("io_model=") + mode);
+        args.push_back("-D"); args.push_back("listen_backlog=1024");
+        args.push_back("-D"); args.push_back("log_level=3");
+        if (threads > 0) {
+            args.push_back("-D"); args.push_back("threads=" + std::to_string(threads));
+        }
+        args.push_back(std::to_string(g_port));
+        std::vector<char*> argv;
+        for (size_t i = 0; i < args.size(); i++) {
+            argv.push_back((char*)args[i].c_str());
+        }
+        argv.push_back(NULL);
+        execv(bin, &argv[0]);
+        _exit(127);
+    }
+    //等到能连上(建立根目录索引需要一点时间)
+    for (int i = 0; i < 100; i++) {
+        usleep(50000);
+        int fd = connect_server();
+        if (fd >= 0) {
+            close(fd);
+            return pid;
+        }
+        if (waitpid(pid, NULL, WNOHANG) == pid) {
+            return -1;
+        }
+    }
+    kill(pid, SIGKILL);
+    waitpid(pid, NULL, 0);
+    return -1;
+}
+
+static void stop_server(pid_t pid) {
+    kill(pid, SIGTERM);
+    for (int i = 0; i < 50; i++) {
+        if (waitpid(pid, NULL, WNOHANG) == pid) {
+            return;
+        }
+        usleep(100000);
+    }
+    kill(pid, SIGKILL);
+    waitpid(pid, NULL, 0);
+}
+
+static bool make_docroot(char* dir, const std::vector<std::string>& sizes) {
+    if (!mkdtemp(dir)) {
+        perror("mkdtemp");
+        return false;
+    }
+    for (size_t i = 0; i < sizes.size(); i++) {
+        std::string path = std::string(dir) + "/f" + sizes[i];
+        FILE* fp = fopen(path.c_str(), "wb");
+        if (!fp) {
+            perror(path.c_str());
+            return false;
+        }
+        std::string data(atoi(sizes[i].c_str()), 'x');
+        fwrite(data.data(), 1, data.size(), fp);
+        fclose(fp);
+    }
+    return true;
+}
+
+static void remove_docroot(const char* dir, const std::vector<std::string>& sizes) {
+    for (size_t i = 0; i < sizes.size(); i++) {
+        unlink((std::string(dir) + "/f" + sizes[i]).c_str());
+    }
+    rmdir(dir);
+}
+
+int main(int argc, char* argv[]) {
+    int duration = 3;
+    int threads = 0;
+    std::vector<std::string> modes = split("proactor,reactor,uring");
+    std::vector<std::string> sizes = split("128,4096,65536,1048576");
+    std::vector<std::string> conns = split("1,16,64,256");
+    int opt;
+    while ((opt = getopt(argc, argv, "d:m:s:c:t:p:")) != -1) {
+        switch (opt) {
+            case 'd': duration = atoi(optarg); break;
+            case 'm': modes = split(optarg); break;
+            case 's': sizes = split(optarg); break;
+            case 'c': conns = split(optarg); break;
+            case 't': threads = atoi(optarg); break;
+            case 'p': g_port = atoi(optarg); break;
+            default: break;
+        }
+    }
+    if (optind >= argc) {
+        printf("usage: %s [-d seconds] [-m modes] [-s sizes] [-c conns] [-t threads] [-p port] ./main\n", argv[0]);
+        return 1;
+    }
+    const char* bin = argv[optind];
+    signal(SIGPIPE, SIG_IGN);
+
+    char docroot[] = "/tmp/modes.XXXXXX";
+    if (!make_docroot(docroot, sizes)) {
+        return 1;
+    }
+
+    printf("%-9s %9s %6s %10s %10s %9s %9s %9s %7s\n", "model", "size", "conns", "req/s", "MB/s", "p50(us)", "p99(us)", "max(us)", "errors");
+    for (size_t m = 0; m < modes.size(); m++) {
+        pid_t pid = start_server(bin, modes[m].c_str(), docroot, threads);
+        if (pid < 0) {
+            printf("%-9s server failed to start\n", modes[m].c_str());
+            continue;
+        }
+        for (size_t s = 0; s < sizes.size(); s++) {
+            for (size_t c = 0; c < conns.size(); c++) {
+                int n = atoi(conns[c].c_str());
+                std::vector<load_arg> args(n);
+                std::vector<pthread_t> tids(n);
+                uint64_t start = now_us();
+                for (int i = 0; i < n; i++) {
+                    args[i].size = atoi(sizes[s].c_str());
+                    args[i].end_us = start + duration * 1000000ULL;
+                    args[i].requests = 0;
+                    args[i].errors = 0;
+                    pthread_create(&tids[i], NULL, load_thread, &args[i]);
+                }
+                long requests = 0, errors = 0;
+                std::vector<uint64_t> latency;
+                for (int i = 0; i < n; i++) {
+                    pthread_join(tids[i], NULL);
+                    requests += args[i].requests;
+                    errors += args[i].errors;
+                    latency.insert(latency.end(), args[i].latency.begin(), args[i].latency.end());
+                }
+                double secs = (now_us() - start) / 1e6;
+                std::sort(latency.begin(), latency.end());
+                uint64_t p50 = latency.empty() ? 0 : latency[latency.size() / 2];
+                uint64_t p99 = latency.empty() ? 0 : latency[latency.size() * 99 / 100];
+                uint64_t max = latency.empty() ? 0 : latency.back();
+                printf("%-9s %9s %6d %10.0f %10.1f %9llu %9llu %9llu %7ld\n", modes[m].c_str(), sizes[s].c_str(), n,
+                       requests / secs, requests * (double)args[0].size / secs / (1 << 20),
+                       (unsigned long long)p50, (unsigned long long)p99, (unsigned long long)max, errors);
+                fflush(stdout);
+            }
+        }
+        stop_server(pid);
+    }
+    remove_docroot(docroot, sizes);
+    return 0;
+}
@@ -0,0 +1,400 @@
+/*
+    按抓取文件(配置 capture_file)重放流量：每个连接一个线程，按原来的时间间隔(或按 -s 缩放)
+    建立连接、发送收到过的数据，连接上的请求顺序和长连接复用与抓取时相同。
+    每个抓到的响应处读一个完整的响应，统计从发出最后一段数据到收完响应的延迟，并与抓到的状态码比较。
+
+    编译：
+        g++ -std=c++11 -O2 -I. test_presure/replay/replay.cpp -pthread -o replay
+    运行：
+        ./replay [-s 倍速] [-t 超时秒数] capture.bin 127.0.0.1:9006
+        -s 2 按两倍速重放，-s 0 不等待、尽快发送；默认按原来的时间
+    说明：
+        HTTPS 连接记录的是解密后的数据，重放时按明文发给目标端口；
+        切换到 HTTP/2 的连接不记录帧，重放时跳过；
+        HEAD 请求按请求行判断，流水线请求中间的 HEAD 可能判断不准。
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include "capture.h"
+
+struct event {
+    uint64_t ts_us;
+    int type;
+    int status;
+    std::string data;
+};
+
+struct replay_conn {
+    uint32_t id;
+    uint64_t open_us;
+    bool h2;
+    std::vector<event> events;
+};
+
+static double g_speed = 1.0;
+static int g_timeout = 10;
+static sockaddr_in g_target;
+static uint64_t g_base_us;      //重放开始的单调时钟
+
+static pthread_mutex_t g_lock = PTHREAD_MUTEX_INITIALIZER;
+static std::vector<uint64_t> g_latency;             //每个响应的延迟(微秒)
+static std::map<std::pair<int, int>, int> g_diff;   //(抓到的状态码, 重放的状态码，0 表示没有收到) -> 次数
+static long g_connect_errors = 0;
+static uint64_t g_max_lag_us = 0;                   //比计划晚发送的最大时间
+
+static uint64_t now_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+//等到抓取时刻 ts_us(按倍速缩放)对应的重放时刻，返回落后计划的微秒数
+static uint64_t wait_until(uint64_t ts_us) {
+    if (g_speed <= 0) {
+        return 0;
+    }
+    uint64_t due = g_base_us + (uint64_t)(ts_us / g_speed);
+    uint64_t now = now_us();
+    if (now < due) {
+        usleep(due - now);
+        return 0;
+    }
+    return now - due;
+}
+
+//读一个完整的响应，返回状态码，连接关闭或出错返回0。
+//跳过 100 Continue 等中间响应；1xx/204/304 和 HEAD 的响应没有响应体，没有长度的响应读到连接关闭
+static int read_response(int fd, std::string& buf, bool head) {
+    char tmp[65536];
+    while (true) {
+        size_t end;
+        while ((end = buf.find("\r\n\r\n")) == std::string::npos) {
+            int n = recv(fd, tmp, sizeof(tmp), 0);
+            if (n <= 0) {
+                return 0;
+            }
+            buf.append(tmp, n);
+        }
+        size_t head_len = end + 4;
+        if (buf.compare(0, 7, "HTTP/1.") != 0 || buf.size() < 12) {
+            return 0;
+        }
+        int status = atoi(buf.c_str() + 9);
+        if (status >= 100 && status < 200 && status != 101) {
+            buf.erase(0, head_len);
+            continue;
+        }
+
+        long long length = -1;
+        bool chunked = false;
+        std::string h = buf.substr(0, head_len);
+        for (size_t pos = h.find("\r\n") + 2; pos < head_len - 2;) {
+            size_t eol = h.find("\r\n", pos);
+            std::string line = h.substr(pos, eol - pos);
+            if (strncasecmp(line.c_str(), "Content-Length:", 15) == 0) {
+                length = atoll(line.c_str() + 15);
+            }
+            else if (strncasecmp(line.c_str(), "Transfer-Encoding:", 18) == 0 && strcasestr(line.c_str(), "chunked")) {
+                chunked = true;
+            }
+            pos = eol + 2;
+        }
+        buf.erase(0, head_len);
+        if (head || status == 204 || status == 304 || status == 101) {
+            return status;
+        }
+
+        if (chunked) {
+            size_t pos = 0;
+            while (true) {
+                size_t eol;
+                while ((eol = buf.find("\r\n", pos)) == std::string::npos) {
+                    int n = recv(fd, tmp, sizeof(tmp), 0);
+                    if (n <= 0) {
+                        return 0;
+                    }
+                    buf.append(tmp, n);
+                }
+                long long size = strtoll(buf.c_str() + pos, NULL, 16);
+                pos = eol + 2;
+                if (size == 0) {
+                    //跳过 trailer，直到空行
+                    while (true) {
+                        while ((eol = buf.find("\r\n", pos)) == std::string::npos) {
+                            int n = recv(fd, tmp, sizeof(tmp), 0);
+                            if (n <= 0) {
+                                return 0;
+                            }
+                            buf.append(tmp, n);
+                        }
+                        bool blank = eol == pos;
+                        pos = eol + 2;
+                        if (blank) {
+                            buf.erase(0, pos);
+                            return status;
+                        }
+                    }
+                }
+                while (buf.size() < pos + size + 2) {
+                    int n = recv(fd, tmp, sizeof(tmp), 0);
+                    if (n <= 0) {
+                        return 0;
+                    }
+                    buf.append(tmp, n);
+                }
+                pos += size + 2;
+            }
+        }
+
+        if (length < 0) {
+            //没有长度：读到连接关闭
+            while (true) {
+                int n = recv(fd, tmp, sizeof(tmp), 0);
+                if (n <= 0) {
+                    buf.clear();
+                    return n == 0 ? status : 0;
+                }
+            }
+        }
+        //响应体不保存，只计数
+        long long left = length;
+        long long have = std::min<long long>(left, buf.size());
+        buf.erase(0, have);
+        left -= have;
+        while (left > 0) {
+            int n = recv(fd, tmp, sizeof(tmp), 0);
+            if (n <= 0) {
+                return 0;
+            }
+            if (n > left) {
+                buf.append(tmp + left, n - left);
+                n = left;
+            }
+            left -= n;
+        }
+        return status;
+    }
+}
+
+static void* run_conn(void* arg) {
+    replay_conn* c = (replay_conn*)arg;
+    int fd = socket(PF_INET, SOCK_STREAM, 0);
+    timeval tv = { g_timeout, 0 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if (connect(fd, (sockaddr*)&g_target, sizeof(g_target)) < 0) {
+        pthread_mutex_lock(&g_lock);
+        g_connect_errors++;
+        for (size_t i = 0; i < c->events.size(); i++) {
+            if (c->events[i].type == CAP_RESP) {
+                g_diff[std::make_pair(c->events[i].status, 0)]++;
+            }
+        }
+        pthread_mutex_unlock(&g_lock);
+        close(fd);
+        delete c;
+        return NULL;
+    }
+
+    std::string buf;
+    std::vector<bool> heads;    //已发出、还没有读响应的请求是否为 HEAD
+    bool new_request = true;    //下一段数据是一个新请求的开头
+    uint64_t sent_us = now_us();
+    bool broken = false;
+    for (size_t i = 0; i < c->events.size(); i++) {
+        const event& e = c->events[i];
+        if (e.type == CAP_DATA) {
+            uint64_t lag = wait_until(e.ts_us);
+            if (lag > g_max_lag_us) {
+                pthread_mutex_lock(&g_lock);
+                g_max_lag_us = std::max(g_max_lag_us, lag);
+                pthread_mutex_unlock(&g_lock);
+            }
+            if (new_request) {
+                heads.push_back(e.data.compare(0, 5, "HEAD ") == 0);
+                new_request = false;
+            }
+            if (!broken && send(fd, e.data.data(), e.data.size(), MSG_NOSIGNAL) != (ssize_t)e.data.size()) {
+                broken = true;
+            }
+            sent_us = now_us();
+        }
+        else if (e.type == CAP_RESP) {
+            bool head = !heads.empty() && heads.front();
+            if (!heads.empty()) {
+                heads.erase(heads.begin());
+            }
+            new_request = heads.empty();
+            int status = broken ? 0 : read_response(fd, buf, head);
+            uint64_t latency = now_us() - sent_us;
+            if (status == 0) {
+                broken = true;
+            }
+            pthread_mutex_lock(&g_lock);
+            if (status) {
+                g_latency.push_back(latency);
+            }
+            g_diff[std::make_pair(e.status, status)]++;
+            pthread_mutex_unlock(&g_lock);
+        }
+        else if (e.type == CAP_CLOSE) {
+            wait_until(e.ts_us);
+            break;
+        }
+    }
+    close(fd);
+    delete c;
+    return NULL;
+}
+
+static bool load(const char* path, std::vector<replay_conn*>& conns) {
+    FILE* fp = fopen(path, "rb");
+    if (!fp) {
+        perror("fopen");
+        return false;
+    }
+    capture_header head;
+    if (fread(&head, sizeof(head), 1, fp) != 1 || memcmp(head.magic, "WSCAP001", 8) != 0) {
+        printf("%s 不是抓取文件\n", path);
+        fclose(fp);
+        return false;
+    }
+    std::map<uint32_t, replay_conn*> by_id;
+    capture_record rec;
+    while (fread(&rec, sizeof(rec), 1, fp) == 1) {
+        std::string data(rec.len, '\0');
+        if (rec.len > 0 && fread(&data[0], 1, rec.len, fp) != rec.len) {
+            break;      //抓取进程被杀掉时最后一条可能不完整
+        }
+        if (rec.type == CAP_OPEN) {
+            replay_conn* c = new replay_conn;
+            c->id = rec.conn;
+            c->open_us = rec.ts_us;
+            c->h2 = false;
+            by_id[rec.conn] = c;
+            conns.push_back(c);
+            continue;
+        }
+        std::map<uint32_t, replay_conn*>::iterator it = by_id.find(rec.conn);
+        if (it == by_id.end()) {
+            continue;
+        }
+        if (rec.type == CAP_H2) {
+            it->second->h2 = true;
+            continue;
+        }
+        event e;
+        e.ts_us = rec.ts_us;
+        e.type = rec.type;
+        e.status = rec.status;
+        e.data.swap(data);
+        it->second->events.push_back(e);
+    }
+    fclose(fp);
+    return true;
+}
+
+static uint64_t percentile(const std::vector<uint64_t>& v, double p) {
+    if (v.empty()) {
+        return 0;
+    }
+    size_t i = (size_t)(p * (v.size() - 1) + 0.5);
+    return v[i];
+}
+
+int main(int argc, char* argv[]) {
+    int opt;
+    while ((opt = getopt(argc, argv, "s:t:")) != -1) {
+        switch (opt) {
+            case 's':
+                g_speed = atof(optarg);
+                break;
+            case 't':
+                g_timeout = atoi(optarg);
+                break;
+            default:
+                printf("usage: %s [-s speed] [-t timeout] capture host:port\n", argv[0]);
+                return 1;
+        }
+    }
+    if (argc - optind != 2) {
+        printf("usage: %s [-s speed] [-t timeout] capture host:port\n", argv[0]);
+        return 1;
+    }
+    const char* target = argv[optind + 1];
+    const char* colon = strrchr(target, ':');
+    if (!colon) {
+        printf("目标地址应为 host:port\n");
+        return 1;
+    }
+    std::string host(target, colon - target);
+    g_target.sin_family = AF_INET;
+    g_target.sin_port = htons(atoi(colon + 1));
+    if (inet_pton(AF_INET, host.c_str(), &g_target.sin_addr) != 1) {
+        printf("目标地址应为 IPv4 地址：%s\n", host.c_str());
+        return 1;
+    }
+
+    std::vector<replay_conn*> conns;
+    if (!load(argv[optind], conns)) {
+        return 1;
+    }
+    int skipped = 0;
+    std::vector<pthread_t> threads;
+    g_base_us = now_us();
+    for (size_t i = 0; i < conns.size(); i++) {
+        replay_conn* c = conns[i];
+        if (c->h2 || c->events.empty()) {
+            skipped += c->h2;
+            delete c;
+            continue;
+        }
+        wait_until(c->open_us);
+        pthread_t tid;
+        if (pthread_create(&tid, NULL, run_conn, c) != 0) {
+            perror("pthread_create");
+            return 1;
+        }
+        threads.push_back(tid);
+    }
+    for (size_t i = 0; i < threads.size(); i++) {
+        pthread_join(threads[i], NULL);
+    }
+    double elapsed = (now_us() - g_base_us) / 1e6;
+
+    std::sort(g_latency.begin(), g_latency.end());
+    long total = 0, matched = 0;
+    for (std::map<std::pair<int, int>, int>::iterator it = g_diff.begin(); it != g_diff.end(); ++it) {
+        total += it->second;
+        if (it->first.first == it->first.second) {
+            matched += it->second;
+        }
+    }
+    printf("connections %zu (http2 skipped %d, connect errors %ld), responses %ld, elapsed %.2fs, max lag %.1fms\n",
+           threads.size(), skipped, g_connect_errors, total, elapsed, g_max_lag_us / 1000.0);
+    printf("latency(ms) p50 %.3f  p90 %.3f  p99 %.3f  p99.9 %.3f  max %.3f\n",
+           percentile(g_latency, 0.5) / 1000.0, percentile(g_latency, 0.9) / 1000.0,
+           percentile(g_latency, 0.99) / 1000.0, percentile(g_latency, 0.999) / 1000.0,
+           g_latency.empty() ? 0.0 : g_latency.back() / 1000.0);
+    printf("status matched %ld/%ld\n", matched, total);
+    for (std::map<std::pair<int, int>, int>::iterator it = g_diff.begin(); it != g_diff.end(); ++it) {
+        if (it->first.first != it->first.second) {
+            printf("  captured %d -> replayed %d : %d\n", it->first.first, it->first.second, it->second);
+        }
+    }
+    return total == matched ? 0 : 2;
+}
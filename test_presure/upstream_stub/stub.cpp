@@ -0,0 +1,238 @@
+/*
+    反向代理测试用的上游：每个连接一个线程，支持长连接，按路径决定响应的形式
+
+    编译：
+        g++ -std=c++11 -O2 test_presure/upstream_stub/stub.cpp -pthread -o upstream_stub
+    运行：
+        ./upstream_stub unix:/tmp/app.sock        或  ./upstream_stub 9000
+    路径：
+        /.../chunked...     响应体用 chunked 编码
+        /.../close...       不带长度，发完响应后关闭连接
+        /.../slow...        等待 -d 给出的毫秒数(默认2000)后再响应
+        /.../big...         响应体 8MB
+        其它                Content-Length 响应，内容为请求行、连接序号、该连接上的请求序号和收到的 X-Forwarded-For
+    POST/PUT 的请求体(Content-Length 或 chunked)原样返回。
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <string>
+#include <atomic>
+
+static int g_delay_ms = 2000;
+static std::atomic<int> g_conns(0);
+
+struct conn_ctx {
+    int fd;
+    int id;
+    std::string in;
+};
+
+static bool fill(conn_ctx* c) {
+    char buf[65536];
+    int n = recv(c->fd, buf, sizeof(buf), 0);
+    if (n <= 0) {
+        return false;
+    }
+    c->in.append(buf, n);
+    return true;
+}
+
+static bool send_all(int fd, const char* data, size_t len) {
+    while (len > 0) {
+        int n = send(fd, data, len, MSG_NOSIGNAL);
+        if (n <= 0) {
+            return false;
+        }
+        data += n;
+        len -= n;
+    }
+    return true;
+}
+
+static const char* header(const std::string& head, const char* name) {
+    static thread_local std::string value;
+    size_t pos = 0;
+    size_t len = strlen(name);
+    while ((pos = head.find("\r\n", pos)) != std::string::npos) {
+        pos += 2;
+        if (strncasecmp(head.c_str() + pos, name, len) == 0 && head[pos + len] == ':') {
+            size_t start = head.find_first_not_of(" \t", pos + len + 1);
+            value = head.substr(start, head.find("\r\n", start) - start);
+            return value.c_str();
+        }
+    }
+    return NULL;
+}
+
+//读请求体，chunked 时解码
+static bool read_body(conn_ctx* c, const std::string& head, std::string* body) {
+    const char* te = header(head, "Transfer-Encoding");
+    if (te && strcasecmp(te, "chunked") == 0) {
+        while (true) {
+            size_t eol;
+            while ((eol = c->in.find("\r\n")) == std::string::npos) {
+                if (!fill(c)) return false;
+            }
+            long size = strtol(c->in.c_str(), NULL, 16);
+            c->in.erase(0, eol + 2);
+            if (size == 0) {
+                while ((eol = c->in.find("\r\n")) != 0) {       //trailer 直到空行
+                    if (eol == std::string::npos) {
+                        if (!fill(c)) return false;
+                        continue;
+                    }
+                    c->in.erase(0, eol + 2);
+                }
+                c->in.erase(0, 2);
+                return true;
+            }
+            while (c->in.size() < (size_t)size + 2) {
+                if (!fill(c)) return false;
+            }
+            body->append(c->in, 0, size);
+            c->in.erase(0, size + 2);
+        }
+    }
+    const char* cl = header(head, "Content-Length");
+    size_t len = cl ? strtoul(cl, NULL, 10) : 0;
+    while (c->in.size() < len) {
+        if (!fill(c)) return false;
+    }
+    body->assign(c->in, 0, len);
+    c->in.erase(0, len);
+    return true;
+}
+
+static void* serve(void* arg) {
+    conn_ctx* c = (conn_ctx*)arg;
+    int reqs = 0;
+    while (true) {
+        size_t end;
+        while ((end = c->in.find("\r\n\r\n")) == std::string::npos) {
+            if (!fill(c)) goto done;
+        }
+        std::string head = c->in.substr(0, end + 2);
+        c->in.erase(0, end + 4);
+        reqs++;
+
+        std::string line = head.substr(0, head.find("\r\n"));
+        std::string method = line.substr(0, line.find(' '));
+        std::string path = line.substr(line.find(' ') + 1);
+        path = path.substr(0, path.find(' '));
+        std::string body;
+        if (!read_body(c, head, &body)) {
+            break;
+        }
+        if (path.find("slow") != std::string::npos) {
+            usleep(g_delay_ms * 1000);
+        }
+
+        if (method != "POST" && method != "PUT") {
+            const char* xff = header(head, "X-Forwarded-For");
+            char text[512];
+            snprintf(text, sizeof(text), "%s conn=%d req=%d xff=%s\n", line.c_str(), c->id, reqs, xff ? xff : "-");
+            body = text;
+            if (path.find("big") != std::string::npos) {
+                body.assign(8 * 1024 * 1024, 'x');
+            }
+        }
+        bool head_only = method == "HEAD";
+
+        std::string out = "HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\nX-Upstream: stub\r\n";
+        if (path.find("close") != std::string::npos) {
+            out += "Connection: close\r\n\r\n";
+            send_all(c->fd, out.data(), out.size());
+            if (!head_only) send_all(c->fd, body.data(), body.size());
+            break;
+        }
+        if (path.find("chunked") != std::string::npos) {
+            out += "Transfer-Encoding: chunked\r\n\r\n";
+            if (!head_only) {
+                //分成几个块，最后带一个trailer
+                for (size_t off = 0; off < body.size(); off += 7) {
+                    size_t n = body.size() - off < 7 ? body.size() - off : 7;
+                    char size[16];
+                    snprintf(size, sizeof(size), "%zx;ext=1\r\n", n);
+                    out += size;
+                    out.append(body, off, n);
+                    out += "\r\n";
+                }
+                out += "0\r\nX-Trailer: done\r\n\r\n";
+            }
+            if (!send_all(c->fd, out.data(), out.size())) break;
+            continue;
+        }
+        char cl[64];
+        snprintf(cl, sizeof(cl), "Content-Length: %zu\r\n\r\n", body.size());
+        out += cl;
+        if (!send_all(c->fd, out.data(), out.size())) break;
+        if (!head_only && !send_all(c->fd, body.data(), body.size())) break;
+    }
+done:
+    close(c->fd);
+    delete c;
+    return NULL;
+}
+
+int main(int argc, char* argv[]) {
+    int opt;
+    while ((opt = getopt(argc, argv, "d:")) != -1) {
+        if (opt == 'd') {
+            g_delay_ms = atoi(optarg);
+        }
+    }
+    if (optind >= argc) {
+        printf("usage: %s [-d delay_ms] unix:/path | port\n", argv[0]);
+        return 1;
+    }
+    const char* spec = argv[optind];
+    int lfd;
+    if (strncmp(spec, "unix:", 5) == 0) {
+        struct sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", spec + 5);
+        unlink(addr.sun_path);
+        lfd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (bind(lfd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+            perror("bind");
+            return 1;
+        }
+    }
+    else {
+        struct sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        addr.sin_port = htons(atoi(spec));
+        lfd = socket(AF_INET, SOCK_STREAM, 0);
+        int on = 1;
+        setsockopt(lfd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+        if (bind(lfd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+            perror("bind");
+            return 1;
+        }
+    }
+    listen(lfd, 128);
+    while (true) {
+        int fd = accept(lfd, NULL, NULL);
+        if (fd < 0) {
+            continue;
+        }
+        conn_ctx* c = new conn_ctx;
+        c->fd = fd;
+        c->id = ++g_conns;
+        printf("connection %d\n", c->id);
+        fflush(stdout);
+        pthread_t tid;
+        pthread_create(&tid, NULL, serve, c);
+        pthread_detach(tid);
+    }
+}
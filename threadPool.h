@@ -2,22 +2,44 @@
 #define THREADPOOL_H
 
 #include<pthread.h>
-#include<list>
 #include"locker.h"
+#include"busy_poll.h"
 #include<exception>
 #include<cstdio>
+#include<atomic>
 
 //线程池类， 定义成模板类是为了代码的复用, 模板参数T是任务类
+//任务分 PRIORITIES 个优先级(0 最高)，工作线程总是先取高优先级的队首；低优先级的队列连续被越过 STARVE_LIMIT 次后
+//取各队列中等得最久的一个，避免过载时一直饿死。任务入队时记下时间和期限，取出时已过期限的交给 set_expire 的处理函数
+//(如直接回复503)，不再做无用的处理
 template<typename T>
 class threadPool {
 public:
+    static const int PRIORITIES = 3;        //优先级类别数
+    static const int DEFAULT_PRIORITY = 1;
+    static const int WAIT_BUCKETS = 21;     //排队时间直方图：第0格 <1us，第 i 格 [2^(i-1), 2^i) us，最后一格为更长的
+    static const int STARVE_LIMIT = 16;
+
+    //每个优先级的计数，工作线程无锁累加
+    struct class_stats {
+        std::atomic<unsigned long> served;      //取出的任务数(包括过期的)
+        std::atomic<unsigned long> expired;     //过期后交给处理函数的任务数
+        std::atomic<unsigned long> wait[WAIT_BUCKETS];
+    };
+
     threadPool(int thread_number = 8, int max_requests = 10000);
     ~threadPool();
-    bool append(T* request);    //添加任务方法
+    bool append(T* request, int prio = DEFAULT_PRIORITY);    //添加任务方法
     void run();                 //启动线程池
+    bool resize(int thread_number);         //运行中调整线程数，多出的线程处理完手头任务后退出
+    void set_max_requests(int max_requests);
+    void set_deadline(int ms);              //之后入队的任务最多排队 ms 毫秒，0 不限制
+    void set_expire(bool (*expire)(T*)) { m_expire = expire; }  //过期任务的处理函数，返回 false 时照常 process()
+    const class_stats& stats(int prio) const { return m_stats[prio]; }
 
 private:
     static void* worker(void* arg); //静态成员函数
+    int pick();                     //持锁时调用：选出要取任务的优先级
 
 private:
     //线程的数量
@@ -29,8 +51,27 @@ private:
     //请求队列中最多允许的， 等待处理的请求数量
     int m_max_requests;
 
-    //请求队列
-    std::list<T*> m_workQueue;
+    //请求队列中的一项：入队时间和期限(CLOCK_MONOTONIC 纳秒，期限为0表示不限制)
+    struct entry {
+        T* request;
+        unsigned long long enqueued;
+        unsigned long long deadline;
+    };
+
+    //每个优先级一个固定容量的环形数组，入队出队不向堆申请节点，容量只在 set_max_requests 时改变
+    struct ring {
+        entry* items;
+        int head;       //队首下标
+        int size;
+    };
+    ring m_queues[PRIORITIES];
+    int m_queueCap;     //每个环形数组的容量，比 m_max_requests 多一个(与原来 size > max 才拒绝的行为一致)
+    int m_queueSize;    //所有优先级的任务数，上限为 m_max_requests
+    int m_passed;       //低优先级有任务时连续取高优先级的次数
+
+    unsigned long long m_deadline_ns;
+    bool (*m_expire)(T*);
+    class_stats m_stats[PRIORITIES];
 
     //互斥锁
     locker m_queueLocker;
@@ -40,16 +81,26 @@ private:
 
     //是否结束线程
     bool m_stop;
+
+    //缩容时还需要退出的线程数
+    int m_exit_count;
 };
 
 //构造函数实现
 template<typename T> 
 threadPool<T>::threadPool(int thread_number, int max_requests) : m_thread_number(thread_number), 
-                m_max_requests(max_requests), m_stop(false), m_threads(NULL) {
+                m_threads(NULL), m_max_requests(max_requests), m_queueCap(0), m_queueSize(0), m_passed(0),
+                m_deadline_ns(0), m_expire(NULL), m_stats(), m_stop(false), m_exit_count(0) {
 
     if ((thread_number <= 0) || (max_requests <= 0)) {
         throw std::exception();
     }
+    m_queueCap = max_requests + 1;
+    for (int p = 0; p < PRIORITIES; p++) {
+        m_queues[p].items = new entry[m_queueCap];
+        m_queues[p].head = 0;
+        m_queues[p].size = 0;
+    }
     //创建线程数组
     m_threads = new pthread_t[m_thread_number];
     if(!m_threads) {
@@ -79,22 +130,92 @@ threadPool<T>::threadPool(int thread_number, int max_requests) : m_thread_number
 template<typename T> 
 threadPool<T>::~threadPool() {
     delete[] m_threads;
+    for (int p = 0; p < PRIORITIES; p++) {
+        delete[] m_queues[p].items;
+    }
     m_stop = true;
 }
 
+//扩容时新建线程，缩容时让多出的线程依次退出
+template<typename T> 
+bool threadPool<T>::resize(int thread_number) {
+    if (thread_number <= 0) {
+        return false;
+    }
+    m_queueLocker.lock();
+    int add = thread_number - m_thread_number;
+    for (int i = 0; i < add; i++) {
+        pthread_t tid;
+        if (pthread_create(&tid, NULL, worker, this) != 0) {
+            thread_number = m_thread_number + i;
+            break;
+        }
+        pthread_detach(tid);
+    }
+    int remove = add < 0 ? -add : 0;
+    m_exit_count += remove;
+    m_thread_number = thread_number;
+    m_queueLocker.unlock();
+    //每个要退出的线程消耗一个信号量；先醒来的线程无论原本是否为任务而醒，
+    //总数不变，任务仍会被其余线程取走
+    for (int i = 0; i < remove; i++) {
+        m_queueStat.post();
+    }
+    return true;
+}
+
+template<typename T> 
+void threadPool<T>::set_max_requests(int max_requests) {
+    m_queueLocker.lock();
+    m_max_requests = max_requests;
+    //按新上限重新分配环形数组，已排队的任务按顺序搬过去(缩小时保留全部已排队的任务)
+    int cap = max_requests + 1 > m_queueSize ? max_requests + 1 : m_queueSize;
+    if (cap != m_queueCap) {
+        for (int p = 0; p < PRIORITIES; p++) {
+            ring& q = m_queues[p];
+            entry* items = new entry[cap];
+            for (int i = 0; i < q.size; i++) {
+                items[i] = q.items[(q.head + i) % m_queueCap];
+            }
+            delete[] q.items;
+            q.items = items;
+            q.head = 0;
+        }
+        m_queueCap = cap;
+    }
+    m_queueLocker.unlock();
+}
+
+template<typename T> 
+void threadPool<T>::set_deadline(int ms) {
+    m_queueLocker.lock();
+    m_deadline_ns = ms > 0 ? ms * 1000000ULL : 0;
+    m_queueLocker.unlock();
+}
+
 //添加请求任务函数
 template<typename T> 
-bool threadPool<T>::append(T * request) {
+bool threadPool<T>::append(T * request, int prio) {
+    if (prio < 0 || prio >= PRIORITIES) {
+        prio = DEFAULT_PRIORITY;
+    }
+    unsigned long long now = busy_poll::now_ns();
 
     m_queueLocker.lock();   //上锁
 
     //超出最大值了，无法添加任务
-    if (m_workQueue.size() > m_max_requests) {  
+    if (m_queueSize > m_max_requests || m_queueSize == m_queueCap) {
         m_queueLocker.unlock();
         return false;
     }
 
-    m_workQueue.push_back(request); //添加一个任务到队尾
+    ring& q = m_queues[prio];
+    entry& e = q.items[(q.head + q.size) % m_queueCap];   //添加一个任务到该优先级的队尾
+    e.request = request;
+    e.enqueued = now;
+    e.deadline = m_deadline_ns ? now + m_deadline_ns : 0;
+    q.size++;
+    m_queueSize++;
     m_queueLocker.unlock();         //解锁
     m_queueStat.post();             //增加一个信号量
     return true;
@@ -108,25 +229,91 @@ void* threadPool<T>::worker(void* arg) {
     return pool;
 }
 
+template<typename T> 
+int threadPool<T>::pick() {
+    int first = 0;
+    while (m_queues[first].size == 0) {
+        first++;
+    }
+    int oldest = first;
+    for (int p = first + 1; p < PRIORITIES; p++) {
+        if (m_queues[p].size > 0 &&
+            m_queues[p].items[m_queues[p].head].enqueued < m_queues[oldest].items[m_queues[oldest].head].enqueued) {
+            oldest = p;
+        }
+    }
+    if (oldest == first) {
+        m_passed = 0;
+        return first;
+    }
+    //低优先级的队首等得更久：连续越过 STARVE_LIMIT 次后先取它
+    if (++m_passed >= STARVE_LIMIT) {
+        m_passed = 0;
+        return oldest;
+    }
+    return first;
+}
+
 template<typename T> 
 void threadPool<T>::run() {
+    busy_poll::budget budget(busy_poll::POOL);     //每个工作线程自己的自旋预算
     while (!m_stop) {
-        m_queueStat.wait();     //信号量>0，信号量减一且取任务， 否则阻塞等待
+        //低延迟模式：先自旋 trywait，预算内没等到再阻塞
+        bool spun = false;
+        if (busy_poll::enabled()) {
+            spun = budget.spin([this]() { return m_queueStat.trywait(); });
+            if (!spun) {
+                unsigned long long start = busy_poll::now_ns();
+                m_queueStat.wait();
+                budget.blocked(busy_poll::now_ns() - start);
+            }
+        }
+        else {
+            m_queueStat.wait();     //信号量>0，信号量减一且取任务， 否则阻塞等待
+        }
         m_queueLocker.lock();   //上锁，操作请求队列
-        if (m_workQueue.empty()) {  //队列是否为空
+        if (m_exit_count > 0) {     //线程池缩容，本线程退出
+            m_exit_count--;
+            m_queueLocker.unlock();
+            break;
+        }
+        if (m_queueSize == 0) {     //队列是否为空
             m_queueLocker.unlock(); //是就解锁
             continue;               //继续循环判断是否来任务了。
         }
 
-        T* request = m_workQueue.front();    //取出第一个任务
-        m_workQueue.pop_front();             //从队列里删除已经取出的任务
+        int prio = pick();
+        ring& q = m_queues[prio];
+        entry e = q.items[q.head];          //取出该优先级的第一个任务
+        q.head = (q.head + 1) % m_queueCap; //从队列里删除已经取出的任务
+        q.size--;
+        m_queueSize--;
         m_queueLocker.unlock();              //释放锁
 
-        if (!request) {
+        if (!e.request) {
             continue;       //未获取到任务，继续循环
         }
+        unsigned long long now = busy_poll::now_ns();
+        unsigned long long wait_us = (now - e.enqueued) / 1000;
+        int bucket = 0;
+        while (wait_us > 0 && bucket < WAIT_BUCKETS - 1) {
+            wait_us >>= 1;
+            bucket++;
+        }
+        class_stats& st = m_stats[prio];
+        st.served.fetch_add(1, std::memory_order_relaxed);
+        st.wait[bucket].fetch_add(1, std::memory_order_relaxed);
+        if (busy_poll::enabled()) {
+            busy_poll::handoff(spun, now - e.enqueued);
+        }
+
+        //排队超过期限：已经没有意义的请求交给处理函数快速失败
+        if (e.deadline && now > e.deadline && m_expire && m_expire(e.request)) {
+            st.expired.fetch_add(1, std::memory_order_relaxed);
+            continue;
+        }
 
-        request->process(); //获取到了进行任务处理
+        e.request->process(); //获取到了进行任务处理
 
     }
 }
@@ -0,0 +1,97 @@
+#include "tls.h"
+#include "log.h"
+#include <openssl/err.h>
+
+static const unsigned char session_id_ctx[] = "webserver";
+static const unsigned char alpn_h2[] = "\x02h2\x08http/1.1";
+static const unsigned char alpn_http11[] = "\x08http/1.1";
+
+//把 OpenSSL 错误队列写到日志
+static void log_ssl_errors(const char* what) {
+    unsigned long err;
+    char buf[256];
+    while ((err = ERR_get_error()) != 0) {
+        ERR_error_string_n(err, buf, sizeof(buf));
+        EMlog(LOGLEVEL_ERROR, "%s: %s\n", what, buf);
+    }
+}
+
+//ALPN：按服务端的顺序选第一个客户端也支持的协议，没有共同的协议时不协商(按 HTTP/1.1 处理)
+static int select_alpn(SSL*, const unsigned char** out, unsigned char* outlen,
+                       const unsigned char* in, unsigned int inlen, void* arg) {
+    const unsigned char* protos = arg ? alpn_h2 : alpn_http11;
+    unsigned int len = arg ? sizeof(alpn_h2) - 1 : sizeof(alpn_http11) - 1;
+    if (SSL_select_next_proto((unsigned char**)out, outlen, protos, len, in, inlen) != OPENSSL_NPN_NEGOTIATED) {
+        return SSL_TLSEXT_ERR_NOACK;
+    }
+    return SSL_TLSEXT_ERR_OK;
+}
+
+tls_context::tls_context() : m_ctx(NULL), m_handshakes(0), m_resumed(0), m_ktls(0) {
+}
+
+tls_context::~tls_context() {
+    if (m_ctx) {
+        SSL_CTX_free(m_ctx);
+    }
+}
+
+bool tls_context::init(const char* cert, const char* key, bool h2) {
+    m_ctx = SSL_CTX_new(TLS_server_method());
+    if (!m_ctx) {
+        log_ssl_errors("SSL_CTX_new");
+        return false;
+    }
+    SSL_CTX_set_min_proto_version(m_ctx, TLS1_2_VERSION);
+    //kTLS：握手完成后由 OpenSSL 尝试设置 TCP_ULP "tls"，内核或加密套件不支持时保持用户态加密
+    SSL_CTX_set_options(m_ctx, SSL_OP_ENABLE_KTLS | SSL_OP_NO_RENEGOTIATION | SSL_OP_CIPHER_SERVER_PREFERENCE);
+    //非阻塞写：允许部分写入，重试时缓冲区地址可以变化(iovec 前移后重试)
+    SSL_CTX_set_mode(m_ctx, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER | SSL_MODE_RELEASE_BUFFERS);
+
+    if (SSL_CTX_use_certificate_chain_file(m_ctx, cert) != 1) {
+        log_ssl_errors(cert);
+        return false;
+    }
+    if (SSL_CTX_use_PrivateKey_file(m_ctx, key, SSL_FILETYPE_PEM) != 1 || SSL_CTX_check_private_key(m_ctx) != 1) {
+        log_ssl_errors(key);
+        return false;
+    }
+
+    //会话恢复：服务端缓存 + 会话票据(默认打开)，热重启后的新进程票据密钥不同，客户端退回完整握手
+    SSL_CTX_set_session_cache_mode(m_ctx, SSL_SESS_CACHE_SERVER);
+    SSL_CTX_set_session_id_context(m_ctx, session_id_ctx, sizeof(session_id_ctx) - 1);
+    SSL_CTX_sess_set_cache_size(m_ctx, 20480);
+    SSL_CTX_set_timeout(m_ctx, 300);
+
+    SSL_CTX_set_alpn_select_cb(m_ctx, select_alpn, h2 ? (void*)1 : NULL);
+    return true;
+}
+
+SSL* tls_context::accept(int connfd) {
+    SSL* ssl = SSL_new(m_ctx);
+    if (!ssl) {
+        log_ssl_errors("SSL_new");
+        return NULL;
+    }
+    if (SSL_set_fd(ssl, connfd) != 1) {
+        log_ssl_errors("SSL_set_fd");
+        SSL_free(ssl);
+        return NULL;
+    }
+    SSL_set_accept_state(ssl);
+    return ssl;
+}
+
+void tls_context::handshake_done(SSL* ssl, bool ktls_send) {
+    m_handshakes++;
+    if (SSL_session_reused(ssl)) {
+        m_resumed++;
+    }
+    if (ktls_send) {
+        m_ktls++;
+    }
+    else if (m_handshakes == 1) {
+        EMlog(LOGLEVEL_WARN, "kTLS unavailable (%s, %s), responses are encrypted by SSL_write\n",
+              SSL_get_version(ssl), SSL_get_cipher_name(ssl));
+    }
+}
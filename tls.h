@@ -0,0 +1,37 @@
+#ifndef TLS_H
+#define TLS_H
+
+#include <openssl/ssl.h>
+
+/*
+    HTTPS 监听socket的TLS上下文(OpenSSL)。
+    握手在事件循环线程中非阻塞地推进(SSL_do_handshake 返回 WANT_READ/WANT_WRITE 时改注册事件)；
+    握手完成后如果内核支持 kTLS(TCP_ULP "tls")，OpenSSL 把发送方向的记录层交给内核，
+    之后响应仍然由 writev 直接从写缓冲区和文件映射发出，加密在内核中完成，不经过用户态的拷贝；
+    内核不支持时退回 SSL_write。请求的接收总是经过 SSL_read(请求一般很小)。
+    会话恢复：服务端会话缓存(TLS 1.2 session id)和会话票据(TLS 1.3 / 1.2 ticket)都打开。
+    ALPN：开启 HTTP/2 时客户端提供 h2 就选择 h2，之后客户端发送连接序言，由 http_conn 切换；否则选择 http/1.1。
+*/
+class tls_context {
+public:
+    tls_context();
+    ~tls_context();
+
+    bool init(const char* cert, const char* key, bool h2);    //加载证书链和私钥，启动时调用，失败时写日志
+    SSL* accept(int connfd);                        //为新连接创建服务端 SSL 对象，失败返回NULL
+
+    //握手完成时由 http_conn 调用，统计握手、会话恢复和 kTLS 的次数(事件循环线程)
+    void handshake_done(SSL* ssl, bool ktls_send);
+
+    unsigned long handshakes() const { return m_handshakes; }
+    unsigned long resumed() const { return m_resumed; }
+    unsigned long ktls() const { return m_ktls; }
+
+private:
+    SSL_CTX* m_ctx;
+    unsigned long m_handshakes;
+    unsigned long m_resumed;
+    unsigned long m_ktls;
+};
+
+#endif
@@ -0,0 +1,270 @@
+/*
+    打包工具：把网站根目录打成一个 bundle 文件，供 ./main -b 使用(格式见 bundle.h)
+
+    编译（在仓库根目录下执行）：
+        g++ -std=c++11 -O2 -I. tools/mkbundle.cpp doc_index.cpp log.cpp -lz -pthread -o mkbundle
+    运行：
+        ./mkbundle [-z] [-o site.bundle] resources
+
+    -z 为每个文件额外生成gzip版本(压缩后至少小10%才保留)，客户端带 Accept-Encoding: gzip 时发送。
+    输出先写入临时文件再 rename，运行中的服务器会检测到并原子切换到新的打包文件。
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <zlib.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include "bundle.h"
+#include "doc_index.h"
+
+struct packed_file {
+    std::string key;
+    std::string path;
+    std::string data;
+    std::string gz;
+    time_t mtime;
+};
+
+static bool read_file(const std::string& path, std::string& out) {
+    FILE* fp = fopen(path.c_str(), "rb");
+    if (!fp) {
+        return false;
+    }
+    char buf[65536];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), fp)) > 0) {
+        out.append(buf, n);
+    }
+    bool ok = !ferror(fp);
+    fclose(fp);
+    return ok;
+}
+
+//与 doc_index 的收录规则一致：跳过以'.'开头的文件和符号链接，只收录普通文件
+static void walk(const std::string& root, const std::string& rel, std::vector<packed_file>& files) {
+    std::string dir = root + rel;
+    DIR* dp = opendir(dir.c_str());
+    if (!dp) {
+        fprintf(stderr, "cannot open %s\n", dir.c_str());
+        return;
+    }
+    struct dirent* de;
+    while ((de = readdir(dp)) != NULL) {
+        if (de->d_name[0] == '.') {
+            continue;
+        }
+        std::string key = rel + "/" + de->d_name;
+        struct stat st;
+        if (lstat((root + key).c_str(), &st) < 0) {
+            continue;
+        }
+        if (S_ISDIR(st.st_mode)) {
+            walk(root, key, files);
+        }
+        else if (S_ISREG(st.st_mode)) {
+            packed_file f;
+            f.key = key;
+            f.path = root + key;
+            f.mtime = st.st_mtime;
+            files.push_back(f);
+        }
+    }
+    closedir(dp);
+}
+
+static bool gzip(const std::string& in, std::string& out) {
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    if (deflateInit2(&zs, Z_BEST_COMPRESSION, Z_DEFLATED, 15 + 16, 9, Z_DEFAULT_STRATEGY) != Z_OK) {
+        return false;
+    }
+    out.resize(deflateBound(&zs, in.size()));
+    zs.next_in = (Bytef*)in.data();
+    zs.avail_in = in.size();
+    zs.next_out = (Bytef*)&out[0];
+    zs.avail_out = out.size();
+    int ret = deflate(&zs, Z_FINISH);
+    out.resize(zs.total_out);
+    deflateEnd(&zs);
+    return ret == Z_STREAM_END;
+}
+
+//FNV-1a 64位，作为内容ETag
+static unsigned long long content_hash(const std::string& data) {
+    unsigned long long h = 14695981039346656037ULL;
+    for (size_t i = 0; i < data.size(); i++) {
+        h ^= (unsigned char)data[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+static uint64_t align_up(uint64_t v) {
+    return (v + BUNDLE_ALIGN - 1) & ~(uint64_t)(BUNDLE_ALIGN - 1);
+}
+
+static bool by_key(const packed_file& a, const packed_file& b) {
+    return a.key < b.key;
+}
+
+int main(int argc, char* argv[]) {
+    const char* out_path = "site.bundle";
+    bool use_gzip = false;
+    int opt;
+    while ((opt = getopt(argc, argv, "zo:")) != -1) {
+        switch (opt) {
+            case 'z': use_gzip = true; break;
+            case 'o': out_path = optarg; break;
+            default:
+                fprintf(stderr, "usage: %s [-z] [-o out.bundle] docroot\n", argv[0]);
+                return 1;
+        }
+    }
+    if (optind >= argc) {
+        fprintf(stderr, "usage: %s [-z] [-o out.bundle] docroot\n", argv[0]);
+        return 1;
+    }
+    std::string root = argv[optind];
+    while (root.size() > 1 && root[root.size() - 1] == '/') {
+        root.erase(root.size() - 1);
+    }
+
+    std::vector<packed_file> files;
+    walk(root, "", files);
+    std::sort(files.begin(), files.end(), by_key);
+
+    std::string strings;
+    std::vector<bundle_entry> entries(files.size());
+    uint64_t index_off = align_up(sizeof(bundle_header));
+    uint64_t data_off = 0;      //先按相对数据区的偏移记录，最后再加上数据区起点
+    size_t total = 0, total_gz = 0;
+
+    for (size_t i = 0; i < files.size(); i++) {
+        packed_file& f = files[i];
+        bundle_entry& e = entries[i];
+        memset(&e, 0, sizeof(e));
+        if (f.key.size() >= (size_t)doc_index::PATH_LEN || !read_file(f.path, f.data)) {
+            fprintf(stderr, "skip %s\n", f.path.c_str());
+            continue;   //key_len 为0的项不会被查到
+        }
+        if (use_gzip && !f.data.empty()) {
+            std::string gz;
+            if (gzip(f.data, gz) && gz.size() < f.data.size() / 10 * 9) {
+                f.gz.swap(gz);
+            }
+        }
+
+        e.key_off = strings.size();
+        e.key_len = f.key.size();
+        strings += f.key;
+        e.mime_off = strings.size();
+        strings += doc_index::mime_type(f.key.c_str());
+        strings += '\0';
+
+        unsigned long long h = content_hash(f.data);
+        snprintf(e.etag, sizeof(e.etag), "\"%016llx\"", h);
+        snprintf(e.gz_etag, sizeof(e.gz_etag), "\"%016llx-gz\"", h);
+
+        char date[64];
+        struct tm tm;
+        gmtime_r(&f.mtime, &tm);
+        strftime(date, sizeof(date), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+        const char* vary = f.gz.empty() ? "" : "Vary: Accept-Encoding\r\n";
+        char hdr[256];
+        e.hdr_off = strings.size();
+        e.hdr_len = snprintf(hdr, sizeof(hdr), "ETag: %s\r\nLast-Modified: %s\r\n%s", e.etag, date, vary);
+        strings.append(hdr, e.hdr_len);
+        e.gz_hdr_off = strings.size();
+        e.gz_hdr_len = snprintf(hdr, sizeof(hdr), "ETag: %s\r\nLast-Modified: %s\r\nContent-Encoding: gzip\r\n%s",
+                                e.gz_etag, date, vary);
+        strings.append(hdr, e.gz_hdr_len);
+
+        e.mtime = f.mtime;
+        e.data_off = data_off;
+        e.data_size = f.data.size();
+        data_off = align_up(data_off + f.data.size());
+        if (!f.gz.empty()) {
+            e.gz_off = data_off;
+            e.gz_size = f.gz.size();
+            data_off = align_up(data_off + f.gz.size());
+        }
+        total += f.data.size();
+        total_gz += f.gz.size();
+    }
+    //跳过读取失败的项后仍需保持有序且key唯一
+    std::vector<bundle_entry> kept;
+    for (size_t i = 0; i < entries.size(); i++) {
+        if (entries[i].key_len > 0) {
+            kept.push_back(entries[i]);
+        }
+    }
+
+    bundle_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, BUNDLE_MAGIC, 8);
+    header.version = BUNDLE_VERSION;
+    header.count = kept.size();
+    header.index_off = index_off;
+    header.strings_off = index_off + kept.size() * sizeof(bundle_entry);
+    header.strings_size = strings.size();
+    uint64_t data_start = align_up(header.strings_off + strings.size());
+    header.file_size = data_start + data_off;
+    for (size_t i = 0; i < kept.size(); i++) {
+        kept[i].data_off += data_start;
+        if (kept[i].gz_size > 0) {
+            kept[i].gz_off += data_start;
+        }
+    }
+
+    //写临时文件，完成后rename，服务器不会看到写了一半的文件
+    std::string tmp = std::string(out_path) + ".tmp";
+    FILE* fp = fopen(tmp.c_str(), "wb");
+    if (!fp) {
+        perror("fopen");
+        return 1;
+    }
+    std::string pad(BUNDLE_ALIGN, '\0');
+    fwrite(&header, sizeof(header), 1, fp);
+    fwrite(pad.data(), 1, index_off - sizeof(header), fp);
+    if (!kept.empty()) {
+        fwrite(&kept[0], sizeof(bundle_entry), kept.size(), fp);
+    }
+    fwrite(strings.data(), 1, strings.size(), fp);
+    fwrite(pad.data(), 1, data_start - header.strings_off - strings.size(), fp);
+    uint64_t pos = 0;
+    for (size_t i = 0; i < files.size(); i++) {
+        const packed_file& f = files[i];
+        if (entries[i].key_len == 0) {
+            continue;
+        }
+        fwrite(f.data.data(), 1, f.data.size(), fp);
+        pos += f.data.size();
+        fwrite(pad.data(), 1, align_up(pos) - pos, fp);
+        pos = align_up(pos);
+        if (!f.gz.empty()) {
+            fwrite(f.gz.data(), 1, f.gz.size(), fp);
+            pos += f.gz.size();
+            fwrite(pad.data(), 1, align_up(pos) - pos, fp);
+            pos = align_up(pos);
+        }
+    }
+    if (fflush(fp) != 0 || fsync(fileno(fp)) != 0 || fclose(fp) != 0) {
+        perror("write");
+        unlink(tmp.c_str());
+        return 1;
+    }
+    if (rename(tmp.c_str(), out_path) != 0) {
+        perror("rename");
+        unlink(tmp.c_str());
+        return 1;
+    }
+    printf("%s: %u files, %zu bytes, %zu bytes gzip, %llu bytes total\n",
+           out_path, header.count, total, total_gz, (unsigned long long)header.file_size);
+    return 0;
+}
@@ -0,0 +1,622 @@
+#include "uring_loop.h"
+#include <sys/syscall.h>
+#include <sys/eventfd.h>
+#include <sys/utsname.h>
+#include <sys/mman.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <poll.h>
+#include "hot_restart.h"
+#include "prefork.h"
+#include "config.h"
+
+uring_loop* uring_loop::s_instance = NULL;
+
+//user_data 编码：类型(8位) | 连接代数(24位) | fd(32位)
+static inline unsigned long long encode_data(int type, unsigned int gen, int fd) {
+    return ((unsigned long long)type << 56) | ((unsigned long long)(gen & 0xffffff) << 32) | (unsigned int)fd;
+}
+
+static inline int data_type(unsigned long long data) { return (int)(data >> 56); }
+static inline unsigned int data_gen(unsigned long long data) { return (unsigned int)(data >> 32) & 0xffffff; }
+static inline int data_fd(unsigned long long data) { return (int)(data & 0xffffffff); }
+
+//multishot recv 需要 6.0，provided buffer ring 需要 5.19
+static bool kernel_supported() {
+    struct utsname u;
+    if (uname(&u) != 0) {
+        return false;
+    }
+    int major = 0, minor = 0;
+    if (sscanf(u.release, "%d.%d", &major, &minor) != 2) {
+        return false;
+    }
+    return major > 6 || (major == 6 && minor >= 0);
+}
+
+uring_loop::uring_loop(int listenfd, int sigfd, http_conn* users, int max_fd, threadPool<http_conn>* pool)
+    : m_listenfd(listenfd), m_sigfd(sigfd), m_users(users), m_max_fd(max_fd), m_pool(pool),
+      m_state(max_fd), m_stop(false), m_timeout(false), m_ready_fd(-1), m_ring_fd(-1),
+      m_sq_ptr(MAP_FAILED), m_sq_size(0), m_cq_ptr(MAP_FAILED), m_cq_size(0),
+      m_sqes((io_uring_sqe*)MAP_FAILED), m_sqes_size(0), m_sqe_tail(0),
+      m_buf_ring((io_uring_buf*)MAP_FAILED), m_buf_ring_size(0), m_bufs(NULL), m_buf_size(http_conn::m_read_buffer_size),
+      m_wakeup_fd(-1), m_wakeup_val(0) {
+    for (int i = 0; i < max_fd; i++) {
+        m_state[i].gen = 0;
+        m_state[i].open = false;
+        m_state[i].busy = false;
+        m_state[i].sending = false;
+        m_state[i].receiving = false;
+        m_state[i].throttled = false;
+    }
+}
+
+uring_loop::~uring_loop() {
+    if (s_instance == this) {
+        http_conn::m_process_done = NULL;
+        s_instance = NULL;
+    }
+    if (m_buf_ring != MAP_FAILED) munmap(m_buf_ring, m_buf_ring_size);
+    free(m_bufs);
+    if (m_sqes != MAP_FAILED) munmap(m_sqes, m_sqes_size);
+    if (m_cq_ptr != MAP_FAILED && m_cq_ptr != m_sq_ptr) munmap(m_cq_ptr, m_cq_size);
+    if (m_sq_ptr != MAP_FAILED) munmap(m_sq_ptr, m_sq_size);
+    if (m_ring_fd >= 0) close(m_ring_fd);
+    if (m_wakeup_fd >= 0) close(m_wakeup_fd);
+}
+
+bool uring_loop::init() {
+    if (!kernel_supported()) {
+        EMlog(LOGLEVEL_WARN, "kernel too old for multishot recv, need >= 6.0\n");
+        return false;
+    }
+    if (!setup_ring() || !setup_buf_ring()) {
+        return false;
+    }
+    m_wakeup_fd = eventfd(0, EFD_CLOEXEC);
+    if (m_wakeup_fd < 0) {
+        return false;
+    }
+
+    s_instance = this;
+    http_conn::m_process_done = on_process_done;
+    http_conn::m_epollfd = -1;
+    return true;
+}
+
+//创建ring并映射SQ、CQ和SQE数组
+bool uring_loop::setup_ring() {
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    p.flags = IORING_SETUP_CQSIZE | IORING_SETUP_SUBMIT_ALL | IORING_SETUP_COOP_TASKRUN;
+    p.cq_entries = QUEUE_DEPTH * 4;     //multishot请求一次提交会产生多个CQE
+    m_ring_fd = syscall(__NR_io_uring_setup, QUEUE_DEPTH, &p);
+    if (m_ring_fd < 0) {
+        EMlog(LOGLEVEL_WARN, "io_uring_setup failed: %s\n", strerror(errno));
+        return false;
+    }
+
+    m_sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+    m_cq_size = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (m_cq_size > m_sq_size) m_sq_size = m_cq_size;
+        m_cq_size = m_sq_size;
+    }
+    m_sq_ptr = mmap(0, m_sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ring_fd, IORING_OFF_SQ_RING);
+    if (m_sq_ptr == MAP_FAILED) {
+        return false;
+    }
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        m_cq_ptr = m_sq_ptr;
+    }
+    else {
+        m_cq_ptr = mmap(0, m_cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ring_fd, IORING_OFF_CQ_RING);
+        if (m_cq_ptr == MAP_FAILED) {
+            return false;
+        }
+    }
+    m_sqes_size = p.sq_entries * sizeof(io_uring_sqe);
+    m_sqes = (io_uring_sqe*)mmap(0, m_sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ring_fd, IORING_OFF_SQES);
+    if (m_sqes == MAP_FAILED) {
+        return false;
+    }
+
+    char* sq = (char*)m_sq_ptr;
+    m_sq_head = (unsigned int*)(sq + p.sq_off.head);
+    m_sq_tail = (unsigned int*)(sq + p.sq_off.tail);
+    m_sq_mask = *(unsigned int*)(sq + p.sq_off.ring_mask);
+    m_sq_entries = p.sq_entries;
+    m_sqe_tail = *m_sq_tail;
+    //SQ数组与SQE一一对应，之后无需再改
+    unsigned int* array = (unsigned int*)(sq + p.sq_off.array);
+    for (unsigned int i = 0; i < p.sq_entries; i++) {
+        array[i] = i;
+    }
+
+    char* cq = (char*)m_cq_ptr;
+    m_cq_head = (unsigned int*)(cq + p.cq_off.head);
+    m_cq_tail = (unsigned int*)(cq + p.cq_off.tail);
+    m_cq_mask = *(unsigned int*)(cq + p.cq_off.ring_mask);
+    m_cqes = (io_uring_cqe*)(cq + p.cq_off.cqes);
+    return true;
+}
+
+//注册provided buffer ring，multishot recv每次由内核从中挑一块缓冲区
+bool uring_loop::setup_buf_ring() {
+    m_buf_ring_size = BUF_COUNT * sizeof(io_uring_buf);
+    m_buf_ring = (io_uring_buf*)mmap(0, m_buf_ring_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (m_buf_ring == MAP_FAILED) {
+        return false;
+    }
+    if (posix_memalign((void**)&m_bufs, 4096, (size_t)BUF_COUNT * m_buf_size) != 0) {
+        m_bufs = NULL;
+        return false;
+    }
+
+    for (unsigned int i = 0; i < BUF_COUNT; i++) {
+        io_uring_buf* buf = &m_buf_ring[i];
+        buf->addr = (unsigned long long)(m_bufs + (size_t)i * m_buf_size);
+        buf->len = m_buf_size;
+        buf->bid = i;
+    }
+    __atomic_store_n(&m_buf_ring[0].resv, (unsigned short)BUF_COUNT, __ATOMIC_RELEASE);  //环尾与第0项的resv重叠
+
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (unsigned long long)m_buf_ring;
+    reg.ring_entries = BUF_COUNT;
+    reg.bgid = BUF_GROUP;
+    if (syscall(__NR_io_uring_register, m_ring_fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        EMlog(LOGLEVEL_WARN, "register buffer ring failed: %s\n", strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+//把用完的缓冲区还给内核
+void uring_loop::recycle_buffer(unsigned short bid) {
+    unsigned short tail = m_buf_ring[0].resv;
+    io_uring_buf* buf = &m_buf_ring[tail & (BUF_COUNT - 1)];
+    buf->addr = (unsigned long long)(m_bufs + (size_t)bid * m_buf_size);
+    buf->len = m_buf_size;
+    buf->bid = bid;
+    __atomic_store_n(&m_buf_ring[0].resv, (unsigned short)(tail + 1), __ATOMIC_RELEASE);
+}
+
+//取一个空闲SQE，SQ满时先提交已有的
+io_uring_sqe* uring_loop::get_sqe() {
+    unsigned int head = __atomic_load_n(m_sq_head, __ATOMIC_ACQUIRE);
+    if (m_sqe_tail - head >= m_sq_entries) {
+        enter(0);
+        head = __atomic_load_n(m_sq_head, __ATOMIC_ACQUIRE);
+    }
+    io_uring_sqe* sqe = &m_sqes[m_sqe_tail & m_sq_mask];
+    m_sqe_tail++;
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+//提交所有已填充的SQE，并等待至少min_complete个完成事件
+int uring_loop::enter(unsigned int min_complete) {
+    unsigned int to_submit = m_sqe_tail - *m_sq_tail;
+    __atomic_store_n(m_sq_tail, m_sqe_tail, __ATOMIC_RELEASE);
+    unsigned int flags = min_complete ? IORING_ENTER_GETEVENTS : 0;
+    return syscall(__NR_io_uring_enter, m_ring_fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+void uring_loop::prep(io_uring_sqe* sqe, int opcode, int fd, OP_TYPE type, unsigned int gen) {
+    sqe->opcode = opcode;
+    sqe->fd = fd;
+    sqe->user_data = encode_data(type, gen, fd);
+}
+
+void uring_loop::arm_accept() {
+    io_uring_sqe* sqe = get_sqe();
+    prep(sqe, IORING_OP_ACCEPT, m_listenfd, OP_ACCEPT, 0);
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+}
+
+void uring_loop::arm_recv(int fd) {
+    m_state[fd].receiving = true;
+    io_uring_sqe* sqe = get_sqe();
+    prep(sqe, IORING_OP_RECV, fd, OP_RECV, m_state[fd].gen);
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = BUF_GROUP;
+}
+
+void uring_loop::arm_send(int fd) {
+    conn_state& st = m_state[fd];
+    http_conn& conn = m_users[fd];
+    memset(&st.msg, 0, sizeof(st.msg));
+    st.msg.msg_iov = conn.get_iov();
+    st.msg.msg_iovlen = conn.get_iv_count();
+    st.sending = true;
+
+    io_uring_sqe* sqe = get_sqe();
+    prep(sqe, IORING_OP_SENDMSG, fd, OP_SEND, st.gen);
+    sqe->addr = (unsigned long long)&st.msg;
+    sqe->len = 1;
+    sqe->msg_flags = MSG_NOSIGNAL;
+}
+
+//热重启：等待新进程的就绪通知
+void uring_loop::arm_ready() {
+    io_uring_sqe* sqe = get_sqe();
+    prep(sqe, IORING_OP_POLL_ADD, m_ready_fd, OP_READY, 0);
+    sqe->poll32_events = POLLIN;
+}
+
+//取消multishot accept，取消完成后 handle_accept 关闭监听socket
+void uring_loop::stop_accept() {
+    io_uring_sqe* sqe = get_sqe();
+    prep(sqe, IORING_OP_ASYNC_CANCEL, -1, OP_CANCEL, 0);
+    sqe->addr = encode_data(OP_ACCEPT, 0, m_listenfd);
+}
+
+//上传的请求体来得比状态机(sink)消化得快：取消multishot recv，数据留在内核接收缓冲区，
+//TCP窗口随之关闭，客户端放慢发送。每个连接暂存的数据因此有上限
+void uring_loop::pause_recv(int fd) {
+    conn_state& st = m_state[fd];
+    if (st.throttled || !st.receiving) {
+        return;
+    }
+    st.throttled = true;
+    io_uring_sqe* sqe = get_sqe();
+    prep(sqe, IORING_OP_ASYNC_CANCEL, -1, OP_CANCEL, 0);
+    sqe->addr = encode_data(OP_RECV, st.gen, fd);
+}
+
+//暂存的数据消化得差不多了，重新提交recv(取消还没完成时由 handle_recv 提交)
+void uring_loop::resume_recv(int fd) {
+    conn_state& st = m_state[fd];
+    if (!st.throttled || st.pending.size() >= PENDING_BUFS * m_buf_size) {
+        return;
+    }
+    st.throttled = false;
+    if (!st.receiving) {
+        arm_recv(fd);
+    }
+}
+
+void uring_loop::arm_signal() {
+    io_uring_sqe* sqe = get_sqe();
+    prep(sqe, IORING_OP_RECV, m_sigfd, OP_SIGNAL, 0);
+    sqe->addr = (unsigned long long)m_sig_buf;
+    sqe->len = sizeof(m_sig_buf);
+}
+
+void uring_loop::arm_wakeup() {
+    io_uring_sqe* sqe = get_sqe();
+    prep(sqe, IORING_OP_READ, m_wakeup_fd, OP_WAKEUP, 0);
+    sqe->addr = (unsigned long long)&m_wakeup_val;
+    sqe->len = sizeof(m_wakeup_val);
+    sqe->off = (unsigned long long)-1;
+}
+
+void uring_loop::run() {
+    arm_accept();
+    arm_signal();
+    arm_wakeup();
+
+    while (!m_stop) {
+        int ret = enter(1);     //一次系统调用：提交上一轮产生的所有请求并等待完成事件
+        if (ret < 0 && errno != EINTR) {
+            EMlog(LOGLEVEL_ERROR, "io_uring_enter failure: %s\n", strerror(errno));
+            break;
+        }
+
+        unsigned int head = *m_cq_head;
+        unsigned int tail = __atomic_load_n(m_cq_tail, __ATOMIC_ACQUIRE);
+        while (head != tail) {
+            handle_cqe(&m_cqes[head & m_cq_mask]);
+            head++;
+        }
+        __atomic_store_n(m_cq_head, head, __ATOMIC_RELEASE);
+
+        //最后处理定时事件，与epoll循环相同
+        if (m_timeout) {
+            http_conn::m_timer_lst.tick();
+            alarm(config::current().timeslot);
+            m_timeout = false;
+        }
+        prefork::publish();
+        //热重启：所有连接都已结束，旧进程退出
+        if (http_conn::m_draining && http_conn::m_user_count == 0) {
+            m_stop = true;
+        }
+    }
+}
+
+void uring_loop::handle_cqe(const io_uring_cqe* cqe) {
+    unsigned long long data = cqe->user_data;
+    int fd = data_fd(data);
+    switch (data_type(data)) {
+        case OP_ACCEPT:
+            handle_accept(cqe->res, cqe->flags);
+            break;
+        case OP_SIGNAL:
+            handle_signal(cqe->res);
+            break;
+        case OP_WAKEUP:
+            handle_wakeup();
+            break;
+        case OP_READY:
+            handle_ready();
+            break;
+        case OP_CANCEL:
+            break;
+        case OP_RECV:
+            if (m_state[fd].open && m_state[fd].gen == data_gen(data)) {
+                handle_recv(fd, cqe->res, cqe->flags);
+            }
+            else if (cqe->flags & IORING_CQE_F_BUFFER) {
+                recycle_buffer(cqe->flags >> IORING_CQE_BUFFER_SHIFT);    //旧连接的数据，直接丢弃
+            }
+            break;
+        case OP_SEND:
+            if (m_state[fd].open && m_state[fd].gen == data_gen(data)) {
+                handle_send(fd, cqe->res);
+            }
+            break;
+    }
+}
+
+void uring_loop::handle_accept(int res, unsigned int flags) {
+    if (res < 0) {
+        if (res != -ECANCELED) {
+            EMlog(LOGLEVEL_WARN, "accept errno is : %d\n", -res);
+        }
+    }
+    else {
+        int connfd = res;
+        if (connfd >= m_max_fd || http_conn::m_user_count >= config::current().max_conn) {
+            //目前连接数满了
+            close(connfd);
+        }
+        else {
+            //multishot accept不回填地址，这里单独取一次对端地址
+            struct sockaddr_in client_address;
+            socklen_t client_addrlen = sizeof(client_address);
+            memset(&client_address, 0, sizeof(client_address));
+            getpeername(connfd, (struct sockaddr*)&client_address, &client_addrlen);
+            m_users[connfd].init(connfd, client_address, sock_profile::of(m_listenfd));
+
+            conn_state& st = m_state[connfd];
+            st.gen++;
+            st.open = true;
+            st.busy = false;
+            st.sending = false;
+            st.throttled = false;
+            st.pending.clear();
+            arm_recv(connfd);
+        }
+    }
+    if (!(flags & IORING_CQE_F_MORE)) {
+        if (http_conn::m_draining) {
+            close(m_listenfd);  //热重启：accept已取消，监听socket只留给新进程
+            m_listenfd = -1;
+        }
+        else {
+            arm_accept();   //multishot被内核终止，重新提交
+        }
+    }
+}
+
+void uring_loop::handle_recv(int fd, int res, unsigned int flags) {
+    conn_state& st = m_state[fd];
+    bool more = flags & IORING_CQE_F_MORE;
+
+    if (flags & IORING_CQE_F_BUFFER) {
+        unsigned short bid = flags >> IORING_CQE_BUFFER_SHIFT;
+        if (res > 0) {
+            const char* data = m_bufs + (size_t)bid * m_buf_size;
+            if (st.busy || st.sending) {
+                st.pending.append(data, res);   //与EPOLLONESHOT语义一致：处理期间不交给状态机
+            }
+            else {
+                dispatch(fd, data, res);
+            }
+            if (st.open && st.pending.size() >= PENDING_BUFS * m_buf_size) {
+                pause_recv(fd);
+            }
+        }
+        recycle_buffer(bid);
+    }
+
+    if (res == -ENOBUFS || res == -ECANCELED) {
+        more = false;       //缓冲区暂时耗尽，已回收后重新提交；或被 pause_recv 取消
+    }
+    else if (res <= 0) {
+        //对方关闭连接或出错
+        close_fd(fd);
+        return;
+    }
+    if (!more) {
+        st.receiving = false;
+        if (st.open && !st.throttled) {
+            arm_recv(fd);
+        }
+    }
+}
+
+void uring_loop::handle_send(int fd, int res) {
+    conn_state& st = m_state[fd];
+    http_conn& conn = m_users[fd];
+    st.sending = false;
+
+    if (res < 0) {
+        conn.write_done();
+        close_fd(fd);
+        return;
+    }
+    conn.advance_iov(res);
+    conn.refresh_timer();       //发送的期限按已发送的字节数计算
+    if (conn.get_bytes_to_send() > 0) {
+        arm_send(fd);   //没发完，继续发
+        return;
+    }
+    if (!conn.write_done()) {
+        close_fd(fd);
+        return;
+    }
+    //长连接：处理期间收到的下一个请求
+    dispatch_pending(fd);
+}
+
+void uring_loop::handle_ready() {
+    int ret = hot_restart::check_ready(m_ready_fd);
+    if (ret < 0) {
+        arm_ready();
+        return;
+    }
+    m_ready_fd = -1;
+    if (ret == 1) {
+        http_conn::m_draining = true;
+        stop_accept();
+    }
+}
+
+void uring_loop::handle_signal(int res) {
+    for (int i = 0; i < res; i++) {
+        switch (m_sig_buf[i]) {
+            case SIGALRM:
+                m_timeout = true;
+                break;
+            case SIGTERM:
+                m_stop = true;
+                break;
+            case SIGHUP:    //热加载配置
+                if (config::current().reload()) {
+                    m_pool->resize(config::current().threads);
+                    m_pool->set_max_requests(config::current().max_requests);
+                    m_pool->set_deadline(config::current().queue_deadline_ms);
+                }
+                break;
+            case SIGUSR2:
+                if (prefork::worker() >= 0) {
+                    //多进程模式由主进程负责热重启，worker 收到时排空
+                    if (!http_conn::m_draining) {
+                        http_conn::m_draining = true;
+                        stop_accept();
+                    }
+                }
+                else if (m_ready_fd < 0 && !http_conn::m_draining) {
+                    m_ready_fd = hot_restart::spawn(m_listenfd);
+                    if (m_ready_fd >= 0) {
+                        arm_ready();
+                    }
+                }
+                break;
+        }
+    }
+    arm_signal();
+}
+
+//工作线程处理完的连接
+void uring_loop::handle_wakeup() {
+    std::vector<std::pair<int, int> > done;
+    m_done_locker.lock();
+    done.swap(m_done);
+    m_done_locker.unlock();
+
+    for (size_t i = 0; i < done.size(); i++) {
+        int fd = done[i].first;
+        int ev = done[i].second;
+        conn_state& st = m_state[fd];
+        if (!st.open || !st.busy) {
+            continue;
+        }
+        st.busy = false;
+        if (m_users[fd].get_sockfd() == -1) {
+            st.open = false;    //处理期间已被定时器关闭
+            continue;
+        }
+
+        if (ev == EPOLLOUT) {
+            arm_send(fd);
+        }
+        else if (ev == EPOLLIN) {
+            //请求不完整，若处理期间又收到了数据则继续交给状态机，否则等待multishot recv
+            dispatch_pending(fd);
+        }
+        else {
+            close_fd(fd);
+        }
+    }
+    arm_wakeup();
+}
+
+//把收到的数据交给http_conn，并放入线程池处理。读缓冲区放不下的部分(流式请求体)留在pending中
+void uring_loop::dispatch(int fd, const char* data, int len) {
+    conn_state& st = m_state[fd];
+    http_conn& conn = m_users[fd];
+    int used = conn.feed(data, len);
+    if (used < 0 || !conn.admit()) {
+        close_fd(fd);
+        return;
+    }
+    if (used < len) {
+        st.pending.append(data + used, len - used);
+    }
+    st.busy = true;
+    if (!m_pool->append(&conn, conn.priority())) {
+        st.busy = false;
+        close_fd(fd);
+    }
+}
+
+//busy/sending 结束后，把期间暂存的数据交给状态机，读缓冲区放不下的部分继续留在pending中
+void uring_loop::dispatch_pending(int fd) {
+    conn_state& st = m_state[fd];
+    if (!st.pending.empty()) {
+        http_conn& conn = m_users[fd];
+        int used = conn.feed(st.pending.data(), st.pending.size());
+        if (used < 0 || !conn.admit()) {
+            close_fd(fd);
+            return;
+        }
+        st.pending.erase(0, used);
+        if (st.pending.empty() && st.pending.capacity() > PENDING_BUFS * m_buf_size) {
+            std::string().swap(st.pending);     //一批完成事件可能一次暂存很多数据，消化完后释放
+        }
+        st.busy = true;
+        if (!m_pool->append(&conn, conn.priority())) {
+            st.busy = false;
+            close_fd(fd);
+            return;
+        }
+    }
+    if (st.open) {
+        resume_recv(fd);
+    }
+}
+
+void uring_loop::close_fd(int fd) {
+    conn_state& st = m_state[fd];
+    st.open = false;
+    st.pending.clear();
+    http_conn& conn = m_users[fd];
+    if (conn.get_sockfd() != -1) {
+        conn.close_conn();      //shutdown后close，挂起的multishot recv随之结束
+        http_conn::m_timer_lst.del_timer(conn.timer);
+    }
+}
+
+//由工作线程调用
+void uring_loop::on_process_done(http_conn* conn, int ev) {
+    uring_loop* loop = s_instance;
+    int fd = conn - loop->m_users;
+
+    loop->m_done_locker.lock();
+    bool need_wakeup = loop->m_done.empty();
+    loop->m_done.push_back(std::make_pair(fd, ev));
+    loop->m_done_locker.unlock();
+
+    if (need_wakeup) {
+        unsigned long long one = 1;
+        ::write(loop->m_wakeup_fd, &one, sizeof(one));
+    }
+}
@@ -0,0 +1,125 @@
+#ifndef URING_LOOP_H
+#define URING_LOOP_H
+
+#include <linux/io_uring.h>
+#include <sys/socket.h>
+#include <string>
+#include <vector>
+#include <utility>
+#include "http_conn.h"
+#include "threadPool.h"
+#include "locker.h"
+
+/*
+    io_uring 事件循环，替代 epoll_wait + 多次recv + epoll_ctl + writev 的组合：
+        multishot accept    一次提交，持续接收新连接
+        multishot recv      数据由内核放进注册的缓冲区环(provided buffer ring)，再拷入 http_conn 读缓冲区
+        sendmsg             直接发送 http_conn 拼好的 iovec(响应头 + mmap 文件)，无额外拷贝
+    解析仍由线程池完成，工作线程通过 http_conn::m_process_done 把连接交还给本循环(eventfd 唤醒)。
+    一轮循环中产生的所有请求通过一次 io_uring_enter 批量提交。
+    需要内核 >= 6.0，不满足时 init() 返回 false，调用方回退到 epoll。
+*/
+class uring_loop {
+public:
+    uring_loop(int listenfd, int sigfd, http_conn* users, int max_fd, threadPool<http_conn>* pool);
+    ~uring_loop();
+
+    bool init();    //创建ring、注册缓冲区环，失败返回false
+    void run();     //事件循环，收到SIGTERM后返回
+
+private:
+    enum OP_TYPE { OP_ACCEPT = 1, OP_RECV, OP_SEND, OP_SIGNAL, OP_WAKEUP, OP_READY, OP_CANCEL };
+
+    static const unsigned int QUEUE_DEPTH = 1024;   //SQ大小，CQ为其4倍
+    static const unsigned int BUF_COUNT = 1024;     //缓冲区环中的缓冲区个数，必须是2的幂
+    static const unsigned short BUF_GROUP = 0;
+    static const size_t PENDING_BUFS = 4;           //暂存数据超过这么多个缓冲区时取消recv，让TCP流量控制接管
+
+    //每个连接(按fd索引)在事件循环中的状态
+    struct conn_state {
+        unsigned int gen;       //连接代数，fd被复用后，旧连接遗留的完成事件据此丢弃
+        bool open;
+        bool busy;              //正在线程池中处理
+        bool sending;           //有sendmsg在途
+        bool receiving;         //有multishot recv在途
+        bool throttled;         //暂存数据过多，recv已取消，等状态机消化后再提交
+        std::string pending;    //busy/sending期间收到的数据(以及读缓冲区放不下的部分)，处理完后再交给状态机
+        struct msghdr msg;      //sendmsg参数，在请求完成前必须保持有效
+    };
+
+    static void on_process_done(http_conn* conn, int ev);   //工作线程回调
+
+    bool setup_ring();
+    bool setup_buf_ring();
+    io_uring_sqe* get_sqe();
+    int enter(unsigned int min_complete);
+    void prep(io_uring_sqe* sqe, int opcode, int fd, OP_TYPE type, unsigned int gen);
+    void arm_accept();
+    void arm_recv(int fd);
+    void arm_send(int fd);
+    void arm_signal();
+    void arm_wakeup();
+    void arm_ready();
+    void stop_accept();
+    void pause_recv(int fd);
+    void resume_recv(int fd);
+    void recycle_buffer(unsigned short bid);
+
+    void handle_cqe(const io_uring_cqe* cqe);
+    void handle_accept(int res, unsigned int flags);
+    void handle_recv(int fd, int res, unsigned int flags);
+    void handle_send(int fd, int res);
+    void handle_signal(int res);
+    void handle_wakeup();
+    void handle_ready();
+    void dispatch(int fd, const char* data, int len);
+    void dispatch_pending(int fd);
+    void close_fd(int fd);
+
+private:
+    static uring_loop* s_instance;
+
+    int m_listenfd;
+    int m_sigfd;                //信号管道读端
+    http_conn* m_users;
+    int m_max_fd;
+    threadPool<http_conn>* m_pool;
+    std::vector<conn_state> m_state;
+    bool m_stop;
+    bool m_timeout;
+    int m_ready_fd;             //热重启时新进程的就绪通知管道
+
+    //ring
+    int m_ring_fd;
+    void* m_sq_ptr;
+    size_t m_sq_size;
+    void* m_cq_ptr;
+    size_t m_cq_size;
+    io_uring_sqe* m_sqes;
+    size_t m_sqes_size;
+    unsigned int* m_sq_head;
+    unsigned int* m_sq_tail;
+    unsigned int m_sq_mask;
+    unsigned int m_sq_entries;
+    unsigned int m_sqe_tail;        //本地已填充的SQE尾部，提交时才写回内核
+    unsigned int* m_cq_head;
+    unsigned int* m_cq_tail;
+    unsigned int m_cq_mask;
+    io_uring_cqe* m_cqes;
+
+    //缓冲区环。内核头文件中 io_uring_buf_ring 的柔性数组在C++下会偏移8字节，
+    //这里直接按 io_uring_buf 数组访问，环尾(tail)与第0项的resv字段重叠
+    io_uring_buf* m_buf_ring;
+    size_t m_buf_ring_size;
+    char* m_bufs;
+    unsigned int m_buf_size;        //每个缓冲区的大小，与 http_conn 读缓冲区相同
+
+    //信号管道和工作线程唤醒
+    char m_sig_buf[64];
+    int m_wakeup_fd;
+    unsigned long long m_wakeup_val;
+    locker m_done_locker;
+    std::vector<std::pair<int, int> > m_done;     //(fd, ev)
+};
+
+#endif